@@ -11,16 +11,24 @@ public:
         Operator
     };
 
+    enum class Quoting {
+        None,
+        Double,
+        Single
+    };
+
     NodeType node{};
 
     std::string command;
     std::vector<std::string> args;
+    std::vector<Quoting> quoting;   // parallel to args: how each argument was quoted
 
     std::string op;
     std::unique_ptr<AST> left;
     std::unique_ptr<AST> right;
 
-    static AST makeCommandNode(std::string cmd, std::vector<std::string> arguments);
+    static AST makeCommandNode(std::string cmd, std::vector<std::string> arguments,
+                               std::vector<Quoting> argQuoting = {});
     static AST makeOperatorNode(const std::string& op, AST lhs, AST rhs);
     void print(std::ostream& os, int indent = 0);
 
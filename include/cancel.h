@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/**
+ * Cooperative cancellation of the running command on Ctrl-C.
+ *
+ * The shell installs a SIGINT handler that only sets a flag; long-running
+ * loops (FileReader chunks, TreeWalker directories, ls and rm entries, job
+ * pool jobs) poll requested() and stop as if they had reached the end,
+ * closing what they opened on the way out. The executor then reports the
+ * command's partial output with status STATUS, like a shell whose child
+ * was killed by SIGINT. Programs the shell spawned receive the terminal's
+ * SIGINT themselves. The flag is cleared before each command line.
+ *
+ * requested() is also true inside a cancelled CancelScope of the current
+ * job. Polling is a relaxed atomic load, plus a walk up the job's scopes
+ * when it has any, cheap enough for once per chunk or per directory entry.
+ */
+class Cancellation {
+public:
+    Cancellation() = delete;
+
+    static constexpr int STATUS = 130;
+
+    static void install();
+    static void reset();
+    static bool requested() { return flag.load(std::memory_order_relaxed) || scopeCancelled(); }
+
+    // Readable from Ctrl-C until reset(), for threads that wait in poll()
+    static int interruptFd() { return eventFd; }
+
+private:
+    static_assert(ATOMIC_BOOL_LOCK_FREE == 2, "the flag is set from a signal handler");
+
+    static std::atomic<bool> flag;
+    static int eventFd;
+
+    static void onInterrupt(int);
+    static bool scopeCancelled();
+};
+
+/**
+ * Part of a job that can be cancelled on its own: the command run by
+ * timeout or limit. A scope is attached to an ExecContext and inherited by
+ * its forks and by the worker threads that run in it; scopes nest, and
+ * cancelling one cancels everything inside it.
+ *
+ * Programs spawned inside a scope are adopted by it and every enclosing
+ * scope until they are reaped, so they can be signalled when it is
+ * cancelled, and start with the scope's resource limits applied. Like
+ * timeout(1), each runs in a process group of its own so that signals
+ * reach whatever it started too; it therefore does not see the terminal's
+ * SIGINT, which the Watchdog forwards instead.
+ *
+ * Every thread that installs a context with a scope (ExecContext::Scope)
+ * is counted as working in it and in every enclosing scope, so cpuTime()
+ * covers a builtin's worker threads as well as the thread that called it.
+ * Output is charged by the OutputBuffers of the builtins that run inside
+ * the scope and by the programs' pipes as it is produced.
+ */
+class CancelScope {
+public:
+    // Statuses of a command stopped by its scope
+    static constexpr int TIMED_OUT = 124;
+    static constexpr int KILLED = 137;
+    static constexpr int CPU_EXCEEDED = 152;        // 128 + SIGXCPU
+    static constexpr int OUTPUT_EXCEEDED = 153;     // 128 + SIGXFSZ
+    static constexpr int MEMORY_EXCEEDED = 137;     // as if the OOM killer had struck
+
+    explicit CancelScope(CancelScope* parent);
+
+    CancelScope(const CancelScope&) = delete;
+    CancelScope& operator=(const CancelScope&) = delete;
+
+    // The first status given wins
+    void cancel(int status);
+    int status() const { return reason.load(std::memory_order_relaxed); }
+    bool cancelled() const;
+
+    void adopt(pid_t pid);
+    void release(pid_t pid);
+    void signalPrograms(int signal);
+
+    void limitPrograms(int resource, rlim_t value);
+    void limitOutput(size_t bytes) { outputLimit = bytes; }
+    bool chargeOutput(size_t bytes);
+
+    // Called by ExecContext::Scope as the calling thread starts and stops working in the scope
+    void enterThread();
+    void leaveThread();
+
+    // CPU time, in ns, used by threads while they worked in the scope
+    int64_t cpuTime();
+
+    static CancelScope* current();
+
+private:
+    CancelScope* parent;
+    std::atomic<int> reason{0};
+    std::atomic<size_t> outputUsed{0};
+    size_t outputLimit = 0;   // 0 = unlimited
+
+    struct ThreadClock {
+        pthread_t thread;
+        clockid_t clock;
+        int64_t start;      // clock reading when the thread entered
+        int depth;          // contexts of the scope installed on the thread
+    };
+
+    std::mutex mutex;
+    std::vector<pid_t> programs;
+    std::vector<std::pair<int, rlim_t>> rlimits;
+    std::vector<ThreadClock> threads;
+    int64_t cpuFinished = 0;    // of the threads that have left
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * Streaming checksum. Feed data with update() in pieces of any size, then
+ * call hexDigest() once.
+ *
+ * Kernels are chosen at runtime: crc32c uses the SSE4.2 crc32 instruction
+ * and sha256 the SHA-NI extensions when the CPU has them, with portable
+ * versions otherwise. xxhash64 is portable; its four independent lanes
+ * already keep the ALUs busy.
+ */
+class Checksum {
+public:
+    virtual ~Checksum() = default;
+
+    virtual void update(const char* data, size_t size) = 0;
+    virtual std::string hexDigest() = 0;
+
+    // "crc32c", "xxh64" or "sha256"; null for anything else
+    static std::unique_ptr<Checksum> create(const std::string& algorithm);
+
+    static const char* const ALGORITHMS;
+};
+
+class Crc32c : public Checksum {
+public:
+    void update(const char* data, size_t size) override;
+    std::string hexDigest() override;
+
+private:
+    uint32_t crc = 0xFFFFFFFF;
+};
+
+class XxHash64 : public Checksum {
+public:
+    explicit XxHash64(uint64_t seed = 0);
+
+    void update(const char* data, size_t size) override;
+    std::string hexDigest() override;
+
+private:
+    uint64_t lanes[4];
+    uint64_t seed;
+    uint64_t total = 0;
+    unsigned char pending[32];
+    size_t pendingSize = 0;
+};
+
+class Sha256 : public Checksum {
+public:
+    Sha256();
+
+    void update(const char* data, size_t size) override;
+    std::string hexDigest() override;
+
+private:
+    uint32_t state[8];
+    uint64_t total = 0;
+    unsigned char pending[64];
+    size_t pendingSize = 0;
+};
@@ -1,12 +1,22 @@
 #pragma once
 #include <vector>
+#include <memory>
 #include <string>
 #include <regex>
+#include <cstdint>
+#include <sys/types.h>
+#include "glob.h"
+#include "matcher.h"
+
+class StreamStage;
+class OutputBuffer;
 
 struct CommandResult {
     int status;
     std::string output;
     std::string error;
+    bool trailingNewline = true;    // false to print output exactly as is (e.g. clr's escape codes)
+    std::shared_ptr<OutputBuffer> spill = nullptr;  // the output instead, once too large to keep in memory
 };
 
 class Commands {
@@ -18,13 +28,27 @@ public:
     static CommandResult pauseCommand(const std::vector<std::string>& args);
     static CommandResult lsCommand(const std::vector<std::string>& args);
     static CommandResult dirCommand(const std::vector<std::string>& args);
+    static CommandResult findCommand(const std::vector<std::string>& args);
+    static CommandResult duCommand(const std::vector<std::string>& args);
     static CommandResult cdCommand(const std::vector<std::string>& args);
     static CommandResult pwdCommand(const std::vector<std::string>& args);
     static CommandResult clrCommand(const std::vector<std::string>& args);
     static CommandResult quitCommand(const std::vector<std::string>& args);
     static CommandResult environCommand(const std::vector<std::string>& args);
+    static CommandResult exportCommand(const std::vector<std::string>& args);
+    static CommandResult unsetCommand(const std::vector<std::string>& args);
     static CommandResult catCommand(const std::vector<std::string>& args);
+    static CommandResult headCommand(const std::vector<std::string>& args);
+    static CommandResult tailCommand(const std::vector<std::string>& args);
+    static CommandResult teeCommand(const std::vector<std::string>& args);
     static CommandResult wcCommand(const std::vector<std::string>& args);
+    static CommandResult sortCommand(const std::vector<std::string>& args);
+    static CommandResult sumCommand(const std::vector<std::string>& args);
+    static CommandResult parallelCommand(const std::vector<std::string>& args);
+    static CommandResult xargsCommand(const std::vector<std::string>& args);
+    static CommandResult patcacheCommand(const std::vector<std::string>& args);
+    static CommandResult timeoutCommand(const std::vector<std::string>& args);
+    static CommandResult limitCommand(const std::vector<std::string>& args);
     static CommandResult mkdirCommand(const std::vector<std::string>& args);
     static CommandResult rmCommand(const std::vector<std::string>& args);
     static CommandResult rmdirCommand(const std::vector<std::string>& args);
@@ -34,11 +58,42 @@ public:
     static CommandResult grepCommand(const std::vector<std::string>& args);
     static CommandResult mvCommand(const std::vector<std::string>& args);
     static CommandResult chmodCommand(const std::vector<std::string>& args);
+
+    static std::unique_ptr<StreamStage> openStage(const std::vector<std::string>& argv,
+                                                  std::vector<std::string>& files);
     
 private:
+    struct GrepOptions {
+        bool ignoreCase = false;
+        bool lineNumbers = false;
+        bool invert = false;
+        bool wordMatch = false;
+        bool countOnly = false;
+        bool onlyMatching = false;
+        bool fixedStrings = false;
+        long maxCount = -1;
+        bool recursive = false;
+        bool useIgnoreFiles = true;
+        std::vector<std::shared_ptr<const GlobPattern>> includes;
+        std::vector<std::shared_ptr<const GlobPattern>> excludes;
+        std::vector<std::shared_ptr<const GlobPattern>> excludeDirs;
+    };
+
+    class GrepScanner;
+    class GrepStage;
+
+    static std::string parseGrepArgs(const std::vector<std::string>& args, GrepOptions& opts,
+                                     std::vector<std::string>& patterns, std::vector<std::string>& operands);
+    static CommandResult grepRecursive(std::vector<std::string> roots, const GrepOptions& opts,
+                                       const LineMatcher& matcher);
+    static long grepFd(int fd, const std::string& prefix, const GrepOptions& opts, const LineMatcher& matcher,
+                       long limit, bool skipBinary, OutputBuffer& out, bool& isBinary);
+    static bool headFd(int fd, long lines, long bytes, OutputBuffer& out);
+    static bool tailFd(int fd, long lines, long bytes, bool fromStart, OutputBuffer& out, off_t& end);
+    static CommandResult followFiles(const std::vector<std::string>& files, const std::vector<off_t>& offsets);
+    static std::string formatHumanSize(uint64_t bytes);
     static std::string formatLsLongListing(const std::string& name, const struct stat& info);
     static std::string formatRmdirErrorMsg(const std::string& path);
-    static bool matchesPattern(const std::string& line, const std::regex& re, bool printOnlyMatch, std::string& outMatch);
     static std::string stripTrailingNewline(const std::string& s);
     static bool isFileEmpty(const std::string& filename);
 }; 
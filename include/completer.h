@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * Sorted index of names supporting O(log n) prefix range lookups.
+ * Directories are stored with a trailing '/' so completing them keeps the
+ * cursor inside the path.
+ */
+class PrefixIndex {
+public:
+    using Iter = std::vector<std::string>::const_iterator;
+
+    void assign(std::vector<std::string> names);
+    bool insert(const std::string& name);
+    bool erase(const std::string& name);
+    bool contains(const std::string& name) const;
+
+    std::pair<Iter, Iter> range(const std::string& prefix) const;
+    size_t size() const { return names.size(); }
+
+private:
+    std::vector<std::string> names;
+};
+
+/**
+ * Tab-completion source for the line editor. Builtin names, PATH executables
+ * and directory listings are indexed once and then kept up to date in place:
+ * each indexed directory is watched with inotify, and the names created,
+ * removed, renamed or chmod'ed in it are inserted into or erased from its
+ * index before the next lookup, so a Tab press never rescans a directory
+ * because one file in it changed. Directories that cannot be watched, or
+ * whose events were lost, fall back to a rescan when their mtime changes.
+ */
+class Completer {
+public:
+    struct Result {
+        std::string insert;                  // text to append after the cursor
+        std::vector<std::string> candidates; // matches when ambiguous (capped)
+        size_t total = 0;                    // number of matches before capping
+    };
+
+    Completer();
+    ~Completer();
+
+    Completer(const Completer&) = delete;
+    Completer& operator=(const Completer&) = delete;
+
+    Result complete(const std::string& line, size_t cursor);
+
+private:
+    struct DirCache {
+        struct timespec mtime{};
+        ino_t ino = 0;
+        int watch = -1;      // inotify watch keeping the index current, or -1
+        bool stale = false;  // events were lost; trust only the mtime
+        PrefixIndex index;
+    };
+    using DirMap = std::unordered_map<std::string, DirCache>;
+
+    PrefixIndex builtins;
+    PrefixIndex commands;
+    std::string cachedPath;
+    DirMap pathDirs;
+    DirMap dirs;
+
+    int notifyFd = -1;
+    std::unordered_multimap<int, std::pair<DirMap*, std::string>> watches;
+
+    const PrefixIndex& commandIndex();
+    const PrefixIndex* directoryIndex(const std::string& dir, bool executablesOnly, DirMap& cache, bool& changed);
+
+    void applyEvents();
+    void updateName(DirMap& cache, const std::string& dir, DirCache& entry, const std::string& name);
+    void watch(DirMap& cache, const std::string& dir, DirCache& entry);
+    void unwatch(DirMap& cache, const std::string& dir, DirCache& entry);
+    void forget(DirMap& cache);
+
+    static bool scanDirectory(const std::string& dir, bool executablesOnly, std::vector<std::string>& out);
+    static bool indexedName(int dirfd, const char* name, unsigned char type, bool executablesOnly, std::string& out);
+    static size_t collect(const PrefixIndex& index, const std::string& prefix, bool showHidden,
+                          std::vector<std::string>& out);
+    static std::string commonPrefix(const std::vector<std::string>& names);
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Resolves the parent directories of a batch of paths, keeping the
+ * directories on the way open.
+ *
+ * The cursor holds an fd for each component of the last parent it resolved,
+ * so a path that shares a prefix with the previous one only opens the
+ * components after it, and the leaf is then created or updated with an *at()
+ * call relative to its parent's fd. Paths should therefore come in
+ * TreeWalker::pathLess order, which keeps the contents of a directory
+ * together. Relative paths start from the job's directory.
+ */
+class DirectoryCursor {
+public:
+    /**
+     * @param createParents Create missing parent directories (mkdir -p)
+     * @param mode Permissions for directories created that way
+     */
+    explicit DirectoryCursor(bool createParents = false, unsigned mode = 0755);
+    ~DirectoryCursor();
+
+    DirectoryCursor(const DirectoryCursor&) = delete;
+    DirectoryCursor& operator=(const DirectoryCursor&) = delete;
+
+    int parentOf(const std::string& path, std::string& leaf, std::string& error);
+
+private:
+    bool createParents;
+    unsigned mode;
+    int baseFd;
+    int rootFd = -1;
+    bool absolute = false;
+    std::vector<std::string> names;
+    std::vector<int> fds;
+
+    void popTo(size_t depth);
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "variables.h"
+
+class CancelScope;
+
+/**
+ * Where a job runs: its working directory, held open as a directory fd,
+ * and its variables.
+ *
+ * Builtins resolve relative paths against dirfd() with the *at() system
+ * calls instead of relying on the process-wide cwd, so jobs on different
+ * threads can each have their own directory. The shell's own context is
+ * shell(); a job starts from a fork() of its parent's context. A thread
+ * runs in whatever context a Scope installed on it, and current() returns
+ * that context, or the shell's if none was installed. A context may also
+ * carry the CancelScope of a timeout or limit command, which its forks share.
+ */
+class ExecContext {
+public:
+    ~ExecContext();
+
+    ExecContext(const ExecContext&) = delete;
+    ExecContext& operator=(const ExecContext&) = delete;
+
+    // Same directory, with a private copy of the variables
+    std::unique_ptr<ExecContext> fork() const;
+
+    int dirfd() const { return fd; }
+    const std::string& cwd() const { return path; }
+    ShellVariables& variables() { return *vars; }
+
+    // Only the shell's own context has the terminal; programs started in
+    // any other (jobs, server sessions) have their output captured
+    bool ownsTerminal() const { return isShell; }
+
+    // quit in a context without the terminal ends just that context's session
+    void requestExit() { exitRequested = true; }
+    bool exitWasRequested() const { return exitRequested; }
+
+    CancelScope* cancelScope() const { return scope; }
+    void setCancelScope(CancelScope* cancelScope) { scope = cancelScope; }
+
+    bool changeDirectory(const std::string& target, std::string& error);
+
+    // Path for interfaces that only take paths (inotify, temp files, spawned programs)
+    std::string absolute(const std::string& relative) const;
+
+    static ExecContext& shell();
+    static ExecContext& current();
+
+    /**
+     * Installs a context as current() for the calling thread until the
+     * scope ends. The thread's CPU time counts towards the context's
+     * CancelScope meanwhile.
+     */
+    class Scope {
+    public:
+        explicit Scope(ExecContext& context);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ExecContext* previous;
+        CancelScope* cancelScope;
+    };
+
+private:
+    ExecContext(int fd, std::string path, ShellVariables* vars);
+
+    int fd;
+    std::string path;
+    ShellVariables* vars;
+    std::unique_ptr<ShellVariables> ownVars;
+    bool isShell = false;
+    bool exitRequested = false;
+    CancelScope* scope = nullptr;
+
+    static std::string pathOf(int fd);
+};
@@ -1,16 +1,28 @@
 #pragma once
 #include "ast.h"
 #include "commands.h"
+#include "variables.h"
 
 class Executor {
 public:
     Executor() = delete;
 
     static CommandResult executeCommand(const AST& node);
+    static std::vector<std::string> builtinNames();
+    static CommandResult runArgs(const std::vector<std::string>& argv);
 
 private:
     static CommandResult execute(const AST& node);
     static CommandResult runCommand(const AST& node);
+    static std::vector<std::string> expandArgv(const AST& node);
+    static bool isAssignment(const std::string& word);
+    static void collectPipeline(const AST& node, std::vector<const AST*>& commands);
+    static void expandVariables(std::vector<std::string>& args, std::vector<AST::Quoting>& quoting,
+                                const ShellVariables& vars);
+    static CommandResult assignVariables(const std::string& first, const std::vector<std::string>& rest,
+                                         ShellVariables& vars);
+
+    static CommandResult handlePipe(const AST& node);
 
    /**
      * TODO:
@@ -21,7 +33,6 @@ private:
      * execution model so that all commands share consistent semantics for 
      * stdin/stdout, process creation, and control flow.
      */
-    static CommandResult handlePipe(const AST& node);
     static CommandResult handleRedirectOut(const AST& node);
     static CommandResult handleRedirectIn(const AST& node);
     static CommandResult handleAppend(const AST& node);
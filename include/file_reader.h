@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+/**
+ * Sequential reader that hands a file to a consumer in large chunks.
+ *
+ * Regular files of at least the mmap threshold are mapped and passed on in
+ * block-sized windows of the mapping, so nothing is copied; the next window
+ * is requested with MADV_WILLNEED while the current one is consumed.
+ * Everything else is read through one page-aligned block buffer, with
+ * POSIX_FADV_SEQUENTIAL and an initial readahead for regular files. Either
+ * way the consumer sees a few large chunks instead of many small reads.
+ *
+ * Both sizes come from the SHELL_READ_BLOCK and SHELL_MMAP_THRESHOLD shell
+ * variables (which start out as the environment), e.g. SHELL_READ_BLOCK=256K.
+ * A threshold of 0 disables mapping.
+ *
+ * A mapped file that shrinks while it is read does not raise SIGBUS in the
+ * shell: see forEachChunk.
+ */
+class FileReader {
+public:
+    // Return false to stop reading early
+    using ChunkFn = std::function<bool(const char* data, size_t size)>;
+    using LineFn = std::function<bool(const char* line, size_t size)>;
+
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+    static constexpr size_t DEFAULT_MMAP_THRESHOLD = 8 << 20;
+
+    struct Config {
+        size_t blockSize = DEFAULT_BLOCK_SIZE;
+        size_t mmapThreshold = DEFAULT_MMAP_THRESHOLD;
+
+        // Defaults overridden by the shell variables
+        static Config current();
+    };
+
+    explicit FileReader(int fd, const Config& config = Config::current());
+
+    bool forEachChunk(const ChunkFn& consume);
+
+    // Chunks of whole lines: each ends with '\n', except a final unterminated line
+    bool forEachLineBlock(const ChunkFn& consume);
+
+    // One line at a time, without its '\n'
+    bool forEachLine(const LineFn& consume);
+
+    size_t blockSize() const { return config.blockSize; }
+
+private:
+    int fd;
+    Config config;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include "glob.h"
+#include "walker.h"
+
+/**
+ * A find(1) expression compiled once into a flat instruction list.
+ *
+ * Tests (-name, -iname, -type, -size, -mtime, -newer) set an accumulator;
+ * "!"/-not negates it and -a/-o compile to conditional jumps, so evaluation
+ * short-circuits exactly like find without walking a tree per entry.
+ * Metadata is fetched with statx only when an executed test needs it, and
+ * only for the fields that test reads.
+ */
+class FindProgram {
+public:
+    bool compile(const std::vector<std::string>& args, size_t start, std::string& error);
+    bool evaluate(const WalkEntry& entry, std::string& out, bool& prune) const;
+
+    int maxDepth = -1;
+    int minDepth = 0;
+
+private:
+    enum class Op {
+        Name, IName, Type, Size, Mtime, Newer,
+        Prune, Print, True, False,
+        Not, JumpIfFalse, JumpIfTrue
+    };
+
+    struct Instr {
+        Op op;
+        int cmp = 0;          // -1 less than, 0 equal, 1 greater than
+        int64_t value = 0;
+        int64_t unit = 1;
+        size_t target = 0;    // jump destination
+        int pattern = -1;     // index into patterns
+    };
+
+    std::vector<Instr> code;
+    std::vector<std::shared_ptr<const GlobPattern>> patterns;
+    bool hasAction = false;
+    time_t now = 0;
+
+    const std::vector<std::string>* tokens = nullptr;
+    size_t pos = 0;
+
+    bool parseOr(std::string& error);
+    bool parseAnd(std::string& error);
+    bool parseUnary(std::string& error);
+    bool parsePrimary(std::string& error);
+    bool parseNumber(const std::string& text, Instr& instr, bool allowUnit, std::string& error);
+    bool atEnd() const { return pos >= tokens->size(); }
+    const std::string& peek() const { return (*tokens)[pos]; }
+};
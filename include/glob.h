@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <bitset>
+#include <memory>
+#include "ast.h"
+
+/**
+ * A single compiled path-segment pattern supporting '*', '?', '[...]'
+ * (with '!'/'^' negation, ranges and [:class:] names) and backslash escapes.
+ */
+class GlobPattern {
+public:
+    explicit GlobPattern(const std::string& pattern);
+
+    bool matches(const char* name, size_t length) const;
+    bool matches(const std::string& name) const { return matches(name.data(), name.size()); }
+
+    bool isLiteral() const { return literal; }
+    const std::string& text() const { return unescaped; }
+
+    // The compiled pattern from the shared pattern cache
+    static std::shared_ptr<const GlobPattern> cached(const std::string& pattern);
+
+private:
+    enum class Kind { Char, Any, Star, Set };
+
+    struct Item {
+        Kind kind;
+        unsigned char c;
+        int set;
+    };
+
+    std::vector<Item> items;
+    std::vector<std::bitset<256>> sets;
+    std::string unescaped;
+    bool literal = true;
+
+    static size_t parseSet(const std::string& pattern, size_t i, std::bitset<256>& set);
+};
+
+/**
+ * Pathname expansion, run by the executor on each command's arguments after
+ * variable expansion and before the command is dispatched.
+ *
+ * Patterns are split on '/' and matched one segment at a time with
+ * openat-relative directory walks. Literal segments are resolved with a
+ * single openat/fstatat instead of reading the directory, d_type decides
+ * whether an entry can be descended into without a stat, and '**' matches
+ * zero or more directories. Results are sorted; a pattern with no matches
+ * is left as typed.
+ */
+class Glob {
+public:
+    Glob() = delete;
+
+    static void expandArgs(std::vector<std::string>& args, std::vector<AST::Quoting>& quoting);
+    static bool hasMagic(const std::string& word);
+    static std::vector<std::string> expandWord(const std::string& pattern);
+
+private:
+    static void walk(int dirfd, const std::string& prefix, const std::vector<std::string>& segments,
+                     size_t index, std::vector<std::string>& out);
+    static void walkRecursive(int dirfd, const std::string& prefix, const std::vector<std::string>& segments,
+                              size_t index, std::vector<std::string>& out);
+    static int openDir(int dirfd, const char* name, unsigned char type, bool followLinks);
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <sys/types.h>
+
+/**
+ * Persistent command history shared by every shell of the same user.
+ *
+ * Entries are appended to a plain text file (one command per line). A
+ * companion ".idx" file holds the end offset of every line as a uint64
+ * array, so both files are simply mmap'd at startup and any entry can be
+ * fetched in O(1) without reading the history text. Appends take an
+ * exclusive flock on the text file, which lets concurrent shells share it.
+ * Other shells may have the index mapped, so a damaged index is replaced
+ * by renaming a new file over it rather than rewritten in place.
+ *
+ * Reverse search is served from an in-memory trigram index with
+ * delta-encoded posting lists. It is built on a background thread at
+ * startup and extended incrementally as new entries appear, so startup
+ * cost stays independent of history size.
+ */
+class History {
+public:
+    explicit History(const std::string& path);
+    ~History();
+
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+
+    void add(const std::string& line);
+    size_t size();
+    std::string entry(size_t i) const;
+    long searchBackward(const std::string& query, size_t before);
+
+    static std::string defaultPath();
+
+private:
+    struct Posting {
+        std::string deltas;  // varint-encoded gaps between entry ids
+        uint32_t last = 0;
+        uint32_t count = 0;
+    };
+
+    using TrigramMap = std::unordered_map<uint32_t, Posting>;
+
+    std::string dataPath;
+    std::string indexPath;
+    int dataFd = -1;
+    int indexFd = -1;
+
+    const char* data = nullptr;
+    size_t dataLength = 0;
+    const uint64_t* ends = nullptr;
+    size_t indexLength = 0;
+    ino_t indexInode = 0;
+    size_t count = 0;
+
+    std::mutex indexMutex;
+    std::thread indexer;
+    std::atomic<bool> stopIndexer{false};
+    bool indexReady = false;
+    TrigramMap trigrams;
+    size_t indexedEntries = 0;
+
+    void refresh();
+    bool remap();
+    void unmap();
+    void reopenIndex();
+    bool indexValid() const;
+    void rebuildIndex();
+    bool replaceIndex();
+    bool appendOffsets(uint64_t from, uint64_t to);
+    void indexNewEntries();
+    void buildIndexAsync();
+
+    const char* entryData(size_t i, size_t& length) const;
+    long scanBackward(const std::string& query, size_t before) const;
+    static void addPostings(TrigramMap& map, const char* text, size_t length, uint32_t id,
+                            std::vector<uint32_t>& keys);
+    static std::vector<uint32_t> decode(const Posting& posting);
+};
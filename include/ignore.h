@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include "glob.h"
+
+/**
+ * .gitignore-style rules for one directory, chained to the rules of its
+ * parent directories. Supports comments, '!' negation, trailing '/' for
+ * directory-only rules, leading or embedded '/' for anchored rules, and
+ * '**' segments. Deeper files take precedence, and within one file the
+ * last matching rule wins.
+ */
+class IgnoreRules {
+public:
+    static std::shared_ptr<IgnoreRules> load(int dirfd, const std::string& dirPath,
+                                             const std::shared_ptr<IgnoreRules>& parent);
+
+    bool ignored(const std::string& path, bool isDir) const;
+
+private:
+    struct Segment {
+        bool globstar;
+        GlobPattern pattern;
+    };
+
+    struct Rule {
+        std::vector<Segment> segments;
+        bool negate = false;
+        bool dirOnly = false;
+        bool anchored = false;
+    };
+
+    std::string base;
+    std::vector<Rule> rules;
+    std::shared_ptr<IgnoreRules> parent;
+
+    void parse(const std::string& text);
+    static bool matchSegments(const std::vector<Segment>& pattern, size_t pi,
+                              const std::vector<std::string>& path, size_t si);
+};
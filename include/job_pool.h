@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "commands.h"
+
+/**
+ * Runs a batch of commands on a pool of threads, for parallel and xargs -P.
+ *
+ * Every job is an expanded command line run through Executor::runArgs in
+ * its own fork() of the caller's ExecContext: builtins run in-process on a
+ * worker thread, other programs are spawned with their output captured,
+ * and a cd or assignment in one job cannot affect another. A job's output
+ * and errors are added to the result in one piece when it finishes, so jobs
+ * never interleave; by default in the order jobs finish, with keepOrder in
+ * the order they were given.
+ */
+class JobPool {
+public:
+    struct Options {
+        unsigned jobs = 0;             // jobs running at once, 0 = one per CPU
+        bool keepOrder = false;
+    };
+
+    explicit JobPool(const Options& options);
+
+    CommandResult run(const std::vector<std::vector<std::string>>& commands, size_t& failed);
+
+private:
+    Options options;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <termios.h>
+#include "completer.h"
+#include "history.h"
+
+/**
+ * Raw-mode single-line editor used by the REPL. Falls back to plain
+ * std::getline when stdin is not a terminal (scripts, pipes).
+ *
+ * Key bindings:
+ *   Left/Right, Ctrl-B/Ctrl-F   move the cursor
+ *   Home/End, Ctrl-A/Ctrl-E     jump to start/end of line
+ *   Backspace, Delete, Ctrl-D   delete characters (Ctrl-D on an empty line is EOF)
+ *   Ctrl-K, Ctrl-U, Ctrl-W      kill to end, kill to start, kill previous word
+ *   Ctrl-C                      discard the line
+ *   Ctrl-L                      clear the screen
+ *   Tab                         complete; a second Tab lists ambiguous matches
+ *   Up/Down, Ctrl-P/Ctrl-N      walk through history
+ *   Ctrl-R                      incremental reverse history search
+ */
+class LineEditor {
+public:
+    explicit LineEditor(History* history = nullptr);
+    ~LineEditor();
+
+    LineEditor(const LineEditor&) = delete;
+    LineEditor& operator=(const LineEditor&) = delete;
+
+    bool readLine(const std::string& prompt, std::string& line);
+
+private:
+    Completer completer;
+    History* history;
+    struct termios original{};
+    bool interactive = false;
+
+    bool enableRawMode();
+    void disableRawMode();
+
+    bool readFallback(const std::string& prompt, std::string& line);
+    void complete(const std::string& prompt, std::string& buf, size_t& cursor, bool listMatches);
+    void listCandidates(const Completer::Result& result);
+    bool reverseSearch(std::string& buf, size_t& cursor);
+    void refresh(const std::string& prompt, const std::string& buf, size_t cursor);
+
+    static int readByte();
+    static void writeAll(const std::string& s);
+    static int terminalWidth();
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * Pattern matcher behind grep. A matcher is built once per command and
+ * then used concurrently by the search threads, so find() is const.
+ */
+class LineMatcher {
+public:
+    virtual ~LineMatcher() = default;
+
+    /**
+     * Find the leftmost (and, among those, longest) match in [from, end).
+     * begin is the start of the line (or block) being searched, so that
+     * word boundaries can look at the byte before from.
+     */
+    virtual bool find(const char* begin, const char* from, const char* end,
+                      const char*& matchBegin, const char*& matchEnd) const = 0;
+
+    // Whether find() may be given a block of many lines at once; matches never span a newline
+    virtual bool searchesBlocks() const { return false; }
+
+    static std::unique_ptr<LineMatcher> create(const std::vector<std::string>& patterns, bool fixed,
+                                               bool ignoreCase, bool wordMatch, std::string& error);
+
+    // create() through the shared pattern cache, for callers that may see the same patterns again
+    static std::shared_ptr<const LineMatcher> cached(const std::vector<std::string>& patterns, bool fixed,
+                                                     bool ignoreCase, bool wordMatch, std::string& error);
+};
+
+/**
+ * ECMAScript regex over the alternation of all patterns.
+ */
+class RegexMatcher : public LineMatcher {
+public:
+    RegexMatcher(const std::vector<std::string>& patterns, bool ignoreCase, bool wordMatch);
+
+    bool find(const char* begin, const char* from, const char* end,
+              const char*& matchBegin, const char*& matchEnd) const override;
+
+private:
+    std::regex re;
+};
+
+/**
+ * Fixed strings, matched in one pass however many there are.
+ *
+ * Small sets are found with a Teddy-style SSSE3 prefilter: the low and high
+ * nibbles of the first few pattern bytes index shuffle tables that yield a
+ * bitmask of pattern buckets, so 16 positions are screened per step and
+ * only candidates are compared against the patterns of their buckets.
+ * Larger sets use an Aho-Corasick automaton that skips bytes which cannot
+ * start a pattern. Its transitions are compiled into a full DFA over byte
+ * equivalence classes when that fits in DFA_MAX_ENTRIES; otherwise the
+ * automaton runs on sorted sparse edges plus failure links.
+ */
+class LiteralMatcher : public LineMatcher {
+public:
+    LiteralMatcher(const std::vector<std::string>& patterns, bool ignoreCase, bool wordMatch);
+
+    bool find(const char* begin, const char* from, const char* end,
+              const char*& matchBegin, const char*& matchEnd) const override;
+
+    bool searchesBlocks() const override { return true; }
+
+    static constexpr size_t TEDDY_MAX_PATTERNS = 32;
+    static constexpr size_t DFA_MAX_ENTRIES = 4 << 20;
+
+private:
+    struct State {
+        uint32_t edgeBegin = 0;
+        uint32_t edgeCount = 0;
+        int32_t fail = 0;
+        int32_t depth = 0;
+        bool terminal = false;
+        int32_t outLink = -1;   // nearest terminal state on the fail chain
+    };
+
+    struct Edge {
+        unsigned char byte;
+        int32_t target;
+    };
+
+    std::vector<std::string> patterns;
+    bool ignoreCase;
+    bool wordMatch;
+    bool hasEmpty = false;
+    size_t maxLength = 0;
+    unsigned char fold[256];
+
+    // Aho-Corasick
+    std::vector<State> states;
+    std::vector<Edge> edges;
+    int32_t rootNext[256];
+    std::vector<int32_t> dfa;                // states x classes, empty if over budget
+    std::vector<unsigned char> hasOutput;    // per state: terminal or outLink set
+    unsigned char byteClass[256];            // folded byte -> equivalence class
+    size_t classCount = 0;
+
+    // Teddy
+    bool useTeddy = false;
+    size_t teddyWidth = 0;                  // prefix bytes screened (1-3)
+    unsigned char teddyLo[3][16];
+    unsigned char teddyHi[3][16];
+    std::vector<size_t> buckets[8];
+
+    void buildAutomaton();
+    void buildDfa();
+    void buildTeddy();
+    int32_t step(int32_t state, unsigned char c) const;
+    bool wordBounded(const char* begin, const char* end, const char* mBegin, const char* mEnd) const;
+    bool equalAt(const char* p, const std::string& pattern) const;
+    bool findAutomaton(const char* begin, const char* from, const char* end,
+                       const char*& matchBegin, const char*& matchEnd) const;
+    bool findTeddy(const char* begin, const char* from, const char* end,
+                   const char*& matchBegin, const char*& matchEnd) const;
+    bool verifyAt(const char* begin, const char* end, const char* p, unsigned bucketBits,
+                  const char*& matchBegin, const char*& matchEnd) const;
+};
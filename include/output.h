@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * Buffered writer for one of the shell's output streams, in place of
+ * iostreams.
+ *
+ * Text collects in a BUFFER_SIZE buffer and is written with writev,
+ * together with any payload too large to be worth copying, so printing a
+ * large result costs a couple of system calls. On a terminal the writer is
+ * line buffered so output appears as it is produced; on pipes and files it
+ * writes only when the buffer fills or on flush(). stderr is written at
+ * once, as with stdio. The stdout and stderr writers are linked: writing to
+ * one first flushes the other, so their text keeps the order in which it
+ * was produced.
+ */
+class OutputWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 << 10;
+
+    explicit OutputWriter(int fd);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    void write(const char* data, size_t size);
+    void write(const std::string& text) { write(text.data(), text.size()); }
+    void flush();
+
+    bool isTerminal() const { return terminal; }
+
+    static OutputWriter& out();
+    static OutputWriter& err();
+
+private:
+    int fd;
+    bool terminal;
+    OutputWriter* peer = nullptr;
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+
+    void send(const char* data, size_t size);
+    static OutputWriter& standard(int fd);
+};
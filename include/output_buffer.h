@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "file_reader.h"
+
+struct CommandResult;
+class CancelScope;
+
+/**
+ * Output of a command, kept in memory up to a cap and past it in an
+ * unlinked temporary file, so that cat or grep over a huge file does not
+ * hold all of it in the shell's memory.
+ *
+ * The cap comes from the SHELL_OUTPUT_MB shell variable (DEFAULT_LIMIT_MB
+ * if unset, 0 for no cap). When the text outgrows it, everything so far is
+ * written to an O_TMPFILE in $TMPDIR (or /tmp) and later text follows it
+ * there through a WRITE_BLOCK buffer. The file has no name, so it goes
+ * away with its last descriptor, even if the shell is killed. If no such
+ * file can be made the text simply stays in memory, as it always used to.
+ *
+ * A spilled buffer is streamed back when it is printed, sent to a server
+ * client or read by the next command of a pipeline; an external program
+ * gets a descriptor of the file as its stdin. Once a buffer has been
+ * handed on (moveInto) it is only read, so several readers may share it.
+ *
+ * Text appended counts against the output limit of the CancelScope the
+ * buffer was made in (limit -o) as it is produced, so a builtin is stopped
+ * when it overflows rather than after it returns. A buffer whose text is
+ * copied on into another one is made with Charge::None, so that nothing is
+ * counted twice; neither is text a buffer takes over or is handed.
+ */
+class OutputBuffer {
+public:
+    static constexpr size_t DEFAULT_LIMIT_MB = 64;
+    static constexpr size_t WRITE_BLOCK = 1 << 20;
+
+    enum class Charge { Scope, None };
+
+    // The cap in bytes, from SHELL_OUTPUT_MB; 0 = none
+    static size_t currentLimit();
+
+    explicit OutputBuffer(size_t limit = currentLimit(), Charge charge = Charge::Scope);
+    explicit OutputBuffer(std::string&& text, size_t limit = currentLimit());
+    OutputBuffer(OutputBuffer&& other) noexcept;
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(OutputBuffer&&) = delete;
+
+    // False once the temporary file could not be written; the text is lost
+    bool append(const char* data, size_t size);
+    bool append(const std::string& text) { return append(text.data(), text.size()); }
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    bool spilled() const { return fd != -1; }
+    bool failed() const { return writeError != 0; }
+
+    // The text itself, while it has not spilled
+    const std::string& inMemory() const { return pending; }
+
+    char back() const;
+    void truncate(size_t size);
+    void popNewline();
+
+    bool forEachChunk(const FileReader::ChunkFn& consume);
+    bool forEachLineBlock(const FileReader::ChunkFn& consume);
+    size_t read(size_t offset, size_t size, std::string& out) const;
+
+    // A new read-only descriptor of the spilled text, at its start
+    int openReader();
+
+    // Hands the text on as result.output, or the spilled buffer as result.spill
+    void moveInto(CommandResult& result);
+
+private:
+    size_t limit;
+    size_t length = 0;
+    std::string pending;    // the whole text, or once spilled what is not yet written
+    int fd = -1;
+    size_t written = 0;     // bytes in the file
+    int writeError = 0;
+    CancelScope* charged;   // scope appended text counts against, or null
+
+    bool spill();
+    bool flush();
+    bool writeOut(const char* data, size_t size);
+    bool readBack(const FileReader::ChunkFn& consume, bool lineBlocks);
+};
@@ -38,5 +38,6 @@ private:
     static AST parseOpExpr(AST lhs, int min_prec, int& index, const std::vector<Token>& tokens);
     static AST parseCmdAtomic(int& index, const std::vector<Token>& tokens);
     static bool isOperator(const Token& tok);
+    static AST::Quoting quotingOf(const Token& tok);
     static int precedence(const std::string& op);
 };
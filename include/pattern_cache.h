@@ -0,0 +1,117 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Process-wide caches of compiled patterns, so a pattern used again (in a
+ * loop, by every job of a parallel run, or once per directory of a walk)
+ * is compiled only once.
+ *
+ * Each cache is a least-recently-used map from a key that encodes the
+ * pattern text and its flags to an immutable compiled object, shared with
+ * callers through shared_ptr so an evicted entry stays valid for as long
+ * as a search still holds it. Lookups take a mutex; compilation runs
+ * outside it, and if two threads compile the same key at once the first
+ * result inserted wins. Every cache registers itself so the patcache
+ * builtin can report and clear them all.
+ */
+class PatternCacheBase {
+public:
+    struct Stats {
+        const char* name;
+        size_t entries;
+        size_t capacity;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    PatternCacheBase(const PatternCacheBase&) = delete;
+    PatternCacheBase& operator=(const PatternCacheBase&) = delete;
+
+    virtual Stats stats() const = 0;
+    virtual void clear() = 0;
+
+    static std::vector<PatternCacheBase*> all();
+
+protected:
+    PatternCacheBase();
+    ~PatternCacheBase() = default;
+};
+
+template <typename T>
+class PatternCache : public PatternCacheBase {
+public:
+    using Compile = std::function<std::shared_ptr<const T>(std::string& error)>;
+
+    PatternCache(const char* name, size_t capacity) : name(name), capacity(capacity) {}
+
+    /**
+     * @brief The object compiled for key, compiling and caching it on a miss
+     * @param error Receives compile's error; failures are not cached
+     * @return Null if compile failed
+     */
+    std::shared_ptr<const T> get(const std::string& key, const Compile& compile, std::string& error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                ++hits;
+                order.splice(order.begin(), order, it->second);
+                return it->second->second;
+            }
+            ++misses;
+        }
+
+        std::shared_ptr<const T> compiled = compile(error);
+        if (!compiled) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            return it->second->second;
+        }
+        order.emplace_front(key, compiled);
+        index.emplace(order.front().first, order.begin());
+        while (order.size() > capacity) {
+            index.erase(order.back().first);
+            order.pop_back();
+            ++evictions;
+        }
+        return compiled;
+    }
+
+    Stats stats() const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {name, order.size(), capacity, hits, misses, evictions};
+    }
+
+    void clear() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        order.clear();
+        hits = misses = evictions = 0;
+    }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const T>>;
+
+    const char* name;
+    size_t capacity;
+    mutable std::mutex mutex;
+    std::list<Entry> order;   // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
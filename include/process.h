@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "commands.h"
+#include "variables.h"
+
+class OutputBuffer;
+
+/**
+ * Launching of external programs for commands that are not builtins.
+ * run() lets programs inherit the shell's stdin/stdout/stderr; capture()
+ * feeds them given input and collects their output instead. Either way
+ * they start in the current job's directory and receive the cached envp of
+ * the variable table.
+ */
+class Process {
+public:
+    Process() = delete;
+
+    static CommandResult run(const std::vector<std::string>& argv, ShellVariables& vars);
+    static CommandResult capture(const std::vector<std::string>& argv, ShellVariables& vars,
+                                 OutputBuffer* input = nullptr);
+    static std::string findExecutable(const std::string& name, const std::string& path);
+    static int exitStatus(int waitStatus);
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * A long-lived shell that runs command lines for local clients over a Unix
+ * domain socket (custom-shell --serve PATH), so scripts need not start a
+ * shell per command.
+ *
+ * Protocol: a client sends command lines, each ending in '\n'. For every
+ * line, in order, the server replies with a header "STATUS OUT ERR\n",
+ * where OUT and ERR are byte counts, followed by that much output and
+ * error text, exactly as the interactive shell would print them.
+ *
+ * One thread runs an epoll loop that accepts connections, reads requests
+ * and writes replies without blocking; complete lines go to a pool of
+ * worker threads. A session runs in its own fork of the shell's
+ * ExecContext, so its directory and variables are private, and its lines
+ * run one at a time in the order received while other sessions run
+ * concurrently. A worker queues each reply on its session and wakes the
+ * loop through an eventfd; output that spilled to a temporary file (see
+ * OutputBuffer) is sent from the file a block at a time. If a client disconnects, whatever its session
+ * is running is cancelled through the session's CancelScope. SIGINT or
+ * SIGTERM, taken through a signalfd, stops the server and removes the
+ * socket.
+ */
+class ShellServer {
+public:
+    ShellServer() = delete;
+
+    static int serve(const std::string& path);
+
+private:
+    struct Reply;
+    struct Session;
+    struct Impl;
+};
+
+/**
+ * Client for ShellServer (custom-shell --client PATH [command...]). Sends
+ * the command given on its command line, or else every line of stdin as
+ * it arrives, and prints the replies as they come back.
+ */
+class ShellClient {
+public:
+    ShellClient() = delete;
+
+    // Exit status of the last command, or 1 if the server could not be reached
+    static int run(const std::string& path, const std::vector<std::string>& command);
+};
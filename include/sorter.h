@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fcntl.h>
+#include "file_reader.h"
+
+class OutputBuffer;
+
+/**
+ * Line sorter behind the sort builtin.
+ *
+ * Input is read into one large buffer and each line becomes a fixed-size
+ * record (offsets of the line and of its sort key, its first key bytes and
+ * the parsed number for -n), so sorting moves records instead of strings
+ * and no line is allocated on its own. Records are sorted in parallel
+ * slices that are then merged pairwise.
+ *
+ * While the buffer and its records fit under the memory budget everything
+ * stays in memory. Beyond it, each full buffer is sorted and spilled to an
+ * unlinked temp file as a run, and the runs are combined with a k-way merge
+ * driven by a loser tree. All steps are stable, so -u keeps the first of
+ * equal lines.
+ */
+class LineSorter {
+public:
+    struct Options {
+        bool numeric = false;
+        bool reverse = false;
+        bool unique = false;
+        int separator = -1;            // -t; -1 = runs of blanks
+        int keyStart = 0;              // -k start field (1-based), 0 = whole line
+        int keyEnd = 0;                // -k end field, 0 = end of line
+        size_t memoryBudget = 256u << 20;
+        unsigned threads = 0;          // 0 = one per CPU
+        std::string tempDir = "/tmp";
+        int baseDir = AT_FDCWD;        // directory relative input paths are opened in
+    };
+
+    explicit LineSorter(const Options& options);
+    ~LineSorter();
+
+    bool sort(const std::vector<std::string>& files, OutputBuffer& out, std::string& error);
+
+    // Input fed in pieces, as by the sort stage of a pipeline
+    bool add(const char* data, size_t size, std::string& error);
+    void endInput();
+    bool finish(const FileReader::ChunkFn& write, std::string& error);
+
+private:
+    struct Key {
+        const char* data;
+        uint32_t length;
+        double number;
+    };
+
+    struct Record {
+        size_t offset;       // line start in the buffer
+        uint32_t length;     // line length without '\n'
+        uint32_t keyOffset;  // key start relative to the line
+        uint32_t keyLength;
+        double number;
+        uint64_t prefix;     // leading key bytes, big-endian
+    };
+
+    class RunReader;
+
+    Options options;
+    std::vector<char> buffer;
+    std::vector<Record> records;
+    std::vector<int> runs;
+    size_t indexed = 0;    // buffer bytes already turned into records
+
+    Key extractKey(const char* line, size_t length) const;
+    int compare(const char* a, size_t aLen, const Key& ak, const char* b, size_t bLen, const Key& bk) const;
+    size_t index(size_t from, size_t to);
+    void sortRecords();
+    bool spill(std::string& error);
+    bool emitRecords(const FileReader::ChunkFn& write) const;
+    bool mergeRuns(const FileReader::ChunkFn& write, std::string& error);
+};
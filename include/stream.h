@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "commands.h"
+
+class OutputBuffer;
+
+/**
+ * One builtin running as a stage of a fused pipeline.
+ *
+ * Data flows through a fused pipeline as blocks of whole lines (only the
+ * last line of the stream may lack its '\n'). A stage receives a block by
+ * reference, and passes on its own output the same way: a filter such as
+ * grep hands on views of the selected lines inside the block it was given,
+ * so a line read from a mapped file reaches the last stage without being
+ * copied. A stage that needs no more input (head) returns false from
+ * write(), and its upstream stops reading.
+ */
+class StreamStage {
+public:
+    virtual ~StreamStage() = default;
+
+    virtual bool write(const char* data, size_t size) = 0;
+
+    // End of the input; stages that summarise their input (wc, grep -c)
+    // emit their output here. Passes the end on to the next stage.
+    virtual void finish();
+
+    // Offered to the first stage when its whole input is a file (an output
+    // that spilled, see OutputBuffer): a descriptor and the size, before
+    // the file is written to the stage in blocks as usual
+    virtual void inputFile(int /*fd*/, size_t /*size*/) {}
+
+    void setNext(StreamStage* stage) { next = stage; }
+
+    int status = 0;
+    std::string error;
+
+protected:
+    bool emit(const char* data, size_t size) { return next->write(data, size); }
+
+    StreamStage* next = nullptr;
+};
+
+/**
+ * A chain of builtins fused into one in-process pass. Input comes from the
+ * files named to the first stage (read with FileReader, so large files are
+ * mapped) or from the output of an earlier, unfused command. The output of
+ * the last stage is collected in an OutputBuffer.
+ */
+class StreamPipeline {
+public:
+    StreamPipeline();
+    ~StreamPipeline();
+
+    void add(std::unique_ptr<StreamStage> stage);
+    bool empty() const { return stages.empty(); }
+
+    CommandResult runFiles(const std::string& name, const std::vector<std::string>& files);
+    CommandResult runText(OutputBuffer& text);
+
+private:
+    class Collector;
+
+    std::vector<std::unique_ptr<StreamStage>> stages;
+    std::unique_ptr<Collector> collector;
+
+    void link();
+    CommandResult finish();
+};
@@ -4,6 +4,7 @@
 enum class TokenType {
     WORD,           
     QUOTED,         
+    SINGLE_QUOTED,  
     AND_OP,         
     OR_OP,          
     APPEND_OP,      
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * Table of shell variables. Exported variables form the environment of
+ * spawned processes; the envp array for them is serialised once and then
+ * reused until an exported variable changes (tracked by a generation
+ * counter), so spawning does not rebuild the environment every time.
+ */
+class ShellVariables {
+public:
+    ShellVariables() = default;
+    ShellVariables(const ShellVariables& other);
+    ShellVariables& operator=(const ShellVariables& other);
+
+    static ShellVariables& global();
+
+    void importEnviron(char** envp);
+
+    const std::string* get(const std::string& name) const;
+    std::string value(const std::string& name) const;
+    void set(const std::string& name, const std::string& value);
+    void exportVar(const std::string& name);
+    void unset(const std::string& name);
+    bool isExported(const std::string& name) const;
+
+    std::vector<std::pair<std::string, bool>> names() const;
+    char* const* envp();
+    uint64_t generation() const { return exportGeneration; }
+
+    std::string expand(const std::string& word) const;
+
+    void setLastStatus(int status) { lastStatus = status; }
+    int getLastStatus() const { return lastStatus; }
+
+    static bool isValidName(const std::string& name);
+
+private:
+    struct Variable {
+        std::string value;
+        bool exported = false;
+    };
+
+    std::unordered_map<std::string, Variable> vars;
+    int lastStatus = 0;
+
+    uint64_t exportGeneration = 1;
+    uint64_t builtGeneration = 0;
+    std::string envBlock;
+    std::vector<char*> envPointers;
+};
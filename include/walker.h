@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+/**
+ * One directory entry reported by TreeWalker. Roots are reported with
+ * depth 0, dirfd == the job's directory fd and name == path.
+ */
+struct WalkEntry {
+    int dirfd;                              // fd of the containing directory
+    const char* name;                       // name relative to dirfd
+    unsigned char type;                     // DT_* value (resolved for roots and DT_UNKNOWN)
+    const std::string& path;                // full path, for display
+    int depth;
+    const std::shared_ptr<void>& dirData;   // data attached to the containing directory
+};
+
+/**
+ * Multi-threaded directory tree walker.
+ *
+ * Directories are read with getdents64 into a large per-thread buffer and
+ * subdirectories are opened with openat relative to their parent's fd.
+ * Directories waiting to be read go on a shared LIFO stack, which keeps the
+ * walk close to depth-first and bounds the number of open fds. On Ctrl-C
+ * the stack is dropped and the walk ends after the directories in progress.
+ *
+ * Relative roots are resolved against the calling job's directory
+ * (ExecContext::current()), which the worker threads also run in.
+ *
+ * The visitor runs concurrently on the worker threads and returns whether a
+ * directory should be descended into. An optional enter hook can attach data
+ * to each directory (for example, ignore rules) that its entries then see.
+ */
+class TreeWalker {
+public:
+    using Visitor = std::function<bool(const WalkEntry&)>;
+    using EnterHook = std::function<std::shared_ptr<void>(int dirfd, const std::string& path,
+                                                          const std::shared_ptr<void>& parentData)>;
+
+    struct Options {
+        unsigned threads = 0;            // 0 = one per CPU
+        size_t bufferSize = 256 * 1024;  // getdents64 buffer per thread
+    };
+
+    TreeWalker();
+    explicit TreeWalker(const Options& options);
+
+    void setEnterHook(EnterHook hook) { enter = std::move(hook); }
+
+    bool walk(const std::vector<std::string>& roots, const Visitor& visit, std::string& error);
+
+    static std::string joinPath(const std::string& dir, const char* name);
+    static bool pathLess(const std::string& a, const std::string& b);
+
+private:
+    struct Impl;
+
+    Options options;
+    EnterHook enter;
+};
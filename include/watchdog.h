@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <signal.h>
+#include <thread>
+#include "cancel.h"
+
+/**
+ * Enforces a deadline and resource caps on the command running in a
+ * CancelScope, from a thread of its own, for the timeout and limit
+ * builtins.
+ *
+ * The deadline is a timerfd. When it expires the scope is cancelled, so
+ * builtins stop at their next cancellation check, and the programs it has
+ * adopted are sent the chosen signal; with a kill-after delay the timer is
+ * re-armed and whatever is still running then gets SIGKILL. CPU time and
+ * memory are sampled by a second, periodic timerfd every SAMPLE_INTERVAL_MS;
+ * exceeding either cancels the scope with the matching status. CPU time is
+ * the scope's own (CancelScope::cpuTime: the calling thread and any worker
+ * threads of the command). Memory cannot be told apart per command, so it
+ * is the growth of the whole shell's resident set, which other jobs running
+ * at the same time add to. Ctrl-C is passed on to the programs as SIGINT. The thread
+ * sleeps in poll() between events and is stopped through an eventfd when
+ * the command returns.
+ */
+class Watchdog {
+public:
+    static constexpr long SAMPLE_INTERVAL_MS = 10;
+
+    struct Options {
+        int64_t timeoutNs = 0;      // wall-clock deadline, 0 = none
+        int signal = SIGTERM;       // sent to programs at the deadline
+        int64_t killAfterNs = 0;    // then SIGKILL this much later, 0 = never
+        int64_t cpuNs = 0;          // CPU time of the scope's threads, 0 = unlimited
+        size_t memoryBytes = 0;     // growth of the shell's resident set, 0 = unlimited
+    };
+
+    // Starts watching the command about to run on the calling thread
+    Watchdog(CancelScope& scope, const Options& options);
+    ~Watchdog();
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    // Whether programs had to be sent SIGKILL after the deadline
+    bool escalated() const { return killed.load(); }
+
+private:
+    CancelScope& scope;
+    Options options;
+    int64_t cpuBaseline = 0;    // scope's CPU time when the command started
+    size_t baselineRss = 0;
+
+    int deadlineFd = -1;
+    int sampleFd = -1;
+    int stopFd = -1;
+    std::atomic<bool> killed{false};
+    std::thread thread;
+
+    void run();
+    void sample();
+    static size_t residentBytes();
+};
@@ -1,10 +1,13 @@
 #include "ast.h"
 
-AST AST::makeCommandNode(std::string cmd, std::vector<std::string> arguments) {
+AST AST::makeCommandNode(std::string cmd, std::vector<std::string> arguments,
+                         std::vector<Quoting> argQuoting) {
     AST node;
     node.node = NodeType::Command;
     node.command = std::move(cmd);
     node.args = std::move(arguments);
+    node.quoting = std::move(argQuoting);
+    node.quoting.resize(node.args.size(), Quoting::None);
     return node;
 }
 
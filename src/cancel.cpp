@@ -0,0 +1,193 @@
+#include "cancel.h"
+#include "exec_context.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+std::atomic<bool> Cancellation::flag{false};
+int Cancellation::eventFd = -1;
+
+/**
+ * @brief Catch SIGINT for the rest of the process's life. Interrupted
+ *        system calls are restarted; the loops that matter poll the flag.
+ */
+void Cancellation::install() {
+    eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    struct sigaction action = {};
+    action.sa_handler = onInterrupt;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, nullptr);
+}
+
+void Cancellation::reset() {
+    flag.store(false, std::memory_order_relaxed);
+
+    uint64_t count;
+    if (eventFd != -1) {
+        while (read(eventFd, &count, sizeof(count)) > 0) {}
+    }
+}
+
+void Cancellation::onInterrupt(int) {
+    int saved = errno;
+    flag.store(true, std::memory_order_relaxed);
+    if (eventFd != -1) {
+        uint64_t one = 1;
+        ssize_t n = write(eventFd, &one, sizeof(one));
+        (void)n;
+    }
+    errno = saved;
+}
+
+bool Cancellation::scopeCancelled() {
+    const CancelScope* scope = CancelScope::current();
+    return scope && scope->cancelled();
+}
+
+CancelScope::CancelScope(CancelScope* parent) : parent(parent) {}
+
+CancelScope* CancelScope::current() {
+    return ExecContext::current().cancelScope();
+}
+
+void CancelScope::cancel(int status) {
+    int none = 0;
+    reason.compare_exchange_strong(none, status, std::memory_order_relaxed);
+}
+
+bool CancelScope::cancelled() const {
+    for (const CancelScope* scope = this; scope; scope = scope->parent) {
+        if (scope->status() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Track a program started inside the scope, applying the limits of
+ *        this scope and those around it (the strictest of each wins)
+ */
+void CancelScope::adopt(pid_t pid) {
+    for (CancelScope* scope = this; scope; scope = scope->parent) {
+        std::lock_guard<std::mutex> lock(scope->mutex);
+        scope->programs.push_back(pid);
+
+        for (const auto& limit : scope->rlimits) {
+            struct rlimit old;
+            if (prlimit(pid, static_cast<__rlimit_resource>(limit.first), nullptr, &old) == 0 &&
+                limit.second < old.rlim_cur) {
+                struct rlimit capped = {limit.second, old.rlim_max};
+                prlimit(pid, static_cast<__rlimit_resource>(limit.first), &capped, nullptr);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Forget a program once it has been reaped, before its pid can be reused
+ */
+void CancelScope::release(pid_t pid) {
+    for (CancelScope* scope = this; scope; scope = scope->parent) {
+        std::lock_guard<std::mutex> lock(scope->mutex);
+        auto it = std::find(scope->programs.begin(), scope->programs.end(), pid);
+        if (it != scope->programs.end()) {
+            scope->programs.erase(it);
+        }
+    }
+}
+
+/**
+ * @brief Signal the process group of every program in the scope
+ */
+void CancelScope::signalPrograms(int signal) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (pid_t pid : programs) {
+        kill(-pid, signal);
+    }
+}
+
+void CancelScope::limitPrograms(int resource, rlim_t value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rlimits.emplace_back(resource, value);
+}
+
+static int64_t readClock(clockid_t clock) {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Start counting the calling thread's CPU time in this scope and
+ *        those around it. A thread already working in one of them (a
+ *        nested limit on the same thread) is not counted twice there.
+ */
+void CancelScope::enterThread() {
+    pthread_t self = pthread_self();
+    clockid_t clock;
+    if (pthread_getcpuclockid(self, &clock) != 0) {
+        return;
+    }
+
+    for (CancelScope* scope = this; scope; scope = scope->parent) {
+        std::lock_guard<std::mutex> lock(scope->mutex);
+        auto it = std::find_if(scope->threads.begin(), scope->threads.end(),
+                               [self](const ThreadClock& t) { return pthread_equal(t.thread, self); });
+        if (it != scope->threads.end()) {
+            ++it->depth;
+        } else {
+            scope->threads.push_back({self, clock, readClock(clock), 1});
+        }
+    }
+}
+
+void CancelScope::leaveThread() {
+    pthread_t self = pthread_self();
+
+    for (CancelScope* scope = this; scope; scope = scope->parent) {
+        std::lock_guard<std::mutex> lock(scope->mutex);
+        auto it = std::find_if(scope->threads.begin(), scope->threads.end(),
+                               [self](const ThreadClock& t) { return pthread_equal(t.thread, self); });
+        if (it != scope->threads.end() && --it->depth == 0) {
+            scope->cpuFinished += readClock(it->clock) - it->start;
+            scope->threads.erase(it);
+        }
+    }
+}
+
+/**
+ * @brief CPU time of the threads that left the scope, plus what those
+ *        still in it have used so far. Programs are limited by RLIMIT_CPU.
+ */
+int64_t CancelScope::cpuTime() {
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t total = cpuFinished;
+    for (const ThreadClock& t : threads) {
+        total += readClock(t.clock) - t.start;
+    }
+    return total;
+}
+
+/**
+ * @brief Count output produced inside the scope against its limit and
+ *        those of the scopes around it
+ * @return False, with the scope that overflowed cancelled, once a limit is exceeded
+ */
+bool CancelScope::chargeOutput(size_t bytes) {
+    for (CancelScope* scope = this; scope; scope = scope->parent) {
+        size_t used = scope->outputUsed.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (scope->outputLimit != 0 && used > scope->outputLimit) {
+            scope->cancel(OUTPUT_EXCEEDED);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,381 @@
+#include "checksum.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+const char* const Checksum::ALGORITHMS = "crc32c, xxh64, sha256";
+
+std::unique_ptr<Checksum> Checksum::create(const std::string& algorithm) {
+    if (algorithm == "crc32c") return std::unique_ptr<Checksum>(new Crc32c());
+    if (algorithm == "xxh64")  return std::unique_ptr<Checksum>(new XxHash64());
+    if (algorithm == "sha256") return std::unique_ptr<Checksum>(new Sha256());
+    return nullptr;
+}
+
+static uint32_t load32le(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t load64le(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint32_t load32be(const unsigned char* p) {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+// ---------------------------------------------------------------- crc32c
+
+namespace {
+    // Slicing-by-8 tables for the reflected Castagnoli polynomial
+    struct Crc32cTables {
+        uint32_t t[8][256];
+
+        Crc32cTables() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c >> 1) ^ (c & 1 ? 0x82F63B78 : 0);
+                }
+                t[0][i] = c;
+            }
+            for (int k = 1; k < 8; ++k) {
+                for (uint32_t i = 0; i < 256; ++i) {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+}
+
+static uint32_t crc32cPortable(uint32_t crc, const unsigned char* p, size_t n) {
+    static const Crc32cTables tables;
+    const auto& t = tables.t;
+
+    while (n >= 8) {
+        uint64_t word = load64le(p);
+        uint32_t lo = static_cast<uint32_t>(word) ^ crc;
+        uint32_t hi = static_cast<uint32_t>(word >> 32);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t n) {
+    uint64_t c = crc;
+    while (n >= 8) {
+        c = _mm_crc32_u64(c, load64le(p));
+        p += 8;
+        n -= 8;
+    }
+
+    uint32_t c32 = static_cast<uint32_t>(c);
+    while (n--) {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return c32;
+}
+#endif
+
+void Crc32c::update(const char* data, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(data);
+#ifdef CHECKSUM_X86
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) {
+        crc = crc32cHardware(crc, p, size);
+        return;
+    }
+#endif
+    crc = crc32cPortable(crc, p, size);
+}
+
+std::string Crc32c::hexDigest() {
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", crc ^ 0xFFFFFFFF);
+    return hex;
+}
+
+// ---------------------------------------------------------------- xxhash64
+
+static const uint64_t XXH_P1 = 11400714785092623617ULL;
+static const uint64_t XXH_P2 = 14029467366897019727ULL;
+static const uint64_t XXH_P3 = 1609587929392839161ULL;
+static const uint64_t XXH_P4 = 9650029242287828579ULL;
+static const uint64_t XXH_P5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t lane) {
+    acc ^= xxhRound(0, lane);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+XxHash64::XxHash64(uint64_t seed) : seed(seed) {
+    lanes[0] = seed + XXH_P1 + XXH_P2;
+    lanes[1] = seed + XXH_P2;
+    lanes[2] = seed;
+    lanes[3] = seed - XXH_P1;
+}
+
+void XxHash64::update(const char* data, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    total += size;
+
+    if (pendingSize + size < 32) {
+        memcpy(pending + pendingSize, p, size);
+        pendingSize += size;
+        return;
+    }
+
+    if (pendingSize > 0) {
+        size_t fill = 32 - pendingSize;
+        memcpy(pending + pendingSize, p, fill);
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] = xxhRound(lanes[i], load64le(pending + 8 * i));
+        }
+        p += fill;
+        size -= fill;
+        pendingSize = 0;
+    }
+
+    uint64_t v0 = lanes[0], v1 = lanes[1], v2 = lanes[2], v3 = lanes[3];
+    while (size >= 32) {
+        v0 = xxhRound(v0, load64le(p));
+        v1 = xxhRound(v1, load64le(p + 8));
+        v2 = xxhRound(v2, load64le(p + 16));
+        v3 = xxhRound(v3, load64le(p + 24));
+        p += 32;
+        size -= 32;
+    }
+    lanes[0] = v0; lanes[1] = v1; lanes[2] = v2; lanes[3] = v3;
+
+    memcpy(pending, p, size);
+    pendingSize = size;
+}
+
+std::string XxHash64::hexDigest() {
+    uint64_t h;
+
+    if (total >= 32) {
+        h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            h = xxhMerge(h, lanes[i]);
+        }
+    } else {
+        h = seed + XXH_P5;
+    }
+    h += total;
+
+    const unsigned char* p = pending;
+    size_t n = pendingSize;
+
+    for (; n >= 8; p += 8, n -= 8) {
+        h ^= xxhRound(0, load64le(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (n >= 4) {
+        h ^= uint64_t(load32le(p)) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; ++p, --n) {
+        h ^= *p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+    return hex;
+}
+
+// ---------------------------------------------------------------- sha256
+
+alignas(16) static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+static void sha256Portable(uint32_t state[8], const unsigned char* p, size_t blocks) {
+    for (; blocks > 0; --blocks, p += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = load32be(p + 4 * i);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef CHECKSUM_X86
+// SHA-NI keeps the state as ABEF/CDGH halves; each sha256rnds2 does two
+// rounds and sha256msg1/msg2 extend the message schedule four words at a time
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256Hardware(uint32_t state[8], const unsigned char* p, size_t blocks) {
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; --blocks, p += 64) {
+        __m128i abefSave = state0;
+        __m128i cdghSave = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 4; ++i) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i)), BSWAP);
+        }
+
+        for (int g = 0; g < 16; ++g) {
+            __m128i msg = _mm_add_epi32(w[g & 3], _mm_load_si128(reinterpret_cast<const __m128i*>(&SHA256_K[4 * g])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+            // w[g] is no longer needed; replace it with w[g + 4]
+            if (g < 12) {
+                __m128i next = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+                w[g & 3] = _mm_sha256msg2_epu32(next, w[(g + 3) & 3]);
+            }
+
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+static void sha256Blocks(uint32_t state[8], const unsigned char* p, size_t blocks) {
+#ifdef CHECKSUM_X86
+    static const bool hardware = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+    if (hardware) {
+        sha256Hardware(state, p, blocks);
+        return;
+    }
+#endif
+    sha256Portable(state, p, blocks);
+}
+
+Sha256::Sha256() {
+    static const uint32_t INITIAL[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(state, INITIAL, sizeof(state));
+}
+
+void Sha256::update(const char* data, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    total += size;
+
+    if (pendingSize > 0) {
+        size_t fill = std::min(size, 64 - pendingSize);
+        memcpy(pending + pendingSize, p, fill);
+        pendingSize += fill;
+        p += fill;
+        size -= fill;
+
+        if (pendingSize < 64) {
+            return;
+        }
+        sha256Blocks(state, pending, 1);
+        pendingSize = 0;
+    }
+
+    sha256Blocks(state, p, size / 64);
+    p += size / 64 * 64;
+    size %= 64;
+
+    memcpy(pending, p, size);
+    pendingSize = size;
+}
+
+std::string Sha256::hexDigest() {
+    uint64_t bits = total * 8;
+
+    unsigned char tail[128] = {0};
+    memcpy(tail, pending, pendingSize);
+    tail[pendingSize] = 0x80;
+
+    size_t length = pendingSize + 1 + 8 <= 64 ? 64 : 128;
+    for (int i = 0; i < 8; ++i) {
+        tail[length - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+    sha256Blocks(state, tail, length / 64);
+
+    std::string hex;
+    char word[9];
+    for (uint32_t v : state) {
+        snprintf(word, sizeof(word), "%08x", v);
+        hex += word;
+    }
+    return hex;
+}
@@ -1,5 +1,8 @@
 #include "commands.h"
+#include "variables.h"
 #include <limits>
+#include <climits>
+#include <cmath>
 #include <string>
 #include <dirent.h>
 #include <unistd.h>
@@ -9,7 +12,38 @@
 #include <iostream>
 #include <fcntl.h>
 #include <pwd.h>
+#include <grp.h>
 #include <regex>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <unordered_set>
+#include <sys/sysmacros.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <signal.h>
+#include <thread>
+#include <functional>
+#include "walker.h"
+#include "ignore.h"
+#include "find.h"
+#include "sorter.h"
+#include "file_reader.h"
+#include "checksum.h"
+#include "matcher.h"
+#include "output.h"
+#include "exec_context.h"
+#include "job_pool.h"
+#include "stream.h"
+#include "dir_cursor.h"
+#include "pattern_cache.h"
+#include "cancel.h"
+#include "watchdog.h"
+#include "executor.h"
+#include "output_buffer.h"
 
 /**
  * @brief Display a list of all supported shell commands
@@ -26,23 +60,39 @@ CommandResult Commands::helpCommand(const std::vector<std::string>& args) {
         "  cd [dir]                                 Change directory.\n"
         "  clr                                      Clear the screen.\n"
         "  dir [-a] [-A] [-l] [path]                List directory contents.\n"
+        "  find [path]... [expression]              Search directory trees in parallel.\n"
+        "  du [-s] [-h] [--max-depth=N] [path]...   Show disk usage.\n"
         "  environ                                  Display environment variables.\n"
+        "  export [name[=value]]...                 Export variables to programs.\n"
+        "  unset <name>...                          Remove variables.\n"
         "  echo [text]                              Print text.\n"
         "  help                                     Show help.\n"
         "  pause                                    Pause shell.\n"
         "  quit                                     Exit shell.\n"
-        "  chmod <mode> <file>                      Change permissions.\n"
-        "  chown <owner> <file>                     Change ownership.\n"
+        "  chmod [-R] <mode> <file>...              Change permissions (octal or u+x,g-w).\n"
+        "  chown [-R] <owner>[:group] <file>...     Change ownership.\n"
         "  ls [-a] [-A] [-l] [path]                 List directory contents.\n"
         "  pwd                                      Print working directory.\n"
         "  cat <file>...                            Print file contents.\n"
-        "  mkdir <dir>                              Create directory.\n"
+        "  head [-n N] [-c N] <file>...             Print the first lines of files.\n"
+        "  tail [-f] [-n [+]N] [-c N] <file>...     Print the last lines of files.\n"
+        "  tee [-a] <file>...                       Copy a pipeline's output to files.\n"
+        "  mkdir [-p] <dir>...                      Create directories.\n"
         "  rmdir [-p] <dir>                         Remove directory.\n"
         "  rm [-r] <path>                           Remove file or directory.\n"
-        "  cp <src>... <dst>                        Copy.\n"
+        "  cp [-ru] [--checksum] <src>... <dst>     Copy; -u skips unchanged files.\n"
         "  mv <src> <dst>                           Move.\n"
-        "  touch <file>                             Create empty file.\n"
+        "  touch [-acm] [-t STAMP] <file>...        Create files or update their times.\n"
         "  grep [OPTIONS] <pattern> <file>          Search text.\n"
+        "  grep -r [OPTIONS] <pattern> [path]...    Search directory trees in parallel.\n"
+        "  grep -F [-e PAT]... [-f FILE] <file>...  Search for many fixed strings at once.\n"
+        "  sort [-nru] [-t C] [-k N[,M]] <file>...  Sort lines.\n"
+        "  sum [-a ALGO] [-r] <path>...             Print crc32c/xxh64/sha256 checksums.\n"
+        "  parallel [-j N] [-k] <cmd> ::: <arg>...  Run a command for each argument in parallel.\n"
+        "  xargs [-P N] [-n N] [-I S] -a FILE cmd   Run a command with arguments from a file.\n"
+        "  patcache [-c]                            Show or clear the compiled pattern caches.\n"
+        "  timeout [-k DUR] [-s SIG] <dur> <cmd>    Run a command with a time limit.\n"
+        "  limit [-t S] [-m SIZE] [-o SIZE] <cmd>   Run a command with resource limits.\n"
         "  wc [-l] [-w] [-c]                        Count lines/words/chars.";
 
     return {0, out, ""};
@@ -73,6 +123,9 @@ CommandResult Commands::pauseCommand(const std::vector<std::string> &args)
     if (!args.empty()){
         return {1, "", "pause: this command takes no arguments"};
     }
+    if (!ExecContext::current().ownsTerminal()) {
+        return {1, "", "pause: not attached to a terminal"};
+    }
 
     std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     return {0, "", ""};
@@ -110,9 +163,15 @@ CommandResult Commands::lsCommand(const std::vector<std::string>& args) {
         paths.push_back(".");
     }
 
+    const int cwdFd = ExecContext::current().dirfd();
+
     for (const std::string& p : paths) {
+        if (Cancellation::requested()) {
+            break;
+        }
+
         struct stat info;
-        if (stat(p.c_str(), &info) == -1) {
+        if (fstatat(cwdFd, p.c_str(), &info, 0) == -1) {
             return {1, "", "ls: cannot access '" + p + "': " + std::string(strerror(errno))};
         }
         
@@ -130,13 +189,16 @@ CommandResult Commands::lsCommand(const std::vector<std::string>& args) {
             out += p + ":\n";
         }
 
-        DIR* dirp = opendir(p.c_str());
+        int dirFd = openat(cwdFd, p.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* dirp = dirFd == -1 ? nullptr : fdopendir(dirFd);
         if (!dirp) {
-            return {1, "", "ls: cannot open directory '" + p + "': " + std::string(strerror(errno))};
+            int err = errno;
+            if (dirFd != -1) close(dirFd);
+            return {1, "", "ls: cannot open directory '" + p + "': " + std::string(strerror(err))};
         }
 
         struct dirent* dp;
-        while ((dp = readdir(dirp)) != nullptr) {
+        while (!Cancellation::requested() && (dp = readdir(dirp)) != nullptr) {
             std::string name = dp->d_name;
 
             if (!showAll && !almostAll && name[0] == '.') {
@@ -147,11 +209,9 @@ CommandResult Commands::lsCommand(const std::vector<std::string>& args) {
                 continue;
             }
 
-            std::string full = p + "/" + name;
-
             if (longList) {
                 struct stat finfo;
-                if (stat(full.c_str(), &finfo) == -1) {
+                if (fstatat(dirFd, name.c_str(), &finfo, 0) == -1) {
                     closedir(dirp);
                     return {1, "", "ls: cannot access '" + name + "': " + std::string(strerror(errno))};
                 }
@@ -176,6 +236,265 @@ CommandResult Commands::dirCommand(const std::vector<std::string>& args) {
     return lsCommand(args);
 }
 
+/**
+ * @brief Search directory trees for entries matching an expression
+ * @param args Zero or more start paths followed by an expression built from
+ *        -name, -iname, -type, -size, -mtime, -newer, -prune, -print,
+ *        -maxdepth, -mindepth, "!", -a, -o and parentheses
+ * @return Status code, matching paths in traversal order, or error message
+ */
+CommandResult Commands::findCommand(const std::vector<std::string>& args) {
+    size_t start = 0;
+    std::vector<std::string> roots;
+
+    while (start < args.size() && args[start][0] != '-' && args[start] != "(" && args[start] != "!") {
+        roots.push_back(args[start++]);
+    }
+    if (roots.empty()) {
+        roots.push_back(".");
+    }
+
+    FindProgram program;
+    std::string error;
+    if (!program.compile(args, start, error)) {
+        return {1, "", "find: " + error};
+    }
+
+    // Where each entry's text sits in the spool, to be put in path order
+    // once the walk is done
+    struct Match {
+        std::string path;
+        size_t offset;
+        size_t size;
+    };
+
+    std::mutex matchesMutex;
+    std::vector<Match> matches;
+    OutputBuffer spool;
+
+    auto visit = [&](const WalkEntry& entry) {
+        bool prune = false;
+
+        if (entry.depth >= program.minDepth) {
+            std::string text;
+            program.evaluate(entry, text, prune);
+
+            if (!text.empty()) {
+                std::lock_guard<std::mutex> lock(matchesMutex);
+                matches.push_back({entry.path, spool.size(), text.size()});
+                spool.append(text);
+            }
+        }
+
+        return !prune && (program.maxDepth < 0 || entry.depth < program.maxDepth);
+    };
+
+    TreeWalker walker;
+    walker.walk(roots, visit, error);
+
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+        return TreeWalker::pathLess(a.path, b.path);
+    });
+
+    // Charged already in the spool
+    OutputBuffer out(OutputBuffer::currentLimit(), OutputBuffer::Charge::None);
+    std::string text;
+    for (const Match& match : matches) {
+        text.clear();
+        if (spool.read(match.offset, match.size, text) < match.size) {
+            return {1, "", "find: cannot read back the output: " + std::string(strerror(errno))};
+        }
+        out.append(text);
+    }
+
+    // Paths that could not be walked fail the command, as in find, but what
+    // was found elsewhere is still listed
+    CommandResult result{error.empty() ? 0 : 1, "", error.empty() ? "" : "find: " + error};
+    out.popNewline();
+    out.moveInto(result);
+    return result;
+}
+
+namespace {
+    std::string kibibytes(uint64_t bytes) {
+        return std::to_string((bytes + 1023) / 1024);
+    }
+
+    struct DuContext {
+        bool summarize = false;
+        std::string (*formatSize)(uint64_t) = kibibytes;    // formatHumanSize for -h
+        int maxDepth = -1;
+        std::vector<std::string> roots;
+        std::mutex mutex;
+        OutputBuffer out;
+
+        // Totals are written out as soon as they are known
+        void report(const std::string& path, uint64_t bytes) {
+            std::string line = formatSize(bytes) + "\t" + path + "\n";
+            std::lock_guard<std::mutex> lock(mutex);
+            out.append(line);
+        }
+    };
+
+    // Usage of one directory. Entries add to it concurrently; once the last
+    // reference is dropped (every subdirectory has finished too) it reports
+    // its total and folds it into its parent, so sizes aggregate bottom-up and
+    // finished subtrees are emitted and freed while the walk goes on.
+    struct DuNode {
+        DuContext* ctx;
+        std::shared_ptr<DuNode> parent;
+        std::string path;
+        int depth;
+        std::atomic<uint64_t> bytes{0};
+
+        DuNode(DuContext* ctx, std::shared_ptr<DuNode> parent, std::string path)
+            : ctx(ctx), parent(std::move(parent)), path(std::move(path)),
+              depth(this->parent ? this->parent->depth + 1 : 0) {}
+
+        ~DuNode() {
+            uint64_t total = bytes.load();
+            if (depth == 0 || (!ctx->summarize && (ctx->maxDepth < 0 || depth <= ctx->maxDepth))) {
+                ctx->report(path, total);
+            }
+
+            // The parent cannot finish, and report, before this line is out
+            if (parent) {
+                parent->bytes += total;
+            }
+        }
+    };
+
+    // (dev, ino) pairs of multiply-linked files already counted, sharded to
+    // keep lock contention low
+    class InodeSet {
+    public:
+        bool insert(uint64_t dev, uint64_t ino) {
+            Shard& shard = shards[(ino ^ dev) % SHARDS];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.seen.insert({dev, ino}).second;
+        }
+
+    private:
+        struct PairHash {
+            size_t operator()(const std::pair<uint64_t, uint64_t>& p) const {
+                return std::hash<uint64_t>()(p.second * 31 + p.first);
+            }
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            std::unordered_set<std::pair<uint64_t, uint64_t>, PairHash> seen;
+        };
+
+        static const size_t SHARDS = 64;
+        Shard shards[SHARDS];
+    };
+}
+
+/**
+ * @brief Report disk usage of files and directory trees. Each directory's
+ *        total is written out as soon as everything below it is done, so a
+ *        directory follows its subdirectories, and subdirectories appear in
+ *        the order the parallel walk finishes them.
+ * @param args Optional flags followed by paths (default "."):
+ *        - "-s" print only a total for each argument
+ *        - "-h" print sizes in human-readable units
+ *        - "--max-depth=N" / "-d N" print directories at most N levels deep
+ * @return Status code, one "size<TAB>path" line per reported entry, or error message
+ */
+CommandResult Commands::duCommand(const std::vector<std::string>& args) {
+    DuContext ctx;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        std::string depth;
+
+        if (arg.compare(0, 12, "--max-depth=") == 0) {
+            depth = arg.substr(12);
+        } else if (arg == "-d" || arg == "--max-depth") {
+            if (++i == args.size()) {
+                return {1, "", "du: option requires an argument -- '" + arg + "'"};
+            }
+            depth = args[i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            for (size_t j = 1; j < arg.size(); ++j) {
+                if (arg[j] == 's') ctx.summarize = true;
+                else if (arg[j] == 'h') ctx.formatSize = formatHumanSize;
+                else return {1, "", "du: invalid option -- '" + std::string(1, arg[j]) + "'"};
+            }
+            continue;
+        } else {
+            ctx.roots.push_back(arg);
+            continue;
+        }
+
+        if (depth.empty() || depth.find_first_not_of("0123456789") != std::string::npos) {
+            return {1, "", "du: invalid maximum depth '" + depth + "'"};
+        }
+        ctx.maxDepth = std::stoi(depth);
+    }
+
+    if (ctx.roots.empty()) {
+        ctx.roots.push_back(".");
+    }
+
+    const unsigned MASK = STATX_BLOCKS | STATX_NLINK | STATX_INO;
+    InodeSet seen;
+
+    auto usage = [&](const struct statx& stx) -> uint64_t {
+        if (stx.stx_nlink > 1 && !S_ISDIR(stx.stx_mode) &&
+            !seen.insert(makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino)) {
+            return 0;
+        }
+        return stx.stx_blocks * 512;
+    };
+
+    TreeWalker walker;
+    walker.setEnterHook([&](int dirfd, const std::string& path, const std::shared_ptr<void>& parent) {
+        auto node = std::make_shared<DuNode>(&ctx, std::static_pointer_cast<DuNode>(parent), path);
+        struct statx stx;
+        if (statx(dirfd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, MASK | STATX_TYPE, &stx) == 0) {
+            node->bytes += usage(stx);
+        }
+        return std::static_pointer_cast<void>(node);
+    });
+
+    auto visit = [&](const WalkEntry& entry) {
+        if (entry.type == DT_DIR) {
+            return true;
+        }
+
+        struct statx stx;
+        if (statx(entry.dirfd, entry.name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, MASK | STATX_TYPE, &stx) == -1) {
+            return false;
+        }
+
+        uint64_t bytes = usage(stx);
+        if (entry.depth == 0) {
+            ctx.report(entry.path, bytes);
+        } else {
+            std::static_pointer_cast<DuNode>(entry.dirData)->bytes += bytes;
+        }
+        return false;
+    };
+
+    // Roots are walked one after another so that files reachable from several
+    // arguments are charged to the first, as du does
+    std::string errors;
+    for (const std::string& root : ctx.roots) {
+        std::string error;
+        if (!walker.walk({root}, visit, error)) {
+            errors += (errors.empty() ? "" : "\n") + error;
+        }
+    }
+
+    // Totals of the roots that could be walked are still printed
+    CommandResult result{errors.empty() ? 0 : 1, "", errors.empty() ? "" : "du: " + errors};
+    ctx.out.popNewline();
+    ctx.out.moveInto(result);
+    return result;
+}
+
 /**
  * @brief Change the current working directory
  * @param args
@@ -184,20 +503,22 @@ CommandResult Commands::dirCommand(const std::vector<std::string>& args) {
  * @return Status code, empty output on success or error message on failure
  */
 CommandResult Commands::cdCommand(const std::vector<std::string>& args) {
-    const char* home = getenv("HOME");
+    ExecContext& context = ExecContext::current();
+    std::string home = context.variables().value("HOME");
+    std::string error;
 
     if (args.empty()){
-        if(chdir(home) == -1) {
+        if (!context.changeDirectory(home, error)) {
             return {1, "", "cd: failed to change directory"};
         };
     } else if (args.size() == 1) {
         std::string path = args[0];
 
         if (path[0] == '~') {
-            path = std::string(home) + path.substr(1);
+            path = home + path.substr(1);
         } 
 
-        if(chdir(path.c_str()) == -1) {
+        if (!context.changeDirectory(path, error)) {
             std::string errorMsg = "cd: failed to change directory: " + path;
             return {1, "", errorMsg};
         };
@@ -235,9 +556,11 @@ CommandResult Commands::rmdirCommand(const std::vector<std::string>& args) {
                 path.pop_back();
             }
 
+            const int cwdFd = ExecContext::current().dirfd();
+
             while (!path.empty()) {
 
-                if (rmdir(path.c_str()) == -1) {
+                if (unlinkat(cwdFd, path.c_str(), AT_REMOVEDIR) == -1) {
                     return {1, "", formatRmdirErrorMsg(path)};
                 }
 
@@ -263,7 +586,7 @@ CommandResult Commands::rmdirCommand(const std::vector<std::string>& args) {
 
     std::string path = args[0];
 
-    if (rmdir(path.c_str()) == -1) {
+    if (unlinkat(ExecContext::current().dirfd(), path.c_str(), AT_REMOVEDIR) == -1) {
         return {1, "", formatRmdirErrorMsg(path)};
     }
 
@@ -271,347 +594,783 @@ CommandResult Commands::rmdirCommand(const std::vector<std::string>& args) {
 }
 
 /**
- * @brief Creates a file if it does not exit or updates an existing file's access/modification times
- * @param args The file name
- * @return Status code, empty output on success or error message on failure
+ * @brief Paths in TreeWalker::pathLess order, so that a DirectoryCursor
+ *        reuses the directories they share
  */
-CommandResult Commands::touchCommand(const std::vector<std::string>& args) {
-    /**
-     * TODO: Implement optional flags
-     *        - "-a"
-     *        - "-m"
-     *        - "-t"
-     *        - "-c"
-    */
+static std::vector<std::string> sortedForCursor(std::vector<std::string> paths) {
+    std::stable_sort(paths.begin(), paths.end(), TreeWalker::pathLess);
+    return paths;
+}
 
-    if (args.empty() || args.size() > 1) {
-        return {1, "", "touch: invalid arguments passed"};
+/**
+ * @brief Creates directories.
+ * @param args Directory paths, optionally preceded by "-p" to create missing
+ *        parents and accept directories that already exist
+ * @return Status code, empty output on success, error messages on failure
+ * @note Paths are created in sorted order with mkdirat relative to their
+ *       parent, whose fd is kept open for its siblings (see DirectoryCursor).
+ */
+CommandResult Commands::mkdirCommand(const std::vector<std::string>& args) {
+    bool parents = false;
+    size_t idx = 0;
+    for (; idx < args.size() && args[idx].size() > 1 && args[idx][0] == '-'; ++idx) {
+        if (args[idx] != "-p") {
+            return {1, "", "mkdir: invalid option '" + args[idx] + "'"};
+        }
+        parents = true;
     }
 
-    std::string fileName = args[0];
-    
-    /**
-     * @note O_CREAT flag creates the file if it does not exist
-     * @note 0644 is the permission bits that allows read and write for the owner, and read-only for group and the public
-    */
-    int fd = open(fileName.c_str(), O_CREAT | O_WRONLY, 0644);
-    if (fd == -1) {
-        return {1, "", "touch: cannot create file '" + fileName + "': " + std::string(strerror(errno))};
+    if (idx == args.size()) {
+        return {1, "", "mkdir: missing directory argument"};
     }
 
-    close(fd); 
+    std::string errors;
+    auto fail = [&errors](const std::string& dir, const std::string& reason) {
+        errors += (errors.empty() ? "" : "\n") + ("mkdir: cannot create directory '" + dir + "': " + reason);
+    };
+
+    DirectoryCursor cursor(parents);
+    for (const std::string& dir : sortedForCursor(std::vector<std::string>(args.begin() + idx, args.end()))) {
+        std::string leaf, error;
+        int parentFd = cursor.parentOf(dir, leaf, error);
+        if (parentFd == -1) {
+            fail(dir, error);
+            continue;
+        }
 
-    return {0, "", ""};
+        if (mkdirat(parentFd, leaf.c_str(), 0755) == -1) {
+            struct stat st;
+            int err = errno;
+            if (parents && err == EEXIST && fstatat(parentFd, leaf.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+                continue;
+            }
+            fail(dir, strerror(err));
+        }
+    }
+
+    return {errors.empty() ? 0 : 1, "", errors};
 }
 
 /**
- * @brief Copy a file or directory to a destination path.
- * @param args Source and destination paths
- * @return Status code, empty output on success or an error message on failure
+ * @brief Parse touch -t's [[CC]YY]MMDDhhmm[.ss] as local time
+ * @return False if the stamp is malformed
  */
-CommandResult Commands::cpCommand(const std::vector<std::string>& args) {
-    /**
-     * TODO: Implement "-r" flag
-    */
-
-    if (args.empty()) {
-        return {1, "", "cp: missing operand"};
-    }
+static bool parseTouchStamp(const std::string& stamp, struct timespec& ts) {
+    size_t dot = stamp.find('.');
+    std::string digits = stamp.substr(0, dot);
+    std::string seconds = dot == std::string::npos ? "00" : stamp.substr(dot + 1);
 
-    if (args.size() == 1) {
-        return {1, "", "cp: missing destination file operand after '" + args[0] + "'"};
+    if ((digits.size() != 8 && digits.size() != 10 && digits.size() != 12) || seconds.size() != 2 ||
+        (digits + seconds).find_first_not_of("0123456789") != std::string::npos) {
+        return false;
     }
 
-    std::string dest = args.back();
+    auto field = [&digits](size_t fromEnd) { return std::stoi(digits.substr(digits.size() - fromEnd, 2)); };
 
-    struct stat stDest;
-    bool destIsDir = stat(dest.c_str(), &stDest) == 0 && S_ISDIR(stDest.st_mode);
+    struct tm tm = {};
+    time_t now = time(nullptr);
+    localtime_r(&now, &tm);
 
-    // If multiple sources, dest MUST be a directory
-    int numSources = args.size() - 1;
-    if (numSources > 1 && !destIsDir) {
-        return {1, "", "cp: target '" + dest + "' is not a directory"};
+    if (digits.size() == 12) {
+        tm.tm_year = std::stoi(digits.substr(0, 4)) - 1900;
+    } else if (digits.size() == 10) {
+        int yy = std::stoi(digits.substr(0, 2));
+        tm.tm_year = (yy < 69 ? 2000 + yy : 1900 + yy) - 1900;
+    }
+    tm.tm_mon = field(8) - 1;
+    tm.tm_mday = field(6);
+    tm.tm_hour = field(4);
+    tm.tm_min = field(2);
+    tm.tm_sec = std::stoi(seconds);
+    tm.tm_isdst = -1;
+
+    if (tm.tm_mon > 11 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+        return false;
     }
 
-    for (int i = 0; i < numSources; ++i) {
-        std::string src = args[i];
-
-        // Rejecting directory sources because no -r support yet
-        struct stat stSrc;
-        if (stat(src.c_str(), &stSrc) == 0 && S_ISDIR(stSrc.st_mode)) {
-            return {1, "", "cp: omitting directory '" + src + "'"};
-        }
+    ts.tv_sec = mktime(&tm);
+    ts.tv_nsec = 0;
+    return ts.tv_sec != -1;
+}
 
-        std::string finalDest = dest;
-        if (destIsDir) {
-            ssize_t pos = src.find_last_of('/'); 
-            std::string filename = (pos == std::string::npos) ? src : src.substr(pos + 1);
-            finalDest = dest + "/" + filename;
+/**
+ * @brief Create files that do not exist and update the access and modification
+ *        times of those that do
+ * @param args Optional flags followed by one or more paths:
+ *        - "-a" change only the access time
+ *        - "-m" change only the modification time
+ *        - "-c" do not create missing files
+ *        - "-t STAMP" use [[CC]YY]MMDDhhmm[.ss] instead of the current time
+ * @return Status code, empty output on success or error messages on failure
+ * @note Paths are handled in sorted order relative to their parent's fd (see
+ *       DirectoryCursor). A new file is created with O_EXCL and, when its
+ *       times are "now", needs no further call; an existing one gets utimensat.
+ */
+CommandResult Commands::touchCommand(const std::vector<std::string>& args) {
+    bool accessOnly = false;
+    bool modifyOnly = false;
+    bool noCreate = false;
+    bool stampGiven = false;
+    struct timespec stamp = {0, UTIME_NOW};
+    size_t idx = 0;
+
+    for (; idx < args.size() && args[idx].size() > 1 && args[idx][0] == '-'; ++idx) {
+        const std::string& flag = args[idx];
+        for (size_t j = 1; j < flag.size(); ++j) {
+            char c = flag[j];
+            if (c == 'a') accessOnly = true;
+            else if (c == 'm') modifyOnly = true;
+            else if (c == 'c') noCreate = true;
+            else if (c == 't') {
+                std::string value = flag.substr(j + 1);
+                if (value.empty()) {
+                    if (++idx == args.size()) {
+                        return {1, "", "touch: option requires an argument -- 't'"};
+                    }
+                    value = args[idx];
+                }
+                if (!parseTouchStamp(value, stamp)) {
+                    return {1, "", "touch: invalid date format '" + value + "'"};
+                }
+                stampGiven = true;
+                break;
+            } else {
+                return {1, "", "touch: invalid option -- '" + std::string(1, c) + "'"};
+            }
         }
+    }
 
-        int fdSrc = open(src.c_str(), O_RDONLY);
-        if (fdSrc == -1) {
-            return {1, "", "cp: cannot open source file '" + src + "': " + std::string(strerror(errno))};
-        }
+    if (idx == args.size()) {
+        return {1, "", "touch: missing file operand"};
+    }
 
-        int fdDest = open(finalDest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fdDest == -1) {
-            close(fdSrc);
-            return {1, "", "cp: cannot create destination file '" + finalDest + "': " + std::string(strerror(errno))};
+    // -a and -m each leave the other time alone; both together change both
+    struct timespec times[2] = {stamp, stamp};
+    if (accessOnly && !modifyOnly) times[1].tv_nsec = UTIME_OMIT;
+    if (modifyOnly && !accessOnly) times[0].tv_nsec = UTIME_OMIT;
+    bool newFileDone = !stampGiven && !accessOnly && !modifyOnly;
+
+    std::string errors;
+    auto fail = [&errors](const std::string& verb, const std::string& file, int err) {
+        errors += (errors.empty() ? "" : "\n") + ("touch: cannot " + verb + " '" + file + "': " + strerror(err));
+    };
+
+    DirectoryCursor cursor;
+    for (const std::string& file : sortedForCursor(std::vector<std::string>(args.begin() + idx, args.end()))) {
+        std::string leaf, error;
+        int parentFd = cursor.parentOf(file, leaf, error);
+        if (parentFd == -1) {
+            if (!noCreate) {
+                errors += (errors.empty() ? "" : "\n") + ("touch: cannot touch '" + file + "': " + error);
+            }
+            continue;
         }
 
-        char buffer[1024];
-        ssize_t bytesRead;
-        while ((bytesRead = read(fdSrc, buffer, sizeof(buffer))) > 0) {
-            if (write(fdDest, buffer, bytesRead) != bytesRead) {
-                close(fdSrc);
-                close(fdDest);
-                return {1, "", "cp: write error on '" + finalDest + "': " + std::string(strerror(errno))};
+        if (!noCreate) {
+            int fd = openat(parentFd, leaf.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_NOCTTY | O_CLOEXEC, 0644);
+            if (fd != -1) {
+                if (!newFileDone && futimens(fd, times) == -1) {
+                    fail("touch", file, errno);
+                }
+                close(fd);
+                continue;
+            }
+            if (errno != EEXIST) {
+                fail("create file", file, errno);
+                continue;
             }
         }
 
-        if (bytesRead == -1) {
-            close(fdSrc);
-            close(fdDest);
-            return {1, "", "cp: read error on '" + src + "': " + std::string(strerror(errno))};
+        if (utimensat(parentFd, leaf.c_str(), times, 0) == -1 && !(noCreate && errno == ENOENT)) {
+            fail("touch", file, errno);
         }
-
-        close(fdSrc);
-        close(fdDest);
     }
 
-    return {0, "", ""};
+    return {errors.empty() ? 0 : 1, "", errors};
 }
 
 /**
- * @brief Change the owner of a file.
- * @param args Username and file path
- * @return Status code, empty output on success or an error message on failure
+ * @brief Write all of data to fd, resuming after short writes
+ * @return False on a write error (errno is set)
  */
-CommandResult Commands::chownCommand(const std::vector<std::string>& args) {
-    if (args.empty()) {
-        return {1, "", "chown: missing arguments"};    
+static bool writeFully(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
     }
+    return true;
+}
 
-    if (args.size() < 2) {
-        return {1, "", "chown: missing operand"};    
-    }
+/**
+ * How cp treats each file (see cpCommand)
+ */
+struct CopyOptions {
+    bool recursive = false;
+    bool update = false;        // skip unchanged files, rewrite only changed blocks
+    bool checksum = false;      // with update: compare contents rather than size and mtime
+};
 
-    std::string username = args[0];
-    std::string file = args[1];
+// Changed files at least this large are compared block by block
+static const off_t DELTA_MIN_SIZE = 1 << 20;
+static const size_t DELTA_BLOCK = 64 << 10;
 
-    struct passwd* pw = getpwnam(username.c_str());
-    if (!pw) {
-        return {1, "", "chown: no such user found"};
+/**
+ * @brief xxh64 of a file from its start; the offset is left at the end
+ * @return The digest, or an empty string on a read error
+ */
+static std::string hashFile(int fd) {
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        return "";
     }
-    uid_t newOwner = pw->pw_uid;
-
-    for (int i = 1; i < args.size(); ++i) {
-        const std::string& file = args[i];
+    XxHash64 hash;
+    FileReader reader(fd);
+    bool ok = reader.forEachChunk([&hash](const char* data, size_t size) {
+        hash.update(data, size);
+        return true;
+    });
+    return ok ? hash.hexDigest() : "";
+}
 
-        struct stat st;
-        if (stat(file.c_str(), &st) == -1) {
-            return {1, "", "chown: cannot access '" + file + "': " + std::string(strerror(errno))};
+/**
+ * @brief Make dest the same as src by rewriting only the DELTA_BLOCK
+ *        blocks that differ; what lies past the end of dest is appended
+ * @param destSize Current size of dest
+ * @return False on a read or write error (errno is set, and writeFailed
+ *         tells which)
+ */
+static bool deltaCopy(int srcFd, int destFd, off_t srcSize, off_t destSize, bool& writeFailed) {
+    std::unique_ptr<char[]> old(new char[DELTA_BLOCK]);
+    off_t offset = 0;
+    writeFailed = false;
+
+    FileReader reader(srcFd);
+    bool ok = reader.forEachChunk([&](const char* data, size_t size) {
+        for (size_t done = 0; done < size && !writeFailed; ) {
+            size_t block = std::min(size - done, DELTA_BLOCK);
+            off_t at = offset + done;
+
+            bool differs = at >= destSize;
+            if (!differs) {
+                ssize_t n;
+                while ((n = pread(destFd, old.get(), block, at)) == -1 && errno == EINTR) {}
+                differs = n != static_cast<ssize_t>(block) || memcmp(old.get(), data + done, block) != 0;
+            }
+            if (differs) {
+                for (size_t written = 0; written < block; ) {
+                    ssize_t n = pwrite(destFd, data + done + written, block - written, at + written);
+                    if (n == -1 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        writeFailed = true;
+                        break;
+                    }
+                    written += n;
+                }
+            }
+            done += block;
         }
+        offset += size;
+        return !writeFailed;
+    });
 
-        if (chown(file.c_str(), newOwner, -1) == -1) {
-            return {1, "", "chown: failed to change owner of '" + file + "': " + std::string(strerror(errno))};
-        }
+    if (ok && !writeFailed && ftruncate(destFd, srcSize) == -1) {
+        writeFailed = true;
     }
-
-    return {0, "", ""};
+    return ok && !writeFailed;
 }
 
 /**
- * @brief Search for a pattern in one or more files using regex
- * @param args The (regex) pattern, the file(s) to search in, and optional flags:
- *        - "-i"  Perform case-insensitive matching
- *        - "-n"  Prefix each matching line with its line number
- *        - "-v"  Select non-matching lines
- *        - "-w"  Match whole words only
- *        - "-c"  Print only the count of matching lines
- *        - "-o"  Print only the matching substring(s) instead of entire lines
- *        - "-m <num>"  Stop after <num> matches
- * @return Status code and matched output text, or an error message on failure
+ * @brief Copy one regular file. With update, a destination of the same
+ *        size and mtime (or, with checksum, the same xxh64) is left alone,
+ *        a large changed one gets only its differing blocks rewritten, and
+ *        the copy takes the source's times so the next run can skip it.
+ * @param srcDirfd, srcName Where the source is
+ * @return An error message, or an empty string on success
  */
-CommandResult Commands::grepCommand(const std::vector<std::string>& args) {
-    /**
-     * TODO: Implement additional flags and support flag combinations
-     */
-
-    if (args.size() < 2) {
-        return {1, "", "grep: missing arguments"};
+static std::string copyFile(int srcDirfd, const char* srcName, const std::string& srcPath, int cwdFd,
+                            const std::string& destPath, const CopyOptions& options) {
+    int srcFd = openat(srcDirfd, srcName, O_RDONLY | O_CLOEXEC);
+    if (srcFd == -1) {
+        return "cp: cannot open source file '" + srcPath + "': " + strerror(errno);
     }
-
-    bool opt_i = false;
-    bool opt_n = false;
-    bool opt_v = false;
-    bool opt_w = false;
-    bool opt_c = false;
-    bool opt_o = false;
-    int  opt_m = -1;
-
-    int idx = 0;
-    int flagCount = 0;
-
-    while (idx < args.size() && args[idx][0] == '-') {
-        if (++flagCount > 1) {
-            return {1, "", "grep: only one flag can be used at a time"};
+    struct stat src;
+    fstat(srcFd, &src);
+
+    int destFd = -1;
+    struct stat dest;
+    bool delta = false;
+
+    if (options.update && (destFd = openat(cwdFd, destPath.c_str(), O_RDWR | O_CLOEXEC)) != -1) {
+        fstat(destFd, &dest);
+        if (S_ISREG(dest.st_mode) && dest.st_size == src.st_size) {
+            bool same;
+            if (options.checksum) {
+                std::string digest = hashFile(srcFd);
+                same = !digest.empty() && digest == hashFile(destFd);
+                lseek(srcFd, 0, SEEK_SET);
+            } else {
+                same = dest.st_mtim.tv_sec == src.st_mtim.tv_sec && dest.st_mtim.tv_nsec == src.st_mtim.tv_nsec;
+            }
+            if (same) {
+                close(srcFd);
+                close(destFd);
+                return "";
+            }
         }
-
-        const std::string& flag = args[idx];
-
-        if (flag == "-i") opt_i = true;
-        else if (flag == "-n") opt_n = true;
-        else if (flag == "-v") opt_v = true;
-        else if (flag == "-w") opt_w = true;
-        else if (flag == "-c") opt_c = true;
-        else if (flag == "-o") opt_o = true;
-        else if (flag == "-m") {
-            if (idx + 1 >= args.size())
-                return {1, "", "grep: missing argument for -m"};
-            opt_m = std::stoi(args[++idx]);
+        delta = S_ISREG(dest.st_mode) && src.st_size >= DELTA_MIN_SIZE && dest.st_size > 0;
+        if (!delta) {
+            close(destFd);
+            destFd = -1;
         }
-        else break;
-
-        ++idx;
     }
 
-    if (idx >= args.size()) {
-        return {1, "", "grep: missing pattern"};
+    if (destFd == -1) {
+        destFd = openat(cwdFd, destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, src.st_mode & 07777);
+        if (destFd == -1) {
+            int err = errno;
+            close(srcFd);
+            return "cp: cannot create destination file '" + destPath + "': " + strerror(err);
+        }
     }
 
-    std::string pattern = args[idx++];
-
-    if (idx >= args.size()) {
-        return {1, "", "grep: missing file operand"};
-    }
-    
-    std::regex_constants::syntax_option_type flags;
-    if (opt_i) {
-        flags = std::regex_constants::ECMAScript | std::regex_constants::icase;
+    bool writeFailed = false;
+    bool ok;
+    if (delta) {
+        ok = deltaCopy(srcFd, destFd, src.st_size, dest.st_size, writeFailed);
     } else {
-        flags = std::regex_constants::ECMAScript;
+        FileReader reader(srcFd);
+        ok = reader.forEachChunk([&](const char* data, size_t size) {
+            writeFailed = !writeFully(destFd, data, size);
+            return !writeFailed;
+        });
     }
+    int err = errno;
 
-    if (opt_w) pattern = "\\b" + pattern + "\\b";
-
-    std::regex re;
-    try {
-        re = std::regex(pattern, flags);
-    } catch (...) {
-        return {1, "", "grep: invalid regex"};
+    if (ok && !writeFailed && options.update) {
+        const struct timespec times[2] = {src.st_atim, src.st_mtim};
+        futimens(destFd, times);
     }
+    close(srcFd);
+    close(destFd);
 
-    bool multipleFiles = (args.size() - idx) > 1;
-
-    int totalMatches = 0;
-    std::string out;
+    if (writeFailed || !ok) {
+        return (writeFailed ? "cp: write error on '" + destPath : "cp: read error on '" + srcPath) +
+               "': " + strerror(err);
+    }
+    return "";
+}
 
-    for (int i = idx; i < args.size(); ++i) {
+/**
+ * @brief Copy a symbolic link found below a directory being copied, as a
+ *        link; with update, one that already points the same way is kept
+ */
+static std::string copyLink(int srcDirfd, const char* srcName, const std::string& srcPath, int cwdFd,
+                            const std::string& destPath, const CopyOptions& options) {
+    char target[PATH_MAX];
+    ssize_t n = readlinkat(srcDirfd, srcName, target, sizeof(target) - 1);
+    if (n == -1) {
+        return "cp: cannot read symbolic link '" + srcPath + "': " + strerror(errno);
+    }
+    target[n] = '\0';
 
-        const std::string& file = args[i];
+    char existing[PATH_MAX];
+    ssize_t m = readlinkat(cwdFd, destPath.c_str(), existing, sizeof(existing) - 1);
+    if (options.update && m == n && memcmp(existing, target, n) == 0) {
+        return "";
+    }
+    if (m != -1) {
+        unlinkat(cwdFd, destPath.c_str(), 0);
+    }
+    if (symlinkat(target, cwdFd, destPath.c_str()) == -1) {
+        return "cp: cannot create symbolic link '" + destPath + "': " + strerror(errno);
+    }
+    return "";
+}
 
-        int fd = open(file.c_str(), O_RDONLY);
-        if (fd == -1) {
-            return {1, "", "grep: cannot open file '" + file + "'"};
+/**
+ * @brief Copy a directory tree: directories are created as the walk reaches
+ *        them, and files are copied by the walker's threads as they are found
+ * @param errors Receives an error message for each entry that failed
+ */
+static void copyTree(const std::string& srcRoot, const std::string& destRoot, const CopyOptions& options,
+                     std::vector<std::string>& errors) {
+    const int cwdFd = ExecContext::current().dirfd();
+    std::mutex mutex;
+    auto report = [&](std::string error) {
+        if (!error.empty()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            errors.push_back(std::move(error));
+        }
+    };
+
+    // The copy must not be copied into itself, as in "cp -r a a/b"
+    struct stat destRootInfo = {};
+    bool destRootKnown = false;
+
+    // Directories get their source's mode (less the umask), but stay
+    // writable by their owner until the files in them have been copied
+    std::vector<std::pair<std::string, mode_t>> restrictLater;
+
+    TreeWalker walker;
+    std::string walkError;
+    walker.walk({srcRoot}, [&](const WalkEntry& entry) {
+        std::string rel = entry.path.substr(std::min(srcRoot.size(), entry.path.size()));
+        if (!rel.empty() && rel[0] != '/') {
+            rel.insert(0, "/");
+        }
+        std::string destPath = destRoot + rel;
+
+        if (entry.type == DT_DIR) {
+            struct stat st;
+            if (destRootKnown && fstatat(entry.dirfd, entry.name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                st.st_dev == destRootInfo.st_dev && st.st_ino == destRootInfo.st_ino) {
+                report("cp: cannot copy a directory, '" + srcRoot + "', into itself, '" + destRoot + "'");
+                return false;
+            }
+            mode_t mode = fstatat(entry.dirfd, entry.name, &st, 0) == 0 ? st.st_mode & 07777 : 0755;
+            if (mkdirat(cwdFd, destPath.c_str(), mode | S_IRWXU) == 0) {
+                if ((mode & S_IRWXU) != S_IRWXU) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    restrictLater.emplace_back(destPath, mode);
+                }
+            } else if (!(errno == EEXIST && fstatat(cwdFd, destPath.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode))) {
+                report("cp: cannot create directory '" + destPath + "': " + strerror(errno == EEXIST ? ENOTDIR : errno));
+                return false;
+            }
+            if (entry.depth == 0) {
+                destRootKnown = fstatat(cwdFd, destPath.c_str(), &destRootInfo, 0) == 0;
+            }
+            return true;
         }
 
-        char buffer[1024];
-        ssize_t bytes;
-        std::string lineBuffer;
-        int lineNumber = 1;
+        if (entry.type == DT_REG) {
+            report(copyFile(entry.dirfd, entry.name, entry.path, cwdFd, destPath, options));
+        } else if (entry.type == DT_LNK) {
+            report(copyLink(entry.dirfd, entry.name, entry.path, cwdFd, destPath, options));
+        } else {
+            report("cp: omitting special file '" + entry.path + "'");
+        }
+        return false;
+    }, walkError);
 
-        while ((bytes = read(fd, buffer, sizeof(buffer))) > 0) {
-            lineBuffer.append(buffer, bytes);
+    if (!walkError.empty()) {
+        report("cp: " + walkError);
+    }
 
-            size_t newlinePos;
-            while ((newlinePos = lineBuffer.find('\n')) != std::string::npos) {
-                std::string line = lineBuffer.substr(0, newlinePos);
-                lineBuffer.erase(0, newlinePos + 1);
+    // Deepest first, so no directory loses its owner's access before its subdirectories are done
+    std::sort(restrictLater.begin(), restrictLater.end(), [](const std::pair<std::string, mode_t>& a,
+                                                             const std::pair<std::string, mode_t>& b) {
+        return a.first.size() > b.first.size();
+    });
+    for (const auto& dir : restrictLater) {
+        struct stat st;
+        if (fstatat(cwdFd, dir.first.c_str(), &st, 0) == 0) {
+            fchmodat(cwdFd, dir.first.c_str(), st.st_mode & dir.second & 07777, 0);
+        }
+    }
+}
 
-                std::string matchedText;
-                bool matched = matchesPattern(line, re, opt_o, matchedText);
+/**
+ * @brief Copy files, or with -r directory trees, to a destination path.
+ * @param args Optional flags, then source paths and the destination:
+ *        - "-r", "-R"  Copy directories recursively; below them symbolic
+ *          links are copied as links
+ *        - "-u"  Incremental: skip files whose size and mtime match the
+ *          destination, rewrite only the changed blocks of large files, and
+ *          give copies the source's times
+ *        - "--checksum"  With -u, compare contents (xxh64) instead of mtime
+ * @return Status code, empty output on success or error messages on failure
+ * @note Directory trees are walked and copied by TreeWalker's threads.
+ */
+CommandResult Commands::cpCommand(const std::vector<std::string>& args) {
+    CopyOptions options;
+    std::vector<std::string> operands;
+    bool flags = true;
 
-                if (opt_v) {
-                    matched = !matched;
+    for (const std::string& arg : args) {
+        if (flags && arg == "--") {
+            flags = false;
+        } else if (flags && arg == "--checksum") {
+            options.update = options.checksum = true;
+        } else if (flags && arg.size() > 1 && arg[0] == '-' && arg[1] != '-') {
+            for (size_t i = 1; i < arg.size(); ++i) {
+                if (arg[i] == 'r' || arg[i] == 'R') {
+                    options.recursive = true;
+                } else if (arg[i] == 'u') {
+                    options.update = true;
+                } else {
+                    return {1, "", std::string("cp: invalid option -- '") + arg[i] + "'"};
                 }
+            }
+        } else if (flags && arg.size() > 2 && arg[0] == '-') {
+            return {1, "", "cp: unrecognized option '" + arg + "'"};
+        } else {
+            operands.push_back(arg);
+        }
+    }
 
-                if (matched) {
-                    ++totalMatches;
+    if (operands.empty()) {
+        return {1, "", "cp: missing operand"};
+    }
 
-                    if (opt_m != -1 && totalMatches > opt_m) {
-                        close(fd);
-                        if (opt_c){
-                            return {0, std::to_string(totalMatches), ""};
-                        }
+    if (operands.size() == 1) {
+        return {1, "", "cp: missing destination file operand after '" + operands[0] + "'"};
+    }
 
-                        if (!out.empty() && out.back() == '\n') {
-                            out.pop_back();
-                        }
+    std::string dest = operands.back();
+    const int cwdFd = ExecContext::current().dirfd();
 
-                        return {0, out, ""};
-                    }
+    struct stat stDest;
+    bool destIsDir = fstatat(cwdFd, dest.c_str(), &stDest, 0) == 0 && S_ISDIR(stDest.st_mode);
 
-                    if (!opt_c) {
-                        if (multipleFiles) {
-                            out += file + ":";
-                        }
+    // If multiple sources, dest MUST be a directory
+    size_t numSources = operands.size() - 1;
+    if (numSources > 1 && !destIsDir) {
+        return {1, "", "cp: target '" + dest + "' is not a directory"};
+    }
 
-                        if (opt_n) {
-                            out += std::to_string(lineNumber) + ":";
-                        }
+    std::vector<std::string> errors;
 
-                        out += matchedText + "\n";
-                    }
-                }
+    for (size_t i = 0; i < numSources && !Cancellation::requested(); ++i) {
+        std::string src = operands[i];
 
-                ++lineNumber;
-            }
+        std::string finalDest = dest;
+        if (destIsDir) {
+            std::string trimmed = src.substr(0, src.find_last_not_of('/') + 1);
+            size_t pos = trimmed.find_last_of('/');
+            std::string filename = (pos == std::string::npos) ? trimmed : trimmed.substr(pos + 1);
+            finalDest = dest + "/" + filename;
         }
 
-        // Last line if it's not newline
-        if (!lineBuffer.empty()) {
-            std::string matchedText;
-            bool matched = matchesPattern(lineBuffer, re, opt_o, matchedText);
-
-            if (opt_v) {
-                matched = !matched;
+        struct stat stSrc;
+        if (fstatat(cwdFd, src.c_str(), &stSrc, 0) == 0 && S_ISDIR(stSrc.st_mode)) {
+            if (!options.recursive) {
+                errors.push_back("cp: omitting directory '" + src + "'");
+            } else {
+                copyTree(src, finalDest, options, errors);
             }
+            continue;
+        }
 
-            if (matched) {
-                ++totalMatches;
-                if (opt_m != -1 && totalMatches > opt_m) {
-                    close(fd);
-                    if (opt_c) {
-                        return {0, std::to_string(totalMatches), ""};
-                    }
-
-                    if (!out.empty() && out.back() == '\n') {
-                        out.pop_back();
-                    }
+        std::string error = copyFile(cwdFd, src.c_str(), src, cwdFd, finalDest, options);
+        if (!error.empty()) {
+            errors.push_back(std::move(error));
+        }
+    }
 
-                    return {0, out, ""};
-                }
+    std::sort(errors.begin(), errors.end());
+    std::string out;
+    for (const std::string& error : errors) {
+        out += (out.empty() ? "" : "\n") + error;
+    }
+    return {errors.empty() ? 0 : 1, "", out};
+}
 
-                if (!opt_c) {
-                    if (multipleFiles) {
-                        out += file + ":";
-                    }
+/**
+ * @brief Apply change to each operand and, when recursive, to everything
+ *        below the directories among them, on a parallel walker
+ * @param name Command name, for walker errors
+ * @param change Returns an error message, or an empty string; runs concurrently
+ * @return Every error message, one per line, sorted by path
+ */
+static std::string forEachTarget(const std::string& name, const std::vector<std::string>& paths, bool recursive,
+                                 const std::function<std::string(const WalkEntry&)>& change) {
+    std::vector<std::string> errors;
+    std::mutex mutex;
+
+    auto report = [&](std::string error) {
+        if (!error.empty()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            errors.push_back(std::move(error));
+        }
+    };
 
-                    if (opt_n) {
-                        out += std::to_string(lineNumber) + ":";
-                    }
+    if (!recursive) {
+        const int cwdFd = ExecContext::current().dirfd();
+        const std::shared_ptr<void> noData;
+        for (const std::string& path : paths) {
+            report(change(WalkEntry{cwdFd, path.c_str(), DT_UNKNOWN, path, 0, noData}));
+        }
+    } else {
+        TreeWalker walker;
+        std::string walkError;
+        walker.walk(paths, [&](const WalkEntry& entry) {
+            report(change(entry));
+            return entry.type == DT_DIR;
+        }, walkError);
+        if (!walkError.empty()) {
+            report(name + ": " + walkError);
+        }
+    }
 
-                    out += matchedText + "\n";
-                }
-            }
+    std::sort(errors.begin(), errors.end());
+    std::string out;
+    for (const std::string& error : errors) {
+        out += (out.empty() ? "" : "\n") + error;
+    }
+    return out;
+}
+
+/**
+ * @brief Change the owner and/or group of files, optionally recursively
+ * @param args Optional "-R", then OWNER, OWNER:GROUP or :GROUP (names or
+ *        numeric ids), then one or more paths
+ * @return Status code, empty output on success or error messages on failure
+ * @note Entries that already have the requested owner and group are not
+ *       touched. Below the operands symbolic links themselves are changed
+ *       and not followed, as with chown -R.
+ */
+CommandResult Commands::chownCommand(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return {1, "", "chown: missing arguments"};    
+    }
+
+    bool recursive = false;
+    size_t idx = 0;
+    for (; idx < args.size() && args[idx].size() > 1 && args[idx][0] == '-'; ++idx) {
+        if (args[idx] != "-R") {
+            return {1, "", "chown: invalid option '" + args[idx] + "'"};
+        }
+        recursive = true;
+    }
+
+    if (args.size() - idx < 2) {
+        return {1, "", "chown: missing operand"};    
+    }
+
+    const std::string& spec = args[idx];
+    size_t colon = spec.find(':');
+    std::string username = spec.substr(0, colon);
+    std::string groupname = colon == std::string::npos ? "" : spec.substr(colon + 1);
+
+    auto isNumber = [](const std::string& s) {
+        return !s.empty() && s.find_first_not_of("0123456789") == std::string::npos;
+    };
+
+    uid_t newOwner = -1;
+    gid_t newGroup = -1;
+
+    if (!username.empty()) {
+        struct passwd* pw = getpwnam(username.c_str());
+        if (pw) {
+            newOwner = pw->pw_uid;
+        } else if (isNumber(username)) {
+            newOwner = std::stoul(username);
+        } else {
+            return {1, "", "chown: no such user found"};
+        }
+    }
+    if (!groupname.empty()) {
+        struct group* gr = getgrnam(groupname.c_str());
+        if (gr) {
+            newGroup = gr->gr_gid;
+        } else if (isNumber(groupname)) {
+            newGroup = std::stoul(groupname);
+        } else {
+            return {1, "", "chown: invalid group: '" + groupname + "'"};
+        }
+    }
+
+    std::vector<std::string> paths(args.begin() + idx + 1, args.end());
+
+    std::string errors = forEachTarget("chown", paths, recursive, [&](const WalkEntry& entry) -> std::string {
+        int flags = entry.depth > 0 ? AT_SYMLINK_NOFOLLOW : 0;
+
+        struct stat st;
+        if (fstatat(entry.dirfd, entry.name, &st, flags) == -1) {
+            return "chown: cannot access '" + entry.path + "': " + strerror(errno);
+        }
+        if ((newOwner == uid_t(-1) || st.st_uid == newOwner) && (newGroup == gid_t(-1) || st.st_gid == newGroup)) {
+            return "";
+        }
+        if (fchownat(entry.dirfd, entry.name, newOwner, newGroup, flags) == -1) {
+            return "chown: failed to change owner of '" + entry.path + "': " + strerror(errno);
+        }
+        return "";
+    });
+
+    return {errors.empty() ? 0 : 1, "", errors};
+}
+
+/**
+ * @brief Search for one or more patterns in files. Flags combine freely, also
+ *        when bundled ("-inw").
+ * @param args The pattern, the file(s) to search in, and optional flags:
+ *        - "-i"  Perform case-insensitive matching
+ *        - "-n"  Prefix each matching line with its line number
+ *        - "-v"  Select non-matching lines
+ *        - "-w"  Match whole words only
+ *        - "-c"  Print only the count of matching lines
+ *        - "-o"  Print only the matching substring(s) instead of entire lines
+ *        - "-m <num>"  Stop after <num> matches
+ *        - "-F"  Patterns are fixed strings rather than regexes
+ *        - "-e <pattern>"  Search for <pattern>; may be repeated
+ *        - "-f <file>"  Read patterns from <file>, one per line; may be repeated
+ *        - "-r" / "-R"  Search directories recursively (see grepRecursive)
+ *        - "--include=<glob>", "--exclude=<glob>", "--exclude-dir=<glob>"  Filter recursive searches
+ *        - "--no-ignore"  Do not honour .gitignore/.ignore files in recursive searches
+ * @return Status code and matched output text, or an error message on failure
+ * @note With -e or -f no positional pattern is taken. A line matches if any pattern
+ *       matches it; fixed strings are searched for all at once (see LiteralMatcher).
+ */
+CommandResult Commands::grepCommand(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return {1, "", "grep: missing arguments"};
+    }
+
+    GrepOptions opts;
+    std::vector<std::string> patterns;
+    std::vector<std::string> operands;
+
+    std::string error = parseGrepArgs(args, opts, patterns, operands);
+    if (!error.empty()) {
+        return {1, "", error};
+    }
+    if (operands.empty() && !opts.recursive) {
+        return {1, "", "grep: missing file operand"};
+    }
+
+    std::shared_ptr<const LineMatcher> matcher =
+        LineMatcher::cached(patterns, opts.fixedStrings, opts.ignoreCase, opts.wordMatch, error);
+    if (!matcher) {
+        return {1, "", "grep: " + error};
+    }
+
+    if (opts.recursive) {
+        return grepRecursive(operands, opts, *matcher);
+    }
+
+    bool multipleFiles = operands.size() > 1;
+    const int cwdFd = ExecContext::current().dirfd();
+
+    long totalMatches = 0;
+    OutputBuffer out;
+
+    for (const std::string& file : operands) {
+        int fd = openat(cwdFd, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return {1, "", "grep: cannot open file '" + file + "'"};
         }
 
+        // -m caps the number of matches across all files
+        long remaining = opts.maxCount < 0 ? -1 : opts.maxCount - totalMatches;
+        bool binary = false;
+
+        totalMatches += grepFd(fd, multipleFiles ? file + ":" : "", opts, *matcher, remaining, false, out, binary);
         close(fd);
+
+        if (opts.maxCount >= 0 && totalMatches >= opts.maxCount) {
+            break;
+        }
     }
 
-    if (opt_c) {
+    if (opts.countOnly) {
         return {0, std::to_string(totalMatches), ""};
     }
 
@@ -619,12 +1378,294 @@ CommandResult Commands::grepCommand(const std::vector<std::string>& args) {
         return {1, "", ""};
     }
 
-    return {0, stripTrailingNewline(out), ""};
+    CommandResult result{0, "", ""};
+    out.popNewline();
+    out.moveInto(result);
+    return result;
+}
+
+/**
+ * @brief Parse grep's options and patterns (see grepCommand)
+ * @param operands Receives the file operands
+ * @return An error message, or an empty string on success
+ */
+std::string Commands::parseGrepArgs(const std::vector<std::string>& args, GrepOptions& opts,
+                                    std::vector<std::string>& patterns, std::vector<std::string>& operands) {
+    bool patternsGiven = false;
+
+    // A pattern argument holds one pattern per line
+    auto addPatterns = [&](const std::string& text) {
+        size_t pos = 0;
+        while (true) {
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string::npos) {
+                patterns.push_back(text.substr(pos));
+                break;
+            }
+            patterns.push_back(text.substr(pos, nl - pos));
+            pos = nl + 1;
+        }
+        patternsGiven = true;
+    };
+
+    size_t idx = 0;
+
+    while (idx < args.size() && args[idx].size() > 1 && args[idx][0] == '-') {
+        const std::string& flag = args[idx++];
+
+        if (flag == "--") {
+            break;
+        }
+        if (flag.rfind("--include=", 0) == 0) {
+            opts.includes.push_back(GlobPattern::cached(flag.substr(10)));
+            continue;
+        }
+        if (flag.rfind("--exclude=", 0) == 0) {
+            opts.excludes.push_back(GlobPattern::cached(flag.substr(10)));
+            continue;
+        }
+        if (flag.rfind("--exclude-dir=", 0) == 0) {
+            opts.excludeDirs.push_back(GlobPattern::cached(flag.substr(14)));
+            continue;
+        }
+        if (flag == "--no-ignore") {
+            opts.useIgnoreFiles = false;
+            continue;
+        }
+        if (flag[1] == '-') {
+            return "grep: unrecognized option '" + flag + "'";
+        }
+
+        for (size_t i = 1; i < flag.size(); ++i) {
+            char c = flag[i];
+
+            if (c == 'm' || c == 'e' || c == 'f') {
+                // The value is the rest of this word or the next argument
+                std::string value;
+                if (i + 1 < flag.size()) {
+                    value = flag.substr(i + 1);
+                } else if (idx < args.size()) {
+                    value = args[idx++];
+                } else {
+                    return std::string("grep: missing argument for -") + c;
+                }
+
+                if (c == 'm') {
+                    char* endp = nullptr;
+                    errno = 0;
+                    long count = strtol(value.c_str(), &endp, 10);
+                    if (value.empty() || *endp != '\0' || errno != 0 || count < 0) {
+                        return "grep: invalid max count '" + value + "'";
+                    }
+                    opts.maxCount = count;
+                } else if (c == 'e') {
+                    addPatterns(value);
+                } else {
+                    int fd = openat(ExecContext::current().dirfd(), value.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (fd == -1) {
+                        return "grep: cannot open file '" + value + "'";
+                    }
+                    std::string text;
+                    FileReader reader(fd);
+                    reader.forEachChunk([&](const char* data, size_t size) {
+                        text.append(data, size);
+                        return true;
+                    });
+                    close(fd);
+
+                    // One pattern per line; an empty file supplies none
+                    if (!text.empty()) {
+                        if (text.back() == '\n') text.pop_back();
+                        addPatterns(text);
+                    }
+                    patternsGiven = true;
+                }
+                break;
+            }
+
+            switch (c) {
+                case 'i': opts.ignoreCase = true; break;
+                case 'n': opts.lineNumbers = true; break;
+                case 'v': opts.invert = true; break;
+                case 'w': opts.wordMatch = true; break;
+                case 'c': opts.countOnly = true; break;
+                case 'o': opts.onlyMatching = true; break;
+                case 'F': opts.fixedStrings = true; break;
+                case 'r':
+                case 'R': opts.recursive = true; break;
+                default:
+                    return std::string("grep: invalid option -- '") + c + "'";
+            }
+        }
+    }
+
+    if (!patternsGiven) {
+        if (idx >= args.size()) {
+            return "grep: missing pattern";
+        }
+        addPatterns(args[idx++]);
+    }
+
+    operands.assign(args.begin() + idx, args.end());
+    return "";
+}
+
+
+/**
+ * @brief Search directory trees on a parallel walker. Each file is searched on
+ *        the worker thread that discovers it; per-file results are then sorted
+ *        by path so output does not depend on thread scheduling.
+ * @param roots Files or directories to search ("." when empty)
+ * @param opts Parsed grep options
+ * @param matcher Compiled patterns
+ * @return Status code and matched output text, or an error message on failure
+ * @note Files whose first block contains a NUL byte are treated as binary and skipped.
+ *       Symlinks below the roots are not followed.
+ */
+CommandResult Commands::grepRecursive(std::vector<std::string> roots, const GrepOptions& opts,
+                                      const LineMatcher& matcher) {
+    bool implicitRoot = roots.empty();
+    if (implicitRoot) {
+        roots.push_back(".");
+    }
+
+    // Where each file's lines sit in the spool
+    struct FileResult {
+        std::string path;
+        size_t offset;
+        size_t size;
+    };
+
+    // Files finish in any order, so their lines are appended to one spool,
+    // which spills past SHELL_OUTPUT_MB like any output, and put in path
+    // order once the walk is done
+    std::mutex resultsMutex;
+    std::vector<FileResult> results;
+    OutputBuffer spool(OutputBuffer::currentLimit(), OutputBuffer::Charge::None);
+    std::atomic<long> totalMatches{0};
+
+    auto matchesAny = [](const std::vector<std::shared_ptr<const GlobPattern>>& globs, const char* name) {
+        for (const auto& glob : globs) {
+            if (glob->matches(name, strlen(name))) return true;
+        }
+        return false;
+    };
+
+    TreeWalker walker;
+    if (opts.useIgnoreFiles) {
+        walker.setEnterHook([](int dirfd, const std::string& path, const std::shared_ptr<void>& parent) {
+            return std::static_pointer_cast<void>(
+                IgnoreRules::load(dirfd, path, std::static_pointer_cast<IgnoreRules>(parent)));
+        });
+    }
+
+    auto visit = [&](const WalkEntry& entry) {
+        auto rules = std::static_pointer_cast<IgnoreRules>(entry.dirData);
+
+        if (entry.type == DT_DIR) {
+            if (entry.depth == 0) {
+                return true;
+            }
+            if (opts.useIgnoreFiles && strcmp(entry.name, ".git") == 0) {
+                return false;
+            }
+            if (matchesAny(opts.excludeDirs, entry.name)) {
+                return false;
+            }
+            return !(rules && rules->ignored(entry.path, true));
+        }
+
+        if (entry.depth > 0) {
+            if (entry.type != DT_REG) {
+                return false;
+            }
+            if (rules && rules->ignored(entry.path, false)) {
+                return false;
+            }
+        }
+
+        if (!opts.includes.empty() && !matchesAny(opts.includes, entry.name)) {
+            return false;
+        }
+        if (matchesAny(opts.excludes, entry.name)) {
+            return false;
+        }
+
+        int fd = openat(entry.dirfd, entry.name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+
+        std::string label = entry.path;
+        if (implicitRoot && label.compare(0, 2, "./") == 0) {
+            label.erase(0, 2);
+        }
+
+        OutputBuffer lines;
+        bool binary = false;
+        long matches = grepFd(fd, opts.countOnly ? "" : label + ":", opts, matcher, opts.maxCount, true, lines, binary);
+        close(fd);
+
+        if (binary) {
+            return false;
+        }
+
+        if (opts.countOnly) {
+            lines.truncate(0);
+            lines.append(label + ":" + std::to_string(matches) + "\n");
+        }
+
+        totalMatches += matches;
+
+        if (!lines.empty()) {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            results.push_back({std::move(label), spool.size(), lines.size()});
+            lines.forEachChunk([&spool](const char* data, size_t size) { return spool.append(data, size); });
+        }
+        return false;
+    };
+
+    std::string error;
+    walker.walk(roots, visit, error);
+
+    std::sort(results.begin(), results.end(), [](const FileResult& a, const FileResult& b) {
+        return TreeWalker::pathLess(a.path, b.path);
+    });
+
+    // Each file's lines were charged as they were found
+    OutputBuffer out(OutputBuffer::currentLimit(), OutputBuffer::Charge::None);
+    std::string chunk;
+    for (const FileResult& result : results) {
+        for (size_t done = 0; done < result.size; ) {
+            chunk.clear();
+            size_t n = spool.read(result.offset + done, std::min(result.size - done, OutputBuffer::WRITE_BLOCK), chunk);
+            if (n == 0) {
+                error += (error.empty() ? "" : "\n") + std::string("cannot read back the matches in '") + result.path + "'";
+                break;
+            }
+            out.append(chunk);
+            done += n;
+        }
+    }
+
+    // Files the walk could not read are reported even when others matched
+    if (!error.empty()) {
+        error = "grep: " + error;
+    }
+    if (totalMatches == 0 && !opts.countOnly) {
+        return {1, "", error};
+    }
+
+    CommandResult result{0, "", error};
+    out.popNewline();
+    out.moveInto(result);
+    return result;
 }
 
 
 /**
- * @brief Exit the shell. Terminates the shell program immediately.
+ * @brief Exit the shell. Terminates the shell program immediately; in a
+ *        server session, ends only that session once the reply is sent.
  * @param args Must be empty
  * @return Status code indicating shell termination.
  */
@@ -633,7 +1674,14 @@ CommandResult Commands::quitCommand(const std::vector<std::string>& args) {
         return {1, "", "quit: this command takes no arguments"};
     }
 
-    std::cout << "[Shell Terminated]\n";
+    ExecContext& context = ExecContext::current();
+    if (!context.ownsTerminal()) {
+        context.requestExit();
+        return {0, "", ""};
+    }
+
+    OutputWriter::out().write("[Shell Terminated]\n");
+    OutputWriter::out().flush();
     std::exit(0);
 }
 
@@ -647,8 +1695,7 @@ CommandResult Commands::clrCommand(const std::vector<std::string>& args) {
         return {1, "", "clr: takes no arguments"};
     }
 
-    // __NO_NL__ is a marker to notify the shell NOT to print out a newline
-    return {0, "__NO_NL__\e[H\e[J", ""};
+    return {0, "\e[H\e[J", "", false};
 }
 
 /**
@@ -661,12 +1708,7 @@ CommandResult Commands::pwdCommand(const std::vector<std::string>& args) {
         return {1, "", "pwd: this command takes no arguments"};
     }
 
-    char cwd[PATH_MAX];
-    if (!getcwd(cwd, sizeof(cwd))) {
-        return {1, "", "pwd: failed to get current directory"};
-    }
-
-    return {0, std::string(cwd), ""};
+    return {0, ExecContext::current().cwd(), ""};
 }
 
 /**
@@ -681,13 +1723,71 @@ CommandResult Commands::environCommand(const std::vector<std::string>& args) {
 
     std::string out;
 
-    for (char **env = environ; *env != nullptr; ++env) {
+    for (char* const* env = ExecContext::current().variables().envp(); *env != nullptr; ++env) {
         out += std::string(*env) + "\n";
     }
 
     return {0, stripTrailingNewline(out), ""};
 }
 
+/**
+ * @brief Mark variables for export to spawned programs, optionally assigning them
+ * @param args
+ *        - zero arguments: list exported variables
+ *        - "NAME=value": assign and export
+ *        - "NAME": export an existing (or new, empty) variable
+ * @return Status code, the export list when called without arguments, or an error message
+ */
+CommandResult Commands::exportCommand(const std::vector<std::string>& args) {
+    ShellVariables& vars = ExecContext::current().variables();
+
+    if (args.empty()) {
+        std::string out;
+        for (const auto& entry : vars.names()) {
+            if (entry.second) {
+                out += "export " + entry.first + "=\"" + vars.value(entry.first) + "\"\n";
+            }
+        }
+        return {0, stripTrailingNewline(out), ""};
+    }
+
+    for (const std::string& arg : args) {
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+
+        if (!ShellVariables::isValidName(name)) {
+            return {1, "", "export: '" + arg + "': not a valid identifier"};
+        }
+
+        if (eq != std::string::npos) {
+            vars.set(name, arg.substr(eq + 1));
+        }
+        vars.exportVar(name);
+    }
+
+    return {0, "", ""};
+}
+
+/**
+ * @brief Remove shell variables (and their exported environment entries)
+ * @param args One or more variable names
+ * @return Status code, empty output on success or error message on failure
+ */
+CommandResult Commands::unsetCommand(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return {1, "", "unset: missing variable name"};
+    }
+
+    for (const std::string& name : args) {
+        if (!ShellVariables::isValidName(name)) {
+            return {1, "", "unset: '" + name + "': not a valid identifier"};
+        }
+        ExecContext::current().variables().unset(name);
+    }
+
+    return {0, "", ""};
+}
+
 /**
  * @brief Reads and prints the contents of each file provided in order.
  * @param args List of file paths to print
@@ -698,390 +1798,2669 @@ CommandResult Commands::catCommand(const std::vector<std::string>& args) {
         return {1, "", "cat: missing file operand"};
     }
 
-    std::string out;
-    const size_t bufferSize = 4096; 
-    char buffer[bufferSize];
+    OutputBuffer out;
+    const int cwdFd = ExecContext::current().dirfd();
 
     for (const std::string& filename : args) {
-        int fd = open(filename.c_str(), O_RDONLY); 
+        int fd = openat(cwdFd, filename.c_str(), O_RDONLY | O_CLOEXEC);
         if (fd == -1) {
             return {1, "", "cat: cannot open " + filename + ": " + strerror(errno)};
         }
 
-        ssize_t bytesRead;
-        while ((bytesRead = read(fd, buffer, bufferSize)) > 0) { 
-            out.append(buffer, bytesRead);  
-        }
+        FileReader reader(fd);
+        bool ok = reader.forEachChunk([&out](const char* data, size_t size) {
+            return out.append(data, size);
+        });
 
-        if (bytesRead == -1) {
-            return {1, "", "cat: error reading " + filename + ": " + strerror(errno)};
+        if (!ok && !out.failed()) {
+            int err = errno;
+            close(fd);
+            return {1, "", "cat: error reading " + filename + ": " + strerror(err)};
         }
 
-        out.append("\n");  
+        out.append("\n", 1);
 
         close(fd);
+        if (out.failed()) {
+            break;
+        }
     }
 
-    return {0, stripTrailingNewline(out), ""};
+    CommandResult result{0, "", ""};
+    out.popNewline();
+    out.moveInto(result);
+    return result;
 }
 
-/**  
- * @brief Count number of lines, words, and characters in a file.
- * @param args List containing exactly one file path and optional files:
- *        "-l" Count lines
- *        "-w" Count words
- *        "-c" Count characters
- * @return Status code, resulting counts on success, error message on failure.
+/**
+ * @brief Parse the shared -n/-c options of head and tail
+ * @param fromStart Set for "+N" counts (tail only)
+ * @return An error message, or an empty string on success
  */
-CommandResult Commands::wcCommand(const std::vector<std::string>& args) {
-    bool countLines = false;
-    bool countWords = false;
-    bool countChars = false;
-    std::vector<std::string> files;
+static std::string parseCountOptions(const std::string& name, const std::vector<std::string>& args,
+                                     long& lines, long& bytes, bool& fromStart, bool* follow,
+                                     std::vector<std::string>& files) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+
+        if (follow && arg == "-f") {
+            *follow = true;
+            continue;
+        }
+        if (arg.size() < 2 || arg[0] != '-' || (arg[1] != 'n' && arg[1] != 'c')) {
+            if (arg.size() > 1 && arg[0] == '-') {
+                return name + ": invalid option -- '" + arg + "'";
+            }
+            files.push_back(arg);
+            continue;
+        }
 
-    for (const std::string& arg : args) {
-        if (arg == "-l") countLines = true;
-        else if (arg == "-w") countWords = true;
-        else if (arg == "-c") countChars = true;
-        else files.push_back(arg);
-    }
+        std::string value = arg.substr(2);
+        if (value.empty()) {
+            if (++i == args.size()) {
+                return name + ": option requires an argument -- '" + arg[1] + "'";
+            }
+            value = args[i];
+        }
 
-    if (!countLines && !countWords && !countChars) {
-        countLines = countWords = countChars = true;
+        fromStart = follow && !value.empty() && value[0] == '+';
+        std::string digits = value.substr(!value.empty() && (value[0] == '+' || value[0] == '-'));
+        if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) {
+            return name + ": invalid number of " + (arg[1] == 'n' ? "lines" : "bytes") + ": '" + value + "'";
+        }
+
+        (arg[1] == 'n' ? lines : bytes) = std::stol(digits);
+        if (arg[1] == 'c') {
+            lines = -1;
+        }
     }
 
+    return "";
+}
+
+/**
+ * @brief Print the first lines or bytes of files, reading no further than needed
+ * @param args Optional "-n N" (default 10) or "-c N", followed by file paths
+ * @return Status code, the leading part of each file, or error message
+ */
+CommandResult Commands::headCommand(const std::vector<std::string>& args) {
+    long lines = 10;
+    long bytes = -1;
+    bool fromStart = false;
+    std::vector<std::string> files;
+
+    std::string error = parseCountOptions("head", args, lines, bytes, fromStart, nullptr, files);
+    if (!error.empty()) {
+        return {1, "", error};
+    }
     if (files.empty()) {
-        return {1, "", "wc: missing file operand"};
+        return {1, "", "head: missing file operand"};
     }
 
-    std::string out;
+    OutputBuffer out;
+    const int cwdFd = ExecContext::current().dirfd();
 
-    for (const std::string& filename : files) {
+    for (const std::string& file : files) {
+        int fd = openat(cwdFd, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return {1, "", "head: cannot open '" + file + "' for reading: " + strerror(errno)};
+        }
 
-        if (isFileEmpty(filename)) {
-            std::string zeroCount = "";
-            if (countLines) zeroCount += "0 ";
-            if (countWords) zeroCount += "0 ";
-            if (countChars) zeroCount += "0 ";
-            zeroCount += filename + "\n";
-            out += zeroCount;
-            continue;
+        if (files.size() > 1) {
+            out.append((out.empty() ? "" : "\n") + std::string("==> ") + file + " <==\n");
         }
 
-        int fd = open(filename.c_str(), O_RDONLY);
-        if (fd == -1) {
-            return {1, "", "wc: cannot open file '" + filename + "': " + strerror(errno)};
+        bool ok = headFd(fd, lines, bytes, out);
+        close(fd);
+
+        if (!ok) {
+            return {1, "", "head: error reading '" + file + "': " + strerror(errno)};
         }
+    }
 
-        size_t lines = 0, words = 0, chars = 0;
-        char buffer[4096];
-        bool inWord = false;
-        ssize_t bytesRead;
-        bool lastCharWasNewline = true;
+    CommandResult result{0, "", ""};
+    out.popNewline();
+    out.moveInto(result);
+    return result;
+}
 
-        while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0) {
-            for (int i = 0; i < bytesRead; ++i) {
-                char c = buffer[i];
-                ++chars;
+/**
+ * @brief Print the last lines or bytes of files, optionally following them
+ * @param args Optional flags followed by file paths:
+ *        - "-n N" last N lines (default 10), "-n +N" from line N onwards
+ *        - "-c N" last N bytes
+ *        - "-f" keep printing data appended to the files, across rotation,
+ *          until interrupted
+ * @return Status code, the trailing part of each file, or error message
+ */
+CommandResult Commands::tailCommand(const std::vector<std::string>& args) {
+    long lines = 10;
+    long bytes = -1;
+    bool fromStart = false;
+    bool follow = false;
+    std::vector<std::string> files;
 
-                if (c == '\n') {
-                    ++lines;
-                    lastCharWasNewline = true;
-                } else {
-                    lastCharWasNewline = false;
-                }
+    std::string error = parseCountOptions("tail", args, lines, bytes, fromStart, &follow, files);
+    if (!error.empty()) {
+        return {1, "", error};
+    }
+    if (files.empty()) {
+        return {1, "", "tail: missing file operand"};
+    }
+    if (follow && !ExecContext::current().ownsTerminal()) {
+        return {1, "", "tail: -f needs the shell's terminal"};
+    }
 
-                if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
-                    inWord = false;
-                } else if (!inWord) {
-                    ++words;
-                    inWord = true;
-                }
-            }
-        }
+    OutputBuffer out;
+    std::vector<off_t> offsets;
+    const int cwdFd = ExecContext::current().dirfd();
 
-        if (!lastCharWasNewline) {
-            ++lines;
+    for (const std::string& file : files) {
+        int fd = openat(cwdFd, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return {1, "", "tail: cannot open '" + file + "' for reading: " + strerror(errno)};
         }
 
-        if (bytesRead == -1) {
-            close(fd);
-            return {1, "", "wc: error reading file '" + filename + "': " + strerror(errno)};
+        if (files.size() > 1) {
+            out.append((out.empty() ? "" : "\n") + std::string("==> ") + file + " <==\n");
         }
 
+        off_t end = 0;
+        bool ok = tailFd(fd, lines, bytes, fromStart, out, end);
         close(fd);
 
-        if (countLines) out += std::to_string(lines) + " ";
-        if (countWords) out += std::to_string(words) + " ";
-        if (countChars) out += std::to_string(chars) + " ";
-        out += filename + "\n";
+        if (!ok) {
+            return {1, "", "tail: error reading '" + file + "': " + strerror(errno)};
+        }
+        offsets.push_back(end);
     }
 
-    return {0, stripTrailingNewline(out), ""};
+    if (!follow) {
+        CommandResult result{0, "", ""};
+        out.popNewline();
+        out.moveInto(result);
+        return result;
+    }
+
+    out.forEachChunk([](const char* data, size_t size) {
+        OutputWriter::out().write(data, size);
+        return true;
+    });
+    OutputWriter::out().flush();
+    return followFiles(files, offsets);
 }
 
 /**
- * @brief Creates a new directory at the specified path.
- * @param args Directory path  
- * @return Status code, empty output on success, error message on failure
+ * @brief Copy the first lines (or bytes, if bytes >= 0) of fd to out
+ * @return False on a read error
  */
-CommandResult Commands::mkdirCommand(const std::vector<std::string>& args) {
-    if (args.empty()) {
-        return {1, "", "mkdir: missing directory argument"};
+bool Commands::headFd(int fd, long lines, long bytes, OutputBuffer& out) {
+    long remaining = bytes >= 0 ? bytes : lines;
+    if (remaining <= 0) {
+        return true;
     }
 
-    std::string out, err;
+    FileReader reader(fd);
+    return reader.forEachChunk([&](const char* data, size_t size) {
+        if (bytes >= 0) {
+            size_t take = std::min<long>(size, remaining);
+            out.append(data, take);
+            remaining -= take;
+            return remaining > 0;
+        }
 
-    for (const std::string& dir : args) {
-        if (mkdir(dir.c_str(), 0755) == -1) { 
-            return {1, "", "mkdir: cannot create directory '" + dir + "': " + strerror(errno)};
+        const char* p = data;
+        const char* end = data + size;
+        while (remaining > 0) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!nl) {
+                p = end;
+                break;
+            }
+            p = nl + 1;
+            --remaining;
         }
-    }
+        out.append(data, p - data);
+        return remaining > 0;
+    });
+}
 
-    return {0, out, ""};
+namespace {
+    /**
+     * The last lines (or bytes) of input read front to back. What can no
+     * longer be part of them is dropped each time the text doubles, so
+     * only about twice the tail is held, however long the input.
+     */
+    class TailWindow {
+    public:
+        TailWindow(long lines, long bytes) : lines(lines), bytes(bytes) {}
+
+        void add(const char* data, size_t size) {
+            kept.append(data, size);
+            if (kept.size() >= trimAt) {
+                kept.erase(0, keptStart());
+                trimAt = std::max(TRIM_SIZE, 2 * kept.size());
+            }
+        }
+
+        const char* data() const { return kept.data() + keptStart(); }
+        size_t size() const { return kept.size() - keptStart(); }
+
+    private:
+        static constexpr size_t TRIM_SIZE = 1 << 20;
+
+        long lines;
+        long bytes;
+        std::string kept;
+        size_t trimAt = TRIM_SIZE;
+
+        // Offset of the last lines or bytes within kept
+        size_t keptStart() const {
+            if (bytes >= 0) {
+                return kept.size() - std::min<size_t>(kept.size(), bytes);
+            }
+
+            size_t end = kept.size();
+            if (end > 0 && kept[end - 1] == '\n') {
+                --end;
+            }
+            for (long n = 0; n < lines; ++n) {
+                size_t nl = end == 0 ? std::string::npos : kept.rfind('\n', end - 1);
+                if (nl == std::string::npos) {
+                    return 0;
+                }
+                end = nl;
+            }
+            return lines == 0 ? kept.size() : end + 1;
+        }
+    };
 }
 
 /**
- * @brief Removes a file or directory tree.
- * @param args A file or directory path, with optional flags:
- *        "-r" Recursively remove a directory and its contents
- * @return Status code, empty output on success, error message on failure
+ * @brief Copy the last lines (or bytes) of fd to out
+ *
+ * Regular files are scanned backwards from the end in blocks, so the cost
+ * depends on how much is printed rather than on the size of the file.
+ * From a starting line or byte ("+N") the file is read forwards with
+ * FileReader, skipping up to the start (by seeking, for bytes of a regular
+ * file) and streaming the rest into out. Anything else is read
+ * through a TailWindow, which holds only about twice the tail.
+ *
+ * @param fromStart Treat lines as a 1-based starting line instead of a count
+ * @param end Receives the offset up to which the file was read
+ * @return False on a read error
  */
-CommandResult Commands::rmCommand(const std::vector<std::string>& args) {
-    if (args.empty()) {
-        return {1, "", "rm: missing operand"};
-    }
+bool Commands::tailFd(int fd, long lines, long bytes, bool fromStart, OutputBuffer& out, off_t& end) {
+    const size_t BLOCK = 65536;
+    char buffer[BLOCK];
+    struct stat st;
 
-    bool recursive = false;
-    int currentArg = 0;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
 
-    while (currentArg < args.size() && args[currentArg][0] == '-') {
-        const std::string& flag = args[currentArg];
-        if (flag.find('r') != std::string::npos) {
-            recursive = true;
+    if (regular && !fromStart) {
+        off_t size = st.st_size;
+        off_t start = 0;
+
+        if (bytes >= 0) {
+            start = std::max<off_t>(0, size - bytes);
+        } else if (lines == 0) {
+            start = size;
         } else {
-            return {1, "", "rm: invalid option '" + flag + "'"};
-        }
-        
-        ++currentArg;
-        if (currentArg == args.size()) {
-            return {1, "", "rm: missing operand after '" + flag + "'"};
+            long seen = 0;
+            bool found = false;
+
+            for (off_t pos = size; pos > 0 && !found; ) {
+                size_t len = std::min<off_t>(BLOCK, pos);
+                pos -= len;
+                if (pread(fd, buffer, len, pos) != static_cast<ssize_t>(len)) {
+                    return false;
+                }
+
+                for (size_t i = len; i-- > 0; ) {
+                    // A newline ending the file does not start another line
+                    if (buffer[i] == '\n' && pos + static_cast<off_t>(i) != size - 1 && ++seen == lines) {
+                        start = pos + i + 1;
+                        found = true;
+                        break;
+                    }
+                }
+            }
         }
-    }
 
-    std::string out;
+        for (off_t pos = start; pos < size; ) {
+            ssize_t n = pread(fd, buffer, std::min<off_t>(BLOCK, size - pos), pos);
+            if (n <= 0) {
+                if (n == -1) return false;
+                break;
+            }
+            out.append(buffer, n);
+            pos += n;
+        }
 
-    for (; currentArg < args.size(); ++currentArg) {
-        const std::string& path = args[currentArg];
+        end = size;
+        return true;
+    }
 
-        struct stat st;
-        if (stat(path.c_str(), &st) == -1) {
-            return {1, "", "rm: cannot access '" + path + "': " + strerror(errno)};
+    if (fromStart) {
+        off_t skip = bytes >= 0 ? std::max(bytes - 1, 0L) : 0;
+        long linesLeft = bytes >= 0 ? 0 : std::max(lines - 1, 0L);
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        if (skip > 0 && start >= 0 && regular && lseek(fd, start + skip, SEEK_SET) != -1) {
+            skip = 0;
         }
 
-        if (S_ISDIR(st.st_mode)) {
-            if (recursive) {
-                DIR* dir = opendir(path.c_str());
-                if (!dir) {
-                    return {1, "", "rm: cannot open directory '" + path + "': " + strerror(errno)};
-                }
-
-                struct dirent* entry;
-                while ((entry = readdir(dir)) != nullptr) {
-                    std::string name = entry->d_name;
-                    if (name == "." || name == "..") continue;
-                    std::string subpath = path + "/" + name;
-                    rmCommand({recursive ? "-r" : "", subpath});
+        off_t total = 0;
+        FileReader reader(fd);
+        bool ok = reader.forEachChunk([&](const char* chunk, size_t size) {
+            total += size;
+            if (skip > 0) {
+                size_t skipped = std::min<off_t>(skip, size);
+                skip -= skipped;
+                chunk += skipped;
+                size -= skipped;
+            }
+            while (linesLeft > 0 && size > 0) {
+                const char* nl = static_cast<const char*>(memchr(chunk, '\n', size));
+                if (!nl) {
+                    return true;
                 }
-                closedir(dir);
+                size -= nl + 1 - chunk;
+                chunk = nl + 1;
+                --linesLeft;
+            }
+            return size == 0 || out.append(chunk, size);
+        });
 
-                if (rmdir(path.c_str()) == -1) {
-                    return {1, "", "rm: failed to remove directory '" + path + "': " + strerror(errno)};
-                }
+        // Where reading stopped, for -f
+        off_t offset = start >= 0 ? lseek(fd, 0, SEEK_CUR) : -1;
+        end = offset >= 0 ? offset : total;
+        return ok;
+    }
 
-            } else {
-                return {1, "", "rm: '" + path + "' is a directory"};
-            }
-        } else {
-            if (unlink(path.c_str()) == -1) {
-                return {1, "", "rm: cannot remove '" + path + "': " + strerror(errno)};
-            }
-        }
+    TailWindow window(lines, bytes);
+    off_t total = 0;
+    FileReader reader(fd);
+    bool ok = reader.forEachChunk([&window, &total](const char* chunk, size_t size) {
+        window.add(chunk, size);
+        total += size;
+        return true;
+    });
+    if (!ok) {
+        return false;
     }
+    end = total;
 
-    return {0, out, ""};
+    out.append(window.data(), window.size());
+    return true;
 }
 
 /**
- * @brief Move files or directories from one location to another.
- * @param args Must contain exactly two arguments:
- *        - args[0]: Source file or directory path
- *        - args[1]: Destination path
- * @return Status code, empty output on success, or an error message on failure
+ * @brief Print data appended to the files until SIGINT
+ *
+ * Waits on inotify rather than polling. Each file is watched for writes and
+ * for being moved or deleted, and its directory for a new file appearing
+ * under the same name, which is how rotation shows up; the new file is then
+ * followed from its start. A file that shrinks is treated as truncated.
+ * SIGINT is taken through a signalfd while following, so Ctrl-C ends the
+ * command instead of the shell.
+ *
+ * @param offsets Offset up to which each file has already been printed
+ * @return Status 130 once interrupted, or 1 if inotify is unavailable
  */
-CommandResult Commands::mvCommand(const std::vector<std::string>& args) {
-    if (args.size() != 2) {
-        return {1, "", "mv: requires exactly two arguments: source and destination"};
+CommandResult Commands::followFiles(const std::vector<std::string>& files, const std::vector<off_t>& offsets) {
+    struct Followed {
+        std::string path;
+        std::string fullPath;
+        std::string name;
+        int fd;
+        off_t offset;
+        int wd;
+        int dirWd;
+    };
+
+    int ino = inotify_init1(IN_CLOEXEC);
+    if (ino == -1) {
+        return {1, "", std::string("tail: inotify cannot be used: ") + strerror(errno)};
     }
 
-    const std::string& src = args[0];
-    std::string dest = args[1];
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, &oldMask);
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    const uint32_t FILE_EVENTS = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    std::vector<Followed> followed;
+
+    // inotify only takes paths, so watches use the absolute path in the job's directory
+    ExecContext& context = ExecContext::current();
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        Followed f;
+        f.path = files[i];
+        f.fullPath = context.absolute(f.path);
+        size_t slash = f.fullPath.rfind('/');
+        f.name = f.fullPath.substr(slash + 1);
+        std::string dir = slash == 0 ? "/" : f.fullPath.substr(0, slash);
+
+        f.fd = open(f.fullPath.c_str(), O_RDONLY | O_CLOEXEC);
+        f.offset = offsets[i];
+        f.wd = inotify_add_watch(ino, f.fullPath.c_str(), FILE_EVENTS);
+        f.dirWd = inotify_add_watch(ino, dir.c_str(), IN_CREATE | IN_MOVED_TO);
+        followed.push_back(f);
+    }
 
-    struct stat st;
-    if (stat(dest.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
-        std::string filename = src.substr(src.find_last_of("/\\") + 1);
-        if (dest.back() != '/' && dest.back() != '\\') {
-            dest += "/";
+    size_t lastPrinted = followed.size() - 1;
+
+    auto drain = [&](size_t index) {
+        Followed& f = followed[index];
+        struct stat st;
+        if (f.fd == -1 || fstat(f.fd, &st) == -1) {
+            return;
         }
-        dest += filename;
-    }
 
-    /**
-     * rename() fails with EXDEV ("Invalid cross-device link") when the source 
-     * and destination are on different filesystems (like on Docker bind mounts and volumes).
-     * In this case, the correct fallback behavior is:
-    *    1. Copy the source file to the destination path, and
-    *    2. Remove the original file
-    */
-    if (std::rename(src.c_str(), dest.c_str()) != 0) {
-        if (errno == EXDEV) {
-            int in = open(src.c_str(), O_RDONLY);
-            if (in == -1) {
-                return {1, "", "mv: cannot open source file '" + src + "'"};
-            }
+        if (st.st_size < f.offset) {
+            OutputWriter::err().write("tail: " + f.path + ": file truncated\n");
+            f.offset = 0;
+        }
 
-            int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (out == -1) {
-                close(in);
-                return {1, "", "mv: cannot create destination file '" + dest + "'"};
+        char buffer[65536];
+        ssize_t n;
+        while ((n = pread(f.fd, buffer, sizeof(buffer), f.offset)) > 0) {
+            if (lastPrinted != index && followed.size() > 1) {
+                OutputWriter::out().write("\n==> " + f.path + " <==\n");
+                lastPrinted = index;
             }
+            OutputWriter::out().write(buffer, n);
+            f.offset += n;
+        }
+        OutputWriter::out().flush();
+    };
+
+    char events[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool interrupted = false;
+
+    while (!interrupted) {
+        struct pollfd fds[2] = {{ino, POLLIN, 0}, {sfd, POLLIN, 0}};
+        if (poll(fds, sfd == -1 ? 1 : 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (sfd != -1 && (fds[1].revents & POLLIN)) {
+            struct signalfd_siginfo info;
+            read(sfd, &info, sizeof(info));
+            interrupted = true;
+            continue;
+        }
+
+        ssize_t len = read(ino, events, sizeof(events));
+        if (len <= 0) {
+            continue;
+        }
 
-            char buffer[4096];
-            ssize_t bytesRead;
-            while ((bytesRead = read(in, buffer, sizeof(buffer))) > 0) {
-                if (write(out, buffer, bytesRead) != bytesRead) {
-                    close(in);
-                    close(out);
-                    return {1, "", "mv: write error while copying to '" + dest + "'"};
+        for (char* p = events; p < events + len; ) {
+            auto* ev = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            for (size_t i = 0; i < followed.size(); ++i) {
+                Followed& f = followed[i];
+
+                if (ev->wd == f.wd && (ev->mask & (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF))) {
+                    drain(i);
                 }
-            }
 
-            close(in);
-            close(out);
+                bool replaced = ev->wd == f.dirWd && ev->len > 0 && f.name == ev->name &&
+                                (ev->mask & (IN_CREATE | IN_MOVED_TO));
+                if (!replaced) {
+                    continue;
+                }
 
-            if (unlink(src.c_str()) != 0) {
-                return {1, "", "mv: copied but failed to remove original '" + src + "'"};
-            }
+                // Print what is left of the old file before switching to the new one
+                drain(i);
+                if (f.fd != -1) {
+                    close(f.fd);
+                }
+                if (f.wd != -1) {
+                    inotify_rm_watch(ino, f.wd);
+                }
 
-            return {0, "", ""};
+                f.fd = open(f.fullPath.c_str(), O_RDONLY | O_CLOEXEC);
+                f.offset = 0;
+                f.wd = inotify_add_watch(ino, f.fullPath.c_str(), FILE_EVENTS);
+                OutputWriter::err().write("tail: '" + f.path + "' has been replaced; following new file\n");
+                drain(i);
+            }
         }
+    }
 
-        return {1, "", "mv: failed to move '" + src + "' to '" + dest + "': " + strerror(errno)};
+    for (const Followed& f : followed) {
+        if (f.fd != -1) {
+            close(f.fd);
+        }
+    }
+    close(ino);
+    if (sfd != -1) {
+        close(sfd);
     }
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
 
-    return {0, "", ""};
+    return {130, "", ""};
 }
 
 /**
- * @brief Modify file permissions for user, group, and others
- * @param args Expects two arguments: 
- *        - permissions (must be numeric)
- *        - file path
- * @return Status code, empty output on success, or error message on failure
+ * @brief Print checksums of files, hashing several files at once
+ * @param args Optional flags followed by paths:
+ *        - "-a ALGO" crc32c, xxh64 or sha256 (default)
+ *        - "-r" include every regular file below directory arguments
+ * @return Status code, one "digest  path" line per file in argument order,
+ *         and an error line for each file that could not be read
  */
-CommandResult Commands::chmodCommand(const std::vector<std::string>& args) {
-    if (args.size() != 2) {
-        return {1, "", "chmod: requires exactly two arguments: permissions and file"};
-    }
-
-    const std::string& perm = args[0];
-    const std::string& filename = args[1];
+CommandResult Commands::sumCommand(const std::vector<std::string>& args) {
+    std::string algorithm = "sha256";
+    bool recursive = false;
+    std::vector<std::string> paths;
 
-    mode_t mode = 0;
-    try {
-        mode = std::stoi(perm, nullptr, 8);
-    } catch (...) {
-        return {1, "", "chmod: invalid permissions format"};
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "-r") {
+            recursive = true;
+        } else if (args[i] == "-a") {
+            if (++i == args.size()) {
+                return {1, "", "sum: option requires an argument -- 'a'"};
+            }
+            algorithm = args[i];
+        } else if (args[i].size() > 1 && args[i][0] == '-') {
+            return {1, "", "sum: invalid option -- '" + args[i] + "'"};
+        } else {
+            paths.push_back(args[i]);
+        }
     }
 
-    if (chmod(filename.c_str(), mode) != 0) {
-        return {1, "", "chmod: failed to change permissions for '" + filename + "': " + strerror(errno)};
+    if (!Checksum::create(algorithm)) {
+        return {1, "", "sum: unknown algorithm '" + algorithm + "' (expected " + Checksum::ALGORITHMS + ")"};
+    }
+    if (paths.empty()) {
+        return {1, "", "sum: missing file operand"};
     }
 
-    return {0, "", ""};
-}
+    struct Job {
+        std::string path;
+        std::string line;
+        std::string error;
+    };
 
-/* --- Helper Functions --- */
-std::string Commands::formatLsLongListing(const std::string& name, const struct stat& info) {
-    std::string out;
+    std::vector<Job> jobs;
+    const int cwdFd = ExecContext::current().dirfd();
 
-    char type = S_ISDIR(info.st_mode) ? 'd' : '-';
-    out += type;
+    for (const std::string& path : paths) {
+        struct stat st;
+        if (fstatat(cwdFd, path.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+            if (!recursive) {
+                jobs.push_back({path, "", "sum: " + path + ": Is a directory"});
+                continue;
+            }
 
-    out += ((info.st_mode & S_IRUSR) ? 'r' : '-');
-    out += ((info.st_mode & S_IWUSR) ? 'w' : '-');
-    out += ((info.st_mode & S_IXUSR) ? 'x' : '-');
-    out += ((info.st_mode & S_IRGRP) ? 'r' : '-');
-    out += ((info.st_mode & S_IWGRP) ? 'w' : '-');
-    out += ((info.st_mode & S_IXGRP) ? 'x' : '-');
-    out += ((info.st_mode & S_IROTH) ? 'r' : '-');
-    out += ((info.st_mode & S_IWOTH) ? 'w' : '-');
-    out += ((info.st_mode & S_IXOTH) ? 'x' : '-');
+            std::mutex filesMutex;
+            std::vector<std::string> files;
+            std::string error;
 
-    out += " " + std::to_string(info.st_size);
-    out += " " + name + "\n";
+            TreeWalker walker;
+            walker.walk({path}, [&](const WalkEntry& entry) {
+                if (entry.type == DT_REG) {
+                    std::lock_guard<std::mutex> lock(filesMutex);
+                    files.push_back(entry.path);
+                }
+                return entry.type == DT_DIR;
+            }, error);
 
-    return out;
-}
+            std::sort(files.begin(), files.end(), TreeWalker::pathLess);
+            for (std::string& file : files) {
+                jobs.push_back({std::move(file), "", ""});
+            }
+            if (!error.empty()) {
+                jobs.push_back({path, "", "sum: " + error});
+            }
+            continue;
+        }
 
-std::string Commands::formatRmdirErrorMsg(const std::string& path) {
-    switch (errno) {
-        case ENOTEMPTY:
-        case EEXIST:
-            return "rmdir: failed to remove '" + path + "': directory not empty";
+        jobs.push_back({path, "", ""});
+    }
 
-        case ENOENT:
-            return "rmdir: failed to remove '" + path + "': no such file or directory";
+    // Files are claimed one at a time by the workers; each result lands in
+    // its own slot, so output keeps the argument order
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i; (i = next++) < jobs.size(); ) {
+            Job& job = jobs[i];
+            if (!job.error.empty()) {
+                continue;
+            }
 
-        case ENOTDIR:
-            return "rmdir: failed to remove '" + path + "': not a directory";
+            int fd = openat(cwdFd, job.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                job.error = "sum: " + job.path + ": " + strerror(errno);
+                continue;
+            }
 
-        case EACCES:
-        case EPERM:
-            return "rmdir: failed to remove '" + path + "': permission denied";
+            std::unique_ptr<Checksum> checksum = Checksum::create(algorithm);
+            FileReader reader(fd);
+            bool ok = reader.forEachChunk([&checksum](const char* data, size_t size) {
+                checksum->update(data, size);
+                return true;
+            });
 
-        default:
-            return "rmdir: failed to remove '" + path + "': " + std::string(strerror(errno));
+            if (ok) {
+                job.line = checksum->hexDigest() + "  " + job.path + "\n";
+            } else {
+                job.error = "sum: " + job.path + ": " + strerror(errno);
+            }
+            close(fd);
+        }
+    };
+
+    // Helpers run in this job's context, for FileReader's settings and its scope's cancellation
+    ExecContext& context = ExecContext::current();
+    unsigned threads = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), jobs.size()));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i) {
+        pool.emplace_back([&worker, &context] {
+            ExecContext::Scope scope(context);
+            worker();
+        });
     }
-}
-
-bool Commands::matchesPattern(const std::string& line, const std::regex& re, bool printOnlyMatch, std::string& outMatch) {
-    std::smatch match;
-    
-    if (!std::regex_search(line, match, re)) {
-        return false;
+    worker();
+    for (std::thread& t : pool) {
+        t.join();
     }
 
-    if (printOnlyMatch) {
-        outMatch = match.str();
-    } else {
-        outMatch = line;
+    std::string out;
+    std::string errors;
+    for (const Job& job : jobs) {
+        out += job.line;
+        if (!job.error.empty()) {
+            errors += (errors.empty() ? "" : "\n") + job.error;
+        }
     }
 
-    return true;
+    return {errors.empty() ? 0 : 1, stripTrailingNewline(out), errors};
 }
 
-std::string Commands::stripTrailingNewline(const std::string& s) {
-    if (!s.empty() && s.back() == '\n') {
-        return s.substr(0, s.size() - 1);
-    }
-    return s;
+/**
+ * Running line, word and byte counts for wc, fed a chunk at a time
+ */
+struct WcCounts {
+    size_t lines = 0, words = 0, chars = 0;
+    bool inWord = false;
+    bool lastCharWasNewline = true;
+
+    // Words need a pass over every byte; lines alone are counted with memchr speed
+    void add(const char* buffer, size_t size, bool countWords) {
+        if (size == 0) {
+            return;
+        }
+        chars += size;
+
+        if (!countWords) {
+            lines += std::count(buffer, buffer + size, '\n');
+        } else {
+            for (size_t i = 0; i < size; ++i) {
+                char c = buffer[i];
+
+                if (c == '\n') {
+                    ++lines;
+                }
+
+                if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                    inWord = false;
+                } else if (!inWord) {
+                    ++words;
+                    inWord = true;
+                }
+            }
+        }
+
+        lastCharWasNewline = buffer[size - 1] == '\n';
+    }
+
+    // A last line without its newline still counts
+    size_t totalLines() const { return lines + !lastCharWasNewline; }
+
+    std::string format(bool countLines, bool countWords, bool countChars) const {
+        std::string out;
+        if (countLines) out += std::to_string(totalLines()) + " ";
+        if (countWords) out += std::to_string(words) + " ";
+        if (countChars) out += std::to_string(chars) + " ";
+        return out;
+    }
+};
+
+/**
+ * @brief Count number of lines, words, and characters in a file.
+ * @param args List containing exactly one file path and optional files:
+ *        "-l" Count lines
+ *        "-w" Count words
+ *        "-c" Count characters
+ * @return Status code, resulting counts on success, error message on failure.
+ */
+CommandResult Commands::wcCommand(const std::vector<std::string>& args) {
+    bool countLines = false;
+    bool countWords = false;
+    bool countChars = false;
+    std::vector<std::string> files;
+
+    for (const std::string& arg : args) {
+        if (arg == "-l") countLines = true;
+        else if (arg == "-w") countWords = true;
+        else if (arg == "-c") countChars = true;
+        else files.push_back(arg);
+    }
+
+    if (!countLines && !countWords && !countChars) {
+        countLines = countWords = countChars = true;
+    }
+
+    if (files.empty()) {
+        return {1, "", "wc: missing file operand"};
+    }
+
+    std::string out;
+
+    for (const std::string& filename : files) {
+
+        if (isFileEmpty(filename)) {
+            std::string zeroCount = "";
+            if (countLines) zeroCount += "0 ";
+            if (countWords) zeroCount += "0 ";
+            if (countChars) zeroCount += "0 ";
+            zeroCount += filename + "\n";
+            out += zeroCount;
+            continue;
+        }
+
+        int fd = openat(ExecContext::current().dirfd(), filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return {1, "", "wc: cannot open file '" + filename + "': " + strerror(errno)};
+        }
+
+        WcCounts counts;
+        FileReader reader(fd);
+        bool ok = reader.forEachChunk([&](const char* buffer, size_t size) {
+            counts.add(buffer, size, countWords);
+            return true;
+        });
+
+        if (!ok) {
+            int err = errno;
+            close(fd);
+            return {1, "", "wc: error reading file '" + filename + "': " + strerror(err)};
+        }
+
+        close(fd);
+
+        out += counts.format(countLines, countWords, countChars) + filename + "\n";
+    }
+
+    return {0, stripTrailingNewline(out), ""};
+}
+
+/**
+ * @brief Parse sort's options, in the current job's directory
+ * @return An error message, or an empty string on success
+ */
+static std::string parseSortArgs(const std::vector<std::string>& args, LineSorter::Options& options,
+                                 std::vector<std::string>& files) {
+    ExecContext& context = ExecContext::current();
+    std::string tmpdir = context.variables().value("TMPDIR");
+    if (!tmpdir.empty()) {
+        options.tempDir = tmpdir;
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+
+        if (arg.size() < 2 || arg[0] != '-') {
+            files.push_back(arg);
+            continue;
+        }
+
+        for (size_t j = 1; j < arg.size(); ++j) {
+            char flag = arg[j];
+
+            if (flag == 'n') { options.numeric = true; continue; }
+            if (flag == 'r') { options.reverse = true; continue; }
+            if (flag == 'u') { options.unique = true; continue; }
+
+            if (flag != 't' && flag != 'k' && flag != 'S' && flag != 'T') {
+                return "sort: invalid option -- '" + std::string(1, flag) + "'";
+            }
+
+            // The rest of this word, or the next word, is the option's value
+            std::string value = arg.substr(j + 1);
+            if (value.empty()) {
+                if (++i == args.size()) {
+                    return "sort: option requires an argument -- '" + std::string(1, flag) + "'";
+                }
+                value = args[i];
+            }
+
+            if (flag == 't') {
+                if (value.size() != 1) {
+                    return "sort: multi-character tab '" + value + "'";
+                }
+                options.separator = static_cast<unsigned char>(value[0]);
+            } else if (flag == 'k') {
+                size_t comma = value.find(',');
+                std::string first = value.substr(0, comma);
+                std::string last = comma == std::string::npos ? "" : value.substr(comma + 1);
+
+                if (first.empty() || first.find_first_not_of("0123456789") != std::string::npos ||
+                    last.find_first_not_of("0123456789") != std::string::npos ||
+                    std::stoi(first) == 0 || (!last.empty() && std::stoi(last) == 0)) {
+                    return "sort: invalid key '" + value + "'";
+                }
+                options.keyStart = std::stoi(first);
+                options.keyEnd = last.empty() ? 0 : std::stoi(last);
+            } else if (flag == 'S') {
+                size_t unit = 1024;
+                std::string digits = value;
+                const std::string suffixes = "bKMG";
+                size_t suffix = digits.empty() ? std::string::npos : suffixes.find(digits.back());
+
+                if (suffix != std::string::npos) {
+                    unit = suffix == 0 ? 1 : size_t(1) << (10 * suffix);
+                    digits.pop_back();
+                }
+                // At most 12 digits, so that neither stoull nor the product can overflow
+                if (digits.empty() || digits.size() > 12 ||
+                    digits.find_first_not_of("0123456789") != std::string::npos) {
+                    return "sort: invalid buffer size '" + value + "'";
+                }
+                options.memoryBudget = std::max<size_t>(std::stoull(digits) * unit, 1 << 20);
+            } else {
+                options.tempDir = value;
+            }
+            break;
+        }
+    }
+
+    options.baseDir = context.dirfd();
+    options.tempDir = context.absolute(options.tempDir);
+    return "";
+}
+
+/**
+ * @brief Sort the lines of one or more files. In a pipeline, sort without
+ *        files sorts its input; see SortStage.
+ * @param args Optional flags followed by file paths:
+ *        - "-n" compare keys numerically
+ *        - "-r" reverse the order
+ *        - "-u" print only the first of lines with equal keys
+ *        - "-t C" fields are separated by C instead of runs of blanks
+ *        - "-k N[,M]" sort on fields N through M (default: to end of line)
+ *        - "-S SIZE" memory budget, with optional K/M/G suffix (default 256M)
+ *        - "-T DIR" directory for temporary runs (default $TMPDIR or /tmp)
+ * @return Status code, sorted lines on success, error message on failure
+ */
+CommandResult Commands::sortCommand(const std::vector<std::string>& args) {
+    LineSorter::Options options;
+    std::vector<std::string> files;
+    std::string error = parseSortArgs(args, options, files);
+    if (!error.empty()) {
+        return {1, "", error};
+    }
+
+    if (files.empty()) {
+        return {1, "", "sort: missing file operand"};
+    }
+
+    LineSorter sorter(options);
+    OutputBuffer out;
+
+    if (!sorter.sort(files, out, error)) {
+        return {1, "", "sort: " + error};
+    }
+
+    CommandResult result{0, "", ""};
+    out.popNewline();
+    out.moveInto(result);
+    return result;
+}
+
+/**
+ * @brief Add the arguments on one line (without its '\n') to items
+ * @param byLine True for the whole line as one argument, false to split on blanks
+ */
+static void splitArguments(const char* line, size_t size, bool byLine, std::vector<std::string>& items) {
+    if (byLine) {
+        if (size > 0) items.emplace_back(line, size);
+        return;
+    }
+    size_t i = 0;
+    while (i < size) {
+        while (i < size && (line[i] == ' ' || line[i] == '\t')) ++i;
+        size_t start = i;
+        while (i < size && line[i] != ' ' && line[i] != '\t') ++i;
+        if (i > start) items.emplace_back(line + start, i - start);
+    }
+}
+
+/**
+ * @brief Read the arguments for parallel or xargs from a file in the current directory
+ * @param byLine True for one argument per line, false to split on blanks and newlines
+ * @return False with error set if the file cannot be read
+ */
+static bool readArgumentFile(const std::string& path, bool byLine, std::vector<std::string>& items,
+                             std::string& error) {
+    int fd = openat(ExecContext::current().dirfd(), path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = "cannot open '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    FileReader reader(fd);
+    bool ok = reader.forEachLine([&](const char* line, size_t size) {
+        splitArguments(line, size, byLine, items);
+        return true;
+    });
+    int saved = errno;
+    close(fd);
+
+    if (!ok) {
+        error = "error reading '" + path + "': " + strerror(saved);
+    }
+    return ok;
+}
+
+/**
+ * @brief Parse the value of -j/-P/-n
+ * @return False if the text is not a non-negative number
+ */
+static bool parseJobNumber(const std::string& text, unsigned& value) {
+    if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    value = std::stoul(text);
+    return true;
+}
+
+/**
+ * @brief Replace parallel's placeholders in one word of the command
+ *        - "{}" the argument
+ *        - "{.}" the argument without its extension
+ *        - "{/}" the last path component of the argument
+ * @param replaced Set to true if the word contained a placeholder
+ */
+static std::string fillPlaceholders(const std::string& word, const std::string& arg, bool& replaced) {
+    if (word.find('{') == std::string::npos) {
+        return word;
+    }
+
+    size_t slash = arg.rfind('/');
+    size_t dot = arg.rfind('.');
+    std::string noExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash + 1)
+                                  ? arg.substr(0, dot) : arg;
+    std::string basename = slash == std::string::npos ? arg : arg.substr(slash + 1);
+
+    std::string out;
+    for (size_t i = 0; i < word.size(); ) {
+        if (word.compare(i, 2, "{}") == 0) {
+            out += arg;
+            i += 2;
+        } else if (word.compare(i, 3, "{.}") == 0) {
+            out += noExtension;
+            i += 3;
+        } else if (word.compare(i, 3, "{/}") == 0) {
+            out += basename;
+            i += 3;
+        } else {
+            out += word[i++];
+            continue;
+        }
+        replaced = true;
+    }
+    return out;
+}
+
+/**
+ * @brief Run a command once per argument on a pool of worker threads.
+ *        Builtins run inside the shell; other programs are spawned. Each
+ *        job's output is printed in one piece.
+ * @param args Options, the command, then ":::" and its arguments, or
+ *        "::::" and files holding one argument per line:
+ *        - "-j N", "--jobs=N" run N jobs at once (default and 0: one per CPU)
+ *        - "-k", "--keep-order" print output in argument order rather than as jobs finish
+ *        The argument replaces "{}", "{.}" or "{/}" in the command, or is
+ *        appended if there is no placeholder.
+ * @return Number of failed jobs (at most 101) as the status, with the jobs' output
+ */
+CommandResult Commands::parallelCommand(const std::vector<std::string>& args) {
+    JobPool::Options options;
+    size_t i = 0;
+
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& arg = args[i];
+        std::string value;
+
+        if (arg == "-k" || arg == "--keep-order") {
+            options.keepOrder = true;
+            continue;
+        } else if (arg == "-j" || arg == "--jobs") {
+            if (++i == args.size()) {
+                return {1, "", "parallel: option '" + arg + "' requires an argument"};
+            }
+            value = args[i];
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            value = arg.substr(7);
+        } else if (arg.rfind("-j", 0) == 0) {
+            value = arg.substr(2);
+        } else {
+            return {1, "", "parallel: unknown option '" + arg + "'"};
+        }
+
+        if (!parseJobNumber(value, options.jobs)) {
+            return {1, "", "parallel: invalid number of jobs '" + value + "'"};
+        }
+    }
+
+    std::vector<std::string> command;
+    for (; i < args.size() && args[i] != ":::" && args[i] != "::::"; ++i) {
+        command.push_back(args[i]);
+    }
+    if (command.empty()) {
+        return {1, "", "parallel: missing command"};
+    }
+    if (i == args.size()) {
+        return {1, "", "parallel: missing arguments; give them after ::: or in files after ::::"};
+    }
+
+    bool fromFiles = args[i] == "::::";
+    std::vector<std::string> inputs;
+    for (++i; i < args.size(); ++i) {
+        if (args[i] == ":::" || args[i] == "::::") {
+            return {1, "", "parallel: only one input source is supported"};
+        }
+        std::string error;
+        if (!fromFiles) {
+            inputs.push_back(args[i]);
+        } else if (!readArgumentFile(args[i], true, inputs, error)) {
+            return {1, "", "parallel: " + error};
+        }
+    }
+
+    std::vector<std::vector<std::string>> jobs;
+    jobs.reserve(inputs.size());
+    for (const std::string& input : inputs) {
+        std::vector<std::string> job;
+        bool replaced = false;
+        for (const std::string& word : command) {
+            job.push_back(fillPlaceholders(word, input, replaced));
+        }
+        if (!replaced) {
+            job.push_back(input);
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    size_t failed = 0;
+    CommandResult result = JobPool(options).run(jobs, failed);
+    result.status = static_cast<int>(std::min<size_t>(failed, 101));
+    return result;
+}
+
+/**
+ * Options of xargs, shared by the builtin and its pipeline stage
+ */
+struct XargsOptions {
+    JobPool::Options pool;
+    unsigned maxArgs = 0;
+    std::string replace;
+    std::string file;
+    std::vector<std::string> command;
+};
+
+/**
+ * @brief Parse xargs's options and command
+ * @return An error message, or an empty string on success
+ */
+static std::string parseXargsArgs(const std::vector<std::string>& args, XargsOptions& options) {
+    options.pool.jobs = 1;
+    size_t i = 0;
+
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& arg = args[i];
+
+        if (arg == "--keep-order") {
+            options.pool.keepOrder = true;
+            continue;
+        }
+
+        char flag = arg[1];
+        if (flag != 'a' && flag != 'P' && flag != 'n' && flag != 'I') {
+            return "xargs: unknown option '" + arg + "'";
+        }
+
+        std::string value = arg.substr(2);
+        if (value.empty()) {
+            if (++i == args.size()) {
+                return "xargs: option requires an argument -- '" + std::string(1, flag) + "'";
+            }
+            value = args[i];
+        }
+
+        if (flag == 'a') {
+            options.file = value;
+        } else if (flag == 'I') {
+            options.replace = value;
+        } else if (!parseJobNumber(value, flag == 'P' ? options.pool.jobs : options.maxArgs) ||
+                   (flag == 'n' && options.maxArgs == 0)) {
+            return "xargs: invalid number for -" + std::string(1, flag) + " option: '" + value + "'";
+        }
+    }
+
+    options.command.assign(args.begin() + i, args.end());
+    if (options.command.empty()) {
+        options.command.push_back("echo");
+    }
+    return "";
+}
+
+/**
+ * @brief Build the command lines for the given arguments and run them
+ */
+static CommandResult runXargs(const XargsOptions& options, const std::vector<std::string>& inputs) {
+    const std::vector<std::string>& command = options.command;
+    const std::string& replace = options.replace;
+
+    std::vector<std::vector<std::string>> jobs;
+    if (!replace.empty()) {
+        for (const std::string& input : inputs) {
+            std::vector<std::string> job;
+            for (const std::string& word : command) {
+                std::string filled;
+                size_t start = 0;
+                for (size_t at; (at = word.find(replace, start)) != std::string::npos; start = at + replace.size()) {
+                    filled.append(word, start, at - start).append(input);
+                }
+                job.push_back(filled.append(word, start, std::string::npos));
+            }
+            jobs.push_back(std::move(job));
+        }
+    } else if (inputs.empty()) {
+        // Like xargs, the command still runs once
+        jobs.push_back(command);
+    } else {
+        size_t perJob = options.maxArgs ? options.maxArgs : inputs.size();
+        for (size_t begin = 0; begin < inputs.size(); begin += perJob) {
+            std::vector<std::string> job = command;
+            size_t end = std::min(inputs.size(), begin + perJob);
+            job.insert(job.end(), inputs.begin() + begin, inputs.begin() + end);
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    size_t failed = 0;
+    CommandResult result = JobPool(options.pool).run(jobs, failed);
+    if (result.status == 126 || result.status == 127) {
+        return result;
+    }
+    result.status = failed > 0 ? 123 : 0;
+    return result;
+}
+
+/**
+ * @brief Build and run command lines from the arguments in a file, like
+ *        xargs, optionally several at once on a pool of worker threads. In
+ *        a pipeline, xargs without -a reads its arguments from its input;
+ *        see XargsStage.
+ * @param args Options, then the command and its initial arguments (default: echo)
+ *        - "-a FILE" read arguments from FILE, separated by blanks and newlines
+ *        - "-P N" run N commands at once (default 1, 0: one per CPU)
+ *        - "-n N" pass at most N arguments to each command
+ *        - "-I STR" run the command once per line, with STR replaced by the line
+ *        - "--keep-order" print output in argument order when running in parallel
+ * @return 123 if any command failed, 126 or 127 if one could not be run, else 0,
+ *         with the commands' output
+ */
+CommandResult Commands::xargsCommand(const std::vector<std::string>& args) {
+    XargsOptions options;
+    std::string error = parseXargsArgs(args, options);
+    if (!error.empty()) {
+        return {1, "", error};
+    }
+
+    // The shell's stdin is the terminal the commands are typed on
+    if (options.file.empty()) {
+        return {1, "", "xargs: reading arguments from standard input is not supported; use -a FILE or a pipeline"};
+    }
+
+    std::vector<std::string> inputs;
+    if (!readArgumentFile(options.file, !options.replace.empty(), inputs, error)) {
+        return {1, "", "xargs: " + error};
+    }
+
+    return runXargs(options, inputs);
+}
+
+/**
+ * @brief Report how well the shared caches of compiled grep and glob patterns work
+ * @param args Optional "-c" to empty the caches and reset their counters
+ * @return Status code and one line of counters per cache
+ */
+CommandResult Commands::patcacheCommand(const std::vector<std::string>& args) {
+    bool clear = false;
+    for (const std::string& arg : args) {
+        if (arg != "-c") {
+            return {1, "", "patcache: invalid option '" + arg + "'"};
+        }
+        clear = true;
+    }
+
+    std::vector<PatternCacheBase*> caches = PatternCacheBase::all();
+    if (clear) {
+        for (PatternCacheBase* cache : caches) {
+            cache->clear();
+        }
+        return {0, "", ""};
+    }
+
+    std::string out = "cache     entries     hits   misses  evicted  hit rate";
+    char line[128];
+    for (const PatternCacheBase* cache : caches) {
+        PatternCacheBase::Stats stats = cache->stats();
+        uint64_t lookups = stats.hits + stats.misses;
+        double rate = lookups ? 100.0 * stats.hits / lookups : 0.0;
+        std::string entries = std::to_string(stats.entries) + "/" + std::to_string(stats.capacity);
+        snprintf(line, sizeof(line), "\n%-8s %8s %8llu %8llu %8llu  %7.1f%%", stats.name, entries.c_str(),
+                 static_cast<unsigned long long>(stats.hits), static_cast<unsigned long long>(stats.misses),
+                 static_cast<unsigned long long>(stats.evictions), rate);
+        out += line;
+    }
+    return {0, out, ""};
+}
+
+/**
+ * @brief Parse a duration: a decimal number of seconds with an optional
+ *        s, m, h or d suffix, as timeout(1) takes
+ * @return False if the text is not a duration
+ */
+static bool parseDuration(const std::string& text, int64_t& ns) {
+    char* end = nullptr;
+    errno = 0;
+    double value = strtod(text.c_str(), &end);
+    if (text.empty() || end == text.c_str() || errno != 0 || value < 0 || !std::isfinite(value)) {
+        return false;
+    }
+
+    switch (*end) {
+        case '\0': case 's': break;
+        case 'm': value *= 60; break;
+        case 'h': value *= 3600; break;
+        case 'd': value *= 86400; break;
+        default: return false;
+    }
+    if (*end != '\0' && end[1] != '\0') {
+        return false;
+    }
+
+    value *= 1e9;
+    if (value > 9e18) {
+        return false;
+    }
+    // A nonzero duration shorter than a nanosecond still expires
+    ns = value > 0 && value < 1 ? 1 : static_cast<int64_t>(value);
+    return true;
+}
+
+/**
+ * @brief Parse a byte count with an optional K, M or G suffix
+ * @return False if the text is not a positive size
+ */
+static bool parseByteCount(const std::string& text, size_t& bytes) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (text.empty() || end == text.c_str() || errno != 0 || text[0] == '-' || value == 0) {
+        return false;
+    }
+
+    switch (*end) {
+        case '\0': break;
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        default: return false;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+
+    bytes = value;
+    return true;
+}
+
+/**
+ * @brief Parse a signal given by name (TERM, SIGTERM) or number
+ * @return The signal number, or 0 if the text names no signal
+ */
+static int parseSignal(std::string text) {
+    static const struct { const char* name; int number; } SIGNALS[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+        {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}
+    };
+
+    unsigned number;
+    if (parseJobNumber(text, number)) {
+        return number > 0 && number < NSIG ? static_cast<int>(number) : 0;
+    }
+
+    for (char& c : text) c = std::toupper(static_cast<unsigned char>(c));
+    if (text.compare(0, 3, "SIG") == 0) {
+        text.erase(0, 3);
+    }
+    for (const auto& signal : SIGNALS) {
+        if (text == signal.name) {
+            return signal.number;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Run a command in a new cancellation scope watched by a Watchdog.
+ *        Like a subshell, the command gets a fork of the job's context, so
+ *        a cd or assignment inside it does not outlive it.
+ * @param escalated Set if its programs had to be killed after the deadline
+ */
+static CommandResult runWatched(const std::vector<std::string>& argv, CancelScope& scope,
+                                const Watchdog::Options& options, bool& escalated) {
+    std::unique_ptr<ExecContext> context = ExecContext::current().fork();
+    context->setCancelScope(&scope);
+
+    CommandResult result;
+    {
+        ExecContext::Scope installed(*context);
+        Watchdog watchdog(scope, options);
+        result = Executor::runArgs(argv);
+        escalated = watchdog.escalated();
+    }
+    return result;
+}
+
+/**
+ * @brief Run a command with a time limit. Builtins stop at their next
+ *        cancellation check once it expires; programs are sent a signal.
+ * @param args Options, the duration, then the command and its arguments:
+ *        - "-s SIG", "--signal=SIG" signal to send at the deadline (default TERM)
+ *        - "-k DUR", "--kill-after=DUR" send KILL if still running this long after
+ *        Durations are seconds, or take an s, m, h or d suffix; 0 disables the limit.
+ * @return 124 if the command timed out, 137 if it had to be killed, 125
+ *         for a usage error, otherwise the command's own status
+ */
+CommandResult Commands::timeoutCommand(const std::vector<std::string>& args) {
+    Watchdog::Options options;
+    size_t i = 0;
+
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& arg = args[i];
+        std::string value;
+        char option;
+
+        if (arg == "--") {
+            ++i;
+            break;
+        } else if (arg == "-s" || arg == "-k") {
+            if (i + 1 == args.size()) {
+                return {125, "", "timeout: option requires an argument -- '" + arg.substr(1) + "'"};
+            }
+            option = arg[1];
+            value = args[++i];
+        } else if ((arg[1] == 's' || arg[1] == 'k') && arg[2] != '-') {
+            option = arg[1];
+            value = arg.substr(2);
+        } else if (arg.compare(0, 9, "--signal=") == 0) {
+            option = 's';
+            value = arg.substr(9);
+        } else if (arg.compare(0, 13, "--kill-after=") == 0) {
+            option = 'k';
+            value = arg.substr(13);
+        } else {
+            return {125, "", "timeout: invalid option '" + arg + "'"};
+        }
+
+        if (option == 's' && (options.signal = parseSignal(value)) == 0) {
+            return {125, "", "timeout: invalid signal '" + value + "'"};
+        }
+        if (option == 'k' && !parseDuration(value, options.killAfterNs)) {
+            return {125, "", "timeout: invalid time interval '" + value + "'"};
+        }
+    }
+
+    if (i == args.size()) {
+        return {125, "", "timeout: missing operand"};
+    }
+    if (!parseDuration(args[i], options.timeoutNs)) {
+        return {125, "", "timeout: invalid time interval '" + args[i] + "'"};
+    }
+    if (++i == args.size()) {
+        return {125, "", "timeout: missing command"};
+    }
+
+    CancelScope scope(CancelScope::current());
+    bool escalated = false;
+    CommandResult result = runWatched(std::vector<std::string>(args.begin() + i, args.end()),
+                                      scope, options, escalated);
+
+    if (scope.status() == CancelScope::TIMED_OUT) {
+        result.status = escalated ? CancelScope::KILLED : CancelScope::TIMED_OUT;
+    }
+    return result;
+}
+
+/**
+ * @brief Run a command with caps on the resources it may use
+ * @param args Options, then the command and its arguments:
+ *        - "-t SECS" CPU time: of a builtin's threads, its workers included,
+ *          or of each program (RLIMIT_CPU, which sends SIGXCPU)
+ *        - "-m SIZE" memory: growth of the whole shell's resident set while a
+ *          builtin runs, so other jobs running meanwhile count too, or the
+ *          address space of each program (RLIMIT_AS)
+ *        - "-o SIZE" bytes of output, counted as it is produced; a builtin
+ *          is stopped and programs are killed when they exceed it
+ *        SIZE takes an optional K, M or G suffix.
+ * @return 152 if the CPU limit was hit, 153 for output, 137 for memory, 125
+ *         for a usage error, otherwise the command's own status
+ */
+CommandResult Commands::limitCommand(const std::vector<std::string>& args) {
+    Watchdog::Options options;
+    size_t outputLimit = 0;
+    size_t i = 0;
+
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--") {
+            ++i;
+            break;
+        }
+        if (arg != "-t" && arg != "-m" && arg != "-o") {
+            return {125, "", "limit: invalid option '" + arg + "'"};
+        }
+        if (i + 1 == args.size()) {
+            return {125, "", "limit: option requires an argument -- '" + arg.substr(1) + "'"};
+        }
+
+        const std::string& value = args[++i];
+        bool ok = arg == "-t" ? parseDuration(value, options.cpuNs) && options.cpuNs > 0
+                : arg == "-m" ? parseByteCount(value, options.memoryBytes)
+                : parseByteCount(value, outputLimit);
+        if (!ok) {
+            return {125, "", "limit: invalid limit '" + value + "' for " + arg};
+        }
+    }
+
+    if (i == args.size()) {
+        return {125, "", "limit: missing command"};
+    }
+
+    CancelScope scope(CancelScope::current());
+    if (options.cpuNs > 0) {
+        scope.limitPrograms(RLIMIT_CPU, (options.cpuNs + 999999999) / 1000000000);
+    }
+    if (options.memoryBytes > 0) {
+        scope.limitPrograms(RLIMIT_AS, options.memoryBytes);
+    }
+    scope.limitOutput(outputLimit);
+
+    bool escalated = false;
+    CommandResult result = runWatched(std::vector<std::string>(args.begin() + i, args.end()),
+                                      scope, options, escalated);
+
+    // Output a builtin built as a plain string is only known once it returns
+    size_t outputSize = result.spill ? result.spill->size() : result.output.size();
+    if (outputLimit > 0 && outputSize > outputLimit) {
+        scope.cancel(CancelScope::OUTPUT_EXCEEDED);
+    }
+
+    switch (scope.status()) {
+        case CancelScope::CPU_EXCEEDED:
+            result.status = CancelScope::CPU_EXCEEDED;
+            result.error = "limit: CPU time limit exceeded";
+            return result;
+        case CancelScope::OUTPUT_EXCEEDED:
+            if (result.spill) {
+                result.spill->truncate(outputLimit);
+            } else {
+                result.output.resize(std::min(result.output.size(), outputLimit));
+            }
+            result.status = CancelScope::OUTPUT_EXCEEDED;
+            result.error = "limit: output limit exceeded";
+            return result;
+        case CancelScope::MEMORY_EXCEEDED:
+            result.status = CancelScope::MEMORY_EXCEEDED;
+            result.error = "limit: memory limit exceeded";
+            return result;
+        default:
+            return result;
+    }
+}
+
+/**
+ * @brief Removes a file or directory tree.
+ * @param args A file or directory path, with optional flags:
+ *        "-r" Recursively remove a directory and its contents
+ * @return Status code, empty output on success, error message on failure
+ */
+CommandResult Commands::rmCommand(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return {1, "", "rm: missing operand"};
+    }
+
+    bool recursive = false;
+    int currentArg = 0;
+
+    while (currentArg < args.size() && args[currentArg][0] == '-') {
+        const std::string& flag = args[currentArg];
+        if (flag.find('r') != std::string::npos) {
+            recursive = true;
+        } else {
+            return {1, "", "rm: invalid option '" + flag + "'"};
+        }
+        
+        ++currentArg;
+        if (currentArg == args.size()) {
+            return {1, "", "rm: missing operand after '" + flag + "'"};
+        }
+    }
+
+    std::string out;
+    const int cwdFd = ExecContext::current().dirfd();
+
+    for (; currentArg < args.size() && !Cancellation::requested(); ++currentArg) {
+        const std::string& path = args[currentArg];
+
+        struct stat st;
+        if (fstatat(cwdFd, path.c_str(), &st, 0) == -1) {
+            return {1, "", "rm: cannot access '" + path + "': " + strerror(errno)};
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (recursive) {
+                int dirFd = openat(cwdFd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                DIR* dir = dirFd == -1 ? nullptr : fdopendir(dirFd);
+                if (!dir) {
+                    if (dirFd != -1) close(dirFd);
+                    return {1, "", "rm: cannot open directory '" + path + "': " + strerror(errno)};
+                }
+
+                struct dirent* entry;
+                while (!Cancellation::requested() && (entry = readdir(dir)) != nullptr) {
+                    std::string name = entry->d_name;
+                    if (name == "." || name == "..") continue;
+                    std::string subpath = path + "/" + name;
+                    rmCommand({recursive ? "-r" : "", subpath});
+                }
+                closedir(dir);
+
+                if (Cancellation::requested()) {
+                    return {Cancellation::STATUS, out, ""};
+                }
+
+                if (unlinkat(cwdFd, path.c_str(), AT_REMOVEDIR) == -1) {
+                    return {1, "", "rm: failed to remove directory '" + path + "': " + strerror(errno)};
+                }
+
+            } else {
+                return {1, "", "rm: '" + path + "' is a directory"};
+            }
+        } else {
+            if (unlinkat(cwdFd, path.c_str(), 0) == -1) {
+                return {1, "", "rm: cannot remove '" + path + "': " + strerror(errno)};
+            }
+        }
+    }
+
+    return {0, out, ""};
+}
+
+/**
+ * @brief Move files or directories from one location to another.
+ * @param args Must contain exactly two arguments:
+ *        - args[0]: Source file or directory path
+ *        - args[1]: Destination path
+ * @return Status code, empty output on success, or an error message on failure
+ */
+CommandResult Commands::mvCommand(const std::vector<std::string>& args) {
+    if (args.size() != 2) {
+        return {1, "", "mv: requires exactly two arguments: source and destination"};
+    }
+
+    const std::string& src = args[0];
+    std::string dest = args[1];
+    const int cwdFd = ExecContext::current().dirfd();
+
+    struct stat st;
+    if (fstatat(cwdFd, dest.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+        std::string filename = src.substr(src.find_last_of("/\\") + 1);
+        if (dest.back() != '/' && dest.back() != '\\') {
+            dest += "/";
+        }
+        dest += filename;
+    }
+
+    /**
+     * rename() fails with EXDEV ("Invalid cross-device link") when the source 
+     * and destination are on different filesystems (like on Docker bind mounts and volumes).
+     * In this case, the correct fallback behavior is:
+    *    1. Copy the source file to the destination path, and
+    *    2. Remove the original file
+    */
+    if (renameat(cwdFd, src.c_str(), cwdFd, dest.c_str()) != 0) {
+        if (errno == EXDEV) {
+            int in = openat(cwdFd, src.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in == -1) {
+                return {1, "", "mv: cannot open source file '" + src + "'"};
+            }
+
+            int out = openat(cwdFd, dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (out == -1) {
+                close(in);
+                return {1, "", "mv: cannot create destination file '" + dest + "'"};
+            }
+
+            bool writeFailed = false;
+            FileReader reader(in);
+            bool readOk = reader.forEachChunk([&](const char* data, size_t size) {
+                writeFailed = !writeFully(out, data, size);
+                return !writeFailed;
+            });
+
+            if (writeFailed || !readOk) {
+                close(in);
+                close(out);
+                return {1, "", writeFailed ? "mv: write error while copying to '" + dest + "'"
+                                           : "mv: read error on '" + src + "'"};
+            }
+
+            close(in);
+            close(out);
+
+            if (unlinkat(cwdFd, src.c_str(), 0) != 0) {
+                return {1, "", "mv: copied but failed to remove original '" + src + "'"};
+            }
+
+            return {0, "", ""};
+        }
+
+        return {1, "", "mv: failed to move '" + src + "' to '" + dest + "': " + strerror(errno)};
+    }
+
+    return {0, "", ""};
+}
+
+/**
+ * A chmod mode compiled to masks: the new mode is (mode & keep) | set.
+ * 'X' makes the result depend on the file, so there is a second pair for
+ * directories and files that already have an execute bit. As with chmod,
+ * directories keep their set-user-ID and set-group-ID bits unless the mode
+ * names them.
+ */
+struct ModeChange {
+    mode_t keep = 07777, set = 0;
+    mode_t keepExec = 07777, setExec = 0;
+    mode_t keepDirSpecial = S_ISUID | S_ISGID;
+
+    mode_t apply(mode_t mode) const {
+        bool exec = S_ISDIR(mode) || (mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+        mode_t result = exec ? (mode & keepExec) | setExec : (mode & keep) | set;
+        return S_ISDIR(mode) ? result | (mode & keepDirSpecial) : result;
+    }
+};
+
+/**
+ * @brief The process's umask, from /proc/self/status. Setting it to read
+ *        it back, as umask() requires, would race with jobs on other
+ *        threads creating files meanwhile.
+ * @return The umask, or 022 if the kernel does not report it
+ */
+static mode_t currentUmask() {
+    int fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 022;
+    }
+    char text[4096];
+    ssize_t n = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 022;
+    }
+    text[n] = '\0';
+
+    const char* field = strstr(text, "\nUmask:");
+    if (!field) {
+        return 022;
+    }
+    return static_cast<mode_t>(strtoul(field + 7, nullptr, 8)) & 0777;
+}
+
+/**
+ * @brief Compile an octal mode or comma-separated symbolic clauses such as
+ *        "u+x,g-w,o=r" or "a+rX" ([ugoa]*[+-=][rwxXst]*)
+ * @return False if the mode is invalid
+ * @note Without u, g, o or a a clause affects all classes, less the umask.
+ */
+static bool compileMode(const std::string& text, ModeChange& change) {
+    if (!text.empty() && text.find_first_not_of("01234567") == std::string::npos) {
+        if (text.size() > 5) {
+            return false;
+        }
+        change.keep = change.keepExec = 0;
+        change.set = change.setExec = std::stoul(text, nullptr, 8);
+        if (change.set > 07777) {
+            return false;
+        }
+        // Only a fifth digit clears a directory's set-ID bits
+        if (text.size() == 5) {
+            change.keepDirSpecial = 0;
+        }
+        return true;
+    }
+
+    mode_t mask = currentUmask();
+
+    size_t i = 0;
+    while (true) {
+        mode_t who = 0;
+        for (; i < text.size() && strchr("ugoa", text[i]); ++i) {
+            switch (text[i]) {
+                case 'u': who |= S_ISUID | S_IRWXU; break;
+                case 'g': who |= S_ISGID | S_IRWXG; break;
+                case 'o': who |= S_ISVTX | S_IRWXO; break;
+                default:  who |= 07777; break;
+            }
+        }
+        bool implicit = who == 0;
+        if (implicit) {
+            who = 07777 & ~mask;
+        }
+
+        if (i == text.size() || !strchr("+-=", text[i])) {
+            return false;
+        }
+
+        // One or more operations, each with its permission letters
+        while (i < text.size() && strchr("+-=", text[i])) {
+            char op = text[i++];
+            mode_t bits = 0, execBits = 0;
+
+            for (; i < text.size() && strchr("rwxXst", text[i]); ++i) {
+                switch (text[i]) {
+                    case 'r': bits |= S_IRUSR | S_IRGRP | S_IROTH; break;
+                    case 'w': bits |= S_IWUSR | S_IWGRP | S_IWOTH; break;
+                    case 'x': bits |= S_IXUSR | S_IXGRP | S_IXOTH; break;
+                    case 'X': execBits |= S_IXUSR | S_IXGRP | S_IXOTH; break;
+                    case 's': bits |= S_ISUID | S_ISGID; break;
+                    case 't': bits |= S_ISVTX; break;
+                }
+            }
+            execBits = (execBits | bits) & who;
+            bits &= who;
+            if (op != '+') {
+                change.keepDirSpecial &= ~(bits & (S_ISUID | S_ISGID));
+            }
+
+            auto applyOp = [&](mode_t& keep, mode_t& set, mode_t opBits) {
+                if (op == '+') {
+                    set |= opBits;
+                } else if (op == '-') {
+                    keep &= ~opBits;
+                    set &= ~opBits;
+                } else {
+                    // "=" without a class clears everything, but sets only what the umask allows
+                    mode_t cleared = implicit ? 07777 : who;
+                    keep &= ~cleared;
+                    set = (set & ~cleared) | opBits;
+                }
+            };
+            applyOp(change.keep, change.set, bits);
+            applyOp(change.keepExec, change.setExec, execBits);
+        }
+
+        if (i == text.size()) {
+            return true;
+        }
+        if (text[i++] != ',') {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Modify file permissions, optionally recursively
+ * @param args Optional "-R", then the mode (octal, or symbolic such as
+ *        "u+x,g-w"), then one or more paths
+ * @return Status code, empty output on success, or error messages on failure
+ * @note The mode is compiled once; entries whose mode would not change are
+ *       not touched. Symbolic links inside the trees are skipped, as with chmod -R.
+ */
+CommandResult Commands::chmodCommand(const std::vector<std::string>& args) {
+    bool recursive = false;
+    size_t idx = 0;
+    if (!args.empty() && args[0] == "-R") {
+        recursive = true;
+        ++idx;
+    }
+
+    if (args.size() - idx < 2) {
+        return {1, "", "chmod: requires a mode and at least one file"};
+    }
+
+    ModeChange change;
+    if (!compileMode(args[idx], change)) {
+        return {1, "", "chmod: invalid mode: '" + args[idx] + "'"};
+    }
+
+    std::vector<std::string> paths(args.begin() + idx + 1, args.end());
+
+    std::string errors = forEachTarget("chmod", paths, recursive, [&](const WalkEntry& entry) -> std::string {
+        if (entry.depth > 0 && entry.type == DT_LNK) {
+            return "";
+        }
+
+        struct stat st;
+        if (fstatat(entry.dirfd, entry.name, &st, 0) == -1) {
+            return "chmod: cannot access '" + entry.path + "': " + strerror(errno);
+        }
+
+        mode_t mode = change.apply(st.st_mode);
+        if (mode == (st.st_mode & 07777)) {
+            return "";
+        }
+        if (fchmodat(entry.dirfd, entry.name, mode, 0) != 0) {
+            return "chmod: failed to change permissions for '" + entry.path + "': " + strerror(errno);
+        }
+        return "";
+    });
+
+    return {errors.empty() ? 0 : 1, "", errors};
+}
+
+/* --- Helper Functions --- */
+std::string Commands::formatLsLongListing(const std::string& name, const struct stat& info) {
+    std::string out;
+
+    char type = S_ISDIR(info.st_mode) ? 'd' : '-';
+    out += type;
+
+    out += ((info.st_mode & S_IRUSR) ? 'r' : '-');
+    out += ((info.st_mode & S_IWUSR) ? 'w' : '-');
+    out += ((info.st_mode & S_IXUSR) ? 'x' : '-');
+    out += ((info.st_mode & S_IRGRP) ? 'r' : '-');
+    out += ((info.st_mode & S_IWGRP) ? 'w' : '-');
+    out += ((info.st_mode & S_IXGRP) ? 'x' : '-');
+    out += ((info.st_mode & S_IROTH) ? 'r' : '-');
+    out += ((info.st_mode & S_IWOTH) ? 'w' : '-');
+    out += ((info.st_mode & S_IXOTH) ? 'x' : '-');
+
+    out += " " + std::to_string(info.st_size);
+    out += " " + name + "\n";
+
+    return out;
+}
+
+/**
+ * @brief Format a byte count the way du -h does ("512", "4.0K", "12M")
+ */
+std::string Commands::formatHumanSize(uint64_t bytes) {
+    if (bytes < 1024) {
+        return std::to_string(bytes);
+    }
+
+    const char* units = "KMGTPE";
+    double value = bytes / 1024.0;
+    int unit = 0;
+
+    while (value >= 1024 && units[unit + 1]) {
+        value /= 1024;
+        ++unit;
+    }
+
+    char buffer[32];
+    if (value < 10) {
+        snprintf(buffer, sizeof(buffer), "%.1f%c", std::ceil(value * 10) / 10, units[unit]);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.0f%c", std::ceil(value), units[unit]);
+    }
+    return buffer;
+}
+
+std::string Commands::formatRmdirErrorMsg(const std::string& path) {
+    switch (errno) {
+        case ENOTEMPTY:
+        case EEXIST:
+            return "rmdir: failed to remove '" + path + "': directory not empty";
+
+        case ENOENT:
+            return "rmdir: failed to remove '" + path + "': no such file or directory";
+
+        case ENOTDIR:
+            return "rmdir: failed to remove '" + path + "': not a directory";
+
+        case EACCES:
+        case EPERM:
+            return "rmdir: failed to remove '" + path + "': permission denied";
+
+        default:
+            return "rmdir: failed to remove '" + path + "': " + std::string(strerror(errno));
+    }
+}
+
+/**
+ * grep's line selection over blocks of whole lines, where only the last
+ * line of the input may lack its '\n'. Each selected line, or with -o each
+ * match, is passed to emit as a view into the block.
+ */
+class Commands::GrepScanner {
+public:
+    using EmitFn = std::function<void(const char* text, const char* textEnd, long lineNumber)>;
+
+    /**
+     * @param limit Stop after this many selected lines (-1 for no limit)
+     */
+    GrepScanner(const GrepOptions& opts, const LineMatcher& matcher, long limit, EmitFn emit)
+        : opts(opts), matcher(matcher), limit(limit), emit(std::move(emit)) {}
+
+    /**
+     * @brief Select lines from [start, end)
+     * @return False once the limit is reached
+     * @note When the matcher can search whole blocks (fixed strings), lines without a
+     *       match are skipped without being split out one by one.
+     */
+    bool scan(const char* start, const char* end) {
+        auto lineEndAfter = [end](const char* p) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            return nl ? nl : end;
+        };
+
+        if (!matcher.searchesBlocks() || opts.invert) {
+            while (start < end) {
+                const char* nl = lineEndAfter(start);
+                if (!handleLine(start, nl)) return false;
+                start = nl + 1;
+            }
+            return true;
+        }
+
+        // Jump from match to match; the lines in between cannot be selected
+        while (start < end) {
+            const char* matchBegin;
+            const char* matchEnd;
+            if (!matcher.find(start, start, end, matchBegin, matchEnd)) {
+                if (opts.lineNumbers) lineNumber += std::count(start, end, '\n');
+                return true;
+            }
+
+            const char* line = static_cast<const char*>(memrchr(start, '\n', matchBegin - start));
+            line = line ? line + 1 : start;
+            const char* nl = lineEndAfter(matchBegin);
+
+            if (opts.lineNumbers) lineNumber += std::count(start, line, '\n');
+            if (!handleLine(line, nl)) return false;
+            start = nl + 1;
+        }
+        return true;
+    }
+
+    long matches() const { return selected; }
+
+private:
+    const GrepOptions& opts;
+    const LineMatcher& matcher;
+    long limit;
+    EmitFn emit;
+    long selected = 0;
+    long lineNumber = 1;
+
+    // Select or reject one line; false once the limit is reached
+    bool handleLine(const char* line, const char* lineEnd) {
+        const char* matchBegin = nullptr;
+        const char* matchEnd = nullptr;
+        bool matched = matcher.find(line, line, lineEnd, matchBegin, matchEnd);
+
+        if (matched != opts.invert) {
+            ++selected;
+
+            if (opts.onlyMatching && !opts.invert && !opts.countOnly) {
+                // Every non-empty match on the line, left to right
+                do {
+                    if (matchEnd > matchBegin) {
+                        emit(matchBegin, matchEnd, lineNumber);
+                    } else if (matchEnd == lineEnd) {
+                        break;
+                    } else {
+                        ++matchEnd;
+                    }
+                } while (matcher.find(line, matchEnd, lineEnd, matchBegin, matchEnd));
+            } else if (!opts.countOnly) {
+                emit(line, lineEnd, lineNumber);
+            }
+        }
+
+        ++lineNumber;
+        return limit < 0 || selected < limit;
+    }
+};
+
+/**
+ * @brief Search one open file line by line, appending selected lines to out
+ * @param prefix Text placed before each output line (file name and ':' or empty)
+ * @param limit Stop after this many selected lines (-1 for no limit)
+ * @param skipBinary Give up, setting isBinary, if the first block contains a NUL byte
+ * @return Number of selected lines
+ */
+long Commands::grepFd(int fd, const std::string& prefix, const GrepOptions& opts, const LineMatcher& matcher,
+                      long limit, bool skipBinary, OutputBuffer& out, bool& isBinary) {
+    const size_t binaryCheckSize = 64 * 1024;
+    bool firstBlock = true;
+    isBinary = false;
+
+    GrepScanner scanner(opts, matcher, limit, [&](const char* text, const char* textEnd, long lineNumber) {
+        out.append(prefix);
+        if (opts.lineNumbers) {
+            out.append(std::to_string(lineNumber) + ":");
+        }
+        out.append(text, textEnd - text);
+        out.append("\n", 1);
+    });
+
+    FileReader reader(fd);
+    reader.forEachLineBlock([&](const char* data, size_t size) {
+        if (firstBlock) {
+            firstBlock = false;
+            if (skipBinary && memchr(data, '\0', std::min(size, binaryCheckSize)) != nullptr) {
+                isBinary = true;
+                return false;
+            }
+        }
+        return scanner.scan(data, data + size);
+    });
+
+    return isBinary ? 0 : scanner.matches();
+}
+
+std::string Commands::stripTrailingNewline(const std::string& s) {
+    if (!s.empty() && s.back() == '\n') {
+        return s.substr(0, s.size() - 1);
+    }
+    return s;
 }
 
 bool Commands::isFileEmpty(const std::string& filename) {
     struct stat st;
-    if (stat(filename.c_str(), &st) != 0) {
+    if (fstatat(ExecContext::current().dirfd(), filename.c_str(), &st, 0) != 0) {
         return false;
     }
     return st.st_size == 0;
 }
+
+/* --- Pipeline Stages --- */
+
+/**
+ * cat reading its input: passes every block on unchanged
+ */
+class CatStage : public StreamStage {
+public:
+    bool write(const char* data, size_t size) override {
+        return emit(data, size);
+    }
+};
+
+/**
+ * head: passes on the first lines or bytes, then asks for no more input
+ */
+class HeadStage : public StreamStage {
+public:
+    HeadStage(long lines, long bytes) : remaining(bytes >= 0 ? bytes : lines), countBytes(bytes >= 0) {}
+
+    bool write(const char* data, size_t size) override {
+        const char* end = data;
+        if (countBytes) {
+            end += std::min<size_t>(size, remaining);
+            remaining -= end - data;
+        } else {
+            const char* limit = data + size;
+            while (remaining > 0 && end < limit) {
+                const char* nl = static_cast<const char*>(memchr(end, '\n', limit - end));
+                end = nl ? nl + 1 : limit;
+                --remaining;
+            }
+        }
+
+        bool more = end == data || emit(data, end - data);
+        return more && remaining > 0;
+    }
+
+private:
+    long remaining;
+    bool countBytes;
+};
+
+/**
+ * tail: "+N" passes on everything from line N; otherwise the end of the
+ * input is kept, trimmed as it grows, and passed on at the end
+ */
+class TailStage : public StreamStage {
+public:
+    TailStage(long lines, long bytes, bool fromStart)
+        : skip(fromStart && bytes < 0 ? std::max(lines - 1, 0L) : -1),
+          skipBytes(fromStart && bytes >= 0 ? std::max(bytes - 1, 0L) : -1),
+          window(lines, bytes) {}
+
+    bool write(const char* data, size_t size) override {
+        if (skipBytes >= 0) {
+            size_t skipped = std::min<size_t>(size, skipBytes);
+            skipBytes -= skipped;
+            return skipped == size || emit(data + skipped, size - skipped);
+        }
+        if (skip >= 0) {
+            const char* end = data + size;
+            while (skip > 0 && data < end) {
+                const char* nl = static_cast<const char*>(memchr(data, '\n', end - data));
+                data = nl ? nl + 1 : end;
+                --skip;
+            }
+            return data == end || emit(data, end - data);
+        }
+
+        window.add(data, size);
+        return true;
+    }
+
+    void finish() override {
+        if (skip < 0 && skipBytes < 0 && window.size() > 0) {
+            emit(window.data(), window.size());
+        }
+        StreamStage::finish();
+    }
+
+private:
+    long skip;              // lines still to skip with "+N", -1 otherwise
+    long skipBytes;         // bytes still to skip with "-c +N", -1 otherwise
+    TailWindow window;
+};
+
+/**
+ * wc reading its input: prints the counts, without a file name, at the end
+ */
+class WcStage : public StreamStage {
+public:
+    WcStage(bool countLines, bool countWords, bool countChars)
+        : countLines(countLines), countWords(countWords), countChars(countChars) {}
+
+    bool write(const char* data, size_t size) override {
+        counts.add(data, size, countWords);
+        return true;
+    }
+
+    void finish() override {
+        std::string out = counts.format(countLines, countWords, countChars);
+        out.back() = '\n';
+        emit(out.data(), out.size());
+        StreamStage::finish();
+    }
+
+private:
+    WcCounts counts;
+    bool countLines, countWords, countChars;
+};
+
+/**
+ * grep reading its input. Runs of adjacent selected lines are passed on as
+ * one view into the input block; only -n and -o output is formatted into a
+ * buffer of its own.
+ */
+class Commands::GrepStage : public StreamStage {
+public:
+    GrepStage(const GrepOptions& options, std::shared_ptr<const LineMatcher> lineMatcher)
+        : opts(options), matcher(std::move(lineMatcher)),
+          scanner(opts, *matcher, opts.maxCount,
+                  [this](const char* text, const char* textEnd, long lineNumber) { select(text, textEnd, lineNumber); }) {}
+
+    bool write(const char* data, size_t size) override {
+        if (opts.maxCount == 0) {
+            return false;
+        }
+        blockEnd = data + size;
+        bool more = scanner.scan(data, blockEnd);
+        flush();
+        return more && !stopped;
+    }
+
+    void finish() override {
+        if (opts.countOnly) {
+            std::string count = std::to_string(scanner.matches()) + "\n";
+            emit(count.data(), count.size());
+        }
+        status = opts.countOnly || scanner.matches() > 0 ? 0 : 1;
+        StreamStage::finish();
+    }
+
+private:
+    GrepOptions opts;
+    std::shared_ptr<const LineMatcher> matcher;
+    GrepScanner scanner;
+
+    const char* blockEnd = nullptr;
+    const char* runBegin = nullptr;
+    const char* runEnd = nullptr;
+    std::string formatted;
+    bool stopped = false;
+
+    void select(const char* text, const char* textEnd, long lineNumber) {
+        if (stopped) {
+            return;
+        }
+
+        // The stream's last line may lack its '\n'; it is copied so one can be added
+        if (opts.lineNumbers || opts.onlyMatching || textEnd == blockEnd) {
+            flushRun();
+            if (opts.lineNumbers) {
+                formatted += std::to_string(lineNumber) + ":";
+            }
+            formatted.append(text, textEnd);
+            formatted += '\n';
+            return;
+        }
+
+        if (text != runEnd) {
+            flushRun();
+            runBegin = text;
+        }
+        runEnd = textEnd + 1;
+    }
+
+    void flushRun() {
+        if (runBegin != runEnd && !stopped) {
+            stopped = !emit(runBegin, runEnd - runBegin);
+        }
+        runBegin = runEnd = nullptr;
+    }
+
+    void flush() {
+        flushRun();
+        if (!formatted.empty() && !stopped) {
+            stopped = !emit(formatted.data(), formatted.size());
+        }
+        formatted.clear();
+    }
+};
+
+/**
+ * tee: passes its input on unchanged and writes it to every file too.
+ * Small blocks gather in one buffer shared by all the files, so a byte is
+ * copied once however many files there are; a block that does not fit is
+ * written from where it lies, after the buffer, with one writev per file.
+ * Input that spilled to a file is copied to the files by the kernel
+ * (copy_file_range), except where it cannot be (-a, other file systems).
+ * The files are opened (and truncated) only once the pipeline runs, so a
+ * stage that is built and then dropped leaves them alone.
+ */
+class TeeStage : public StreamStage {
+public:
+    static constexpr size_t BUFFER_SIZE = 256 << 10;
+
+    TeeStage(const std::vector<std::string>& files, bool append)
+        : files(files), append(append), cwdFd(ExecContext::current().dirfd()) {}
+
+    ~TeeStage() override {
+        for (const Output& output : outputs) {
+            if (output.fd != -1) {
+                close(output.fd);
+            }
+        }
+    }
+
+    void inputFile(int fd, size_t size) override {
+        openOutputs();
+        for (Output& output : outputs) {
+            off_t offset = 0;
+            while (offset < static_cast<off_t>(size)) {
+                ssize_t n = copy_file_range(fd, &offset, output.fd, nullptr, size - offset, 0);
+                if (n > 0 || (n == -1 && errno == EINTR)) {
+                    continue;
+                }
+                // Nothing copied yet: leave it to write()
+                if (offset == 0 && (n == 0 || errno == EXDEV || errno == EINVAL || errno == EBADF ||
+                                    errno == ENOSYS || errno == EOPNOTSUPP)) {
+                    break;
+                }
+                fail("error writing '" + output.name + "'", n == 0 ? EIO : errno);
+                break;
+            }
+            output.copied = offset > 0;
+        }
+    }
+
+    bool write(const char* data, size_t size) override {
+        openOutputs();
+        if (buffer.size() + size <= BUFFER_SIZE) {
+            buffer.append(data, size);
+        } else {
+            writeOut(data, size);
+        }
+        return emit(data, size);
+    }
+
+    void finish() override {
+        openOutputs();
+        writeOut(nullptr, 0);
+        StreamStage::finish();
+    }
+
+private:
+    struct Output {
+        int fd;
+        std::string name;
+        bool copied;    // already holds the whole input
+    };
+
+    std::vector<std::string> files;
+    bool append;
+    int cwdFd;
+    bool opened = false;
+    std::vector<Output> outputs;
+    std::string buffer;
+
+    /**
+     * @brief Open the files on the first input or at the end, whichever comes first
+     */
+    void openOutputs() {
+        if (opened) {
+            return;
+        }
+        opened = true;
+
+        const int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+        for (const std::string& file : files) {
+            int fd = openat(cwdFd, file.c_str(), flags, 0666);
+            if (fd == -1) {
+                fail("cannot open '" + file + "' for writing", errno);
+            } else {
+                outputs.push_back({fd, file, false});
+            }
+        }
+    }
+
+    /**
+     * @brief Write the buffer and then data to every file, and empty the buffer
+     */
+    void writeOut(const char* data, size_t size) {
+        for (Output& output : outputs) {
+            if (output.copied || output.fd == -1) {
+                continue;
+            }
+            struct iovec iov[2] = {{&buffer[0], buffer.size()}, {const_cast<char*>(data), size}};
+            if (!writeFully(output.fd, iov, 2)) {
+                fail("error writing '" + output.name + "'", errno);
+                close(output.fd);
+                output.fd = -1;
+            }
+        }
+        buffer.clear();
+    }
+
+    static bool writeFully(int fd, struct iovec* iov, int count) {
+        while (count > 0) {
+            ssize_t n = writev(fd, iov, count);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1) {
+                return false;
+            }
+            // Skip what was written, which may end inside an iovec
+            while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+                n -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
+    void fail(const std::string& what, int err) {
+        status = 1;
+        error += (error.empty() ? "" : "\n") + std::string("tee: ") + what + ": " + strerror(err);
+    }
+};
+
+/**
+ * sort reading its input: every block goes to a LineSorter, which spills
+ * runs past its memory budget, and the sorted lines are passed on at the end
+ */
+class SortStage : public StreamStage {
+public:
+    explicit SortStage(const LineSorter::Options& options) : sorter(options) {}
+
+    bool write(const char* data, size_t size) override {
+        std::string message;
+        if (!sorter.add(data, size, message)) {
+            fail(message);
+            return false;
+        }
+        return true;
+    }
+
+    void finish() override {
+        std::string message;
+        sorter.endInput();
+        if (status == 0 &&
+            !sorter.finish([this](const char* data, size_t size) { return emit(data, size); }, message)) {
+            fail(message);
+        }
+        StreamStage::finish();
+    }
+
+private:
+    LineSorter sorter;
+
+    void fail(const std::string& message) {
+        status = 1;
+        error = "sort: " + message;
+    }
+};
+
+/**
+ * xargs reading its arguments from its input: lines are split as they
+ * arrive, and the commands run at the end with their output passed on
+ */
+class XargsStage : public StreamStage {
+public:
+    explicit XargsStage(XargsOptions options) : options(std::move(options)) {}
+
+    bool write(const char* data, size_t size) override {
+        const char* end = data + size;
+        while (data < end) {
+            const char* nl = static_cast<const char*>(memchr(data, '\n', end - data));
+            const char* lineEnd = nl ? nl : end;
+            if (!partial.empty() || nl == nullptr) {
+                partial.append(data, lineEnd);
+                if (nl == nullptr) {
+                    break;
+                }
+                splitArguments(partial.data(), partial.size(), !options.replace.empty(), inputs);
+                partial.clear();
+            } else {
+                splitArguments(data, lineEnd - data, !options.replace.empty(), inputs);
+            }
+            data = lineEnd + 1;
+        }
+        return true;
+    }
+
+    void finish() override {
+        if (!partial.empty()) {
+            splitArguments(partial.data(), partial.size(), !options.replace.empty(), inputs);
+        }
+        CommandResult result = runXargs(options, inputs);
+        status = result.status;
+        error = result.error;
+
+        if (result.spill) {
+            result.spill->forEachLineBlock([this](const char* data, size_t size) { return emit(data, size); });
+        } else if (!result.output.empty()) {
+            emit(result.output.data(), result.output.size());
+        }
+        size_t size = result.spill ? result.spill->size() : result.output.size();
+        if (size > 0 && result.trailingNewline) {
+            emit("\n", 1);
+        }
+        StreamStage::finish();
+    }
+
+private:
+    XargsOptions options;
+    std::vector<std::string> inputs;
+    std::string partial;    // a line continued in the next block
+};
+
+/**
+ * @brief Parse tee's options
+ * @return An error message, or an empty string on success
+ */
+static std::string parseTeeArgs(const std::vector<std::string>& args, bool& append,
+                                std::vector<std::string>& files) {
+    append = false;
+    bool options = true;
+    for (const std::string& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg == "-a") {
+            append = true;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            return "tee: invalid option -- '" + arg + "'";
+        } else {
+            files.push_back(arg);
+        }
+    }
+    return "";
+}
+
+/**
+ * @brief Copy a pipeline's output to files while passing it on; see
+ *        TeeStage. Run on its own, with no input, tee only creates (or
+ *        with -a, keeps) its files.
+ * @param args Optional "-a" to append rather than truncate, then file paths
+ * @return Status code, and an error for each file that could not be written
+ */
+CommandResult Commands::teeCommand(const std::vector<std::string>& args) {
+    bool append;
+    std::vector<std::string> files;
+    std::string error = parseTeeArgs(args, append, files);
+    if (!error.empty()) {
+        return {1, "", error};
+    }
+
+    TeeStage stage(files, append);
+    return {stage.status, "", stage.error};
+}
+
+/**
+ * @brief Set up a builtin to run as a stage of a fused pipeline
+ * @param argv The builtin's name followed by its arguments
+ * @param files Receives the files the builtin reads instead of its input, if any
+ * @return The stage, or null if the builtin cannot run as one with these
+ *         arguments; it is then run on its own (and reports any usage error)
+ * @note Supported: cat, grep (without -r), head, tail (without -f), tee and
+ *       wc reading its input, sort without files and xargs without -a. grep,
+ *       head and tail take at most one file, since with several their output
+ *       names each file.
+ */
+std::unique_ptr<StreamStage> Commands::openStage(const std::vector<std::string>& argv,
+                                                 std::vector<std::string>& files) {
+    const std::string& name = argv[0];
+    std::vector<std::string> args(argv.begin() + 1, argv.end());
+    files.clear();
+
+    if (name == "cat") {
+        files = args;
+        return std::unique_ptr<StreamStage>(new CatStage);
+    }
+
+    if (name == "head" || name == "tail") {
+        long lines = 10;
+        long bytes = -1;
+        bool fromStart = false;
+        bool follow = false;
+        std::string error = parseCountOptions(name, args, lines, bytes, fromStart,
+                                              name == "tail" ? &follow : nullptr, files);
+        if (!error.empty() || follow || files.size() > 1) {
+            return nullptr;
+        }
+        if (name == "head") {
+            return std::unique_ptr<StreamStage>(new HeadStage(lines, bytes));
+        }
+        return std::unique_ptr<StreamStage>(new TailStage(lines, bytes, fromStart));
+    }
+
+    if (name == "tee") {
+        bool append;
+        std::vector<std::string> outputs;
+        if (!parseTeeArgs(args, append, outputs).empty()) {
+            return nullptr;
+        }
+        return std::unique_ptr<StreamStage>(new TeeStage(outputs, append));
+    }
+
+    if (name == "wc") {
+        bool countLines = false, countWords = false, countChars = false;
+        for (const std::string& arg : args) {
+            if (arg == "-l") countLines = true;
+            else if (arg == "-w") countWords = true;
+            else if (arg == "-c") countChars = true;
+            else return nullptr;
+        }
+        if (!countLines && !countWords && !countChars) {
+            countLines = countWords = countChars = true;
+        }
+        return std::unique_ptr<StreamStage>(new WcStage(countLines, countWords, countChars));
+    }
+
+    if (name == "sort") {
+        LineSorter::Options options;
+        if (!parseSortArgs(args, options, files).empty() || !files.empty()) {
+            files.clear();
+            return nullptr;
+        }
+        return std::unique_ptr<StreamStage>(new SortStage(options));
+    }
+
+    if (name == "xargs") {
+        XargsOptions options;
+        if (!parseXargsArgs(args, options).empty() || !options.file.empty()) {
+            return nullptr;
+        }
+        return std::unique_ptr<StreamStage>(new XargsStage(std::move(options)));
+    }
+
+    if (name == "grep") {
+        GrepOptions opts;
+        std::vector<std::string> patterns;
+        if (args.empty() || !parseGrepArgs(args, opts, patterns, files).empty() ||
+            opts.recursive || files.size() > 1) {
+            return nullptr;
+        }
+
+        std::string error;
+        std::shared_ptr<const LineMatcher> matcher =
+            LineMatcher::cached(patterns, opts.fixedStrings, opts.ignoreCase, opts.wordMatch, error);
+        if (!matcher) {
+            return nullptr;
+        }
+        return std::unique_ptr<StreamStage>(new GrepStage(opts, std::move(matcher)));
+    }
+
+    return nullptr;
+}
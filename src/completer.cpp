@@ -0,0 +1,515 @@
+#include "completer.h"
+#include "exec_context.h"
+#include "executor.h"
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t MAX_CANDIDATES = 256;
+static const size_t MAX_CACHED_DIRS = 64;
+
+void PrefixIndex::assign(std::vector<std::string> list) {
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+    names = std::move(list);
+}
+
+/**
+ * @brief Add one name in its sorted place
+ * @return False if it was already there
+ */
+bool PrefixIndex::insert(const std::string& name) {
+    auto pos = std::lower_bound(names.begin(), names.end(), name);
+    if (pos != names.end() && *pos == name) {
+        return false;
+    }
+    names.insert(pos, name);
+    return true;
+}
+
+/**
+ * @brief Remove one name
+ * @return False if it was not there
+ */
+bool PrefixIndex::erase(const std::string& name) {
+    auto pos = std::lower_bound(names.begin(), names.end(), name);
+    if (pos == names.end() || *pos != name) {
+        return false;
+    }
+    names.erase(pos);
+    return true;
+}
+
+bool PrefixIndex::contains(const std::string& name) const {
+    return std::binary_search(names.begin(), names.end(), name);
+}
+
+/**
+ * @brief Locate every name starting with a prefix
+ * @param prefix The prefix to look up
+ * @return Half-open iterator range of matching names, in sorted order
+ */
+std::pair<PrefixIndex::Iter, PrefixIndex::Iter> PrefixIndex::range(const std::string& prefix) const {
+    Iter first = std::lower_bound(names.begin(), names.end(), prefix);
+    Iter last = first;
+
+    if (prefix.empty()) {
+        return {names.begin(), names.end()};
+    }
+
+    // Every string with this prefix sorts below the prefix with its last byte incremented
+    std::string upper = prefix;
+    while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xFF) {
+        upper.pop_back();
+    }
+
+    if (upper.empty()) {
+        last = names.end();
+    } else {
+        upper.back() = static_cast<char>(static_cast<unsigned char>(upper.back()) + 1);
+        last = std::lower_bound(first, names.end(), upper);
+    }
+
+    return {first, last};
+}
+
+Completer::Completer() {
+    builtins.assign(Executor::builtinNames());
+}
+
+Completer::~Completer() {
+    if (notifyFd != -1) {
+        close(notifyFd);
+    }
+}
+
+/**
+ * @brief Complete the word ending at the cursor
+ * @param line The full input line
+ * @param cursor Byte offset of the cursor in the line
+ * @return Text to insert at the cursor, plus the candidate list when the match is ambiguous
+ */
+Completer::Result Completer::complete(const std::string& line, size_t cursor) {
+    Result result;
+    applyEvents();
+
+    size_t start = cursor;
+    while (start > 0 && !std::isspace(static_cast<unsigned char>(line[start - 1]))) {
+        --start;
+    }
+
+    std::string word = line.substr(start, cursor - start);
+
+    bool isCommand = true;
+    for (size_t i = 0; i < start; ++i) {
+        if (!std::isspace(static_cast<unsigned char>(line[i]))) {
+            isCommand = false;
+            break;
+        }
+    }
+
+    std::vector<std::string> matches;
+    std::string base = word;
+
+    if (isCommand && word.find('/') == std::string::npos) {
+        result.total = collect(commandIndex(), word, true, matches);
+    } else {
+        size_t slash = word.find_last_of('/');
+        std::string dirPart = (slash == std::string::npos) ? "" : word.substr(0, slash + 1);
+        base = (slash == std::string::npos) ? word : word.substr(slash + 1);
+
+        std::string dir = dirPart.empty() ? "." : dirPart;
+        if (dir[0] == '~') {
+            dir = ExecContext::current().variables().value("HOME") + dir.substr(1);
+        }
+
+        bool changed = false;
+        const PrefixIndex* index = directoryIndex(dir, false, dirs, changed);
+        if (index) {
+            result.total = collect(*index, base, !base.empty() && base[0] == '.', matches);
+        }
+    }
+
+    if (matches.empty()) {
+        return result;
+    }
+
+    std::string common = commonPrefix(matches);
+    result.insert = common.substr(base.size());
+
+    if (matches.size() == 1) {
+        if (common.back() != '/') {
+            result.insert += ' ';
+        }
+    } else {
+        result.candidates = std::move(matches);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Return the merged builtin + PATH executable index, refreshing only
+ *        the PATH directories whose mtime changed since the last lookup
+ */
+const PrefixIndex& Completer::commandIndex() {
+    // The shell's own PATH, so that an export at the prompt applies at once
+    std::string path = ExecContext::current().variables().value("PATH");
+
+    bool rebuild = false;
+    if (path != cachedPath) {
+        forget(pathDirs);
+        cachedPath = path;
+        rebuild = true;
+    }
+
+    std::vector<const PrefixIndex*> indexes;
+    size_t begin = 0;
+
+    while (begin <= path.size()) {
+        size_t end = path.find(':', begin);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+
+        std::string dir = path.substr(begin, end - begin);
+        if (!dir.empty()) {
+            bool changed = false;
+            const PrefixIndex* index = directoryIndex(dir, true, pathDirs, changed);
+            if (index) {
+                indexes.push_back(index);
+            }
+            rebuild = rebuild || changed;
+        }
+
+        begin = end + 1;
+    }
+
+    if (rebuild || commands.size() == 0) {
+        std::vector<std::string> all;
+        auto range = builtins.range("");
+        all.insert(all.end(), range.first, range.second);
+
+        for (const PrefixIndex* index : indexes) {
+            auto r = index->range("");
+            all.insert(all.end(), r.first, r.second);
+        }
+
+        commands.assign(std::move(all));
+    }
+
+    return commands;
+}
+
+/**
+ * @brief Fetch the cached index for a directory. A watched directory is
+ *        current already; any other one is rescanned when its inode or
+ *        modification time differs from the cached snapshot.
+ * @return The index, or nullptr when the directory cannot be read
+ */
+const PrefixIndex* Completer::directoryIndex(const std::string& dir, bool executablesOnly, DirMap& cache,
+                                             bool& changed) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) {
+        return nullptr;
+    }
+
+    auto iter = cache.find(dir);
+    if (iter != cache.end() && iter->second.ino == st.st_ino) {
+        const DirCache& entry = iter->second;
+        if ((entry.watch != -1 && !entry.stale) ||
+            (entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec)) {
+            return &iter->second.index;
+        }
+    }
+
+    if (iter == cache.end()) {
+        if (cache.size() >= MAX_CACHED_DIRS && !executablesOnly) {
+            forget(cache);
+        }
+        iter = cache.emplace(dir, DirCache{}).first;
+    } else if (iter->second.ino != st.st_ino) {
+        // Another directory under the same name, e.g. "." after a cd
+        unwatch(cache, dir, iter->second);
+    }
+
+    // Watched before the scan, so that nothing changed during it is missed
+    watch(cache, dir, iter->second);
+
+    std::vector<std::string> names;
+    if (!scanDirectory(dir, executablesOnly, names)) {
+        unwatch(cache, dir, iter->second);
+        cache.erase(iter);
+        return nullptr;
+    }
+
+    iter->second.ino = st.st_ino;
+    iter->second.mtime = st.st_mtim;
+    iter->second.stale = false;
+    iter->second.index.assign(std::move(names));
+    changed = true;
+
+    return &iter->second.index;
+}
+
+/**
+ * @brief Apply the inotify events queued since the last lookup to the
+ *        indexes of the watched directories
+ */
+void Completer::applyEvents() {
+    if (notifyFd == -1) {
+        return;
+    }
+
+    alignas(struct inotify_event) char buf[16384];
+    ssize_t n;
+    while ((n = read(notifyFd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Some changes are unknown: every index is checked against its mtime again
+                for (DirMap* cache : {&pathDirs, &dirs}) {
+                    for (auto& item : *cache) {
+                        item.second.stale = true;
+                    }
+                }
+                continue;
+            }
+
+            bool gone = event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED);
+            auto range = watches.equal_range(event->wd);
+            for (auto it = range.first; it != range.second; ++it) {
+                DirMap& cache = *it->second.first;
+                auto entry = cache.find(it->second.second);
+                if (entry == cache.end()) {
+                    continue;
+                }
+                if (gone) {
+                    // The name may now lead somewhere else; rescan it if it is used again
+                    entry->second.watch = -1;
+                    entry->second.stale = true;
+                } else if (event->len > 0) {
+                    updateName(cache, entry->first, entry->second, event->name);
+                }
+            }
+            if (gone) {
+                if (!(event->mask & IN_IGNORED)) {
+                    inotify_rm_watch(notifyFd, event->wd);
+                }
+                watches.erase(event->wd);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Bring one name of a watched directory up to date in its index,
+ *        and in the merged command index for a PATH directory
+ */
+void Completer::updateName(DirMap& cache, const std::string& dir, DirCache& entry, const std::string& name) {
+    bool executablesOnly = &cache == &pathDirs;
+    std::string indexed;
+    bool present = false;
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd != -1) {
+        struct stat st;
+        present = fstatat(dfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                  indexedName(dfd, name.c_str(), DT_UNKNOWN, executablesOnly, indexed);
+        close(dfd);
+    }
+
+    entry.index.erase(name);
+    entry.index.erase(name + "/");
+    if (present) {
+        entry.index.insert(indexed);
+    }
+
+    if (!executablesOnly || commands.size() == 0) {
+        return;
+    }
+    if (present) {
+        commands.insert(name);
+        return;
+    }
+    // Still a command if a builtin or another PATH directory provides it
+    if (builtins.contains(name)) {
+        return;
+    }
+    for (const auto& item : pathDirs) {
+        if (item.second.index.contains(name)) {
+            return;
+        }
+    }
+    commands.erase(name);
+}
+
+/**
+ * @brief Start watching a directory for its cache entry. Without inotify,
+ *        or past the user's watch limit, the entry keeps relying on its mtime.
+ */
+void Completer::watch(DirMap& cache, const std::string& dir, DirCache& entry) {
+    if (entry.watch != -1) {
+        return;
+    }
+    if (notifyFd == -1) {
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notifyFd == -1) {
+            return;
+        }
+    }
+
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                          IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+    entry.watch = inotify_add_watch(notifyFd, dir.c_str(), mask);
+    if (entry.watch != -1) {
+        watches.emplace(entry.watch, std::make_pair(&cache, dir));
+    }
+}
+
+void Completer::unwatch(DirMap& cache, const std::string& dir, DirCache& entry) {
+    if (entry.watch == -1) {
+        return;
+    }
+
+    // One watch serves a directory indexed both as a PATH entry and as a listing
+    bool shared = false;
+    auto range = watches.equal_range(entry.watch);
+    for (auto it = range.first; it != range.second; ) {
+        if (it->second.first == &cache && it->second.second == dir) {
+            it = watches.erase(it);
+        } else {
+            shared = true;
+            ++it;
+        }
+    }
+    if (!shared) {
+        inotify_rm_watch(notifyFd, entry.watch);
+    }
+    entry.watch = -1;
+}
+
+/**
+ * @brief Drop every entry of a cache along with its watch
+ */
+void Completer::forget(DirMap& cache) {
+    for (auto& item : cache) {
+        unwatch(cache, item.first, item.second);
+    }
+    cache.clear();
+}
+
+/**
+ * @brief Read a directory once, using d_type to avoid a stat per entry where
+ *        the filesystem reports it
+ */
+bool Completer::scanDirectory(const std::string& dir, bool executablesOnly, std::vector<std::string>& out) {
+    DIR* dirp = opendir(dir.c_str());
+    if (!dirp) {
+        return false;
+    }
+
+    int dfd = dirfd(dirp);
+    struct dirent* dp;
+
+    while ((dp = readdir(dirp)) != nullptr) {
+        std::string name = dp->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        std::string indexed;
+        if (indexedName(dfd, dp->d_name, dp->d_type, executablesOnly, indexed)) {
+            out.push_back(std::move(indexed));
+        }
+    }
+
+    closedir(dirp);
+    return true;
+}
+
+/**
+ * @brief Decide how one directory entry is indexed: directories with a
+ *        trailing '/', and only executables for a PATH directory
+ * @param type The entry's d_type, DT_UNKNOWN if not known
+ * @return False if the entry is not indexed at all
+ */
+bool Completer::indexedName(int dirfd, const char* name, unsigned char type, bool executablesOnly,
+                            std::string& out) {
+    if (type == DT_UNKNOWN || type == DT_LNK) {
+        struct stat st;
+        if (fstatat(dirfd, name, &st, 0) == 0) {
+            type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+    }
+
+    if (executablesOnly) {
+        if (type == DT_DIR || faccessat(dirfd, name, X_OK, 0) == -1) {
+            return false;
+        }
+        out = name;
+    } else {
+        out = type == DT_DIR ? std::string(name) + "/" : std::string(name);
+    }
+    return true;
+}
+
+/**
+ * @brief Gather matches for a prefix, skipping dotfiles unless requested
+ */
+size_t Completer::collect(const PrefixIndex& index, const std::string& prefix, bool showHidden,
+                          std::vector<std::string>& out) {
+    auto range = index.range(prefix);
+
+    // Dotfiles are contiguous in sorted order, so they can be skipped as one block
+    auto hidden = std::make_pair(range.second, range.second);
+    if (prefix.empty() && !showHidden) {
+        hidden = index.range(".");
+    }
+
+    size_t total = (range.second - range.first) - (hidden.second - hidden.first);
+    if (total == 0) {
+        return 0;
+    }
+
+    // The common prefix of a sorted set is the common prefix of its ends, so
+    // large match sets only materialise the first MAX_CANDIDATES names plus the last one
+    std::string last;
+    for (auto it = range.second; it != range.first; ) {
+        --it;
+        if (it < hidden.first || it >= hidden.second) {
+            last = *it;
+            break;
+        }
+    }
+
+    for (auto it = range.first; it != range.second && out.size() < MAX_CANDIDATES; ++it) {
+        if (it >= hidden.first && it < hidden.second) {
+            continue;
+        }
+        out.push_back(*it);
+    }
+
+    if (total > out.size()) {
+        out.push_back(last);
+    }
+
+    return total;
+}
+
+std::string Completer::commonPrefix(const std::vector<std::string>& names) {
+    const std::string& first = names.front();
+    const std::string& last = names.back();
+
+    size_t n = 0;
+    while (n < first.size() && n < last.size() && first[n] == last[n]) {
+        ++n;
+    }
+
+    return first.substr(0, n);
+}
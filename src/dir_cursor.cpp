@@ -0,0 +1,94 @@
+#include "dir_cursor.h"
+#include "exec_context.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DirectoryCursor::DirectoryCursor(bool createParents, unsigned mode)
+    : createParents(createParents), mode(mode), baseFd(ExecContext::current().dirfd()) {}
+
+DirectoryCursor::~DirectoryCursor() {
+    popTo(0);
+    if (rootFd != -1) {
+        close(rootFd);
+    }
+}
+
+void DirectoryCursor::popTo(size_t depth) {
+    while (fds.size() > depth) {
+        close(fds.back());
+        fds.pop_back();
+        names.pop_back();
+    }
+}
+
+/**
+ * @brief Open (or with createParents, create) the directory holding path
+ * @param leaf Receives the last component of path, relative to the returned fd
+ * @param error Receives the strerror text if a parent cannot be opened
+ * @return A directory fd owned by the cursor, valid until the next call; -1 on error
+ */
+int DirectoryCursor::parentOf(const std::string& path, std::string& leaf, std::string& error) {
+    std::vector<std::string> components;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t slash = path.find('/', pos);
+        if (slash == std::string::npos) slash = path.size();
+        if (slash > pos && path.compare(pos, slash - pos, ".") != 0) {
+            components.emplace_back(path, pos, slash - pos);
+        }
+        pos = slash + 1;
+    }
+
+    bool isAbsolute = !path.empty() && path[0] == '/';
+    if (components.empty()) {
+        leaf = isAbsolute ? "/" : ".";
+    } else {
+        leaf = std::move(components.back());
+        components.pop_back();
+    }
+
+    if (isAbsolute != absolute) {
+        popTo(0);
+        absolute = isAbsolute;
+    }
+    if (absolute && rootFd == -1) {
+        rootFd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (rootFd == -1) {
+            error = strerror(errno);
+            return -1;
+        }
+    }
+
+    // Keep the directories this path shares with the previous one
+    size_t shared = 0;
+    while (shared < names.size() && shared < components.size() && names[shared] == components[shared]) {
+        ++shared;
+    }
+    popTo(shared);
+
+    for (size_t i = shared; i < components.size(); ++i) {
+        int parent = fds.empty() ? (absolute ? rootFd : baseFd) : fds.back();
+        const char* name = components[i].c_str();
+
+        int fd = openat(parent, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1 && errno == ENOENT && createParents) {
+            if (mkdirat(parent, name, mode) == -1 && errno != EEXIST) {
+                error = strerror(errno);
+                return -1;
+            }
+            fd = openat(parent, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (fd == -1) {
+            error = strerror(errno);
+            return -1;
+        }
+
+        fds.push_back(fd);
+        names.push_back(components[i]);
+    }
+
+    return fds.empty() ? (absolute ? rootFd : baseFd) : fds.back();
+}
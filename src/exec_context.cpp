@@ -0,0 +1,107 @@
+#include "exec_context.h"
+#include "cancel.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static thread_local ExecContext* installed = nullptr;
+
+ExecContext::ExecContext(int fd, std::string path, ShellVariables* vars)
+    : fd(fd), path(std::move(path)), vars(vars) {}
+
+ExecContext::~ExecContext() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+ExecContext& ExecContext::shell() {
+    static ExecContext* context = [] {
+        int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        auto* shellContext = new ExecContext(fd, pathOf(fd), &ShellVariables::global());
+        shellContext->isShell = true;
+        return shellContext;
+    }();
+    return *context;
+}
+
+ExecContext& ExecContext::current() {
+    return installed ? *installed : shell();
+}
+
+std::unique_ptr<ExecContext> ExecContext::fork() const {
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    std::unique_ptr<ExecContext> child(new ExecContext(copy, path, nullptr));
+    child->ownVars.reset(new ShellVariables(*vars));
+    child->vars = child->ownVars.get();
+    child->scope = scope;
+    return child;
+}
+
+/**
+ * @brief Move to another directory, relative to the current one
+ * @param error Receives strerror text if the directory cannot be opened
+ * @return False if the context is unchanged
+ */
+bool ExecContext::changeDirectory(const std::string& target, std::string& error) {
+    int newFd = openat(fd, target.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (newFd == -1) {
+        error = strerror(errno);
+        return false;
+    }
+
+    // The shell's own directory is also the process's, for code that still
+    // takes plain paths (tab completion, programs started without a context)
+    if (isShell && fchdir(newFd) == -1) {
+        error = strerror(errno);
+        close(newFd);
+        return false;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = newFd;
+    path = pathOf(fd);
+    vars->set("PWD", path);
+    return true;
+}
+
+std::string ExecContext::absolute(const std::string& relative) const {
+    if (!relative.empty() && relative[0] == '/') {
+        return relative;
+    }
+    if (relative.empty() || relative == ".") {
+        return path;
+    }
+    return path == "/" ? "/" + relative : path + "/" + relative;
+}
+
+/**
+ * @brief Physical path of an open directory, as getcwd() would report it
+ */
+std::string ExecContext::pathOf(int fd) {
+    char buffer[PATH_MAX];
+    std::string link = "/proc/self/fd/" + std::to_string(fd);
+    ssize_t n = readlink(link.c_str(), buffer, sizeof(buffer) - 1);
+    if (n > 0) {
+        return std::string(buffer, n);
+    }
+    return getcwd(buffer, sizeof(buffer)) ? std::string(buffer) : std::string("/");
+}
+
+ExecContext::Scope::Scope(ExecContext& context) : previous(installed), cancelScope(context.cancelScope()) {
+    installed = &context;
+    if (cancelScope) {
+        cancelScope->enterThread();
+    }
+}
+
+ExecContext::Scope::~Scope() {
+    if (cancelScope) {
+        cancelScope->leaveThread();
+    }
+    installed = previous;
+}
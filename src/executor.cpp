@@ -1,9 +1,68 @@
 #include "executor.h"
 #include "commands.h"
+#include "glob.h"
+#include "process.h"
+#include "variables.h"
+#include "exec_context.h"
+#include "stream.h"
+#include "cancel.h"
+#include "output_buffer.h"
 #include <iostream>
+#include <unordered_map>
+
+using BuiltinFn = CommandResult (*)(const std::vector<std::string>&);
+using BuiltinMap = std::unordered_map<std::string, BuiltinFn>;
+using BuiltinIter = BuiltinMap::const_iterator;
+
+static const BuiltinMap BUILTIN_TABLE = {
+    {"help",    Commands::helpCommand},
+    {"echo",    Commands::echoCommand},
+    {"pause",   Commands::pauseCommand},
+    {"ls",      Commands::lsCommand},
+    {"dir",     Commands::dirCommand},
+    {"find",    Commands::findCommand},
+    {"du",      Commands::duCommand},
+    {"cd",      Commands::cdCommand},
+    {"pwd",     Commands::pwdCommand},
+    {"clr",     Commands::clrCommand},
+    {"quit",    Commands::quitCommand},
+    {"environ", Commands::environCommand},
+    {"export",  Commands::exportCommand},
+    {"unset",   Commands::unsetCommand},
+    {"cat",     Commands::catCommand},
+    {"head",    Commands::headCommand},
+    {"tail",    Commands::tailCommand},
+    {"tee",     Commands::teeCommand},
+    {"wc",      Commands::wcCommand},
+    {"sort",    Commands::sortCommand},
+    {"sum",     Commands::sumCommand},
+    {"parallel", Commands::parallelCommand},
+    {"xargs",   Commands::xargsCommand},
+    {"patcache", Commands::patcacheCommand},
+    {"timeout", Commands::timeoutCommand},
+    {"limit",   Commands::limitCommand},
+    {"mkdir",   Commands::mkdirCommand},
+    {"rm",      Commands::rmCommand},
+    {"rmdir",   Commands::rmdirCommand},
+    {"touch",   Commands::touchCommand},
+    {"cp",      Commands::cpCommand},
+    {"chown",   Commands::chownCommand},
+    {"grep",    Commands::grepCommand},
+    {"mv",      Commands::mvCommand},
+    {"chmod",   Commands::chmodCommand}
+};
 
 CommandResult Executor::executeCommand(const AST& node) {
-    return execute(node);
+    CommandResult result = execute(node);
+
+    // Interrupted commands keep the output they produced; their errors are
+    // only the aftermath of stopping (e.g. ECANCELED from a reader)
+    if (Cancellation::requested()) {
+        result.status = Cancellation::STATUS;
+        result.error.clear();
+    }
+    ExecContext::current().variables().setLastStatus(result.status);
+    return result;
 }
 
 CommandResult Executor::execute(const AST& node) {
@@ -24,34 +83,245 @@ CommandResult Executor::execute(const AST& node) {
     return {1, "", "Unknown operator: " + op};
 }
 
+/**
+ * @brief Expand a command's words and dispatch it to a builtin, a variable
+ *        assignment, or an external program
+ */
 CommandResult Executor::runCommand(const AST& node) {
-    if (node.command == "help")  return Commands::helpCommand(node.args);
-    if (node.command == "echo")  return Commands::echoCommand(node.args);
-    if (node.command == "pause") return Commands::pauseCommand(node.args);
-    if (node.command == "ls")    return Commands::lsCommand(node.args);
-    if (node.command == "dir")   return Commands::dirCommand(node.args);
-    if (node.command == "cd")    return Commands::cdCommand(node.args);
-    if (node.command == "pwd")   return Commands::pwdCommand(node.args);
-    if (node.command == "clr")   return Commands::clrCommand(node.args);
-    if (node.command == "quit")  return Commands::quitCommand(node.args);
-    if (node.command == "environ") return Commands::environCommand(node.args);
-    if (node.command == "cat")   return Commands::catCommand(node.args);
-    if (node.command == "wc")    return Commands::wcCommand(node.args);
-    if (node.command == "mkdir") return Commands::mkdirCommand(node.args);
-    if (node.command == "rm")    return Commands::rmCommand(node.args);
-    if (node.command == "rmdir") return Commands::rmdirCommand(node.args);
-    if (node.command == "touch") return Commands::touchCommand(node.args);
-    if (node.command == "cp")    return Commands::cpCommand(node.args);
-    if (node.command == "chown") return Commands::chownCommand(node.args);
-    if (node.command == "grep")  return Commands::grepCommand(node.args);
-    if (node.command == "mv")    return Commands::mvCommand(node.args);
-    if (node.command == "chmod") return Commands::chmodCommand(node.args);
-
-    return {1, "", "Unknown command: " + node.command};
+    std::vector<std::string> argv = expandArgv(node);
+    if (argv.empty()) {
+        return {0, "", ""};
+    }
+
+    ExecContext& context = ExecContext::current();
+    ShellVariables& vars = context.variables();
+    const std::string& command = argv[0];
+    std::vector<std::string> args(argv.begin() + 1, argv.end());
+
+    if (isAssignment(command)) {
+        return assignVariables(command, args, vars);
+    }
+
+    BuiltinIter iter = BUILTIN_TABLE.find(command);
+
+    if (iter != BUILTIN_TABLE.end()) {
+        return iter->second(args);
+    }
+
+    if (!context.ownsTerminal()) {
+        return Process::capture(argv, vars);
+    }
+    return Process::run(argv, vars);
+}
+
+/**
+ * @brief Expand a command's name and arguments: variables, then globs
+ * @return The command name followed by its arguments, or nothing if the
+ *         name expanded to an empty string
+ */
+std::vector<std::string> Executor::expandArgv(const AST& node) {
+    ShellVariables& vars = ExecContext::current().variables();
+
+    std::string command = vars.expand(node.command);
+    std::vector<std::string> args = node.args;
+    std::vector<AST::Quoting> quoting = node.quoting;
+
+    expandVariables(args, quoting, vars);
+    Glob::expandArgs(args, quoting);
+
+    if (command.empty()) {
+        return {};
+    }
+
+    args.insert(args.begin(), std::move(command));
+    return args;
+}
+
+bool Executor::isAssignment(const std::string& word) {
+    size_t eq = word.find('=');
+    return eq != std::string::npos && ShellVariables::isValidName(word.substr(0, eq));
+}
+
+/**
+ * @brief Substitute variables in every argument that was not single-quoted.
+ *        Unquoted arguments that expand to nothing are dropped.
+ */
+void Executor::expandVariables(std::vector<std::string>& args, std::vector<AST::Quoting>& quoting,
+                               const ShellVariables& vars) {
+    size_t out = 0;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        AST::Quoting q = i < quoting.size() ? quoting[i] : AST::Quoting::None;
+
+        if (q != AST::Quoting::Single) {
+            args[i] = vars.expand(args[i]);
+        }
+
+        if (q == AST::Quoting::None && args[i].empty()) {
+            continue;
+        }
+
+        if (out != i) {
+            args[out] = std::move(args[i]);
+            quoting[out] = q;
+        }
+        ++out;
+    }
+
+    args.resize(out);
+    quoting.resize(out);
+}
+
+/**
+ * @brief Handle a command line made only of NAME=value words
+ */
+CommandResult Executor::assignVariables(const std::string& first, const std::vector<std::string>& rest,
+                                        ShellVariables& vars) {
+    std::vector<std::string> words = {first};
+    words.insert(words.end(), rest.begin(), rest.end());
+
+    for (const std::string& word : words) {
+        size_t eq = word.find('=');
+        if (eq == std::string::npos || !ShellVariables::isValidName(word.substr(0, eq))) {
+            return {1, "", "assignment: expected NAME=value, got '" + word + "'"};
+        }
+    }
+
+    for (const std::string& word : words) {
+        size_t eq = word.find('=');
+        vars.set(word.substr(0, eq), word.substr(eq + 1));
+    }
+
+    return {0, "", ""};
+}
+
+/**
+ * @brief Run an already expanded command in the current context, for jobs
+ *        started by other builtins. A builtin is called directly; anything
+ *        else is spawned with its output captured rather than printed.
+ */
+CommandResult Executor::runArgs(const std::vector<std::string>& argv) {
+    if (argv.empty()) {
+        return {0, "", ""};
+    }
+
+    BuiltinIter iter = BUILTIN_TABLE.find(argv[0]);
+    if (iter != BUILTIN_TABLE.end()) {
+        return iter->second(std::vector<std::string>(argv.begin() + 1, argv.end()));
+    }
+
+    return Process::capture(argv, ExecContext::current().variables());
+}
+
+std::vector<std::string> Executor::builtinNames() {
+    std::vector<std::string> names;
+    names.reserve(BUILTIN_TABLE.size());
+
+    for (const auto& entry : BUILTIN_TABLE) {
+        names.push_back(entry.first);
+    }
+
+    return names;
 }
 
+/**
+ * @brief Run a pipeline. Runs of builtins that can read their input (see
+ *        Commands::openStage) are fused into one in-process pass in which
+ *        each hands blocks of lines to the next by reference. Any other
+ *        command runs on its own: an external program gets the output so far
+ *        as its stdin, and a builtin that reads no input ignores it.
+ * @return Status of the last command, the output of the pipeline, and the
+ *         errors of every command in it
+ */
 CommandResult Executor::handlePipe(const AST& node) {
-    return {1, "", ""}; 
+    std::vector<const AST*> commands;
+    collectPipeline(node, commands);
+
+    CommandResult result{0, "", ""};
+    std::shared_ptr<OutputBuffer> text;     // output of the commands so far
+    std::unique_ptr<StreamPipeline> fused;
+    std::string sourceName;                 // command reading sourceFiles, if fused reads files
+    std::vector<std::string> sourceFiles;
+
+    auto take = [&](CommandResult&& ran) {
+        text = ran.spill ? std::move(ran.spill) : std::make_shared<OutputBuffer>(std::move(ran.output));
+        if (!text->empty() && ran.trailingNewline) {
+            text->append("\n", 1);
+        }
+        result.status = ran.status;
+        if (!ran.error.empty()) {
+            result.error += (result.error.empty() ? "" : "\n") + ran.error;
+        }
+    };
+
+    auto runFused = [&] {
+        if (fused) {
+            take(sourceName.empty() ? fused->runText(*text) : fused->runFiles(sourceName, sourceFiles));
+            fused.reset();
+        }
+    };
+
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const AST& command = *commands[i];
+        std::vector<std::string> argv;
+        std::unique_ptr<StreamStage> stage;
+        std::vector<std::string> files;
+
+        if (command.node == AST::NodeType::Command) {
+            argv = expandArgv(command);
+            if (!argv.empty() && BUILTIN_TABLE.count(argv[0]) != 0) {
+                stage = Commands::openStage(argv, files);
+            }
+        }
+
+        // The first command has no input to read
+        if (stage && (i > 0 || !files.empty())) {
+            if (!files.empty()) {
+                // Reads its files instead of the output so far, like cat in "ls | cat f"
+                runFused();
+                sourceName = argv[0];
+                sourceFiles = files;
+            } else if (!fused) {
+                sourceName.clear();
+            }
+            if (!fused || !files.empty()) {
+                fused.reset(new StreamPipeline);
+            }
+            fused->add(std::move(stage));
+            continue;
+        }
+
+        runFused();
+
+        if (command.node != AST::NodeType::Command) {
+            take(execute(command));
+        } else if (argv.empty() || isAssignment(argv[0])) {
+            // An assignment in a pipeline does not outlive it
+            take({0, "", ""});
+        } else if (BUILTIN_TABLE.count(argv[0]) != 0) {
+            take(BUILTIN_TABLE.at(argv[0])(std::vector<std::string>(argv.begin() + 1, argv.end())));
+        } else {
+            take(Process::capture(argv, ExecContext::current().variables(), i > 0 ? text.get() : nullptr));
+        }
+    }
+
+    runFused();
+
+    text->popNewline();
+    text->moveInto(result);
+    return result;
+}
+
+/**
+ * @brief Flatten a tree of "|" operators into its commands, left to right
+ */
+void Executor::collectPipeline(const AST& node, std::vector<const AST*>& commands) {
+    if (node.node == AST::NodeType::Operator && node.op == "|") {
+        collectPipeline(*node.left, commands);
+        collectPipeline(*node.right, commands);
+    } else {
+        commands.push_back(&node);
+    }
 }
 
 CommandResult Executor::handleRedirectOut(const AST& node) {
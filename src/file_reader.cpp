@@ -0,0 +1,291 @@
+#include "file_reader.h"
+#include "cancel.h"
+#include "exec_context.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t PAGE = 4096;
+static const size_t MIN_BLOCK_SIZE = 4096;
+static const size_t MAX_BLOCK_SIZE = 64 << 20;
+
+// The mapping this thread is reading, for the SIGBUS handler
+struct GuardedMapping {
+    char* start = nullptr;
+    size_t size = 0;
+    volatile sig_atomic_t truncated = 0;
+};
+
+static thread_local GuardedMapping guarded;
+
+/**
+ * @brief A page of the mapping being read lies past the end of the file,
+ *        which another process truncated. The page is replaced with one of
+ *        empty lines, so the read in progress can finish without running
+ *        into one endless line, and the reader then reports the file as
+ *        truncated. A fault anywhere else gets the default action, as if
+ *        no handler were installed.
+ */
+static void onSigbus(int sig, siginfo_t* info, void*) {
+    char* addr = static_cast<char*>(info->si_addr);
+    if (guarded.start && addr >= guarded.start && addr < guarded.start + guarded.size) {
+        char* page = guarded.start + (addr - guarded.start) / PAGE * PAGE;
+        if (mmap(page, PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+            memset(page, '\n', PAGE);
+            mprotect(page, PAGE, PROT_READ);
+            guarded.truncated = 1;
+            return;
+        }
+    }
+    signal(sig, SIG_DFL);
+}
+
+static void installSigbusGuard() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = onSigbus;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO;
+        sigaction(SIGBUS, &action, nullptr);
+    });
+}
+
+/**
+ * @brief Parse a byte count with an optional K, M or G suffix
+ * @return False if the text is not a size
+ */
+static bool parseSize(const std::string& text, size_t& size) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (text.empty() || end == text.c_str() || errno != 0 || text[0] == '-') {
+        return false;
+    }
+
+    switch (*end) {
+        case '\0': break;
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        default: return false;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+
+    size = value;
+    return true;
+}
+
+FileReader::Config FileReader::Config::current() {
+    Config config;
+    const ShellVariables& vars = ExecContext::current().variables();
+    size_t size;
+
+    if (const std::string* block = vars.get("SHELL_READ_BLOCK")) {
+        if (parseSize(*block, size)) {
+            // Whole pages, so windows of a mapping stay page aligned
+            size = std::min(std::max(size, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+            config.blockSize = (size + PAGE - 1) / PAGE * PAGE;
+        }
+    }
+    if (const std::string* threshold = vars.get("SHELL_MMAP_THRESHOLD")) {
+        if (parseSize(*threshold, size)) {
+            config.mmapThreshold = size;
+        }
+    }
+
+    return config;
+}
+
+FileReader::FileReader(int fd, const Config& config) : fd(fd), config(config) {}
+
+/**
+ * @brief Pass the rest of the file to consume, chunk by chunk
+ *
+ * A mapped file that another process truncates must not kill the shell
+ * with SIGBUS. Its size is checked again before each window, and once it
+ * has shrunk the rest is read with read(). A truncation while a window is
+ * being consumed is caught by a SIGBUS handler, which fills the missing
+ * pages with newlines; the read then fails with EIO.
+ *
+ * @return False on a read error or Ctrl-C (errno is set, ECANCELED for
+ *         Ctrl-C); stopping early is not an error
+ */
+bool FileReader::forEachChunk(const ChunkFn& consume) {
+    const size_t block = config.blockSize;
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    off_t start = regular ? lseek(fd, 0, SEEK_CUR) : -1;
+
+    if (regular && start >= 0 && start < st.st_size && config.mmapThreshold > 0 &&
+        static_cast<size_t>(st.st_size - start) >= config.mmapThreshold) {
+        installSigbusGuard();
+
+        // Map from the page holding the current offset
+        off_t mapStart = start / PAGE * PAGE;
+        size_t mapSize = st.st_size - mapStart;
+
+        void* map = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, mapStart);
+        if (map != MAP_FAILED) {
+            madvise(map, mapSize, MADV_SEQUENTIAL);
+
+            // A FileReader used inside consume guards a mapping of its own
+            GuardedMapping outer = guarded;
+            guarded.start = static_cast<char*>(map);
+            guarded.size = mapSize;
+            guarded.truncated = 0;
+
+            auto release = [&](off_t offset) {
+                lseek(fd, offset, SEEK_SET);
+                munmap(map, mapSize);
+                guarded.start = outer.start;
+                guarded.size = outer.size;
+                guarded.truncated = outer.truncated;
+            };
+
+            const char* data = static_cast<const char*>(map);
+            size_t pos = start - mapStart;
+            while (pos < mapSize) {
+                size_t size = std::min(block - pos % block, mapSize - pos);
+                size_t next = pos + size;
+
+                struct stat now;
+                if (fstat(fd, &now) == 0 && now.st_size < static_cast<off_t>(mapStart + next)) {
+                    break;
+                }
+                if (next < mapSize) {
+                    madvise(const_cast<char*>(data) + next, std::min(block, mapSize - next), MADV_WILLNEED);
+                }
+                if (Cancellation::requested()) {
+                    release(mapStart + pos);
+                    errno = ECANCELED;
+                    return false;
+                }
+                bool more = consume(data + pos, size);
+                if (guarded.truncated) {
+                    release(mapStart + next);
+                    errno = EIO;
+                    return false;
+                }
+                if (!more) {
+                    release(mapStart + next);
+                    return true;
+                }
+                pos = next;
+            }
+
+            release(mapStart + pos);
+            if (pos == mapSize) {
+                return true;
+            }
+            // The file shrank: read what is left of it
+        }
+    }
+
+    if (regular && start >= 0) {
+        posix_fadvise(fd, start, 0, POSIX_FADV_SEQUENTIAL);
+        readahead(fd, start, 2 * block);
+    }
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, PAGE, block) != 0) {
+        errno = ENOMEM;
+        return false;
+    }
+    std::unique_ptr<char, decltype(&free)> buffer(static_cast<char*>(memory), &free);
+
+    while (true) {
+        if (Cancellation::requested()) {
+            errno = ECANCELED;
+            return false;
+        }
+        ssize_t n = read(fd, buffer.get(), block);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0 || !consume(buffer.get(), n)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Pass the rest of the file to consume in chunks that hold whole lines.
+ *        Only a line that straddles two chunks is copied.
+ * @return False on a read error (errno is set); stopping early is not an error
+ */
+bool FileReader::forEachLineBlock(const ChunkFn& consume) {
+    std::string partial;
+    bool stopped = false;
+
+    bool ok = forEachChunk([&](const char* data, size_t size) {
+        const char* start = data;
+        const char* end = data + size;
+
+        // Finish the line carried over from the previous chunk
+        if (!partial.empty()) {
+            const char* nl = static_cast<const char*>(memchr(start, '\n', size));
+            if (!nl) {
+                partial.append(start, end);
+                return true;
+            }
+            partial.append(start, nl + 1);
+            if (!consume(partial.data(), partial.size())) {
+                stopped = true;
+                return false;
+            }
+            partial.clear();
+            start = nl + 1;
+        }
+
+        const char* last = static_cast<const char*>(memrchr(start, '\n', end - start));
+        if (!last) {
+            partial.assign(start, end);
+            return true;
+        }
+        if (!consume(start, last + 1 - start)) {
+            stopped = true;
+            return false;
+        }
+        partial.assign(last + 1, end);
+        return true;
+    });
+
+    // Last line if it's not newline terminated
+    if (ok && !stopped && !partial.empty()) {
+        consume(partial.data(), partial.size());
+    }
+    return ok;
+}
+
+/**
+ * @brief Pass the rest of the file to consume line by line
+ * @return False on a read error (errno is set); stopping early is not an error
+ */
+bool FileReader::forEachLine(const LineFn& consume) {
+    return forEachLineBlock([&](const char* data, size_t size) {
+        const char* p = data;
+        const char* end = data + size;
+        while (p < end) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char* lineEnd = nl ? nl : end;
+            if (!consume(p, lineEnd - p)) {
+                return false;
+            }
+            p = lineEnd + 1;
+        }
+        return true;
+    });
+}
@@ -0,0 +1,331 @@
+#include "find.h"
+#include "exec_context.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Compile the expression starting at args[start]
+ * @param error Receives a message if the expression is malformed
+ * @return False on a syntax error
+ */
+bool FindProgram::compile(const std::vector<std::string>& args, size_t start, std::string& error) {
+    tokens = &args;
+    pos = start;
+    now = time(nullptr);
+    code.clear();
+    patterns.clear();
+    hasAction = false;
+
+    if (!atEnd() && !parseOr(error)) {
+        return false;
+    }
+
+    if (!atEnd()) {
+        error = "unexpected '" + peek() + "'";
+        return false;
+    }
+
+    tokens = nullptr;
+    return true;
+}
+
+// <or>  ::= <and> { "-o" <and> }
+bool FindProgram::parseOr(std::string& error) {
+    if (!parseAnd(error)) {
+        return false;
+    }
+
+    while (!atEnd() && (peek() == "-o" || peek() == "-or")) {
+        ++pos;
+        size_t jump = code.size();
+        code.push_back({Op::JumpIfTrue});
+        if (!parseAnd(error)) {
+            return false;
+        }
+        code[jump].target = code.size();
+    }
+
+    return true;
+}
+
+// <and> ::= <unary> { ["-a"] <unary> }
+bool FindProgram::parseAnd(std::string& error) {
+    if (!parseUnary(error)) {
+        return false;
+    }
+
+    while (!atEnd() && peek() != "-o" && peek() != "-or" && peek() != ")") {
+        if (peek() == "-a" || peek() == "-and") {
+            ++pos;
+        }
+        size_t jump = code.size();
+        code.push_back({Op::JumpIfFalse});
+        if (!parseUnary(error)) {
+            return false;
+        }
+        code[jump].target = code.size();
+    }
+
+    return true;
+}
+
+// <unary> ::= ( "!" | "-not" ) <unary> | <primary>
+bool FindProgram::parseUnary(std::string& error) {
+    if (!atEnd() && (peek() == "!" || peek() == "-not")) {
+        ++pos;
+        if (!parseUnary(error)) {
+            return false;
+        }
+        code.push_back({Op::Not});
+        return true;
+    }
+
+    return parsePrimary(error);
+}
+
+// <primary> ::= "(" <or> ")" | <test> | <action> | <option>
+bool FindProgram::parsePrimary(std::string& error) {
+    if (atEnd()) {
+        error = "expected an expression";
+        return false;
+    }
+
+    std::string token = peek();
+    ++pos;
+
+    if (token == "(") {
+        if (!parseOr(error)) {
+            return false;
+        }
+        if (atEnd() || peek() != ")") {
+            error = "missing ')'";
+            return false;
+        }
+        ++pos;
+        return true;
+    }
+
+    if (token == "-prune" || token == "-print" || token == "-true" || token == "-false") {
+        Op op = token == "-prune" ? Op::Prune : token == "-print" ? Op::Print :
+                token == "-true" ? Op::True : Op::False;
+        hasAction = hasAction || op == Op::Print;
+        code.push_back({op});
+        return true;
+    }
+
+    static const char* const WITH_ARG[] = {
+        "-name", "-iname", "-type", "-size", "-mtime", "-newer", "-maxdepth", "-mindepth"
+    };
+    if (std::find(std::begin(WITH_ARG), std::end(WITH_ARG), token) == std::end(WITH_ARG)) {
+        error = "unknown predicate '" + token + "'";
+        return false;
+    }
+
+    if (atEnd()) {
+        error = "missing argument to '" + token + "'";
+        return false;
+    }
+
+    std::string arg = peek();
+    ++pos;
+    Instr instr{Op::True};
+
+    if (token == "-maxdepth" || token == "-mindepth") {
+        int depth;
+        try {
+            depth = std::stoi(arg);
+        } catch (...) {
+            error = "invalid depth '" + arg + "'";
+            return false;
+        }
+        (token == "-maxdepth" ? maxDepth : minDepth) = depth;
+    } else if (token == "-name" || token == "-iname") {
+        instr.op = token == "-name" ? Op::Name : Op::IName;
+        if (instr.op == Op::IName) {
+            for (char& c : arg) c = std::tolower(static_cast<unsigned char>(c));
+        }
+        patterns.push_back(GlobPattern::cached(arg));
+        instr.pattern = patterns.size() - 1;
+    } else if (token == "-type") {
+        instr.op = Op::Type;
+        for (char c : arg) {
+            const char* types = "fdlpscb";
+            const unsigned char dtypes[] = {DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK};
+            const char* hit = (c == ',') ? nullptr : strchr(types, c);
+            if (c != ',' && !hit) {
+                error = "unknown type '" + arg + "'";
+                return false;
+            }
+            if (hit) {
+                instr.value |= int64_t(1) << dtypes[hit - types];
+            }
+        }
+    } else if (token == "-size") {
+        instr.op = Op::Size;
+        instr.unit = 512;
+        if (!parseNumber(arg, instr, true, error)) {
+            return false;
+        }
+    } else if (token == "-mtime") {
+        instr.op = Op::Mtime;
+        if (!parseNumber(arg, instr, false, error)) {
+            return false;
+        }
+    } else if (token == "-newer") {
+        struct stat st;
+        if (fstatat(ExecContext::current().dirfd(), arg.c_str(), &st, 0) == -1) {
+            error = "cannot access '" + arg + "': " + strerror(errno);
+            return false;
+        }
+        instr.op = Op::Newer;
+        instr.value = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    code.push_back(instr);
+    return true;
+}
+
+/**
+ * @brief Parse "[+|-]N[unit]" for -size and -mtime
+ */
+bool FindProgram::parseNumber(const std::string& text, Instr& instr, bool allowUnit, std::string& error) {
+    std::string digits = text;
+
+    if (!digits.empty() && (digits[0] == '+' || digits[0] == '-')) {
+        instr.cmp = digits[0] == '+' ? 1 : -1;
+        digits.erase(0, 1);
+    }
+
+    if (allowUnit && !digits.empty() && std::isalpha(static_cast<unsigned char>(digits.back()))) {
+        switch (digits.back()) {
+            case 'c': instr.unit = 1; break;
+            case 'w': instr.unit = 2; break;
+            case 'b': instr.unit = 512; break;
+            case 'k': instr.unit = 1024; break;
+            case 'M': instr.unit = 1024 * 1024; break;
+            case 'G': instr.unit = 1024 * 1024 * 1024; break;
+            default:
+                error = "invalid size unit in '" + text + "'";
+                return false;
+        }
+        digits.pop_back();
+    }
+
+    if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) {
+        error = "invalid number '" + text + "'";
+        return false;
+    }
+
+    instr.value = std::stoll(digits);
+    return true;
+}
+
+/**
+ * @brief Run the program against one entry
+ * @param out Receives the entry's path if it is printed
+ * @param prune Set when -prune was evaluated for this entry
+ * @return The value of the whole expression
+ */
+bool FindProgram::evaluate(const WalkEntry& entry, std::string& out, bool& prune) const {
+    struct statx stx;
+    unsigned fetched = 0;
+
+    // Fetch only the fields the current test needs, once per entry
+    auto meta = [&](unsigned mask) -> const struct statx* {
+        if ((fetched & mask) == mask) {
+            return &stx;
+        }
+        if (statx(entry.dirfd, entry.name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask | fetched, &stx) == -1) {
+            return nullptr;
+        }
+        fetched |= stx.stx_mask;
+        return &stx;
+    };
+
+    const char* base = entry.name;
+    if (entry.depth == 0) {
+        const char* slash = strrchr(entry.path.c_str(), '/');
+        if (slash && slash[1] != '\0') {
+            base = slash + 1;
+        }
+    }
+
+    bool acc = true;
+    size_t pc = 0;
+
+    while (pc < code.size()) {
+        const Instr& in = code[pc++];
+
+        switch (in.op) {
+            case Op::Name:
+                acc = patterns[in.pattern]->matches(base, strlen(base));
+                break;
+
+            case Op::IName: {
+                std::string lower = base;
+                for (char& c : lower) c = std::tolower(static_cast<unsigned char>(c));
+                acc = patterns[in.pattern]->matches(lower);
+                break;
+            }
+
+            case Op::Type:
+                acc = (in.value >> entry.type) & 1;
+                break;
+
+            case Op::Size: {
+                const struct statx* st = meta(STATX_SIZE);
+                if (!st) { acc = false; break; }
+                // Sizes round up to whole units, as in find(1)
+                int64_t units = (static_cast<int64_t>(st->stx_size) + in.unit - 1) / in.unit;
+                acc = in.cmp > 0 ? units > in.value : in.cmp < 0 ? units < in.value : units == in.value;
+                break;
+            }
+
+            case Op::Mtime: {
+                const struct statx* st = meta(STATX_MTIME);
+                if (!st) { acc = false; break; }
+                int64_t days = (now - st->stx_mtime.tv_sec) / 86400;
+                acc = in.cmp > 0 ? days > in.value : in.cmp < 0 ? days < in.value : days == in.value;
+                break;
+            }
+
+            case Op::Newer: {
+                const struct statx* st = meta(STATX_MTIME);
+                acc = st && int64_t(st->stx_mtime.tv_sec) * 1000000000 + st->stx_mtime.tv_nsec > in.value;
+                break;
+            }
+
+            case Op::Prune:
+                prune = true;
+                acc = true;
+                break;
+
+            case Op::Print:
+                out += entry.path + "\n";
+                acc = true;
+                break;
+
+            case Op::True:  acc = true;  break;
+            case Op::False: acc = false; break;
+            case Op::Not:   acc = !acc;  break;
+
+            case Op::JumpIfFalse:
+                if (!acc) pc = in.target;
+                break;
+
+            case Op::JumpIfTrue:
+                if (acc) pc = in.target;
+                break;
+        }
+    }
+
+    if (acc && !hasAction) {
+        out += entry.path + "\n";
+    }
+
+    return acc;
+}
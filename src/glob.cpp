@@ -0,0 +1,434 @@
+#include "glob.h"
+#include "exec_context.h"
+#include "pattern_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct CharClass {
+    const char* name;
+    int (*test)(int);
+};
+
+static const CharClass CHAR_CLASSES[] = {
+    {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+    {"lower", islower}, {"space", isspace}, {"punct", ispunct}, {"xdigit", isxdigit}
+};
+
+static PatternCache<GlobPattern> globCache("glob", 256);
+
+std::shared_ptr<const GlobPattern> GlobPattern::cached(const std::string& pattern) {
+    std::string error;
+    return globCache.get(pattern, [&](std::string&) {
+        return std::make_shared<const GlobPattern>(pattern);
+    }, error);
+}
+
+GlobPattern::GlobPattern(const std::string& pattern) {
+    size_t i = 0;
+
+    while (i < pattern.size()) {
+        char c = pattern[i];
+
+        if (c == '\\' && i + 1 < pattern.size()) {
+            items.push_back({Kind::Char, static_cast<unsigned char>(pattern[i + 1]), -1});
+            unescaped.push_back(pattern[i + 1]);
+            i += 2;
+            continue;
+        }
+
+        if (c == '*') {
+            // Consecutive stars are equivalent to one
+            if (items.empty() || items.back().kind != Kind::Star) {
+                items.push_back({Kind::Star, 0, -1});
+            }
+            literal = false;
+            ++i;
+            continue;
+        }
+
+        if (c == '?') {
+            items.push_back({Kind::Any, 0, -1});
+            literal = false;
+            ++i;
+            continue;
+        }
+
+        if (c == '[') {
+            std::bitset<256> set;
+            size_t end = parseSet(pattern, i, set);
+            if (end != std::string::npos) {
+                sets.push_back(set);
+                items.push_back({Kind::Set, 0, static_cast<int>(sets.size() - 1)});
+                literal = false;
+                i = end;
+                continue;
+            }
+        }
+
+        items.push_back({Kind::Char, static_cast<unsigned char>(c), -1});
+        unescaped.push_back(c);
+        ++i;
+    }
+}
+
+/**
+ * @brief Parse a bracket expression starting at pattern[i] == '['
+ * @return Index just past the closing ']', or npos if the bracket is unterminated
+ */
+size_t GlobPattern::parseSet(const std::string& pattern, size_t i, std::bitset<256>& set) {
+    size_t j = i + 1;
+    bool negate = false;
+
+    if (j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^')) {
+        negate = true;
+        ++j;
+    }
+
+    bool first = true;
+    while (j < pattern.size() && (first || pattern[j] != ']')) {
+        first = false;
+
+        if (pattern.compare(j, 2, "[:") == 0) {
+            size_t close = pattern.find(":]", j + 2);
+            if (close != std::string::npos) {
+                std::string name = pattern.substr(j + 2, close - j - 2);
+                for (const CharClass& cls : CHAR_CLASSES) {
+                    if (name == cls.name) {
+                        for (int ch = 0; ch < 256; ++ch) {
+                            if (cls.test(ch)) set.set(ch);
+                        }
+                    }
+                }
+                j = close + 2;
+                continue;
+            }
+        }
+
+        unsigned char lo = pattern[j];
+        if (lo == '\\' && j + 1 < pattern.size()) {
+            lo = pattern[++j];
+        }
+
+        if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+            unsigned char hi = pattern[j + 2];
+            for (int ch = lo; ch <= hi; ++ch) {
+                set.set(ch);
+            }
+            j += 3;
+        } else {
+            set.set(lo);
+            ++j;
+        }
+    }
+
+    if (j >= pattern.size()) {
+        return std::string::npos;
+    }
+
+    if (negate) {
+        set.flip();
+    }
+
+    return j + 1;
+}
+
+/**
+ * @brief Match a name against the compiled pattern
+ * @note Uses the single-backtrack-point wildcard algorithm: on mismatch only
+ *       the most recent '*' is extended, which is linear for typical patterns
+ */
+bool GlobPattern::matches(const char* name, size_t length) const {
+    size_t p = 0;
+    size_t s = 0;
+    size_t starP = std::string::npos;
+    size_t starS = 0;
+
+    while (s < length) {
+        if (p < items.size()) {
+            const Item& item = items[p];
+            unsigned char c = name[s];
+
+            if (item.kind == Kind::Star) {
+                starP = p++;
+                starS = s;
+                continue;
+            }
+
+            bool ok = (item.kind == Kind::Any) ||
+                      (item.kind == Kind::Char && item.c == c) ||
+                      (item.kind == Kind::Set && sets[item.set].test(c));
+
+            if (ok) {
+                ++p;
+                ++s;
+                continue;
+            }
+        }
+
+        if (starP == std::string::npos) {
+            return false;
+        }
+
+        p = starP + 1;
+        s = ++starS;
+    }
+
+    while (p < items.size() && items[p].kind == Kind::Star) {
+        ++p;
+    }
+
+    return p == items.size();
+}
+
+/**
+ * @brief Replace every unquoted glob argument with the paths it matches
+ * @param args Command arguments; modified in place
+ * @param quoting Quoting of each argument; expanded paths are marked quoted
+ */
+void Glob::expandArgs(std::vector<std::string>& args, std::vector<AST::Quoting>& quoting) {
+    std::vector<std::string> expanded;
+    std::vector<AST::Quoting> expandedQuoting;
+    expanded.reserve(args.size());
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        AST::Quoting q = i < quoting.size() ? quoting[i] : AST::Quoting::None;
+
+        if (q != AST::Quoting::None || !hasMagic(args[i])) {
+            expanded.push_back(std::move(args[i]));
+            expandedQuoting.push_back(q);
+            continue;
+        }
+
+        std::vector<std::string> matches = expandWord(args[i]);
+        if (matches.empty()) {
+            expanded.push_back(std::move(args[i]));
+            expandedQuoting.push_back(q);
+            continue;
+        }
+
+        for (std::string& m : matches) {
+            expanded.push_back(std::move(m));
+            expandedQuoting.push_back(AST::Quoting::Single);
+        }
+    }
+
+    args = std::move(expanded);
+    quoting = std::move(expandedQuoting);
+}
+
+bool Glob::hasMagic(const std::string& word) {
+    for (size_t i = 0; i < word.size(); ++i) {
+        char c = word[i];
+        if (c == '\\') {
+            ++i;
+        } else if (c == '*' || c == '?') {
+            return true;
+        } else if (c == '[' && word.find(']', i + 2) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Expand one pattern into the sorted list of existing paths it matches
+ * @note Relative patterns are matched in the current job's directory
+ * @param pattern A word such as "*.log" or "src/[a-c]*.cpp"; a "**" segment matches any depth
+ * @return Matching paths, or an empty vector if nothing matched
+ */
+std::vector<std::string> Glob::expandWord(const std::string& pattern) {
+    std::vector<std::string> segments;
+    std::string prefix;
+    int startFd = ExecContext::current().dirfd();
+    bool ownStartFd = false;
+
+    size_t pos = 0;
+    if (!pattern.empty() && pattern[0] == '/') {
+        startFd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (startFd == -1) {
+            return {};
+        }
+        ownStartFd = true;
+        prefix = "/";
+        pos = 1;
+    }
+
+    while (pos <= pattern.size()) {
+        size_t slash = pattern.find('/', pos);
+        if (slash == std::string::npos) {
+            slash = pattern.size();
+        }
+        if (slash > pos) {
+            segments.push_back(pattern.substr(pos, slash - pos));
+        }
+        pos = slash + 1;
+    }
+
+    std::vector<std::string> out;
+    if (!segments.empty()) {
+        walk(startFd, prefix, segments, 0, out);
+    }
+
+    if (ownStartFd) {
+        close(startFd);
+    }
+
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+/**
+ * @brief Match segments[index..] against the directory open at dirfd
+ * @param prefix Path of dirfd as it should appear in the output ("" or ending in '/')
+ */
+void Glob::walk(int dirfd, const std::string& prefix, const std::vector<std::string>& segments,
+                size_t index, std::vector<std::string>& out) {
+    const std::string& segment = segments[index];
+    bool last = (index + 1 == segments.size());
+
+    if (segment == "**") {
+        if (!last) {
+            walk(dirfd, prefix, segments, index + 1, out);
+        }
+        walkRecursive(dirfd, prefix, segments, index, out);
+        return;
+    }
+
+    std::shared_ptr<const GlobPattern> compiled = GlobPattern::cached(segment);
+    const GlobPattern& pattern = *compiled;
+
+    // Literal segments never need the directory contents
+    if (pattern.isLiteral()) {
+        const std::string& name = pattern.text();
+
+        if (last) {
+            struct stat st;
+            if (fstatat(dirfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                out.push_back(prefix + name);
+            }
+            return;
+        }
+
+        int child = openDir(dirfd, name.c_str(), DT_UNKNOWN, true);
+        if (child != -1) {
+            walk(child, prefix + name + "/", segments, index + 1, out);
+            close(child);
+        }
+        return;
+    }
+
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    DIR* dirp = fdopendir(fd);
+    if (!dirp) {
+        close(fd);
+        return;
+    }
+
+    bool matchHidden = segment[0] == '.';
+    struct dirent* dp;
+
+    while ((dp = readdir(dirp)) != nullptr) {
+        const char* name = dp->d_name;
+
+        if (name[0] == '.' && (!matchHidden || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+            continue;
+        }
+
+        if (!pattern.matches(name, strlen(name))) {
+            continue;
+        }
+
+        if (last) {
+            out.push_back(prefix + name);
+            continue;
+        }
+
+        int child = openDir(dirfd, name, dp->d_type, true);
+        if (child != -1) {
+            walk(child, prefix + name + "/", segments, index + 1, out);
+            close(child);
+        }
+    }
+
+    closedir(dirp);
+}
+
+/**
+ * @brief Handle '**' at segments[index]: descend into every non-hidden
+ *        subdirectory, trying the rest of the pattern at each level
+ */
+void Glob::walkRecursive(int dirfd, const std::string& prefix, const std::vector<std::string>& segments,
+                         size_t index, std::vector<std::string>& out) {
+    bool last = (index + 1 == segments.size());
+
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    DIR* dirp = fdopendir(fd);
+    if (!dirp) {
+        close(fd);
+        return;
+    }
+
+    struct dirent* dp;
+    while ((dp = readdir(dirp)) != nullptr) {
+        const char* name = dp->d_name;
+        if (name[0] == '.') {
+            continue;
+        }
+
+        // A trailing '**' matches every file and directory below this point
+        if (last) {
+            out.push_back(prefix + name);
+        }
+
+        if (dp->d_type != DT_DIR && dp->d_type != DT_UNKNOWN) {
+            continue;
+        }
+
+        int child = openDir(dirfd, name, dp->d_type, false);
+        if (child == -1) {
+            continue;
+        }
+
+        std::string childPrefix = prefix + name + "/";
+        if (!last) {
+            walk(child, childPrefix, segments, index + 1, out);
+        }
+        walkRecursive(child, childPrefix, segments, index, out);
+        close(child);
+    }
+
+    closedir(dirp);
+}
+
+/**
+ * @brief Open a subdirectory relative to dirfd, skipping the syscall when
+ *        d_type already says the entry is not a directory
+ * @param followLinks False for '**' descent, which like bash does not follow symlinks
+ * @return The directory fd, or -1
+ */
+int Glob::openDir(int dirfd, const char* name, unsigned char type, bool followLinks) {
+    if (type != DT_DIR && type != DT_UNKNOWN && (type != DT_LNK || !followLinks)) {
+        return -1;
+    }
+
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (!followLinks) {
+        flags |= O_NOFOLLOW;
+    }
+
+    return openat(dirfd, name, flags);
+}
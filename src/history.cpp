@@ -0,0 +1,553 @@
+#include "history.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char INDEX_MAGIC[8] = {'C', 'S', 'H', 'I', 'D', 'X', '1', '\0'};
+static const size_t INDEX_HEADER = 16;
+static const size_t SCAN_BLOCK = 1 << 16;
+
+History::History(const std::string& path)
+    : dataPath(path), indexPath(path + ".idx") {
+    dataFd = open(dataPath.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    indexFd = open(indexPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (dataFd == -1 || indexFd == -1) {
+        if (dataFd != -1) close(dataFd);
+        if (indexFd != -1) close(indexFd);
+        dataFd = indexFd = -1;
+        return;
+    }
+
+    refresh();
+    buildIndexAsync();
+}
+
+History::~History() {
+    stopIndexer = true;
+    if (indexer.joinable()) {
+        indexer.join();
+    }
+
+    unmap();
+    if (dataFd != -1) close(dataFd);
+    if (indexFd != -1) close(indexFd);
+}
+
+/**
+ * @brief Location of the history file: $HISTFILE, else ~/.custom_shell_history
+ */
+std::string History::defaultPath() {
+    const char* histfile = getenv("HISTFILE");
+    if (histfile && *histfile) {
+        return histfile;
+    }
+
+    const char* home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.custom_shell_history";
+}
+
+/**
+ * @brief Append a command to the shared history file and its offset index
+ * @param line The command line; empty lines and repeats of the previous entry are skipped
+ */
+void History::add(const std::string& line) {
+    if (dataFd == -1 || line.empty() || line.find('\n') != std::string::npos) {
+        return;
+    }
+
+    refresh();
+    if (count > 0) {
+        size_t length;
+        const char* last = entryData(count - 1, length);
+        if (length == line.size() && memcmp(last, line.data(), length) == 0) {
+            return;
+        }
+    }
+
+    if (flock(dataFd, LOCK_EX) == -1) {
+        return;
+    }
+
+    // Another shell may have replaced the index since it was opened
+    reopenIndex();
+
+    struct stat st;
+    if (fstat(dataFd, &st) == 0) {
+        uint64_t start = st.st_size;
+
+        // Another shell may have died between writing its line and its offset,
+        // or the history file may have been truncated; repair before appending
+        bool indexed = appendOffsets(0, start) || replaceIndex();
+
+        if (indexed) {
+            std::string record = line + "\n";
+            if (write(dataFd, record.data(), record.size()) == static_cast<ssize_t>(record.size())) {
+                appendOffsets(start, start + record.size());
+            }
+        }
+    }
+
+    flock(dataFd, LOCK_UN);
+}
+
+/**
+ * @brief Number of entries, including any appended by other shells since the last call
+ */
+size_t History::size() {
+    refresh();
+    return count;
+}
+
+std::string History::entry(size_t i) const {
+    size_t length = 0;
+    const char* text = entryData(i, length);
+    return text ? std::string(text, length) : std::string();
+}
+
+/**
+ * @brief Find the most recent entry older than `before` that contains `query`
+ * @param query Substring to look for
+ * @param before Only entries with a smaller index are considered
+ * @return Entry index, or -1 when nothing matches
+ */
+long History::searchBackward(const std::string& query, size_t before) {
+    refresh();
+    before = std::min(before, count);
+
+    // Short queries have no trigram; until the background build finishes, fall back to a scan
+    std::unique_lock<std::mutex> lock(indexMutex, std::try_to_lock);
+    if (query.size() < 3 || !lock.owns_lock() || !indexReady) {
+        return scanBackward(query, before);
+    }
+
+    indexNewEntries();
+
+    // Any match must appear in the posting list of every trigram of the query,
+    // so walking the shortest list and verifying each candidate is sufficient
+    const Posting* rarest = nullptr;
+    for (size_t j = 0; j + 3 <= query.size(); ++j) {
+        uint32_t key = (static_cast<unsigned char>(query[j]) << 16) |
+                       (static_cast<unsigned char>(query[j + 1]) << 8) |
+                       static_cast<unsigned char>(query[j + 2]);
+
+        auto iter = trigrams.find(key);
+        if (iter == trigrams.end()) {
+            return -1;
+        }
+        if (!rarest || iter->second.count < rarest->count) {
+            rarest = &iter->second;
+        }
+    }
+
+    std::vector<uint32_t> ids = decode(*rarest);
+    auto pos = std::lower_bound(ids.begin(), ids.end(), before);
+
+    while (pos != ids.begin()) {
+        --pos;
+        size_t length;
+        const char* text = entryData(*pos, length);
+        if (text && memmem(text, length, query.data(), query.size()) != nullptr) {
+            return *pos;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Pick up entries appended by this or other shells, repairing the index if needed
+ */
+void History::refresh() {
+    if (dataFd == -1 || !remap()) {
+        return;
+    }
+
+    if (!indexValid()) {
+        rebuildIndex();
+        remap();
+        if (!indexValid()) {
+            count = 0;
+        }
+    }
+
+    // History was truncated underneath us; the trigram index no longer applies
+    std::lock_guard<std::mutex> lock(indexMutex);
+    if (indexReady && count < indexedEntries) {
+        trigrams.clear();
+        indexedEntries = 0;
+    }
+}
+
+/**
+ * @brief Remap both files if either changed size, or the index was
+ *        replaced, since they were last mapped
+ * @return False if nothing changed
+ */
+bool History::remap() {
+    reopenIndex();
+
+    struct stat ds, is;
+    if (fstat(dataFd, &ds) == -1 || fstat(indexFd, &is) == -1) {
+        return false;
+    }
+
+    if (static_cast<size_t>(ds.st_size) == dataLength && static_cast<size_t>(is.st_size) == indexLength &&
+        is.st_ino == indexInode) {
+        return false;
+    }
+
+    unmap();
+
+    if (ds.st_size > 0) {
+        void* addr = mmap(nullptr, ds.st_size, PROT_READ, MAP_SHARED, dataFd, 0);
+        if (addr != MAP_FAILED) {
+            data = static_cast<const char*>(addr);
+            dataLength = ds.st_size;
+        }
+    }
+
+    if (is.st_size > 0) {
+        void* addr = mmap(nullptr, is.st_size, PROT_READ, MAP_SHARED, indexFd, 0);
+        if (addr != MAP_FAILED) {
+            ends = reinterpret_cast<const uint64_t*>(static_cast<const char*>(addr) + INDEX_HEADER);
+            indexLength = is.st_size;
+        }
+    }
+
+    count = indexLength >= INDEX_HEADER ? (indexLength - INDEX_HEADER) / sizeof(uint64_t) : 0;
+    indexInode = is.st_ino;
+
+    // The two sizes are not read atomically: another shell may have indexed
+    // a line appended after the history was measured. Offsets only grow, so
+    // such entries are at the end and are simply left for the next remap.
+    if (count > 0 && ends[count - 1] > dataLength) {
+        count = std::upper_bound(ends, ends + count, static_cast<uint64_t>(dataLength)) - ends;
+    }
+    return true;
+}
+
+/**
+ * @brief Switch to the index file now at indexPath if another shell
+ *        replaced it (see replaceIndex)
+ */
+void History::reopenIndex() {
+    struct stat current, opened;
+    if (stat(indexPath.c_str(), &current) == -1 || fstat(indexFd, &opened) == -1 ||
+        (current.st_ino == opened.st_ino && current.st_dev == opened.st_dev)) {
+        return;
+    }
+
+    int fd = open(indexPath.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd != -1) {
+        close(indexFd);
+        indexFd = fd;
+    }
+}
+
+void History::unmap() {
+    if (data) {
+        munmap(const_cast<char*>(data), dataLength);
+    }
+    if (ends) {
+        munmap(const_cast<char*>(reinterpret_cast<const char*>(ends) - INDEX_HEADER), indexLength);
+    }
+
+    data = nullptr;
+    ends = nullptr;
+    dataLength = 0;
+    indexLength = 0;
+    count = 0;
+}
+
+bool History::indexValid() const {
+    if (indexLength == 0) {
+        return dataLength == 0;
+    }
+
+    if (indexLength < INDEX_HEADER || !ends) {
+        return false;
+    }
+
+    const char* header = reinterpret_cast<const char*>(ends) - INDEX_HEADER;
+    if (memcmp(header, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+        return false;
+    }
+
+    // Offsets past the end of the history were left out by remap(); add()
+    // replaces an index that runs past a truncated history
+    return true;
+}
+
+/**
+ * @brief Recreate the offset index from the history text (first run or corruption)
+ */
+void History::rebuildIndex() {
+    if (flock(dataFd, LOCK_EX) == -1) {
+        return;
+    }
+
+    reopenIndex();
+    replaceIndex();
+
+    flock(dataFd, LOCK_UN);
+}
+
+/**
+ * @brief Write a complete index to a new file and rename it over the old
+ *        one. Other shells may have the old index mapped, so it is never
+ *        truncated in place: they keep reading it until they notice the
+ *        new file (reopenIndex). Must be called with the history lock held.
+ * @return False if the new index could not be written
+ */
+bool History::replaceIndex() {
+    struct stat st;
+    if (fstat(dataFd, &st) == -1) {
+        return false;
+    }
+
+    std::string tempPath = indexPath + ".XXXXXX";
+    int fd = mkostemp(&tempPath[0], O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    fchmod(fd, 0600);
+
+    std::swap(fd, indexFd);
+    bool ok = appendOffsets(0, st.st_size) && rename(tempPath.c_str(), indexPath.c_str()) == 0;
+    if (!ok) {
+        std::swap(fd, indexFd);
+        unlink(tempPath.c_str());
+    }
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief Index every complete line in [from, to) that is not yet in the index.
+ *        Must be called with the history lock held.
+ * @return False if the index could not be brought up to date
+ */
+bool History::appendOffsets(uint64_t from, uint64_t to) {
+    struct stat st;
+    if (fstat(indexFd, &st) == -1) {
+        return false;
+    }
+
+    uint64_t size = st.st_size;
+    if (size < INDEX_HEADER) {
+        char header[INDEX_HEADER] = {};
+        memcpy(header, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        if (pwrite(indexFd, header, INDEX_HEADER, 0) != static_cast<ssize_t>(INDEX_HEADER)) {
+            return false;
+        }
+        size = INDEX_HEADER;
+    }
+
+    // Drop a torn trailing record left by an interrupted writer
+    size = INDEX_HEADER + (size - INDEX_HEADER) / sizeof(uint64_t) * sizeof(uint64_t);
+
+    uint64_t lastEnd = 0;
+    if (size > INDEX_HEADER &&
+        pread(indexFd, &lastEnd, sizeof(lastEnd), size - sizeof(uint64_t)) != sizeof(lastEnd)) {
+        return false;
+    }
+
+    if (lastEnd > to) {
+        return false;
+    }
+
+    std::vector<uint64_t> offsets;
+    std::vector<char> buffer(SCAN_BLOCK);
+    uint64_t pos = std::max(from, lastEnd);
+
+    while (pos < to) {
+        size_t want = std::min<uint64_t>(buffer.size(), to - pos);
+        ssize_t n = pread(dataFd, buffer.data(), want, pos);
+        if (n <= 0) {
+            break;
+        }
+
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buffer[i] == '\n') {
+                offsets.push_back(pos + i + 1);
+            }
+        }
+        pos += n;
+    }
+
+    if (offsets.empty()) {
+        return ftruncate(indexFd, size) == 0;
+    }
+
+    size_t bytes = offsets.size() * sizeof(uint64_t);
+    return pwrite(indexFd, offsets.data(), bytes, size) == static_cast<ssize_t>(bytes);
+}
+
+/**
+ * @brief Add trigram postings for entries that arrived since the index was built
+ */
+void History::indexNewEntries() {
+    std::vector<uint32_t> keys;
+
+    for (; indexedEntries < count; ++indexedEntries) {
+        size_t length;
+        const char* text = entryData(indexedEntries, length);
+        if (text) {
+            addPostings(trigrams, text, length, static_cast<uint32_t>(indexedEntries), keys);
+        }
+    }
+}
+
+/**
+ * @brief Build the trigram index from a mapping of its own, on a thread,
+ *        so the first Ctrl-R does not pay for indexing years of history
+ */
+void History::buildIndexAsync() {
+    // The index descriptor may be swapped for a new file while this runs
+    int dfd = dataFd;
+    int ifd = dup(indexFd);
+    if (ifd == -1) {
+        indexReady = true;
+        return;
+    }
+
+    indexer = std::thread([this, dfd, ifd]() {
+        struct stat ds, is;
+        if (fstat(dfd, &ds) == -1 || fstat(ifd, &is) == -1 ||
+            ds.st_size == 0 || static_cast<size_t>(is.st_size) <= INDEX_HEADER) {
+            close(ifd);
+            std::lock_guard<std::mutex> lock(indexMutex);
+            indexReady = true;
+            return;
+        }
+
+        void* textMap = mmap(nullptr, ds.st_size, PROT_READ, MAP_SHARED, dfd, 0);
+        void* indexMap = mmap(nullptr, is.st_size, PROT_READ, MAP_SHARED, ifd, 0);
+        close(ifd);
+
+        TrigramMap built;
+        size_t entries = 0;
+
+        if (textMap != MAP_FAILED && indexMap != MAP_FAILED) {
+            madvise(textMap, ds.st_size, MADV_SEQUENTIAL);
+
+            const char* text = static_cast<const char*>(textMap);
+            const uint64_t* offsets = reinterpret_cast<const uint64_t*>(static_cast<char*>(indexMap) + INDEX_HEADER);
+            size_t total = (is.st_size - INDEX_HEADER) / sizeof(uint64_t);
+            std::vector<uint32_t> keys;
+
+            for (; entries < total && !stopIndexer; ++entries) {
+                uint64_t begin = entries ? offsets[entries - 1] : 0;
+                uint64_t end = offsets[entries];
+                if (end <= begin || end > static_cast<uint64_t>(ds.st_size)) {
+                    break;
+                }
+                addPostings(built, text + begin, end - begin - 1, static_cast<uint32_t>(entries), keys);
+            }
+        }
+
+        if (textMap != MAP_FAILED) munmap(textMap, ds.st_size);
+        if (indexMap != MAP_FAILED) munmap(indexMap, is.st_size);
+
+        std::lock_guard<std::mutex> lock(indexMutex);
+        if (!stopIndexer) {
+            trigrams = std::move(built);
+            indexedEntries = entries;
+        }
+        indexReady = true;
+    });
+}
+
+void History::addPostings(TrigramMap& map, const char* text, size_t length, uint32_t id,
+                          std::vector<uint32_t>& keys) {
+    if (length < 3) {
+        return;
+    }
+
+    keys.clear();
+    for (size_t j = 0; j + 3 <= length; ++j) {
+        keys.push_back((static_cast<unsigned char>(text[j]) << 16) |
+                       (static_cast<unsigned char>(text[j + 1]) << 8) |
+                       static_cast<unsigned char>(text[j + 2]));
+    }
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    for (uint32_t key : keys) {
+        Posting& posting = map[key];
+        uint32_t delta = posting.count ? id - posting.last : id;
+
+        while (delta >= 0x80) {
+            posting.deltas.push_back(static_cast<char>((delta & 0x7F) | 0x80));
+            delta >>= 7;
+        }
+        posting.deltas.push_back(static_cast<char>(delta));
+
+        posting.last = id;
+        ++posting.count;
+    }
+}
+
+const char* History::entryData(size_t i, size_t& length) const {
+    if (i >= count || !data) {
+        length = 0;
+        return nullptr;
+    }
+
+    uint64_t start = (i == 0) ? 0 : ends[i - 1];
+    uint64_t end = ends[i];
+
+    if (end <= start || end > dataLength) {
+        length = 0;
+        return nullptr;
+    }
+
+    length = end - start - 1;
+    return data + start;
+}
+
+long History::scanBackward(const std::string& query, size_t before) const {
+    for (size_t i = before; i-- > 0; ) {
+        size_t length;
+        const char* text = entryData(i, length);
+        if (text && memmem(text, length, query.data(), query.size()) != nullptr) {
+            return static_cast<long>(i);
+        }
+    }
+
+    return -1;
+}
+
+std::vector<uint32_t> History::decode(const Posting& posting) {
+    std::vector<uint32_t> ids;
+    ids.reserve(posting.count);
+
+    uint32_t id = 0;
+    uint32_t value = 0;
+    int shift = 0;
+
+    for (char c : posting.deltas) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+
+        if (byte & 0x80) {
+            shift += 7;
+            continue;
+        }
+
+        id = ids.empty() ? value : id + value;
+        ids.push_back(id);
+        value = 0;
+        shift = 0;
+    }
+
+    return ids;
+}
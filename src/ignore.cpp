@@ -0,0 +1,179 @@
+#include "ignore.h"
+#include "file_reader.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char* const IGNORE_FILES[] = {".gitignore", ".ignore"};
+static const size_t MAX_IGNORE_FILE = 1 << 20;
+
+/**
+ * @brief Read the ignore files of a directory
+ * @param dirfd Open fd of the directory
+ * @param dirPath Path of the directory as reported by the walker
+ * @param parent Rules inherited from the parent directory (may be null)
+ * @return New rules chained to the parent, or the parent itself if the directory has none
+ */
+std::shared_ptr<IgnoreRules> IgnoreRules::load(int dirfd, const std::string& dirPath,
+                                               const std::shared_ptr<IgnoreRules>& parent) {
+    std::string text;
+
+    for (const char* file : IGNORE_FILES) {
+        int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+
+        FileReader reader(fd);
+        reader.forEachChunk([&text](const char* data, size_t size) {
+            text.append(data, size);
+            return text.size() < MAX_IGNORE_FILE;
+        });
+        text += '\n';
+        close(fd);
+    }
+
+    if (text.empty()) {
+        return parent;
+    }
+
+    auto rules = std::make_shared<IgnoreRules>();
+    rules->base = dirPath;
+    if (rules->base.back() != '/') {
+        rules->base += '/';
+    }
+    rules->parent = parent;
+    rules->parse(text);
+
+    return rules->rules.empty() ? parent : rules;
+}
+
+void IgnoreRules::parse(const std::string& text) {
+    size_t pos = 0;
+
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        Rule rule;
+        if (line[0] == '!') {
+            rule.negate = true;
+            line.erase(0, 1);
+        } else if (line[0] == '\\') {
+            line.erase(0, 1);
+        }
+
+        if (!line.empty() && line.back() == '/') {
+            rule.dirOnly = true;
+            line.pop_back();
+        }
+
+        if (!line.empty() && line[0] == '/') {
+            rule.anchored = true;
+            line.erase(0, 1);
+        }
+
+        if (line.empty()) {
+            continue;
+        }
+
+        // A slash anywhere but the end anchors the pattern to this directory
+        if (line.find('/') != std::string::npos) {
+            rule.anchored = true;
+        }
+
+        size_t start = 0;
+        while (start <= line.size()) {
+            size_t slash = line.find('/', start);
+            if (slash == std::string::npos) {
+                slash = line.size();
+            }
+            std::string segment = line.substr(start, slash - start);
+            if (!segment.empty()) {
+                rule.segments.push_back({segment == "**", GlobPattern(segment)});
+            }
+            start = slash + 1;
+        }
+
+        rules.push_back(std::move(rule));
+    }
+}
+
+/**
+ * @brief Decide whether a path is excluded by these rules or any inherited ones
+ * @param path Path as produced by the walker (must lie below this directory)
+ * @param isDir Whether the path names a directory
+ */
+bool IgnoreRules::ignored(const std::string& path, bool isDir) const {
+    for (const IgnoreRules* set = this; set; set = set->parent.get()) {
+        if (path.compare(0, set->base.size(), set->base) != 0) {
+            continue;
+        }
+
+        std::vector<std::string> segments;
+        size_t start = set->base.size();
+        while (start <= path.size()) {
+            size_t slash = path.find('/', start);
+            if (slash == std::string::npos) {
+                slash = path.size();
+            }
+            if (slash > start) {
+                segments.push_back(path.substr(start, slash - start));
+            }
+            start = slash + 1;
+        }
+
+        if (segments.empty()) {
+            continue;
+        }
+
+        for (auto rule = set->rules.rbegin(); rule != set->rules.rend(); ++rule) {
+            if (rule->dirOnly && !isDir) {
+                continue;
+            }
+
+            bool matched = rule->anchored
+                ? matchSegments(rule->segments, 0, segments, 0)
+                : rule->segments.size() == 1 && rule->segments[0].pattern.matches(segments.back());
+
+            if (matched) {
+                return !rule->negate;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool IgnoreRules::matchSegments(const std::vector<Segment>& pattern, size_t pi,
+                                const std::vector<std::string>& path, size_t si) {
+    if (pi == pattern.size()) {
+        return si == path.size();
+    }
+
+    if (pattern[pi].globstar) {
+        for (size_t k = si; k <= path.size(); ++k) {
+            if (matchSegments(pattern, pi + 1, path, k)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (si == path.size() || !pattern[pi].pattern.matches(path[si])) {
+        return false;
+    }
+
+    return matchSegments(pattern, pi + 1, path, si + 1);
+}
@@ -0,0 +1,124 @@
+#include "job_pool.h"
+#include "cancel.h"
+#include "exec_context.h"
+#include "executor.h"
+#include "output_buffer.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+JobPool::JobPool(const Options& options) : options(options) {}
+
+/**
+ * @brief Append one job's text to the combined output or error
+ */
+static void appendJobText(std::string& combined, const std::string& text) {
+    if (text.empty()) {
+        return;
+    }
+    if (!combined.empty()) {
+        combined += '\n';
+    }
+    combined += text;
+}
+
+/**
+ * @brief Append one job's output to the combined output, reading it back
+ *        from its file if it spilled
+ */
+static void appendJobOutput(OutputBuffer& combined, const CommandResult& result) {
+    size_t bytes = result.spill ? result.spill->size() : result.output.size();
+    if (bytes == 0) {
+        return;
+    }
+    if (!combined.empty()) {
+        combined.append("\n", 1);
+    }
+    if (!result.spill) {
+        combined.append(result.output);
+        return;
+    }
+    result.spill->forEachChunk([&combined](const char* data, size_t size) {
+        return combined.append(data, size);
+    });
+}
+
+/**
+ * @brief Run every command and collect their output
+ * @param commands Expanded command lines, program name first
+ * @param failed Receives the number of jobs that exited non-zero
+ * @return The highest exit status of any job, with the jobs' output and
+ *         errors each joined by newlines
+ */
+CommandResult JobPool::run(const std::vector<std::vector<std::string>>& commands, size_t& failed) {
+    CommandResult combined{0, "", ""};
+    failed = 0;
+
+    if (commands.empty()) {
+        return combined;
+    }
+
+    // Jobs start from the context of the thread that called run()
+    const ExecContext& parent = ExecContext::current();
+
+    std::vector<CommandResult> results(commands.size());
+    std::vector<bool> finished(commands.size(), false);
+    size_t emitted = 0;
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    // Each job's output was charged as the job produced it
+    OutputBuffer output(OutputBuffer::currentLimit(), OutputBuffer::Charge::None);
+
+    auto emit = [&](const CommandResult& result) {
+        appendJobOutput(output, result);
+        appendJobText(combined.error, result.error);
+        if (result.status != 0) {
+            ++failed;
+            combined.status = std::max(combined.status, result.status);
+        }
+    };
+
+    auto worker = [&] {
+        // After Ctrl-C no new job starts; running ones stop on their own
+        for (size_t i = next++; i < commands.size() && !Cancellation::requested(); i = next++) {
+            std::unique_ptr<ExecContext> context = parent.fork();
+            CommandResult result;
+            {
+                ExecContext::Scope scope(*context);
+                result = Executor::runArgs(commands[i]);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!options.keepOrder) {
+                emit(result);
+                continue;
+            }
+
+            // Held until every earlier job has been emitted
+            results[i] = std::move(result);
+            finished[i] = true;
+            while (emitted < commands.size() && finished[emitted]) {
+                emit(results[emitted]);
+                results[emitted] = CommandResult{};
+                ++emitted;
+            }
+        }
+    };
+
+    unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    size_t threads = std::min<size_t>(jobs, commands.size());
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+
+    output.moveInto(combined);
+    return combined;
+}
@@ -51,7 +51,8 @@ std::vector<Token> Lexer::tokenize(const std::string& input) {
             }
 
             flushCurrent(tokens, current);
-            tokens.push_back({TokenType::QUOTED, quoted});
+            // Single quotes suppress variable expansion, double quotes only globbing
+            tokens.push_back({quote == '\'' ? TokenType::SINGLE_QUOTED : TokenType::QUOTED, quoted});
         } else if (i + 1 < n) { // possible multi-char op
             std::string two = input.substr(i, 2);
 
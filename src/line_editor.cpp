@@ -0,0 +1,402 @@
+#include "line_editor.h"
+#include "output.h"
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+    enum Key {
+        CTRL_A = 1,
+        CTRL_B = 2,
+        CTRL_C = 3,
+        CTRL_D = 4,
+        CTRL_E = 5,
+        CTRL_F = 6,
+        CTRL_G = 7,
+        CTRL_H = 8,
+        TAB = 9,
+        CTRL_K = 11,
+        CTRL_L = 12,
+        ENTER = 13,
+        CTRL_N = 14,
+        CTRL_P = 16,
+        CTRL_R = 18,
+        CTRL_U = 21,
+        CTRL_W = 23,
+        ESC = 27,
+        BACKSPACE = 127
+    };
+}
+
+LineEditor::LineEditor(History* history) : history(history) {
+    interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+                  tcgetattr(STDIN_FILENO, &original) == 0;
+}
+
+LineEditor::~LineEditor() {
+    disableRawMode();
+}
+
+/**
+ * @brief Read one line of input, with editing and completion on a terminal
+ * @param prompt Prompt printed before the line
+ * @param line Receives the entered line (without the newline)
+ * @return False on end of input
+ */
+bool LineEditor::readLine(const std::string& prompt, std::string& line) {
+    OutputWriter::out().flush();
+
+    if (!interactive || !enableRawMode()) {
+        return readFallback(prompt, line);
+    }
+
+    std::string buf;
+    size_t cursor = 0;
+    bool lastWasTab = false;
+
+    // Position while walking history; equal to the entry count while editing a new line
+    size_t histSize = history ? history->size() : 0;
+    size_t histPos = histSize;
+    std::string pending;
+
+    writeAll(prompt);
+
+    while (true) {
+        int c = readByte();
+        if (c == -1) {
+            disableRawMode();
+            writeAll("\n");
+            return false;
+        }
+
+        bool isTab = (c == TAB);
+        int move = 0;
+
+        switch (c) {
+            case ENTER:
+            case '\n':
+                disableRawMode();
+                writeAll("\n");
+                line = buf;
+                return true;
+
+            case CTRL_C:
+                writeAll("^C\n");
+                buf.clear();
+                cursor = 0;
+                writeAll(prompt);
+                break;
+
+            case CTRL_D:
+                if (buf.empty()) {
+                    disableRawMode();
+                    writeAll("\n");
+                    return false;
+                }
+                if (cursor < buf.size()) {
+                    buf.erase(cursor, 1);
+                }
+                break;
+
+            case TAB:
+                complete(prompt, buf, cursor, lastWasTab);
+                break;
+
+            case BACKSPACE:
+            case CTRL_H:
+                if (cursor > 0) {
+                    buf.erase(--cursor, 1);
+                }
+                break;
+
+            case CTRL_A: cursor = 0; break;
+            case CTRL_E: cursor = buf.size(); break;
+            case CTRL_B: if (cursor > 0) --cursor; break;
+            case CTRL_F: if (cursor < buf.size()) ++cursor; break;
+            case CTRL_K: buf.erase(cursor); break;
+
+            case CTRL_U:
+                buf.erase(0, cursor);
+                cursor = 0;
+                break;
+
+            case CTRL_W: {
+                size_t start = cursor;
+                while (start > 0 && buf[start - 1] == ' ') --start;
+                while (start > 0 && buf[start - 1] != ' ') --start;
+                buf.erase(start, cursor - start);
+                cursor = start;
+                break;
+            }
+
+            case CTRL_L:
+                writeAll("\x1b[H\x1b[2J");
+                break;
+
+            case CTRL_P: move = -1; break;
+            case CTRL_N: move = 1; break;
+
+            case CTRL_R:
+                if (history && reverseSearch(buf, cursor)) {
+                    disableRawMode();
+                    writeAll("\r" + prompt + buf + "\x1b[K\n");
+                    line = buf;
+                    return true;
+                }
+                break;
+
+            case ESC: {
+                int a = readByte();
+                int b = readByte();
+                if (a != '[' && a != 'O') {
+                    break;
+                }
+
+                if (b >= '0' && b <= '9') {
+                    int tilde = readByte();
+                    if (tilde != '~') break;
+                    if (b == '3' && cursor < buf.size()) buf.erase(cursor, 1);
+                    if (b == '1' || b == '7') cursor = 0;
+                    if (b == '4' || b == '8') cursor = buf.size();
+                    break;
+                }
+
+                if (b == 'A') move = -1;
+                else if (b == 'B') move = 1;
+                else if (b == 'C' && cursor < buf.size()) ++cursor;
+                else if (b == 'D' && cursor > 0) --cursor;
+                else if (b == 'H') cursor = 0;
+                else if (b == 'F') cursor = buf.size();
+                break;
+            }
+
+            default:
+                if (std::isprint(c) || c >= 0x80) {
+                    buf.insert(buf.begin() + cursor, static_cast<char>(c));
+                    ++cursor;
+                }
+                break;
+        }
+
+        if (history && move != 0) {
+            if (histPos == histSize) {
+                pending = buf;
+            }
+
+            if (move < 0 && histPos > 0) {
+                buf = history->entry(--histPos);
+            } else if (move > 0 && histPos < histSize) {
+                ++histPos;
+                buf = (histPos == histSize) ? pending : history->entry(histPos);
+            }
+            cursor = buf.size();
+        }
+
+        lastWasTab = isTab;
+        refresh(prompt, buf, cursor);
+    }
+}
+
+bool LineEditor::readFallback(const std::string& prompt, std::string& line) {
+    OutputWriter::out().write(prompt);
+    OutputWriter::out().flush();
+    return static_cast<bool>(std::getline(std::cin, line));
+}
+
+/**
+ * @brief Extend the word under the cursor to the longest unambiguous completion
+ * @param listMatches Print every candidate when the completion is still ambiguous
+ */
+void LineEditor::complete(const std::string& prompt, std::string& buf, size_t& cursor, bool listMatches) {
+    Completer::Result result = completer.complete(buf, cursor);
+
+    if (!result.insert.empty()) {
+        buf.insert(cursor, result.insert);
+        cursor += result.insert.size();
+        return;
+    }
+
+    if (result.candidates.empty()) {
+        writeAll("\a");
+        return;
+    }
+
+    if (!listMatches) {
+        writeAll("\a");
+        return;
+    }
+
+    writeAll("\n");
+    listCandidates(result);
+    writeAll(prompt);
+}
+
+/**
+ * @brief Run a Ctrl-R search session, answering each keystroke from the history index
+ * @param buf Replaced with the selected entry unless the search is cancelled
+ * @return True if Enter was pressed and the entry should run immediately
+ */
+bool LineEditor::reverseSearch(std::string& buf, size_t& cursor) {
+    std::string query;
+    std::string match;
+    long pos = -1;
+    bool failed = false;
+
+    while (true) {
+        writeAll(std::string("\r(") + (failed ? "failed " : "") + "reverse-i-search)`" +
+                 query + "': " + match + "\x1b[K");
+
+        int c = readByte();
+
+        if (c == ENTER || c == '\n') {
+            buf = pos >= 0 ? match : buf;
+            cursor = buf.size();
+            return true;
+        }
+
+        if (c == -1 || c == CTRL_C || c == CTRL_G) {
+            return false;
+        }
+
+        long next = pos;
+
+        if (c == CTRL_R) {
+            if (!query.empty()) {
+                next = history->searchBackward(query, pos >= 0 ? pos : history->size());
+            }
+        } else if (c == BACKSPACE || c == CTRL_H) {
+            if (!query.empty()) {
+                query.pop_back();
+            }
+            next = query.empty() ? -1 : history->searchBackward(query, history->size());
+        } else if (std::isprint(c) || c >= 0x80) {
+            query.push_back(static_cast<char>(c));
+            // The current match may still satisfy the longer query
+            next = history->searchBackward(query, pos >= 0 ? pos + 1 : history->size());
+        } else {
+            // Any other key accepts the match and resumes normal editing
+            if (c == ESC) {
+                readByte();
+                readByte();
+            }
+            if (pos >= 0) {
+                buf = match;
+                cursor = buf.size();
+            }
+            return false;
+        }
+
+        failed = !query.empty() && next < 0;
+        if (next >= 0) {
+            pos = next;
+            match = history->entry(pos);
+        } else if (query.empty()) {
+            pos = -1;
+            match.clear();
+        }
+    }
+}
+
+/**
+ * @brief Print candidates in columns sized to the terminal width
+ */
+void LineEditor::listCandidates(const Completer::Result& result) {
+    size_t width = 0;
+    // When truncated, the final candidate is the last match and is only kept for prefix computation
+    size_t shown = result.candidates.size();
+    if (result.total > shown) {
+        --shown;
+    }
+    for (size_t i = 0; i < shown; ++i) {
+        width = std::max(width, result.candidates[i].size());
+    }
+    width += 2;
+
+    size_t columns = std::max<size_t>(1, terminalWidth() / width);
+    std::string out;
+
+    for (size_t i = 0; i < shown; ++i) {
+        const std::string& name = result.candidates[i];
+        out += name;
+
+        if ((i + 1) % columns == 0 || i + 1 == shown) {
+            out += "\n";
+        } else {
+            out.append(width - name.size(), ' ');
+        }
+    }
+
+    if (result.total > shown) {
+        out += "... and " + std::to_string(result.total - shown) + " more\n";
+    }
+
+    writeAll(out);
+}
+
+/**
+ * @brief Redraw the prompt and buffer on the current row and place the cursor
+ */
+void LineEditor::refresh(const std::string& prompt, const std::string& buf, size_t cursor) {
+    std::string out = "\r" + prompt + buf + "\x1b[K";
+
+    size_t back = buf.size() - cursor;
+    if (back > 0) {
+        out += "\x1b[" + std::to_string(back) + "D";
+    }
+
+    writeAll(out);
+}
+
+bool LineEditor::enableRawMode() {
+    struct termios raw = original;
+
+    // Byte-at-a-time input with no echo; Ctrl-C and Ctrl-D are handled as keys
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cflag |= CS8;
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    return tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0;
+}
+
+void LineEditor::disableRawMode() {
+    if (interactive) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &original);
+    }
+}
+
+int LineEditor::readByte() {
+    unsigned char c;
+
+    while (true) {
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == 1) return c;
+        if (n == -1 && errno == EINTR) continue;
+        return -1;
+    }
+}
+
+void LineEditor::writeAll(const std::string& s) {
+    size_t done = 0;
+
+    while (done < s.size()) {
+        ssize_t n = write(STDOUT_FILENO, s.data() + done, s.size() - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        done += n;
+    }
+}
+
+int LineEditor::terminalWidth() {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        return 80;
+    }
+    return ws.ws_col;
+}
@@ -0,0 +1,447 @@
+#include "matcher.h"
+#include "pattern_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <deque>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define MATCHER_X86 1
+#endif
+
+std::unique_ptr<LineMatcher> LineMatcher::create(const std::vector<std::string>& patterns, bool fixed,
+                                                 bool ignoreCase, bool wordMatch, std::string& error) {
+    // Regexes without metacharacters are literals and take the fast path
+    bool literal = fixed;
+    if (!literal) {
+        literal = std::none_of(patterns.begin(), patterns.end(), [](const std::string& pattern) {
+            return pattern.find_first_of(".[]{}()\\*+?^$|") != std::string::npos;
+        });
+    }
+
+    if (literal) {
+        return std::unique_ptr<LineMatcher>(new LiteralMatcher(patterns, ignoreCase, wordMatch));
+    }
+    try {
+        return std::unique_ptr<LineMatcher>(new RegexMatcher(patterns, ignoreCase, wordMatch));
+    } catch (const std::regex_error&) {
+        error = "invalid regex";
+        return nullptr;
+    }
+}
+
+static PatternCache<LineMatcher> matcherCache("grep", 64);
+
+std::shared_ptr<const LineMatcher> LineMatcher::cached(const std::vector<std::string>& patterns, bool fixed,
+                                                       bool ignoreCase, bool wordMatch, std::string& error) {
+    // Flags first, then the patterns; a pattern never holds a NUL
+    std::string key{fixed ? 'F' : 'E', ignoreCase ? 'i' : '-', wordMatch ? 'w' : '-'};
+    for (const std::string& pattern : patterns) {
+        key += '\0';
+        key += pattern;
+    }
+
+    return matcherCache.get(key, [&](std::string& compileError) {
+        return std::shared_ptr<const LineMatcher>(create(patterns, fixed, ignoreCase, wordMatch, compileError));
+    }, error);
+}
+
+static bool isWordByte(unsigned char c) {
+    return std::isalnum(c) || c == '_';
+}
+
+// ---------------------------------------------------------------- regex
+
+RegexMatcher::RegexMatcher(const std::vector<std::string>& patterns, bool ignoreCase, bool wordMatch) {
+    std::string combined;
+    if (patterns.size() == 1) {
+        combined = patterns[0];
+    } else if (patterns.empty()) {
+        combined = "[^\\s\\S]";     // matches nothing, like an empty -f file
+    } else {
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            if (i > 0) combined += '|';
+            combined += "(?:" + patterns[i] + ")";
+        }
+    }
+
+    if (wordMatch) combined = "\\b(?:" + combined + ")\\b";
+
+    auto flags = std::regex_constants::ECMAScript;
+    if (ignoreCase) flags |= std::regex_constants::icase;
+    re = std::regex(combined, flags);
+}
+
+bool RegexMatcher::find(const char* begin, const char* from, const char* end,
+                        const char*& matchBegin, const char*& matchEnd) const {
+    auto flags = std::regex_constants::match_default;
+    if (from > begin) flags |= std::regex_constants::match_prev_avail;
+
+    std::cmatch match;
+    if (!std::regex_search(from, end, match, re, flags)) {
+        return false;
+    }
+    matchBegin = match[0].first;
+    matchEnd = match[0].second;
+    return true;
+}
+
+// ---------------------------------------------------------------- literals
+
+#ifdef MATCHER_X86
+/**
+ * Next position in [p, end) whose first width bytes pass the nibble tables,
+ * with the candidate buckets in bits. Null if there is none.
+ */
+__attribute__((target("ssse3")))
+static const char* teddyScanSsse3(const unsigned char lo[3][16], const unsigned char hi[3][16], size_t width,
+                                  const char* p, const char* end, unsigned& bits) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i loMask[3], hiMask[3];
+    for (size_t k = 0; k < width; ++k) {
+        loMask[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo[k]));
+        hiMask[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi[k]));
+    }
+
+    while (end - p >= static_cast<ptrdiff_t>(16 + width - 1)) {
+        __m128i acc = _mm_set1_epi8(-1);
+        for (size_t k = 0; k < width; ++k) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k));
+            __m128i l = _mm_shuffle_epi8(loMask[k], _mm_and_si128(v, nibble));
+            __m128i h = _mm_shuffle_epi8(hiMask[k], _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+            acc = _mm_and_si128(acc, _mm_and_si128(l, h));
+        }
+
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero))) & 0xFFFF;
+        if (mask != 0) {
+            unsigned char lanes[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+            int lane = __builtin_ctz(mask);
+            bits = lanes[lane];
+            return p + lane;
+        }
+        p += 16;
+    }
+
+    for (; end - p >= static_cast<ptrdiff_t>(width); ++p) {
+        unsigned acc = 0xFF;
+        for (size_t k = 0; k < width; ++k) {
+            unsigned char c = p[k];
+            acc &= lo[k][c & 0x0F] & hi[k][c >> 4];
+        }
+        if (acc != 0) {
+            bits = acc;
+            return p;
+        }
+    }
+    return nullptr;
+}
+#endif
+
+LiteralMatcher::LiteralMatcher(const std::vector<std::string>& input, bool ignoreCase, bool wordMatch)
+    : ignoreCase(ignoreCase), wordMatch(wordMatch) {
+    for (int c = 0; c < 256; ++c) {
+        fold[c] = ignoreCase ? static_cast<unsigned char>(std::tolower(c)) : static_cast<unsigned char>(c);
+    }
+
+    for (const std::string& pattern : input) {
+        if (pattern.empty()) {
+            hasEmpty = true;
+            continue;
+        }
+        std::string folded(pattern);
+        for (char& c : folded) c = static_cast<char>(fold[static_cast<unsigned char>(c)]);
+        patterns.push_back(std::move(folded));
+    }
+
+    std::sort(patterns.begin(), patterns.end());
+    patterns.erase(std::unique(patterns.begin(), patterns.end()), patterns.end());
+
+    for (const std::string& pattern : patterns) {
+        maxLength = std::max(maxLength, pattern.size());
+    }
+
+#ifdef MATCHER_X86
+    useTeddy = !patterns.empty() && patterns.size() <= TEDDY_MAX_PATTERNS && __builtin_cpu_supports("ssse3");
+#endif
+    if (useTeddy) {
+        buildTeddy();
+    } else {
+        buildAutomaton();
+    }
+}
+
+void LiteralMatcher::buildTeddy() {
+    size_t minLength = patterns.front().size();
+    for (const std::string& pattern : patterns) {
+        minLength = std::min(minLength, pattern.size());
+    }
+    teddyWidth = std::min<size_t>(3, minLength);
+    memset(teddyLo, 0, sizeof(teddyLo));
+    memset(teddyHi, 0, sizeof(teddyHi));
+
+    // Patterns are sorted, so neighbours sharing a prefix land in the same bucket
+    size_t count = patterns.size();
+    for (size_t i = 0; i < count; ++i) {
+        size_t bucket = i * 8 / count;
+        buckets[bucket].push_back(i);
+
+        for (size_t k = 0; k < teddyWidth; ++k) {
+            unsigned char c = patterns[i][k];
+            unsigned char variants[2] = {c, ignoreCase ? static_cast<unsigned char>(std::toupper(c)) : c};
+            for (unsigned char v : variants) {
+                teddyLo[k][v & 0x0F] |= 1u << bucket;
+                teddyHi[k][v >> 4] |= 1u << bucket;
+            }
+        }
+    }
+}
+
+void LiteralMatcher::buildAutomaton() {
+    std::fill(rootNext, rootNext + 256, 0);
+    states.assign(1, State());
+
+    // Trie first, with per-state child lists that are flattened afterwards
+    std::vector<std::vector<Edge>> children(1);
+    for (const std::string& pattern : patterns) {
+        int32_t s = 0;
+        for (unsigned char c : pattern) {
+            int32_t next = -1;
+            if (s == 0) {
+                if (rootNext[c] != 0) next = rootNext[c];
+            } else {
+                for (const Edge& e : children[s]) {
+                    if (e.byte == c) { next = e.target; break; }
+                }
+            }
+            if (next == -1) {
+                next = static_cast<int32_t>(states.size());
+                states.emplace_back();
+                states.back().depth = states[s].depth + 1;
+                children.emplace_back();
+                children[s].push_back({c, next});
+                if (s == 0) rootNext[c] = next;
+            }
+            s = next;
+        }
+        states[s].terminal = true;
+    }
+
+    edges.clear();
+    for (size_t s = 0; s < states.size(); ++s) {
+        std::sort(children[s].begin(), children[s].end(),
+                  [](const Edge& a, const Edge& b) { return a.byte < b.byte; });
+        states[s].edgeBegin = static_cast<uint32_t>(edges.size());
+        states[s].edgeCount = static_cast<uint32_t>(children[s].size());
+        edges.insert(edges.end(), children[s].begin(), children[s].end());
+    }
+
+    // Failure and output links, breadth first so shallower states are done first
+    std::deque<int32_t> queue;
+    for (const Edge& e : children[0]) {
+        states[e.target].fail = 0;
+        queue.push_back(e.target);
+    }
+    while (!queue.empty()) {
+        int32_t r = queue.front();
+        queue.pop_front();
+        for (const Edge& e : children[r]) {
+            int32_t f = step(states[r].fail, e.byte);
+            states[e.target].fail = f;
+            states[e.target].outLink = states[f].terminal ? f : states[f].outLink;
+            queue.push_back(e.target);
+        }
+    }
+
+    hasOutput.resize(states.size());
+    for (size_t s = 0; s < states.size(); ++s) {
+        hasOutput[s] = states[s].terminal || states[s].outLink >= 0;
+    }
+
+    buildDfa();
+}
+
+void LiteralMatcher::buildDfa() {
+    // Bytes that never occur in a pattern behave alike and share class 0
+    memset(byteClass, 0, sizeof(byteClass));
+    unsigned char representative[256] = {0};
+    classCount = 1;
+    for (const Edge& e : edges) {
+        if (byteClass[e.byte] == 0) {
+            representative[classCount] = e.byte;
+            byteClass[e.byte] = static_cast<unsigned char>(classCount++);
+        }
+    }
+    for (int c = 0; c < 256; ++c) {
+        if (rootNext[c] != 0 && byteClass[c] == 0) {
+            representative[classCount] = static_cast<unsigned char>(c);
+            byteClass[c] = static_cast<unsigned char>(classCount++);
+        }
+    }
+
+    if (states.size() * classCount > DFA_MAX_ENTRIES) {
+        return;
+    }
+
+    // Breadth first, so a state's failure row is complete before its own
+    dfa.assign(states.size() * classCount, 0);
+    std::vector<int32_t> order(1, 0);
+    for (size_t i = 0; i < order.size(); ++i) {
+        int32_t s = order[i];
+        const State& state = states[s];
+        for (size_t k = 0; k < classCount; ++k) {
+            if (s != 0) {
+                dfa[s * classCount + k] = dfa[state.fail * classCount + k];
+            } else if (k != 0) {
+                dfa[k] = rootNext[representative[k]];
+            }
+        }
+        for (uint32_t e = state.edgeBegin; e < state.edgeBegin + state.edgeCount; ++e) {
+            dfa[s * classCount + byteClass[edges[e].byte]] = edges[e].target;
+            order.push_back(edges[e].target);
+        }
+    }
+}
+
+int32_t LiteralMatcher::step(int32_t state, unsigned char c) const {
+    while (state != 0) {
+        const State& s = states[state];
+        const Edge* first = edges.data() + s.edgeBegin;
+        const Edge* last = first + s.edgeCount;
+        if (s.edgeCount <= 8) {
+            for (const Edge* e = first; e != last; ++e) {
+                if (e->byte == c) return e->target;
+            }
+        } else {
+            const Edge* e = std::lower_bound(first, last, c,
+                                             [](const Edge& edge, unsigned char b) { return edge.byte < b; });
+            if (e != last && e->byte == c) return e->target;
+        }
+        state = s.fail;
+    }
+    return rootNext[c];
+}
+
+bool LiteralMatcher::wordBounded(const char* begin, const char* end, const char* mBegin, const char* mEnd) const {
+    if (mBegin > begin && isWordByte(static_cast<unsigned char>(mBegin[-1]))) return false;
+    if (mEnd < end && isWordByte(static_cast<unsigned char>(*mEnd))) return false;
+    return true;
+}
+
+bool LiteralMatcher::equalAt(const char* p, const std::string& pattern) const {
+    if (!ignoreCase) {
+        return memcmp(p, pattern.data(), pattern.size()) == 0;
+    }
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (fold[static_cast<unsigned char>(p[i])] != static_cast<unsigned char>(pattern[i])) return false;
+    }
+    return true;
+}
+
+bool LiteralMatcher::find(const char* begin, const char* from, const char* end,
+                          const char*& matchBegin, const char*& matchEnd) const {
+    bool found = false;
+    if (!patterns.empty()) {
+        found = useTeddy ? findTeddy(begin, from, end, matchBegin, matchEnd)
+                         : findAutomaton(begin, from, end, matchBegin, matchEnd);
+    }
+
+    if (!hasEmpty) {
+        return found;
+    }
+
+    // An empty pattern matches at every (word-bounded) position; a real match
+    // still wins if it starts no later
+    const char* limit = found ? matchBegin : end;
+    for (const char* p = from; p <= limit; ++p) {
+        if (found && p == matchBegin) return true;
+        if (!wordMatch || wordBounded(begin, end, p, p)) {
+            matchBegin = matchEnd = p;
+            return true;
+        }
+    }
+    return found;
+}
+
+bool LiteralMatcher::verifyAt(const char* begin, const char* end, const char* p, unsigned bucketBits,
+                              const char*& matchBegin, const char*& matchEnd) const {
+    size_t best = 0;
+    while (bucketBits != 0) {
+        int bucket = __builtin_ctz(bucketBits);
+        bucketBits &= bucketBits - 1;
+        for (size_t i : buckets[bucket]) {
+            const std::string& pattern = patterns[i];
+            if (pattern.size() <= best || pattern.size() > static_cast<size_t>(end - p)) continue;
+            if (!equalAt(p, pattern)) continue;
+            if (wordMatch && !wordBounded(begin, end, p, p + pattern.size())) continue;
+            best = pattern.size();
+        }
+    }
+    if (best == 0) {
+        return false;
+    }
+    matchBegin = p;
+    matchEnd = p + best;
+    return true;
+}
+
+bool LiteralMatcher::findTeddy(const char* begin, const char* from, const char* end,
+                               const char*& matchBegin, const char*& matchEnd) const {
+#ifdef MATCHER_X86
+    // Candidates arrive in position order, so the first verified one is leftmost
+    unsigned bits = 0;
+    for (const char* p = from; p < end; ++p) {
+        p = teddyScanSsse3(teddyLo, teddyHi, teddyWidth, p, end, bits);
+        if (!p) break;
+        if (verifyAt(begin, end, p, bits, matchBegin, matchEnd)) return true;
+    }
+#else
+    (void)begin; (void)from; (void)end; (void)matchBegin; (void)matchEnd;
+#endif
+    return false;
+}
+
+bool LiteralMatcher::findAutomaton(const char* begin, const char* from, const char* end,
+                                   const char*& matchBegin, const char*& matchEnd) const {
+    const char* bestBegin = nullptr;
+    const char* bestEnd = nullptr;
+    int32_t s = 0;
+
+    const char* p = from;
+    while (p < end) {
+        if (s == 0) {
+            // Nothing in progress: later matches start after the best one
+            if (bestBegin) break;
+            while (p < end && rootNext[fold[static_cast<unsigned char>(*p)]] == 0) ++p;
+            if (p == end) break;
+        }
+
+        unsigned char c = fold[static_cast<unsigned char>(*p)];
+        s = dfa.empty() ? step(s, c) : dfa[s * classCount + byteClass[c]];
+        ++p;
+
+        if (!hasOutput[s]) {
+            continue;
+        }
+        for (int32_t o = states[s].terminal ? s : states[s].outLink; o >= 0; o = states[o].outLink) {
+            const char* mBegin = p - states[o].depth;
+            if (wordMatch && !wordBounded(begin, end, mBegin, p)) continue;
+            if (!bestBegin || mBegin < bestBegin || (mBegin == bestBegin && p > bestEnd)) {
+                bestBegin = mBegin;
+                bestEnd = p;
+            }
+        }
+
+        // No later match can start at or before the best one
+        if (bestBegin && static_cast<size_t>(p - bestBegin) >= maxLength) break;
+    }
+
+    if (!bestBegin) {
+        return false;
+    }
+    matchBegin = bestBegin;
+    matchEnd = bestEnd;
+    return true;
+}
@@ -0,0 +1,85 @@
+#include "output.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+OutputWriter::OutputWriter(int fd)
+    : fd(fd), terminal(isatty(fd) == 1), buffer(new char[BUFFER_SIZE]) {}
+
+OutputWriter::~OutputWriter() {
+    flush();
+}
+
+OutputWriter& OutputWriter::out() {
+    return standard(STDOUT_FILENO);
+}
+
+OutputWriter& OutputWriter::err() {
+    return standard(STDERR_FILENO);
+}
+
+OutputWriter& OutputWriter::standard(int fd) {
+    static OutputWriter outWriter(STDOUT_FILENO);
+    static OutputWriter errWriter(STDERR_FILENO);
+    static bool linked = (outWriter.peer = &errWriter, errWriter.peer = &outWriter, true);
+    (void)linked;
+
+    return fd == STDERR_FILENO ? errWriter : outWriter;
+}
+
+void OutputWriter::write(const char* data, size_t size) {
+    if (peer && peer->used > 0) {
+        peer->flush();
+    }
+
+    if (used + size > BUFFER_SIZE) {
+        // Buffered text and the new data go out together, without copying
+        send(data, size);
+    } else {
+        memcpy(buffer.get() + used, data, size);
+        used += size;
+    }
+
+    // Like stdio, stderr is unbuffered and a terminal is line buffered
+    if (used > 0 && (fd == STDERR_FILENO || (terminal && memchr(data, '\n', size) != nullptr))) {
+        flush();
+    }
+}
+
+void OutputWriter::flush() {
+    send(nullptr, 0);
+}
+
+/**
+ * @brief Write the buffer followed by data, resuming after short writes.
+ *        Output that cannot be written (e.g. a closed pipe) is dropped.
+ */
+void OutputWriter::send(const char* data, size_t size) {
+    if (used == 0 && size == 0) {
+        return;
+    }
+
+    struct iovec iov[2] = {{buffer.get(), used}, {const_cast<char*>(data), size}};
+    int first = used > 0 ? 0 : 1;
+
+    while (first < 2) {
+        ssize_t n = writev(fd, iov + first, 2 - first);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        size_t written = n;
+        while (first < 2 && written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < 2) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+
+    used = 0;
+}
@@ -0,0 +1,286 @@
+#include "output_buffer.h"
+#include "cancel.h"
+#include "commands.h"
+#include "exec_context.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+
+size_t OutputBuffer::currentLimit() {
+    size_t megabytes = DEFAULT_LIMIT_MB;
+    if (const std::string* value = ExecContext::current().variables().get("SHELL_OUTPUT_MB")) {
+        if (!value->empty() && value->size() < 10 && value->find_first_not_of("0123456789") == std::string::npos) {
+            megabytes = std::stoul(*value);
+        }
+    }
+    return megabytes << 20;
+}
+
+OutputBuffer::OutputBuffer(size_t limit, Charge charge)
+    : limit(limit), charged(charge == Charge::Scope ? CancelScope::current() : nullptr) {}
+
+/**
+ * @brief Take over text produced elsewhere, spilling it at once if it is
+ *        already over the cap
+ */
+OutputBuffer::OutputBuffer(std::string&& text, size_t limit)
+    : limit(limit), length(text.size()), pending(std::move(text)), charged(nullptr) {
+    if (limit > 0 && length > limit) {
+        spill();
+    }
+}
+
+OutputBuffer::OutputBuffer(OutputBuffer&& other) noexcept
+    : limit(other.limit), length(other.length), pending(std::move(other.pending)), fd(other.fd),
+      written(other.written), writeError(other.writeError), charged(nullptr) {
+    other.length = 0;
+    other.fd = -1;
+    other.written = 0;
+}
+
+OutputBuffer::~OutputBuffer() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Add text, moving everything to the temporary file if it
+ *        outgrows the cap. Going over the scope's output limit cancels
+ *        the scope; the text is still kept, for limit to cut.
+ * @return False if the file could not be written
+ */
+bool OutputBuffer::append(const char* data, size_t size) {
+    if (writeError != 0) {
+        return false;
+    }
+    if (charged) {
+        charged->chargeOutput(size);
+    }
+    if (fd == -1 && limit > 0 && length + size > limit && !spill()) {
+        return false;
+    }
+    length += size;
+
+    if (fd == -1) {
+        pending.append(data, size);
+        return true;
+    }
+    if (pending.size() + size > WRITE_BLOCK && !flush()) {
+        return false;
+    }
+    if (size >= WRITE_BLOCK) {
+        return writeOut(data, size);
+    }
+    pending.append(data, size);
+    return true;
+}
+
+/**
+ * @brief Move the text so far to a new unlinked file. If none can be
+ *        made, the buffer stops spilling and keeps everything in memory.
+ * @return False if the file could not be written
+ */
+bool OutputBuffer::spill() {
+    std::string dir = ExecContext::current().variables().value("TMPDIR");
+    if (dir.empty()) {
+        dir = "/tmp";
+    }
+
+    fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        // File systems without O_TMPFILE: a named file, unlinked at once
+        std::string path = dir + "/custom-shell-XXXXXX";
+        fd = mkostemp(&path[0], O_CLOEXEC);
+        if (fd != -1) {
+            unlink(path.c_str());
+        }
+    }
+    if (fd == -1) {
+        limit = 0;
+        return true;
+    }
+
+    std::string text;
+    text.swap(pending);
+    pending.reserve(WRITE_BLOCK);
+    return writeOut(text.data(), text.size());
+}
+
+bool OutputBuffer::flush() {
+    if (fd == -1 || pending.empty()) {
+        return writeError == 0;
+    }
+    bool ok = writeOut(pending.data(), pending.size());
+    pending.clear();
+    return ok;
+}
+
+bool OutputBuffer::writeOut(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, written);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            writeError = n == -1 ? errno : ENOSPC;
+            return false;
+        }
+        data += n;
+        size -= n;
+        written += n;
+    }
+    return true;
+}
+
+char OutputBuffer::back() const {
+    if (!pending.empty()) {
+        return pending.back();
+    }
+    char last = '\0';
+    if (written > 0 && pread(fd, &last, 1, written - 1) != 1) {
+        last = '\0';
+    }
+    return last;
+}
+
+/**
+ * @brief Keep only the first size bytes
+ */
+void OutputBuffer::truncate(size_t size) {
+    if (size >= length) {
+        return;
+    }
+    if (size >= written) {
+        pending.resize(size - written);
+    } else {
+        pending.clear();
+        if (ftruncate(fd, size) == 0) {
+            written = size;
+        }
+    }
+    length = size;
+}
+
+/**
+ * @brief Drop a final newline, as commands do before returning their output
+ */
+void OutputBuffer::popNewline() {
+    if (length > 0 && back() == '\n') {
+        truncate(length - 1);
+    }
+}
+
+/**
+ * @brief Pass the text to consume in chunks, reading a spilled buffer
+ *        back through FileReader
+ * @return False on a read error or Ctrl-C, as FileReader::forEachChunk
+ */
+bool OutputBuffer::forEachChunk(const FileReader::ChunkFn& consume) {
+    return readBack(consume, false);
+}
+
+/**
+ * @brief Pass the text to consume in chunks of whole lines, as
+ *        FileReader::forEachLineBlock; text in memory is one chunk
+ */
+bool OutputBuffer::forEachLineBlock(const FileReader::ChunkFn& consume) {
+    return readBack(consume, true);
+}
+
+bool OutputBuffer::readBack(const FileReader::ChunkFn& consume, bool lineBlocks) {
+    if (fd == -1) {
+        if (!pending.empty()) {
+            consume(pending.data(), pending.size());
+        }
+        return true;
+    }
+
+    int reader = openReader();
+    if (reader == -1) {
+        return false;
+    }
+    FileReader file(reader);
+    bool ok = lineBlocks ? file.forEachLineBlock(consume) : file.forEachChunk(consume);
+    int err = errno;
+    close(reader);
+    errno = err;
+    return ok;
+}
+
+/**
+ * @brief Append up to size bytes of the text, from offset on, to out
+ * @return Number of bytes appended; fewer than asked only at the end or
+ *         on a read error
+ */
+size_t OutputBuffer::read(size_t offset, size_t size, std::string& out) const {
+    size_t copied = 0;
+    if (offset < written) {
+        size_t wanted = std::min(size, written - offset);
+        size_t start = out.size();
+        out.resize(start + wanted);
+        ssize_t n;
+        while ((n = pread(fd, &out[start], wanted, offset)) == -1 && errno == EINTR) {}
+        copied = n > 0 ? n : 0;
+        out.resize(start + copied);
+        if (copied < wanted) {
+            return copied;
+        }
+    }
+
+    size_t from = offset + copied - written;
+    if (copied < size && from < pending.size()) {
+        size_t taken = std::min(size - copied, pending.size() - from);
+        out.append(pending, from, taken);
+        copied += taken;
+    }
+    return copied;
+}
+
+/**
+ * @brief Open the temporary file again, with an offset of its own, for
+ *        FileReader or a program's stdin
+ * @return The descriptor, or -1 if the text is not spilled or the file
+ *         cannot be written or opened (errno is set)
+ */
+int OutputBuffer::openReader() {
+    if (fd == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!flush()) {
+        errno = writeError;
+        return -1;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * @brief Hand the text on as result.output, or the whole spilled buffer as
+ *        result.spill; a failure to write it becomes an error of the result
+ */
+void OutputBuffer::moveInto(CommandResult& result) {
+    flush();
+    if (writeError != 0) {
+        if (result.status == 0) {
+            result.status = 1;
+        }
+        result.error += (result.error.empty() ? "" : "\n") +
+                        std::string("cannot keep output in a temporary file: ") + strerror(writeError);
+    }
+
+    if (fd == -1) {
+        result.output = std::move(pending);
+        length = 0;
+        return;
+    }
+    result.output.clear();
+    result.spill = std::make_shared<OutputBuffer>(std::move(*this));
+}
@@ -39,12 +39,14 @@ AST Parser::parseCmdAtomic(int& index, const std::vector<Token>& tokens) {
 
     // Then collect arguments until we hit an operator
     std::vector<std::string> args;
+    std::vector<AST::Quoting> quoting;
     while (index < n && !isOperator(tokens[index])) {
         args.push_back(tokens[index].lexeme);
+        quoting.push_back(quotingOf(tokens[index]));
         ++index;
     }
 
-    return AST::makeCommandNode(std::move(cmd), std::move(args));
+    return AST::makeCommandNode(std::move(cmd), std::move(args), std::move(quoting));
 }
 
 /**
@@ -94,6 +96,12 @@ AST Parser::parseOpExpr(AST lhs, int min_prec, int& index, const std::vector<Tok
     return lhs;
 }
 
+AST::Quoting Parser::quotingOf(const Token& token) {
+    if (token.type == TokenType::SINGLE_QUOTED) return AST::Quoting::Single;
+    if (token.type == TokenType::QUOTED) return AST::Quoting::Double;
+    return AST::Quoting::None;
+}
+
 bool Parser::isOperator(const Token& token) {
     const std::string& op = token.lexeme;
     return (
@@ -0,0 +1,23 @@
+#include "pattern_cache.h"
+
+// Caches are statics of other translation units and register while they
+// are constructed, so the registry must not depend on initialization order
+static std::mutex& registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<PatternCacheBase*>& registry() {
+    static std::vector<PatternCacheBase*> caches;
+    return caches;
+}
+
+PatternCacheBase::PatternCacheBase() {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().push_back(this);
+}
+
+std::vector<PatternCacheBase*> PatternCacheBase::all() {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    return registry();
+}
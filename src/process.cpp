@@ -0,0 +1,289 @@
+#include "process.h"
+#include "exec_context.h"
+#include "cancel.h"
+#include "output_buffer.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Start a program in the current job's directory
+ * @param streams Descriptors for the child's stdin, stdout and stderr; -1 keeps the shell's
+ * @param pid Receives the child's pid
+ * @return Status 0, or the status and message to report if it could not be started
+ */
+static CommandResult spawnProgram(const std::vector<std::string>& argv, ShellVariables& vars,
+                                  const int streams[3], pid_t& pid) {
+    ExecContext& context = ExecContext::current();
+    std::string program = Process::findExecutable(argv[0], vars.value("PATH"));
+    if (program.empty()) {
+        return {127, "", "Unknown command: " + argv[0]};
+    }
+    program = context.absolute(program);
+
+    std::vector<char*> cargv;
+    cargv.reserve(argv.size() + 1);
+    for (const std::string& arg : argv) {
+        cargv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    cargv.push_back(nullptr);
+
+    // The child starts in the job's directory, not the shell's
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addfchdir_np(&actions, context.dirfd());
+    for (int target = 0; target < 3; ++target) {
+        if (streams[target] != -1) {
+            posix_spawn_file_actions_adddup2(&actions, streams[target], target);
+        }
+    }
+
+    // Inside timeout or limit the program leads a process group, so the
+    // scope's signals also reach anything it starts
+    CancelScope* scope = context.cancelScope();
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    // Programs never inherit signals the calling thread holds (the server
+    // blocks SIGINT and SIGTERM, capture SIGPIPE)
+    sigset_t unblocked;
+    sigemptyset(&unblocked);
+    posix_spawnattr_setsigmask(&attributes, &unblocked);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | (scope ? POSIX_SPAWN_SETPGROUP : 0));
+
+    int rc = posix_spawn(&pid, program.c_str(), &actions, &attributes, cargv.data(), vars.envp());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (rc != 0) {
+        return {126, "", argv[0] + ": " + strerror(rc)};
+    }
+
+    // Adopted, so the scope can signal it; it may have been cancelled
+    // while the program was being started
+    if (scope) {
+        scope->adopt(pid);
+        if (scope->cancelled()) {
+            kill(-pid, SIGTERM);
+        }
+    }
+    return {0, "", ""};
+}
+
+static CommandResult waitForProgram(const std::string& name, pid_t pid) {
+    int status = 0;
+    int rc;
+    while ((rc = waitpid(pid, &status, 0)) == -1 && errno == EINTR) {}
+    int saved = errno;
+
+    if (CancelScope* scope = CancelScope::current()) {
+        scope->release(pid);
+    }
+    if (rc == -1) {
+        return {1, "", name + ": wait failed: " + strerror(saved)};
+    }
+    return {Process::exitStatus(status), "", ""};
+}
+
+/**
+ * @brief Spawn an external program and wait for it to finish
+ * @param argv Program name followed by its arguments
+ * @param vars Variable table providing PATH and the exported environment
+ * @return Exit status of the program (128 + signal number if it was killed)
+ */
+CommandResult Process::run(const std::vector<std::string>& argv, ShellVariables& vars) {
+    const int streams[3] = {-1, -1, -1};
+    pid_t pid;
+    CommandResult started = spawnProgram(argv, vars, streams, pid);
+    if (started.status != 0) {
+        return started;
+    }
+    return waitForProgram(argv[0], pid);
+}
+
+/**
+ * @brief Spawn an external program with its output collected rather than
+ *        printed, for commands that run on worker threads or in pipelines
+ * @param argv Program name followed by its arguments
+ * @param vars Variable table providing PATH and the exported environment
+ * @param input Output of an earlier command for the program's stdin; null
+ *        for /dev/null. Text in memory is written through a pipe, and a
+ *        spilled buffer's file is given to the program to read itself.
+ * @return Exit status of the program, with its stdout and stderr as output
+ *         and error (each without its trailing newline); a large stdout is
+ *         kept as an OutputBuffer
+ */
+CommandResult Process::capture(const std::vector<std::string>& argv, ShellVariables& vars,
+                               OutputBuffer* input) {
+    int stdinFd = -1;
+    if (input && input->spilled()) {
+        stdinFd = input->openReader();
+        if (stdinFd == -1) {
+            return {1, "", argv[0] + ": cannot read input: " + strerror(errno)};
+        }
+    }
+    const std::string* inputText = input && !input->spilled() ? &input->inMemory() : nullptr;
+
+    // Close-on-exec, so programs started by other threads do not hold a
+    // write end open and delay end-of-file
+    int pipes[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+    for (int i = inputText ? 0 : 1; i < 3; ++i) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
+            int saved = errno;
+            for (auto& p : pipes) {
+                if (p[0] != -1) { close(p[0]); close(p[1]); }
+            }
+            if (stdinFd != -1) close(stdinFd);
+            return {1, "", argv[0] + ": cannot create pipe: " + strerror(saved)};
+        }
+    }
+    if (inputText) {
+        stdinFd = pipes[0][0];
+    } else if (stdinFd == -1) {
+        stdinFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    const int streams[3] = {stdinFd, pipes[1][1], pipes[2][1]};
+    pid_t pid;
+    CommandResult started = spawnProgram(argv, vars, streams, pid);
+
+    if (stdinFd != -1) close(stdinFd);
+    close(pipes[1][1]);
+    close(pipes[2][1]);
+
+    if (started.status != 0) {
+        if (inputText) close(pipes[0][1]);
+        close(pipes[1][0]);
+        close(pipes[2][0]);
+        return started;
+    }
+
+    // A program that exits without reading its input makes writes fail with
+    // EPIPE; SIGPIPE is held on this thread and discarded instead
+    sigset_t pipeSignal, previousMask;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+
+    // Charged below as it is read, together with stderr
+    OutputBuffer output(OutputBuffer::currentLimit(), OutputBuffer::Charge::None);
+    std::string errors;
+    struct pollfd fds[3] = {{pipes[1][0], POLLIN, 0}, {pipes[2][0], POLLIN, 0}, {-1, POLLOUT, 0}};
+    size_t written = 0;
+    if (inputText) {
+        fds[2].fd = pipes[0][1];
+        fcntl(fds[2].fd, F_SETFL, O_NONBLOCK);
+        if (inputText->empty()) {
+            close(fds[2].fd);
+            fds[2].fd = -1;
+        }
+    }
+
+    char buffer[16384];
+    int remaining = 2;
+    CancelScope* scope = CancelScope::current();
+
+    while (remaining > 0) {
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd == -1 || fds[i].revents == 0) continue;
+            ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                if (i == 0) {
+                    output.append(buffer, n);
+                } else {
+                    errors.append(buffer, n);
+                }
+                if (scope && !scope->chargeOutput(n)) {
+                    kill(-pid, SIGKILL);
+                }
+            } else if (n == 0 || errno != EINTR) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                --remaining;
+            }
+        }
+        if (fds[2].fd != -1 && fds[2].revents != 0) {
+            ssize_t n = write(fds[2].fd, inputText->data() + written, inputText->size() - written);
+            if (n > 0) {
+                written += n;
+            }
+            if (written == inputText->size() || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+                close(fds[2].fd);
+                fds[2].fd = -1;
+            }
+        }
+    }
+    for (struct pollfd& p : fds) {
+        if (p.fd != -1) close(p.fd);
+    }
+
+    struct timespec noWait = {0, 0};
+    while (sigtimedwait(&pipeSignal, nullptr, &noWait) > 0) {}
+    pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+
+    CommandResult result = waitForProgram(argv[0], pid);
+    if (!errors.empty() && errors.back() == '\n') {
+        errors.pop_back();
+    }
+    if (result.error.empty()) {
+        result.error = std::move(errors);
+    }
+    output.popNewline();
+    output.moveInto(result);
+    return result;
+}
+
+/**
+ * @brief Resolve a command name against PATH. Relative names and PATH
+ *        entries are looked up in the current job's directory.
+ * @return Path of the executable, or an empty string if none was found
+ */
+std::string Process::findExecutable(const std::string& name, const std::string& path) {
+    const int cwdFd = ExecContext::current().dirfd();
+
+    if (name.find('/') != std::string::npos) {
+        return faccessat(cwdFd, name.c_str(), X_OK, 0) == 0 ? name : "";
+    }
+
+    size_t begin = 0;
+    while (begin <= path.size()) {
+        size_t end = path.find(':', begin);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+
+        std::string dir = (end == begin) ? "." : path.substr(begin, end - begin);
+        std::string candidate = dir + "/" + name;
+
+        struct stat st;
+        if (fstatat(cwdFd, candidate.c_str(), &st, 0) == 0 && S_ISREG(st.st_mode) &&
+            faccessat(cwdFd, candidate.c_str(), X_OK, 0) == 0) {
+            return candidate;
+        }
+
+        begin = end + 1;
+    }
+
+    return "";
+}
+
+int Process::exitStatus(int waitStatus) {
+    if (WIFEXITED(waitStatus)) {
+        return WEXITSTATUS(waitStatus);
+    }
+    if (WIFSIGNALED(waitStatus)) {
+        return 128 + WTERMSIG(waitStatus);
+    }
+    return 1;
+}
@@ -0,0 +1,609 @@
+#include "server.h"
+#include "cancel.h"
+#include "exec_context.h"
+#include "executor.h"
+#include "lexer.h"
+#include "output.h"
+#include "output_buffer.h"
+#include "parser.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const unsigned MIN_WORKERS = 4;
+static const size_t READ_SIZE = 64 << 10;
+static const size_t SEND_BLOCK = 256 << 10;
+
+// Text queued for a client; a spilled output follows it, read from its
+// file a block at a time as the socket takes it
+struct ShellServer::Reply {
+    std::string text;                       // from offset sent on
+    size_t sent = 0;
+    std::shared_ptr<OutputBuffer> spill;
+    size_t offset = 0;                      // of the next block of spill
+};
+
+struct ShellServer::Session {
+    int fd;
+    std::unique_ptr<ExecContext> context;
+    CancelScope scope{nullptr};
+
+    // Loop thread only
+    std::string received;            // start of a line still being received
+    uint32_t interest = 0;           // events registered with epoll
+
+    std::mutex mutex;
+    std::deque<std::string> lines;   // complete lines waiting to run
+    bool running = false;            // a worker has the session
+    std::deque<Reply> replies;       // replies not yet sent
+    bool inputClosed = false;        // the client sent EOF, or quit was run
+    bool broken = false;             // the client is gone
+
+    Session(int fd, std::unique_ptr<ExecContext> ctx) : fd(fd), context(std::move(ctx)) {
+        context->setCancelScope(&scope);
+    }
+};
+
+struct ShellServer::Impl {
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    int signalFd = -1;
+    std::unordered_map<int, std::shared_ptr<Session>> sessions;   // loop thread only
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<Session>> ready;       // sessions with a line for a worker
+    std::vector<std::shared_ptr<Session>> updated;    // sessions with news for the loop
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    ~Impl() {
+        for (int fd : {listenFd, epollFd, wakeFd, signalFd}) {
+            if (fd != -1) close(fd);
+        }
+    }
+
+    void watch(Session& session, uint32_t events) {
+        if (events == session.interest) {
+            return;
+        }
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.fd = session.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, session.fd, &event);
+        session.interest = events;
+    }
+
+    // ---------------------------------------------------------------- loop thread
+
+    void accept() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                if (errno == EINTR) continue;
+                return;   // EAGAIN, or out of fds until a session closes
+            }
+
+            auto session = std::make_shared<Session>(fd, ExecContext::shell().fork());
+            struct epoll_event event = {};
+            event.events = session->interest = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+            sessions.emplace(fd, std::move(session));
+        }
+    }
+
+    void receive(Session& session) {
+        char buffer[READ_SIZE];
+        std::vector<std::string> lines;
+        bool closed = false;
+        bool broken = false;
+
+        while (true) {
+            ssize_t n = read(session.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                const char* p = buffer;
+                const char* end = buffer + n;
+                while (const char* nl = static_cast<const char*>(memchr(p, '\n', end - p))) {
+                    session.received.append(p, nl);
+                    lines.push_back(std::move(session.received));
+                    session.received.clear();
+                    p = nl + 1;
+                }
+                session.received.append(p, end);
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            if (n == 0) closed = true;
+            else if (errno != EAGAIN) broken = true;
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(session.mutex);
+        if (closed && !session.received.empty()) {
+            lines.push_back(std::move(session.received));   // last line without a newline
+            session.received.clear();
+        }
+        if (!session.inputClosed) {
+            for (std::string& line : lines) {
+                session.lines.push_back(std::move(line));
+            }
+        }
+        session.inputClosed = session.inputClosed || closed;
+        if (broken) {
+            disconnect(session);
+        }
+        if (!session.running && !session.lines.empty()) {
+            session.running = true;
+            schedule(sessions.at(session.fd));
+        }
+    }
+
+    // Called with the session locked
+    void disconnect(Session& session) {
+        session.broken = true;
+        session.inputClosed = true;
+        session.lines.clear();
+        session.scope.cancel(Cancellation::STATUS);
+        session.scope.signalPrograms(SIGTERM);
+    }
+
+    void flush(Session& session) {
+        std::lock_guard<std::mutex> lock(session.mutex);
+        while (!session.replies.empty() && !session.broken) {
+            Reply& reply = session.replies.front();
+            if (reply.sent == reply.text.size()) {
+                reply.text.clear();
+                reply.sent = 0;
+                if (!reply.spill || reply.offset == reply.spill->size()) {
+                    session.replies.pop_front();
+                } else if (size_t n = reply.spill->read(reply.offset, SEND_BLOCK, reply.text)) {
+                    reply.offset += n;
+                } else {
+                    disconnect(session);    // the header promised more than can be sent
+                }
+                continue;
+            }
+
+            ssize_t n = send(session.fd, reply.text.data() + reply.sent,
+                             reply.text.size() - reply.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                reply.sent += n;
+            } else if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n == -1 && errno == EAGAIN) {
+                break;
+            } else {
+                disconnect(session);
+            }
+        }
+
+        uint32_t events = session.inputClosed ? 0 : EPOLLIN | EPOLLRDHUP;
+        if (!session.replies.empty() && !session.broken) {
+            events |= EPOLLOUT;
+        }
+        watch(session, events);
+    }
+
+    // Drop the session once nothing more can happen on it
+    void closeIfDone(Session& session) {
+        {
+            std::lock_guard<std::mutex> lock(session.mutex);
+            bool drained = session.replies.empty() && session.lines.empty();
+            if (session.running || !(session.broken || (session.inputClosed && drained))) {
+                return;
+            }
+        }
+        int fd = session.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        sessions.erase(fd);
+    }
+
+    bool handle(const struct epoll_event& event) {
+        int fd = event.data.fd;
+
+        if (fd == listenFd) {
+            accept();
+        } else if (fd == signalFd) {
+            return false;
+        } else if (fd == wakeFd) {
+            uint64_t count;
+            while (read(wakeFd, &count, sizeof(count)) == -1 && errno == EINTR) {}
+
+            std::vector<std::shared_ptr<Session>> changed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                changed.swap(updated);
+            }
+            for (const auto& session : changed) {
+                // A session already closed by the loop has no further use for news
+                auto it = sessions.find(session->fd);
+                if (it != sessions.end() && it->second == session) {
+                    flush(*session);
+                    closeIfDone(*session);
+                }
+            }
+        } else {
+            auto it = sessions.find(fd);
+            if (it == sessions.end()) {
+                return true;
+            }
+            std::shared_ptr<Session> session = it->second;
+
+            if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                receive(*session);
+            }
+            if (event.events & (EPOLLHUP | EPOLLERR)) {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                disconnect(*session);
+            }
+            flush(*session);
+            closeIfDone(*session);
+        }
+        return true;
+    }
+
+    // ---------------------------------------------------------------- workers
+
+    void schedule(std::shared_ptr<Session> session) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(std::move(session));
+        }
+        cv.notify_one();
+    }
+
+    void post(std::shared_ptr<Session> session) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            updated.push_back(std::move(session));
+        }
+        uint64_t one = 1;
+        while (write(wakeFd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+    }
+
+    static std::vector<Reply> runLine(Session& session, const std::string& line) {
+        CommandResult result{0, "", ""};
+
+        if (line.find_first_not_of(" \t\r") != std::string::npos) {
+            ExecContext::Scope installed(*session.context);
+            try {
+                std::vector<Token> tokens = Lexer::tokenize(line);
+                AST ast = Parser::parse(tokens);
+                result = Executor::executeCommand(ast);
+            } catch (const std::exception& ex) {
+                result = {1, "", std::string("Error: ") + ex.what()};
+            }
+        }
+
+        size_t outputSize = result.spill ? result.spill->size() : result.output.size();
+        const char* newline = outputSize > 0 && result.trailingNewline ? "\n" : "";
+        std::string error = result.error.empty() ? "" : result.error + "\n";
+
+        char header[64];
+        snprintf(header, sizeof(header), "%d %zu %zu\n", result.status, outputSize + strlen(newline), error.size());
+
+        // A spilled output is streamed from its file rather than copied here
+        std::vector<Reply> replies(1);
+        replies[0].text = header;
+        if (result.spill) {
+            replies[0].spill = std::move(result.spill);
+            replies.emplace_back();
+        } else {
+            replies[0].text += result.output;
+        }
+        replies.back().text += newline + error;
+        return replies;
+    }
+
+    // Runs one line of a session at a time, so other sessions get their turn
+    void work() {
+        while (true) {
+            std::shared_ptr<Session> session;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !ready.empty(); });
+                if (stopping) {
+                    return;
+                }
+                session = std::move(ready.front());
+                ready.pop_front();
+            }
+
+            std::string line;
+            {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                if (session->lines.empty()) {
+                    session->running = false;
+                    post(session);
+                    continue;
+                }
+                line = std::move(session->lines.front());
+                session->lines.pop_front();
+            }
+
+            std::vector<Reply> replies = runLine(*session, line);
+
+            bool more;
+            {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                for (Reply& reply : replies) {
+                    session->replies.push_back(std::move(reply));
+                }
+                if (session->context->exitWasRequested()) {
+                    session->inputClosed = true;
+                    session->lines.clear();
+                }
+                more = !session->lines.empty();
+                session->running = more;
+            }
+
+            post(session);
+            if (more) {
+                schedule(std::move(session));
+            }
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+
+        // Running commands end at their next cancellation check
+        for (auto& entry : sessions) {
+            std::lock_guard<std::mutex> lock(entry.second->mutex);
+            disconnect(*entry.second);
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        for (auto& entry : sessions) {
+            close(entry.first);
+        }
+        sessions.clear();
+    }
+};
+
+/**
+ * @brief Bind a listening socket at path, replacing a stale socket left by
+ *        a server that is no longer running
+ * @return The socket, or -1 with error set
+ */
+static int listenAt(const std::string& path, std::string& error) {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        error = "socket path too long";
+        return -1;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        error = strerror(errno);
+        return -1;
+    }
+
+    auto* addr = reinterpret_cast<struct sockaddr*>(&address);
+    int rc = bind(fd, addr, sizeof(address));
+    if (rc == -1 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe != -1 && connect(probe, addr, sizeof(address)) == 0;
+        if (probe != -1) close(probe);
+        if (live) {
+            close(fd);
+            error = "a server is already listening there";
+            return -1;
+        }
+        unlink(path.c_str());
+        rc = bind(fd, addr, sizeof(address));
+    }
+    if (rc == -1 || listen(fd, SOMAXCONN) == -1) {
+        error = strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Serve command lines on a Unix domain socket until SIGINT or SIGTERM
+ * @param path Where to create the socket
+ * @return Exit status for the process
+ */
+int ShellServer::serve(const std::string& path) {
+    OutputWriter& err = OutputWriter::err();
+
+    // Taken through the signalfd; blocked before any thread starts so that
+    // every thread inherits the mask
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    Impl impl;
+    std::string error;
+    impl.listenFd = listenAt(path, error);
+    if (impl.listenFd == -1) {
+        err.write("custom-shell: cannot serve on '" + path + "': " + error + "\n");
+        return 1;
+    }
+
+    impl.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    impl.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    impl.signalFd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    for (int fd : {impl.listenFd, impl.wakeFd, impl.signalFd}) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(impl.epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    unsigned workers = std::max(MIN_WORKERS, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < workers; ++i) {
+        impl.workers.emplace_back([&impl] { impl.work(); });
+    }
+
+    struct epoll_event events[64];
+    bool running = true;
+    while (running) {
+        int n = epoll_wait(impl.epollFd, events, 64, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n && running; ++i) {
+            running = impl.handle(events[i]);
+        }
+    }
+
+    impl.stop();
+    unlink(path.c_str());
+    return 0;
+}
+
+/**
+ * @brief Write all of data to a socket, resuming after short writes
+ */
+static bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * Prints replies as their bytes arrive, so that a large output passes
+ * through the client rather than collecting in it
+ */
+struct ReplyPrinter {
+    std::string header;     // of the next reply, still being received
+    size_t outputLeft = 0;
+    size_t errorLeft = 0;
+    int status = 0;         // of the last reply
+
+    void feed(const char* data, size_t size) {
+        while (size > 0) {
+            if (outputLeft > 0 || errorLeft > 0) {
+                size_t& left = outputLeft > 0 ? outputLeft : errorLeft;
+                size_t n = std::min(size, left);
+                (outputLeft > 0 ? OutputWriter::out() : OutputWriter::err()).write(data, n);
+                left -= n;
+                data += n;
+                size -= n;
+                continue;
+            }
+
+            const char* nl = static_cast<const char*>(memchr(data, '\n', size));
+            if (nl == nullptr) {
+                header.append(data, size);
+                return;
+            }
+            header.append(data, nl);
+            size -= nl + 1 - data;
+            data = nl + 1;
+
+            // Anything else would be a server bug
+            int replyStatus = 0;
+            if (sscanf(header.c_str(), "%d %zu %zu", &replyStatus, &outputLeft, &errorLeft) == 3) {
+                status = replyStatus;
+            } else {
+                outputLeft = errorLeft = 0;
+            }
+            header.clear();
+        }
+    }
+};
+
+/**
+ * @brief Run commands on a server and print what they produce
+ * @param path The server's socket
+ * @param command Words of a single command line; empty to send stdin instead
+ */
+int ShellClient::run(const std::string& path, const std::vector<std::string>& command) {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    int fd = path.size() < sizeof(address.sun_path) ? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+    if (fd != -1) {
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    }
+    if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+        std::string reason = fd == -1 && path.size() >= sizeof(address.sun_path)
+            ? "socket path too long" : strerror(errno);
+        OutputWriter::err().write("custom-shell: cannot connect to '" + path + "': " + reason + "\n");
+        if (fd != -1) close(fd);
+        return 1;
+    }
+
+    bool sending = command.empty();
+    if (!sending) {
+        std::string line;
+        for (const std::string& word : command) {
+            line += (line.empty() ? "" : " ") + word;
+        }
+        line += '\n';
+        sendAll(fd, line.data(), line.size());
+        shutdown(fd, SHUT_WR);
+    }
+
+    ReplyPrinter printer;
+    std::unique_ptr<char[]> chunk(new char[READ_SIZE]);
+
+    while (true) {
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {sending ? STDIN_FILENO : -1, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[1].revents) {
+            ssize_t n = read(STDIN_FILENO, chunk.get(), READ_SIZE);
+            if (n > 0 && sendAll(fd, chunk.get(), n)) {
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            sending = false;
+            shutdown(fd, SHUT_WR);
+        }
+
+        if (fds[0].revents) {
+            ssize_t n = read(fd, chunk.get(), READ_SIZE);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) {
+                break;
+            }
+            printer.feed(chunk.get(), n);
+        }
+    }
+
+    close(fd);
+    OutputWriter::out().flush();
+    return printer.status;
+}
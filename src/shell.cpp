@@ -7,68 +7,140 @@
 #include "token.h"
 #include "executor.h"
 #include "commands.h"
+#include "line_editor.h"
+#include "history.h"
+#include "output.h"
+#include "exec_context.h"
+#include "cancel.h"
+#include "server.h"
+#include "output_buffer.h"
+#include <cstdio>
+#include <fcntl.h>
 #include <limits.h>
 #include <unistd.h>
 
-int main() {
+/**
+ * @brief Start measuring the shell's peak resident set afresh, by resetting
+ *        VmHWM through /proc/self/clear_refs
+ */
+static void resetPeakMemory() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd != -1) {
+        ssize_t n = write(fd, "5", 1);
+        (void)n;
+        close(fd);
+    }
+}
+
+/**
+ * @brief The shell's peak resident set since resetPeakMemory(), e.g. "10516K"
+ * @return The size, or an empty string if /proc/self/status cannot be read
+ */
+static std::string peakMemory() {
+    FILE* status = fopen("/proc/self/status", "re");
+    if (status == nullptr) {
+        return "";
+    }
+    char line[256];
+    unsigned long kilobytes = 0;
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), status) != nullptr) {
+        found = sscanf(line, "VmHWM: %lu kB", &kilobytes) == 1;
+    }
+    fclose(status);
+    return found ? std::to_string(kilobytes) + "K" : "";
+}
+
+int main(int argc, char* argv[]) {
+    // Nothing prints through iostreams, and std::cin need not track stdio
+    std::ios::sync_with_stdio(false);
+
+    if (argc > 1) {
+        std::string mode = argv[1];
+        if (mode == "--serve" && argc == 3) {
+            return ShellServer::serve(argv[2]);
+        }
+        if (mode == "--client" && argc >= 3) {
+            return ShellClient::run(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+        }
+        OutputWriter::err().write("usage: custom-shell [--serve SOCKET | --client SOCKET [command...]]\n");
+        return 2;
+    }
+
     const char* home = getenv("HOME");
     if (home != nullptr) {
         chdir(home);
     }
 
-    std::cout << "|  Welcome to our Custom Shell!\n";
-    std::cout << "|  Type help for our list of commands!\n";
+    // Ctrl-C stops the running command instead of the shell
+    Cancellation::install();
+
+    OutputWriter& out = OutputWriter::out();
+    OutputWriter& err = OutputWriter::err();
+
+    out.write("|  Welcome to our Custom Shell!\n");
+    out.write("|  Type help for our list of commands!\n");
+
+    History history(History::defaultPath());
+    LineEditor editor(&history);
 
     while (true) {
-        char cwd[PATH_MAX];
-        getcwd(cwd, sizeof(cwd));
-        std::cout << "custom-shell:" << cwd << "# ";
+        std::string prompt = "custom-shell:" + ExecContext::shell().cwd() + "# ";
 
         std::string input;
-        std::getline(std::cin, input);
+        if (!editor.readLine(prompt, input)) {
+            break;
+        }
 
         if (input.empty()) {
             continue;
         }
 
+        history.add(input);
+
         try {
             std::vector<Token> tokens = Lexer::tokenize(input);
 
             AST ast = Parser::parse(tokens);
 
+            Cancellation::reset();
+            resetPeakMemory();
             CommandResult result = Executor::executeCommand(ast);
 
-            bool printNewline = false;
-
-            if (result.status == 0) {
-                if (!result.output.empty()) {
-                    printNewline = true;
-                }
-
-                if (result.output.rfind("__NO_NL__", 0) == 0) {
-                    printNewline = false;
-                    result.output = result.output.substr(9); 
-                }
-
-                std::cout << result.output;
+            // Reported like $?, in SHELL_PEAK_RSS until the next command
+            std::string peak = peakMemory();
+            if (!peak.empty()) {
+                ExecContext::shell().variables().set("SHELL_PEAK_RSS", peak);
             }
 
-            if (result.status == 1) {
-                if (!result.error.empty()) {
-                    printNewline = true;
-                }
-                
-                std::cerr << result.error;
+            // Commands that fail part-way (e.g. one unreadable file out of
+            // several) still report the output they did produce; output
+            // that spilled to a file is printed from it
+            bool printed = false;
+            if (result.spill) {
+                printed = !result.spill->empty();
+                result.spill->forEachChunk([&out](const char* data, size_t size) {
+                    out.write(data, size);
+                    return true;
+                });
+            } else if (!result.output.empty()) {
+                printed = true;
+                out.write(result.output);
             }
-            
-            if (printNewline) {
-                std::cout << "\n";
+            if (printed && result.trailingNewline) {
+                out.write("\n", 1);
+            }
+
+            // Errors are shown even if the command succeeded overall, e.g. from
+            // an earlier stage of a pipeline
+            if (!result.error.empty()) {
+                err.write(result.error + "\n");
             }
-            
         } catch (const std::exception& ex) {
-            std::cerr << "Error: " << ex.what() << "\n";
+            err.write(std::string("Error: ") + ex.what() + "\n");
         }
     }
 
+    out.flush();
     return 0;
 }
@@ -0,0 +1,503 @@
+#include "sorter.h"
+#include "file_reader.h"
+#include "output_buffer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+static const size_t READ_BLOCK = 1 << 20;
+static const size_t PARALLEL_THRESHOLD = 1 << 15;
+
+/**
+ * Sequential reader over one spilled run. Lines are returned as views into
+ * its buffer and stay valid until the next call to next().
+ */
+class LineSorter::RunReader {
+public:
+    RunReader(int fd, size_t bufferSize) : fd(fd), data(bufferSize) {}
+
+    bool next() {
+        if (line) {
+            start += length + 1;
+        }
+
+        while (true) {
+            const char* nl = static_cast<const char*>(memchr(data.data() + start, '\n', end - start));
+            if (nl) {
+                line = data.data() + start;
+                length = nl - line;
+                return true;
+            }
+            if (eof) {
+                return false;
+            }
+
+            memmove(data.data(), data.data() + start, end - start);
+            end -= start;
+            start = 0;
+            if (end == data.size()) {
+                data.resize(data.size() * 2);
+            }
+
+            ssize_t n = read(fd, data.data() + end, data.size() - end);
+            if (n <= 0) {
+                eof = true;
+                failed = n < 0;
+            } else {
+                end += n;
+            }
+        }
+    }
+
+    const char* line = nullptr;
+    size_t length = 0;
+    Key key{};
+    bool failed = false;
+
+private:
+    int fd;
+    std::vector<char> data;
+    size_t start = 0;
+    size_t end = 0;
+    bool eof = false;
+};
+
+LineSorter::LineSorter(const Options& options) : options(options) {}
+
+LineSorter::~LineSorter() {
+    for (int fd : runs) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Sort the lines of the given files
+ * @param out Receives the sorted lines, each terminated by '\n'
+ * @param error Receives a message if a file cannot be read or a run cannot be written
+ * @return False on error
+ */
+bool LineSorter::sort(const std::vector<std::string>& files, OutputBuffer& out, std::string& error) {
+    for (const std::string& file : files) {
+        int fd = openat(options.baseDir, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            error = "cannot read '" + file + "': " + strerror(errno);
+            return false;
+        }
+        bool addFailed = false;
+        FileReader reader(fd);
+        bool ok = reader.forEachChunk([&](const char* data, size_t size) {
+            addFailed = !add(data, size, error);
+            return !addFailed;
+        });
+
+        if (!ok && !addFailed) {
+            error = "cannot read '" + file + "': " + strerror(errno);
+        }
+        close(fd);
+        if (!ok || addFailed) {
+            return false;
+        }
+        endInput();
+    }
+
+    // A buffer that cannot be written reports it when handed on (moveInto)
+    return finish([&out](const char* data, size_t size) { return out.append(data, size); }, error);
+}
+
+/**
+ * @brief Take more input, which need not end on a line boundary; full
+ *        buffers are spilled as runs
+ * @return False with error set if a run cannot be written
+ */
+bool LineSorter::add(const char* data, size_t size, std::string& error) {
+    buffer.insert(buffer.end(), data, data + size);
+    indexed = index(indexed, buffer.size());
+
+    if (!records.empty() && buffer.size() + records.size() * sizeof(Record) >= options.memoryBudget) {
+        if (!spill(error)) {
+            return false;
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + indexed);
+        indexed = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief End one input: its last line ends here even without a '\n'
+ */
+void LineSorter::endInput() {
+    if (indexed < buffer.size()) {
+        buffer.push_back('\n');
+        indexed = index(indexed, buffer.size());
+    }
+}
+
+/**
+ * @brief Sort everything added so far
+ * @param write Receives the sorted lines in blocks, each line terminated
+ *        by '\n'; returns false to stop early
+ * @return False with error set if a run cannot be written or read back
+ */
+bool LineSorter::finish(const FileReader::ChunkFn& write, std::string& error) {
+    if (runs.empty()) {
+        sortRecords();
+        emitRecords(write);
+        return true;
+    }
+
+    if (!records.empty() && !spill(error)) {
+        return false;
+    }
+
+    return mergeRuns(write, error);
+}
+
+/**
+ * @brief Add a record for every complete line in buffer[from, to)
+ * @return Offset just past the last complete line
+ */
+size_t LineSorter::index(size_t from, size_t to) {
+    const char* base = buffer.data();
+
+    while (from < to) {
+        const char* nl = static_cast<const char*>(memchr(base + from, '\n', to - from));
+        if (!nl) {
+            break;
+        }
+
+        const char* line = base + from;
+        size_t length = nl - line;
+        Key key = extractKey(line, length);
+
+        // The first eight key bytes, big-endian, so most comparisons are
+        // decided without touching the lines themselves
+        uint64_t prefix = 0;
+        for (uint32_t i = 0; i < 8; ++i) {
+            prefix = (prefix << 8) | (i < key.length ? static_cast<unsigned char>(key.data[i]) : 0);
+        }
+
+        records.push_back({from, static_cast<uint32_t>(length),
+                           static_cast<uint32_t>(key.data - line), key.length, key.number, prefix});
+        from += length + 1;
+    }
+
+    return from;
+}
+
+/**
+ * @brief Locate the -k key of a line and, for -n, parse its number
+ */
+LineSorter::Key LineSorter::extractKey(const char* line, size_t length) const {
+    size_t start = 0;
+    size_t end = length;
+
+    auto isBlank = [](char c) { return c == ' ' || c == '\t'; };
+
+    // Offset of the end of field n (1-based), or of the line if it has fewer fields
+    auto fieldEnd = [&](int n) {
+        size_t pos = 0;
+        for (int f = 0; f < n && pos < length; ++f) {
+            if (options.separator >= 0) {
+                if (f > 0) ++pos;
+                const void* sep = memchr(line + pos, options.separator, length - pos);
+                pos = sep ? static_cast<const char*>(sep) - line : length;
+            } else {
+                while (pos < length && isBlank(line[pos])) ++pos;
+                while (pos < length && !isBlank(line[pos])) ++pos;
+            }
+        }
+        return pos;
+    };
+
+    if (options.keyStart > 1) {
+        start = fieldEnd(options.keyStart - 1);
+        if (options.separator >= 0 && start < length) {
+            ++start;
+        }
+    }
+    if (options.keyEnd > 0) {
+        end = std::max(start, fieldEnd(options.keyEnd));
+    }
+
+    Key key{line + start, static_cast<uint32_t>(end - start), 0};
+
+    if (options.numeric) {
+        const char* p = key.data;
+        const char* stop = key.data + key.length;
+        while (p < stop && isBlank(*p)) ++p;
+
+        bool negative = p < stop && *p == '-';
+        if (negative) ++p;
+
+        double value = 0;
+        while (p < stop && *p >= '0' && *p <= '9') {
+            value = value * 10 + (*p++ - '0');
+        }
+        if (p < stop && *p == '.') {
+            double scale = 0.1;
+            for (++p; p < stop && *p >= '0' && *p <= '9'; ++p, scale /= 10) {
+                value += (*p - '0') * scale;
+            }
+        }
+        key.number = negative ? -value : value;
+    }
+
+    return key;
+}
+
+/**
+ * @brief Three-way comparison of two lines by key, falling back to the whole
+ *        line (unless -u) as sort(1) does
+ */
+int LineSorter::compare(const char* a, size_t aLen, const Key& ak, const char* b, size_t bLen, const Key& bk) const {
+    auto bytes = [](const char* x, size_t xLen, const char* y, size_t yLen) {
+        int r = memcmp(x, y, std::min(xLen, yLen));
+        return r != 0 ? r : (xLen < yLen ? -1 : xLen > yLen);
+    };
+
+    int r = options.numeric
+        ? (ak.number < bk.number ? -1 : ak.number > bk.number)
+        : bytes(ak.data, ak.length, bk.data, bk.length);
+
+    if (r == 0 && !options.unique && (options.numeric || options.keyStart > 0)) {
+        r = bytes(a, aLen, b, bLen);
+    }
+
+    return options.reverse ? -r : r;
+}
+
+/**
+ * @brief Stable-sort the records, splitting large inputs into slices sorted
+ *        on separate threads and then merged pairwise, also in parallel
+ */
+void LineSorter::sortRecords() {
+    const char* base = buffer.data();
+    auto less = [this, base](const Record& a, const Record& b) {
+        if (!options.numeric && a.prefix != b.prefix) {
+            return (a.prefix < b.prefix) != options.reverse;
+        }
+        Key ak{base + a.offset + a.keyOffset, a.keyLength, a.number};
+        Key bk{base + b.offset + b.keyOffset, b.keyLength, b.number};
+        return compare(base + a.offset, a.length, ak, base + b.offset, b.length, bk) < 0;
+    };
+
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    size_t n = records.size();
+
+    if (threads <= 1 || n < PARALLEL_THRESHOLD) {
+        std::stable_sort(records.begin(), records.end(), less);
+        return;
+    }
+
+    std::vector<size_t> bounds;
+    for (unsigned i = 0; i <= threads; ++i) {
+        bounds.push_back(n * i / threads);
+    }
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i) {
+        pool.emplace_back([&, i] {
+            std::stable_sort(records.begin() + bounds[i], records.begin() + bounds[i + 1], less);
+        });
+    }
+    for (std::thread& t : pool) {
+        t.join();
+    }
+
+    while (bounds.size() > 2) {
+        std::vector<size_t> next;
+        pool.clear();
+
+        size_t i = 0;
+        for (; i + 2 < bounds.size(); i += 2) {
+            pool.emplace_back([&, i] {
+                std::inplace_merge(records.begin() + bounds[i], records.begin() + bounds[i + 1],
+                                   records.begin() + bounds[i + 2], less);
+            });
+            next.push_back(bounds[i]);
+        }
+        if (i + 1 < bounds.size()) {
+            next.push_back(bounds[i]);
+        }
+        next.push_back(bounds.back());
+
+        for (std::thread& t : pool) {
+            t.join();
+        }
+        bounds.swap(next);
+    }
+}
+
+/**
+ * @brief Write a buffer out in full
+ */
+static bool writeAll(int fd, const char* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Pass the sorted records on in blocks, dropping duplicates for -u
+ * @return False if write returned false
+ */
+bool LineSorter::emitRecords(const FileReader::ChunkFn& write) const {
+    const char* base = buffer.data();
+    const Record* prev = nullptr;
+    std::string out;
+    out.reserve(READ_BLOCK + 4096);
+
+    for (const Record& r : records) {
+        if (options.unique && prev) {
+            Key pk{base + prev->offset + prev->keyOffset, prev->keyLength, prev->number};
+            Key rk{base + r.offset + r.keyOffset, r.keyLength, r.number};
+            if (compare(base + prev->offset, prev->length, pk, base + r.offset, r.length, rk) == 0) {
+                continue;
+            }
+        }
+        out.append(base + r.offset, r.length);
+        out += '\n';
+        prev = &r;
+
+        if (out.size() >= READ_BLOCK) {
+            if (!write(out.data(), out.size())) return false;
+            out.clear();
+        }
+    }
+
+    return out.empty() || write(out.data(), out.size());
+}
+
+/**
+ * @brief Sort the buffered records and write them to an unlinked temp file
+ *        as one run, leaving the records empty
+ */
+bool LineSorter::spill(std::string& error) {
+    sortRecords();
+
+    std::string path = options.tempDir + "/custom-shell-sort.XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) {
+        error = "cannot create temporary file in '" + options.tempDir + "': " + strerror(errno);
+        return false;
+    }
+    unlink(path.c_str());
+    runs.push_back(fd);
+
+    if (!emitRecords([fd](const char* data, size_t size) { return writeAll(fd, data, size); })) {
+        error = "cannot write temporary file: " + std::string(strerror(errno));
+        return false;
+    }
+
+    records.clear();
+    lseek(fd, 0, SEEK_SET);
+    return true;
+}
+
+/**
+ * @brief k-way merge of the spilled runs through a loser tree
+ *
+ * Internal nodes 1..k-1 hold the loser of the match played there and
+ * tree[0] holds the overall winner, so replacing the winner's line costs
+ * one comparison per level instead of a full heap sift.
+ */
+bool LineSorter::mergeRuns(const FileReader::ChunkFn& write, std::string& error) {
+    size_t k = runs.size();
+    size_t readBuffer = std::min<size_t>(4 << 20, std::max<size_t>(64 << 10, options.memoryBudget / (k + 1)));
+
+    std::vector<std::unique_ptr<RunReader>> readers;
+    std::vector<char> done(k);
+
+    for (size_t i = 0; i < k; ++i) {
+        readers.emplace_back(new RunReader(runs[i], readBuffer));
+        done[i] = !readers[i]->next();
+        if (!done[i]) {
+            readers[i]->key = extractKey(readers[i]->line, readers[i]->length);
+        }
+    }
+
+    // Exhausted runs lose to everything; ties go to the earlier run to stay stable
+    auto less = [&](size_t a, size_t b) -> bool {
+        if (done[a] || done[b]) {
+            return done[a] == done[b] ? a < b : done[b] != 0;
+        }
+        const RunReader& x = *readers[a];
+        const RunReader& y = *readers[b];
+        int r = compare(x.line, x.length, x.key, y.line, y.length, y.key);
+        return r < 0 || (r == 0 && a < b);
+    };
+
+    std::vector<size_t> tree(k);
+    std::vector<size_t> winners(2 * k);
+    for (size_t i = 0; i < k; ++i) {
+        winners[k + i] = i;
+    }
+    for (size_t node = k - 1; node >= 1; --node) {
+        size_t l = winners[2 * node];
+        size_t r = winners[2 * node + 1];
+        winners[node] = less(l, r) ? l : r;
+        tree[node] = less(l, r) ? r : l;
+    }
+    tree[0] = k > 1 ? winners[1] : 0;
+
+    std::string prev;
+    Key prevKey{};
+    bool havePrev = false;
+    std::string out;
+    out.reserve(READ_BLOCK + 4096);
+
+    while (!done[tree[0]]) {
+        size_t w = tree[0];
+        RunReader& reader = *readers[w];
+
+        bool duplicate = options.unique && havePrev &&
+            compare(prev.data(), prev.size(), prevKey, reader.line, reader.length, reader.key) == 0;
+
+        if (!duplicate) {
+            out.append(reader.line, reader.length);
+            out += '\n';
+            if (out.size() >= READ_BLOCK) {
+                if (!write(out.data(), out.size())) return true;
+                out.clear();
+            }
+            if (options.unique) {
+                prev.assign(reader.line, reader.length);
+                prevKey = extractKey(prev.data(), prev.size());
+                havePrev = true;
+            }
+        }
+
+        done[w] = !reader.next();
+        if (!done[w]) {
+            reader.key = extractKey(reader.line, reader.length);
+        } else if (reader.failed) {
+            error = "cannot read temporary file: " + std::string(strerror(errno));
+            return false;
+        }
+
+        size_t winner = w;
+        for (size_t node = (k + w) / 2; node >= 1; node /= 2) {
+            if (less(tree[node], winner)) {
+                std::swap(tree[node], winner);
+            }
+        }
+        tree[0] = winner;
+    }
+
+    if (!out.empty()) {
+        write(out.data(), out.size());
+    }
+    return true;
+}
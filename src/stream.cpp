@@ -0,0 +1,153 @@
+#include "stream.h"
+#include "exec_context.h"
+#include "file_reader.h"
+#include "output_buffer.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+void StreamStage::finish() {
+    if (next) {
+        next->finish();
+    }
+}
+
+/**
+ * The end of every pipeline: keeps the output of the last stage, in memory
+ * or, past SHELL_OUTPUT_MB, in a temporary file
+ */
+class StreamPipeline::Collector : public StreamStage {
+public:
+    bool write(const char* data, size_t size) override {
+        return output.append(data, size);
+    }
+
+    OutputBuffer output;
+};
+
+StreamPipeline::StreamPipeline() : collector(new Collector) {}
+
+StreamPipeline::~StreamPipeline() = default;
+
+void StreamPipeline::add(std::unique_ptr<StreamStage> stage) {
+    stages.push_back(std::move(stage));
+}
+
+void StreamPipeline::link() {
+    for (size_t i = 0; i < stages.size(); ++i) {
+        stages[i]->setNext(i + 1 < stages.size() ? stages[i + 1].get() : collector.get());
+    }
+}
+
+/**
+ * @brief Run the stages over the given files, in the current job's directory
+ * @param name Command of the first stage, for error messages
+ * @return Status of the last stage, the pipeline's output and every stage's errors
+ */
+CommandResult StreamPipeline::runFiles(const std::string& name, const std::vector<std::string>& files) {
+    link();
+    StreamStage& first = *stages.front();
+    const int cwdFd = ExecContext::current().dirfd();
+    bool stopped = false;
+
+    // A last line without its '\n' is held back and continued by the next
+    // file, as cat would print it, so blocks still hold whole lines
+    std::string carried;
+
+    for (const std::string& file : files) {
+        if (stopped) {
+            break;
+        }
+
+        int fd = openat(cwdFd, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            first.status = 1;
+            first.error += (first.error.empty() ? "" : "\n") + name + ": cannot open '" + file + "': " + strerror(errno);
+            continue;
+        }
+
+        FileReader reader(fd);
+        bool ok = reader.forEachLineBlock([&](const char* data, size_t size) {
+            if (!carried.empty()) {
+                const char* nl = static_cast<const char*>(memchr(data, '\n', size));
+                size_t head = nl ? nl + 1 - data : size;
+                carried.append(data, head);
+                if (nl == nullptr) {
+                    return true;
+                }
+                stopped = !first.write(carried.data(), carried.size());
+                carried.clear();
+                data += head;
+                size -= head;
+                if (stopped || size == 0) {
+                    return !stopped;
+                }
+            }
+            if (data[size - 1] != '\n') {
+                const char* nl = static_cast<const char*>(memrchr(data, '\n', size));
+                size_t whole = nl ? nl + 1 - data : 0;
+                carried.assign(data + whole, size - whole);
+                size = whole;
+                if (size == 0) {
+                    return true;
+                }
+            }
+            stopped = !first.write(data, size);
+            return !stopped;
+        });
+        int err = errno;
+        close(fd);
+
+        if (!ok) {
+            first.status = 1;
+            first.error += (first.error.empty() ? "" : "\n") + name + ": error reading '" + file + "': " + strerror(err);
+        }
+    }
+
+    if (!carried.empty() && !stopped) {
+        first.write(carried.data(), carried.size());
+    }
+
+    return finish();
+}
+
+/**
+ * @brief Run the stages over the output of an earlier command, read back
+ *        in blocks of lines if it spilled to a file
+ * @return Status of the last stage, the pipeline's output and every stage's errors
+ */
+CommandResult StreamPipeline::runText(OutputBuffer& text) {
+    link();
+    StreamStage& first = *stages.front();
+    if (text.spilled()) {
+        int fd = text.openReader();
+        if (fd != -1) {
+            first.inputFile(fd, text.size());
+            close(fd);
+        }
+    }
+    bool ok = text.forEachLineBlock([&first](const char* data, size_t size) {
+        return first.write(data, size);
+    });
+    if (!ok) {
+        first.status = 1;
+        first.error += (first.error.empty() ? "" : "\n") + std::string("cannot read output: ") + strerror(errno);
+    }
+    return finish();
+}
+
+CommandResult StreamPipeline::finish() {
+    stages.front()->finish();
+
+    CommandResult result{stages.back()->status, "", ""};
+    for (const std::unique_ptr<StreamStage>& stage : stages) {
+        if (!stage->error.empty()) {
+            result.error += (result.error.empty() ? "" : "\n") + stage->error;
+        }
+    }
+
+    collector->output.popNewline();
+    collector->output.moveInto(result);
+    return result;
+}
@@ -0,0 +1,218 @@
+#include "variables.h"
+#include <algorithm>
+#include <cctype>
+#include <unistd.h>
+
+ShellVariables::ShellVariables(const ShellVariables& other)
+    : vars(other.vars), lastStatus(other.lastStatus), exportGeneration(other.exportGeneration) {}
+
+ShellVariables& ShellVariables::operator=(const ShellVariables& other) {
+    if (this != &other) {
+        vars = other.vars;
+        lastStatus = other.lastStatus;
+        ++exportGeneration;
+    }
+    return *this;
+}
+
+/**
+ * @brief The shell's own variable table, seeded from the process environment
+ */
+ShellVariables& ShellVariables::global() {
+    static ShellVariables instance = [] {
+        ShellVariables vars;
+        vars.importEnviron(environ);
+        return vars;
+    }();
+    return instance;
+}
+
+void ShellVariables::importEnviron(char** envp) {
+    for (char** env = envp; env && *env; ++env) {
+        std::string entry = *env;
+        size_t eq = entry.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            continue;
+        }
+        vars[entry.substr(0, eq)] = {entry.substr(eq + 1), true};
+    }
+    ++exportGeneration;
+}
+
+const std::string* ShellVariables::get(const std::string& name) const {
+    auto iter = vars.find(name);
+    return iter == vars.end() ? nullptr : &iter->second.value;
+}
+
+std::string ShellVariables::value(const std::string& name) const {
+    const std::string* v = get(name);
+    return v ? *v : std::string();
+}
+
+/**
+ * @brief Assign a variable, keeping its export flag. Only changes to exported
+ *        variables invalidate the cached envp.
+ */
+void ShellVariables::set(const std::string& name, const std::string& value) {
+    Variable& var = vars[name];
+    if (var.exported && var.value != value) {
+        ++exportGeneration;
+    }
+    var.value = value;
+}
+
+void ShellVariables::exportVar(const std::string& name) {
+    Variable& var = vars[name];
+    if (!var.exported) {
+        var.exported = true;
+        ++exportGeneration;
+    }
+}
+
+void ShellVariables::unset(const std::string& name) {
+    auto iter = vars.find(name);
+    if (iter == vars.end()) {
+        return;
+    }
+    if (iter->second.exported) {
+        ++exportGeneration;
+    }
+    vars.erase(iter);
+}
+
+bool ShellVariables::isExported(const std::string& name) const {
+    auto iter = vars.find(name);
+    return iter != vars.end() && iter->second.exported;
+}
+
+/**
+ * @brief Every variable name with its export flag, sorted by name
+ */
+std::vector<std::pair<std::string, bool>> ShellVariables::names() const {
+    std::vector<std::pair<std::string, bool>> out;
+    out.reserve(vars.size());
+
+    for (const auto& entry : vars) {
+        out.emplace_back(entry.first, entry.second.exported);
+    }
+
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+/**
+ * @brief NULL-terminated "NAME=value" array for execve/posix_spawn
+ * @return Pointer valid until the next change to an exported variable
+ */
+char* const* ShellVariables::envp() {
+    if (builtGeneration == exportGeneration) {
+        return envPointers.data();
+    }
+
+    size_t bytes = 0;
+    size_t count = 0;
+    for (const auto& entry : vars) {
+        if (entry.second.exported) {
+            bytes += entry.first.size() + entry.second.value.size() + 2;
+            ++count;
+        }
+    }
+
+    // One contiguous block, so rebuilding is a single allocation
+    envBlock.clear();
+    envBlock.reserve(bytes);
+    std::vector<size_t> offsets;
+    offsets.reserve(count);
+
+    for (const auto& entry : vars) {
+        if (!entry.second.exported) {
+            continue;
+        }
+        offsets.push_back(envBlock.size());
+        envBlock += entry.first;
+        envBlock += '=';
+        envBlock += entry.second.value;
+        envBlock += '\0';
+    }
+
+    envPointers.clear();
+    envPointers.reserve(count + 1);
+    for (size_t off : offsets) {
+        envPointers.push_back(&envBlock[off]);
+    }
+    envPointers.push_back(nullptr);
+
+    builtGeneration = exportGeneration;
+    return envPointers.data();
+}
+
+/**
+ * @brief Substitute $NAME, ${NAME}, $? and $$ in a word
+ * @param word The word to expand; unset variables expand to nothing
+ * @return The expanded word
+ */
+std::string ShellVariables::expand(const std::string& word) const {
+    size_t dollar = word.find('$');
+    if (dollar == std::string::npos) {
+        return word;
+    }
+
+    std::string out = word.substr(0, dollar);
+    size_t i = dollar;
+    const size_t n = word.size();
+
+    while (i < n) {
+        char c = word[i];
+
+        if (c != '$' || i + 1 >= n) {
+            out.push_back(c);
+            ++i;
+            continue;
+        }
+
+        char next = word[i + 1];
+
+        if (next == '?') {
+            out += std::to_string(lastStatus);
+            i += 2;
+        } else if (next == '$') {
+            out += std::to_string(getpid());
+            i += 2;
+        } else if (next == '{') {
+            size_t close = word.find('}', i + 2);
+            if (close == std::string::npos) {
+                out.push_back(c);
+                ++i;
+                continue;
+            }
+            out += value(word.substr(i + 2, close - i - 2));
+            i = close + 1;
+        } else if (std::isalpha(static_cast<unsigned char>(next)) || next == '_') {
+            size_t end = i + 1;
+            while (end < n && (std::isalnum(static_cast<unsigned char>(word[end])) || word[end] == '_')) {
+                ++end;
+            }
+            out += value(word.substr(i + 1, end - i - 1));
+            i = end;
+        } else {
+            out.push_back(c);
+            ++i;
+        }
+    }
+
+    return out;
+}
+
+bool ShellVariables::isValidName(const std::string& name) {
+    if (name.empty() || !(std::isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_')) {
+        return false;
+    }
+
+    for (char c : name) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,243 @@
+#include "walker.h"
+#include "exec_context.h"
+#include "cancel.h"
+#include <condition_variable>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+    struct LinuxDirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    struct DirHandle {
+        int fd;
+        std::string path;
+        std::shared_ptr<void> data;
+
+        DirHandle(int fd, std::string path) : fd(fd), path(std::move(path)) {}
+        ~DirHandle() { close(fd); }
+    };
+
+    struct Work {
+        std::shared_ptr<DirHandle> parent;   // keeps the parent fd open until we have opened ours
+        std::string name;
+        std::string path;
+        int depth;
+        std::shared_ptr<void> parentData;
+    };
+}
+
+struct TreeWalker::Impl {
+    const Visitor& visit;
+    const EnterHook& enter;
+    size_t bufferSize;
+    int baseDir;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<Work> stack;
+    size_t active = 0;
+    std::string errors;
+
+    Impl(const Visitor& visit, const EnterHook& enter, size_t bufferSize, int baseDir)
+        : visit(visit), enter(enter), bufferSize(bufferSize), baseDir(baseDir) {}
+
+    void push(Work work) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stack.push_back(std::move(work));
+        }
+        cv.notify_one();
+    }
+
+    bool pop(Work& work) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !stack.empty() || active == 0 || Cancellation::requested(); });
+
+        // On Ctrl-C the pending directories are dropped and idle workers woken
+        if (Cancellation::requested()) {
+            stack.clear();
+            cv.notify_all();
+            return false;
+        }
+        if (stack.empty()) {
+            return false;
+        }
+
+        work = std::move(stack.back());
+        stack.pop_back();
+        ++active;
+        return true;
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--active == 0 && stack.empty()) {
+            cv.notify_all();
+        }
+    }
+
+    void fail(const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!errors.empty()) {
+            errors += "\n";
+        }
+        errors += message;
+    }
+
+    void run() {
+        std::vector<char> buffer(bufferSize);
+        Work work;
+
+        while (pop(work)) {
+            process(work, buffer);
+            work = Work();
+            finish();
+        }
+    }
+
+    void process(Work& work, std::vector<char>& buffer) {
+        int fd = work.parent
+            ? openat(work.parent->fd, work.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+            : openat(baseDir, work.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        work.parent.reset();
+
+        if (fd == -1) {
+            fail("cannot open directory '" + work.path + "': " + strerror(errno));
+            return;
+        }
+
+        auto dir = std::make_shared<DirHandle>(fd, std::move(work.path));
+        dir->data = enter ? enter(fd, dir->path, work.parentData) : work.parentData;
+
+        while (!Cancellation::requested()) {
+            long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (n == -1) {
+                fail("cannot read directory '" + dir->path + "': " + strerror(errno));
+                return;
+            }
+            if (n == 0) {
+                return;
+            }
+
+            for (long off = 0; off < n; ) {
+                auto* d = reinterpret_cast<LinuxDirent64*>(buffer.data() + off);
+                off += d->d_reclen;
+
+                const char* name = d->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                    continue;
+                }
+
+                unsigned char type = d->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat st;
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                        type = IFTODT(st.st_mode);
+                    }
+                }
+
+                std::string path = joinPath(dir->path, name);
+                WalkEntry entry{fd, name, type, path, work.depth + 1, dir->data};
+
+                if (visit(entry) && type == DT_DIR) {
+                    push(Work{dir, name, std::move(path), work.depth + 1, dir->data});
+                }
+            }
+        }
+    }
+};
+
+TreeWalker::TreeWalker() {}
+
+TreeWalker::TreeWalker(const Options& options) : options(options) {}
+
+/**
+ * @brief Walk each root, calling the visitor for every entry (roots included)
+ * @param roots Paths to start from; symlinked roots are followed
+ * @param visit Called concurrently; return true to descend into a directory
+ * @param error Receives one line per path that could not be read
+ * @return True if every directory could be read
+ */
+bool TreeWalker::walk(const std::vector<std::string>& roots, const Visitor& visit, std::string& error) {
+    ExecContext& context = ExecContext::current();
+    Impl impl(visit, enter, options.bufferSize, context.dirfd());
+    std::shared_ptr<void> none;
+
+    for (const std::string& root : roots) {
+        struct stat st;
+        if (fstatat(impl.baseDir, root.c_str(), &st, 0) == -1) {
+            impl.fail("cannot access '" + root + "': " + strerror(errno));
+            continue;
+        }
+
+        unsigned char type = IFTODT(st.st_mode);
+        WalkEntry entry{impl.baseDir, root.c_str(), type, root, 0, none};
+
+        if (visit(entry) && type == DT_DIR) {
+            impl.stack.push_back(Work{nullptr, root, root, 0, none});
+        }
+    }
+
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (threads <= 1) {
+        impl.run();
+    } else {
+        std::vector<std::thread> pool;
+        pool.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i) {
+            pool.emplace_back([&impl, &context] {
+                ExecContext::Scope scope(context);
+                impl.run();
+            });
+        }
+        for (std::thread& t : pool) {
+            t.join();
+        }
+    }
+
+    error = impl.errors;
+    return error.empty();
+}
+
+std::string TreeWalker::joinPath(const std::string& dir, const char* name) {
+    std::string path;
+    path.reserve(dir.size() + strlen(name) + 1);
+    path += dir;
+    if (path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    path += name;
+    return path;
+}
+
+/**
+ * @brief Order paths component by component ("a/b" before "a-b"), which is
+ *        the order a sequential depth-first walk over sorted names produces
+ */
+bool TreeWalker::pathLess(const std::string& a, const std::string& b) {
+    size_t n = std::min(a.size(), b.size());
+
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char ca = a[i];
+        unsigned char cb = b[i];
+        if (ca == cb) continue;
+        if (ca == '/') return true;
+        if (cb == '/') return false;
+        return ca < cb;
+    }
+
+    return a.size() < b.size();
+}
@@ -0,0 +1,137 @@
+#include "watchdog.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static struct timespec toTimespec(int64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+static void armTimer(int fd, int64_t ns, int64_t intervalNs) {
+    struct itimerspec spec;
+    spec.it_value = toTimespec(ns);
+    spec.it_interval = toTimespec(intervalNs);
+    timerfd_settime(fd, 0, &spec, nullptr);
+}
+
+Watchdog::Watchdog(CancelScope& scope, const Options& options) : scope(scope), options(options) {
+    if (options.cpuNs > 0) {
+        cpuBaseline = scope.cpuTime();
+    }
+    if (options.memoryBytes > 0) {
+        baselineRss = residentBytes();
+    }
+
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (options.timeoutNs > 0) {
+        deadlineFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        armTimer(deadlineFd, options.timeoutNs, 0);
+    }
+    if (options.cpuNs > 0 || options.memoryBytes > 0) {
+        const int64_t interval = SAMPLE_INTERVAL_MS * 1000000;
+        sampleFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        armTimer(sampleFd, interval, interval);
+    }
+
+    thread = std::thread([this] { run(); });
+}
+
+Watchdog::~Watchdog() {
+    uint64_t one = 1;
+    while (write(stopFd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+    thread.join();
+
+    for (int fd : {deadlineFd, sampleFd, stopFd}) {
+        if (fd != -1) close(fd);
+    }
+}
+
+void Watchdog::run() {
+    struct pollfd fds[4] = {{stopFd, POLLIN, 0}, {deadlineFd, POLLIN, 0}, {sampleFd, POLLIN, 0},
+                             {Cancellation::interruptFd(), POLLIN, 0}};
+    bool signalled = false;
+
+    while (true) {
+        if (poll(fds, 4, -1) == -1) {
+            continue;   // EINTR; nothing else can fail with valid fds
+        }
+        if (fds[0].revents) {
+            return;
+        }
+
+        uint64_t expirations;
+        if (fds[1].revents && read(deadlineFd, &expirations, sizeof(expirations)) > 0) {
+            if (!signalled) {
+                signalled = true;
+                scope.cancel(CancelScope::TIMED_OUT);
+                scope.signalPrograms(options.signal);
+                if (options.killAfterNs > 0) {
+                    armTimer(deadlineFd, options.killAfterNs, 0);
+                } else {
+                    fds[1].fd = -1;
+                }
+            } else {
+                killed = true;
+                scope.signalPrograms(SIGKILL);
+                fds[1].fd = -1;
+            }
+        }
+
+        if (fds[2].revents && read(sampleFd, &expirations, sizeof(expirations)) > 0) {
+            sample();
+        }
+
+        // The programs are outside the terminal's foreground process group
+        if (fds[3].revents) {
+            scope.signalPrograms(SIGINT);
+            fds[3].fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Check CPU time and memory against their caps
+ */
+void Watchdog::sample() {
+    if (options.cpuNs > 0 && scope.cpuTime() - cpuBaseline >= options.cpuNs) {
+        scope.cancel(CancelScope::CPU_EXCEEDED);
+        scope.signalPrograms(SIGXCPU);
+    }
+    if (options.memoryBytes > 0) {
+        size_t rss = residentBytes();
+        if (rss > baselineRss && rss - baselineRss >= options.memoryBytes) {
+            scope.cancel(CancelScope::MEMORY_EXCEEDED);
+            scope.signalPrograms(SIGKILL);
+        }
+    }
+}
+
+/**
+ * @brief Resident set size of the shell, from /proc/self/statm
+ */
+size_t Watchdog::residentBytes() {
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    char text[128];
+    ssize_t n = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    text[n] = '\0';
+
+    unsigned long size = 0, resident = 0;
+    if (sscanf(text, "%lu %lu", &size, &resident) != 2) {
+        return 0;
+    }
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
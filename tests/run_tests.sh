@@ -0,0 +1,170 @@
+#!/bin/sh
+# Runs command lines through the shell and compares what they print.
+# Usage: tests/run_tests.sh [path to custom-shell]
+
+SHELL_BIN=${1:-bin/custom-shell}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+failures=0
+# touch -t takes local time
+export TZ=UTC
+
+# expect NAME ACTUAL EXPECTED
+expect() {
+    if [ "$2" = "$3" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        echo "  expected: $3"
+        echo "  actual:   $2"
+        failures=$((failures + 1))
+    fi
+}
+
+# check NAME COMMAND EXPECTED: COMMAND runs in $WORK, stdout and stderr together
+check() {
+    actual=$(printf '%s\n' "$2" | HOME="$WORK" "$SHELL_BIN" 2>&1 |
+             sed -e '1,2d' -e 's/custom-shell:[^#]*# //g' | sed -e 's/ *$//' -e '/^$/d')
+    expect "$1" "$actual" "$3"
+}
+
+# offsets FILE: the end offsets held in a history index, on one line
+offsets() {
+    od -A n -t u8 -j 16 "$1" | tr -s ' \n' ' ' | sed -e 's/^ //' -e 's/ $//'
+}
+
+printf 'one\ntwo\nthree\nfour\n' > "$WORK/n.txt"
+
+check "tail -c +N reading a file" "tail -c +9 n.txt" "three
+four"
+check "tail -n +N reading a file" "tail -n +3 n.txt" "three
+four"
+check "tail -c +N in a pipeline" "cat n.txt | tail -c +9" "three
+four"
+check "tail -n +N in a pipeline" "cat n.txt | tail -n +3" "three
+four"
+
+printf 'n.txt\nlist\n' > "$WORK/list"
+check "sort reading a pipeline" "cat n.txt | sort" "four
+one
+three
+two"
+check "sort -S without a size" "sort -S '' n.txt
+sort -S K n.txt" "sort: invalid buffer size ''
+sort: invalid buffer size 'K'"
+check "tee in a pipeline" "cat n.txt | tee t.txt | wc -l
+cat t.txt" "4
+one
+two
+three
+four"
+check "xargs reading a pipeline" "cat list | xargs -P 2 --keep-order wc -l" "4 n.txt
+2 list"
+check "xargs -I reading a pipeline" "cat list | sort | xargs -I F echo F" "list
+n.txt"
+
+mkdir "$WORK/p"
+: > "$WORK/p/f"
+check "find lists what it can and fails on a missing path" 'find p nosuch
+echo $?' "p
+p/f
+find: cannot access 'nosuch': No such file or directory
+1"
+check "du totals what it can and fails on a missing path" 'du -s p nosuch
+echo $?' "$(du -sk "$WORK/p" | cut -f1)	p
+du: cannot access 'nosuch': No such file or directory
+1"
+
+mkdir -p "$WORK/g/sub/x/tmp" "$WORK/g/.hidden"
+touch "$WORK/g/b.log" "$WORK/g/a.log" "$WORK/g/c.txt" "$WORK/g/sub/tmp" "$WORK/g/.hidden/tmp"
+check "globs expand to sorted matches" "echo g/*.log g/?.txt g/[c-z]*" "g/a.log g/b.log g/c.txt g/c.txt g/sub"
+check "** matches any depth but not hidden directories" "echo g/**/tmp" "g/sub/tmp g/sub/x/tmp"
+check "globs that match nothing or are quoted stay as typed" 'echo g/*.none "g/*.log"' "g/*.none g/*.log"
+
+mkdir -p "$WORK/m/d"
+touch "$WORK/m/f" "$WORK/m/d/g"
+chmod 644 "$WORK/m/f" "$WORK/m/d/g"
+chmod 755 "$WORK/m" "$WORK/m/d"
+check "chmod -R with a symbolic mode" "chmod -R go-rwx,u+x m
+chmod g+r,o=r m/f
+chmod a-x+X m/d
+chmod -R u+q m" "chmod: invalid mode: 'u+q'"
+expect "chmod -R sets every mode" "$(cd "$WORK" && stat -c '%a %n' m m/f m/d m/d/g)" "700 m
+744 m/f
+711 m/d
+700 m/d/g"
+
+check "mkdir -p creates shared prefixes once and existing paths quietly" "mkdir -p mk/b/c mk/b/d mk/e
+mkdir mk
+mkdir -p mk/b
+echo \$?" "mkdir: cannot create directory 'mk': File exists
+0"
+check "touch -t, -m and -c" "touch -t 202001021304.05 mk/b/c/f mk/e/g
+touch -m -t 201901010000 mk/e/g
+touch -c mk/nosuch" ""
+expect "mkdir -p and touch make every path" "$(cd "$WORK" && find mk | sort)" "mk
+mk/b
+mk/b/c
+mk/b/c/f
+mk/b/d
+mk/e
+mk/e/g"
+expect "touch sets the times asked for" "$(cd "$WORK" && stat -c '%n %y %x' mk/b/c/f mk/e/g)" \
+"mk/b/c/f 2020-01-02 13:04:05.000000000 +0000 2020-01-02 13:04:05.000000000 +0000
+mk/e/g 2019-01-01 00:00:00.000000000 +0000 2020-01-02 13:04:05.000000000 +0000"
+
+# Server mode: each client session has its own directory and variables
+"$SHELL_BIN" --serve "$WORK/sock" > /dev/null 2>&1 &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$WORK/sock" ] && break
+    sleep 0.1
+done
+session=$(printf 'cd %s/m\nX=one\necho $X\npwd\nls nosuch\n' "$WORK" |
+          "$SHELL_BIN" --client "$WORK/sock" 2>&1; echo "status $?")
+expect "a client session runs its lines in order" "$(printf '%s\n' "$session" | sed -e 's/ *$//')" "one
+$WORK/m
+ls: cannot access 'nosuch': No such file or directory
+status 1"
+session=$(printf 'echo "[$X]"\npwd\n' | "$SHELL_BIN" --client "$WORK/sock" 2>&1; echo "status $?")
+expect "another session does not see its directory or variables" "$(printf '%s\n' "$session" | sed -e 's/ *$//')" "[]
+$(pwd)
+status 0"
+kill "$server"
+
+# cp -u: a changed file is patched in place, one whose size and mtime match
+# is left alone unless --checksum is given
+mkdir -p "$WORK/cu/d" "$WORK/cu-out"
+head -c 300000 /dev/urandom > "$WORK/cu/big"
+echo hello > "$WORK/cu/d/s"
+check "cp -r into a directory" "cp -r cu cu-out" ""
+inode=$(stat -c %i "$WORK/cu-out/cu/big")
+printf 'XXXX' | dd of="$WORK/cu/big" bs=1 seek=150000 conv=notrunc 2> /dev/null
+touch -d '+1 min' "$WORK/cu/big"
+echo HELLO > "$WORK/cu-out/cu/d/s"
+touch -r "$WORK/cu/d/s" "$WORK/cu-out/cu/d/s"
+check "cp -u after a change" "cp -u -r cu cu-out" ""
+cmp -s "$WORK/cu/big" "$WORK/cu-out/cu/big"
+expect "cp -u copies the changed blocks into the same file" "$? $(stat -c %i "$WORK/cu-out/cu/big")" "0 $inode"
+expect "cp -u skips a file with the same size and mtime" "$(cat "$WORK/cu-out/cu/d/s")" "HELLO"
+truncate -s 1000 "$WORK/cu/big"
+check "cp -u after the source shrinks" "cp -u -r cu cu-out" ""
+cmp -s "$WORK/cu/big" "$WORK/cu-out/cu/big"
+expect "cp -u truncates a copy that shrank" "$? $(stat -c %s "$WORK/cu-out/cu/big")" "0 1000"
+check "cp -u --checksum compares contents" "cp -u --checksum -r cu cu-out
+cat cu-out/cu/d/s" "hello"
+
+# History: one line per command, repeats skipped, and an index of line ends
+# that a later shell repairs when it was cut short or overwritten
+printf 'echo a\necho a\necho bb\n' | HISTFILE="$WORK/hist" "$SHELL_BIN" > /dev/null 2>&1
+expect "history keeps each command once" "$(cat "$WORK/hist")" "echo a
+echo bb"
+expect "history indexes the end of each line" "$(offsets "$WORK/hist.idx")" "7 15"
+truncate -s 20 "$WORK/hist.idx"
+printf 'echo c\n' | HISTFILE="$WORK/hist" "$SHELL_BIN" > /dev/null 2>&1
+expect "history repairs a cut-short index" "$(offsets "$WORK/hist.idx")" "7 15 22"
+printf 'garbage!' | dd of="$WORK/hist.idx" conv=notrunc 2> /dev/null
+printf 'echo d\n' | HISTFILE="$WORK/hist" "$SHELL_BIN" > /dev/null 2>&1
+expect "history replaces an overwritten index" "$(offsets "$WORK/hist.idx")" "7 15 22 29"
+
+[ "$failures" -eq 0 ]